@@ -36,34 +36,73 @@ SOFTWARE.
 #include "mcc_generated_files/mcc.h"
 
 //This handles messages published from the MQTT server when subscribed
-void receivedFromCloud(uint8_t *topic, uint8_t *payload)
+//The payload comes in pieces, the token may be split between two of them
+void receivedFromCloud(uint8_t *topic, uint8_t *payload, uint16_t length, uint32_t offset, uint32_t payloadLength)
 {
-    char *toggleToken = "\"toggle\":";
-    char *subString;
+    static const char toggleToken[] = "\"toggle\":";
+    static uint8_t matched;     // Characters of toggleToken seen so far, past its length once it was handled
+    uint16_t i;
 
-    if ((subString = strstr((char*)payload, toggleToken)))
+    if (offset == 0)
     {
-        LED_holdYellowOn( subString[strlen(toggleToken)] == '1' );
+        matched = 0;
+        debug_printer(SEVERITY_NONE, LEVEL_NORMAL, "topic: %s (%lu bytes)", topic, (unsigned long) payloadLength);
     }
 
+    for (i = 0; i < length && matched <= strlen(toggleToken); i++)
+    {
+        if (matched == strlen(toggleToken))
+        {
+            LED_holdYellowOn( payload[i] == '1' );
+            matched++;
+        }
+        else if (payload[i] == toggleToken[matched])
+        {
+            matched++;
+        }
+        else
+        {
+            matched = (payload[i] == toggleToken[0]);
+        }
+    }
 
-    debug_printer(SEVERITY_NONE, LEVEL_NORMAL, "topic: %s", topic);
-    debug_printer(SEVERITY_NONE, LEVEL_NORMAL, "payload: %s", payload);
+    debug_printer(SEVERITY_NONE, LEVEL_NORMAL, "payload: %.*s", (int) length, payload);
 }
 
 // This will get called every CFG_SEND_INTERVAL only while we have a valid Cloud connection
 void sendToCloud(void)
 {
    static char json[70];
+   static int  pendingLen = 0;  // the sample in json the publish queue refused
+
+   // A refused sample goes out first, the new one waits while the queue is full
+   if (pendingLen > 0) {
+      if (!CLOUD_publishData((uint8_t*)json, pendingLen)) {
+         return;
+      }
+      pendingLen = 0;
+      LED_flashYellow();
+   }
 
    // This part runs every  seconds
    int rawTemperature = SENSORS_getTempValue();
    int light = SENSORS_getLightValue();
+#if CFG_PUBLISH_LOAD && SCHEDULER_LOAD
+   strSchedulerLoad_t load;
+
+   scheduler_get_load(&load);
+   int len = sprintf(json, "{\"Light\":%d,\"Temp\":\"%d.%02d\",\"Load\":\"%u.%u\"}", light,rawTemperature/100,abs(rawTemperature)%100,
+                     load.load10 / 10, load.load10 % 10);
+#else
    int len = sprintf(json, "{\"Light\":%d,\"Temp\":\"%d.%02d\"}", light,rawTemperature/100,abs(rawTemperature)%100);
+#endif
 
    if (len >0) {
-      CLOUD_publishData((uint8_t*)json, len);
-      LED_flashYellow();
+      if (CLOUD_publishData((uint8_t*)json, len)) {
+         LED_flashYellow();
+      } else {
+         pendingLen = len;
+      }
    }
 }
 
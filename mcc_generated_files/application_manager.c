@@ -45,9 +45,15 @@ SOFTWARE.
 #include "led.h"
 #include "debug_print.h"
 
-#define MAIN_DATATASK_INTERVAL 100L
-// The debounce time is currently close to 2 Seconds.
-#define SW_DEBOUNCE_INTERVAL   1460000L
+// The switches are sampled for 2 Seconds at boot
+#define SW_DEBOUNCE_INTERVAL        2000L
+#define SW_DEBOUNCE_SAMPLE_INTERVAL 10L
+#define SW_DEBOUNCE_SAMPLES         (SW_DEBOUNCE_INTERVAL / SW_DEBOUNCE_SAMPLE_INTERVAL)
+// The LEDs follow the connection state within 1.5s, whatever CFG_SEND_INTERVAL
+#define MAIN_LED_TASK_INTERVAL      1000L
+#define MAIN_LED_TASK_SLACK         500     // can wait for another task to wake up
+// wifi_init() waits for the WINC to boot
+#define MAIN_BOOT_TASK_BUDGET       1000
 
 #define SW0_TOGGLE_STATE	   SW0_get_level()
 #define SW1_TOGGLE_STATE	   SW1_get_level()
@@ -58,16 +64,16 @@ shared_networking_params_t shared_networking_params;
 ATCA_STATUS retValCryptoClientSerialNumber;
 
 ticks MAIN_dataTask(void *payload);
-strTask_t MAIN_dataTasksTimer = {MAIN_dataTask};
+SCHEDULER_TASK(MAIN_dataTasksTimer, .callback = MAIN_dataTask);
+ticks MAIN_ledTask(void *payload);
+SCHEDULER_TASK(MAIN_ledTaskTimer, .callback = MAIN_ledTask, .period = MAIN_LED_TASK_INTERVAL, .slack = MAIN_LED_TASK_SLACK);
+static void MAIN_startDataTask(void);
+ticks MAIN_bootTask(void *payload);
+SCHEDULER_TASK(MAIN_bootTaskTimer, .callback = MAIN_bootTask, .period = SW_DEBOUNCE_SAMPLE_INTERVAL, .budget = MAIN_BOOT_TASK_BUDGET);
 
 void  wifiConnectionStateChanged(uint8_t status);
 
 void application_init(){
-	uint8_t mode = WIFI_DEFAULT;
-	uint32_t sw0CurrentVal = 0;
-	uint32_t sw1CurrentVal = 0;
-	uint32_t i = 0;
-
    wdt_disable();
 
    // Initialization of modules before interrupts are enabled
@@ -111,15 +117,36 @@ void application_init(){
 #endif
    debug_setPrefix(attDeviceID);
 
-   // Blocking debounce
-   for(i = 0; i < SW_DEBOUNCE_INTERVAL; i++)
+   // The rest of the boot runs from the scheduler
+   scheduler_start_task(&MAIN_bootTaskTimer);
+#if SCHEDULER_WATCHDOG
+   // From now on a stuck main loop resets the device
+   scheduler_watchdog_start();
+#endif
+}
+
+// Debounces the switches without blocking the scheduler, then starts WiFi
+//     in the mode they select
+ticks MAIN_bootTask(void *payload)
+{
+	static uint8_t mode;
+	static uint16_t sw0CurrentVal;
+	static uint16_t sw1CurrentVal;
+	static uint16_t i;
+
+   TASK_BEGIN(&MAIN_bootTaskTimer);
+   mode = WIFI_DEFAULT;
+   sw0CurrentVal = 0;
+   sw1CurrentVal = 0;
+   for(i = 0; i < SW_DEBOUNCE_SAMPLES; i++)
    {
 	   sw0CurrentVal += SW0_TOGGLE_STATE;
 	   sw1CurrentVal += SW1_TOGGLE_STATE;
+	   TASK_YIELD_FOR(SW_DEBOUNCE_SAMPLE_INTERVAL);
    }
-   if(sw0CurrentVal < (SW_DEBOUNCE_INTERVAL/2))
+   if(sw0CurrentVal < (SW_DEBOUNCE_SAMPLES/2))
    {
-	   if(sw1CurrentVal < (SW_DEBOUNCE_INTERVAL/2))
+	   if(sw1CurrentVal < (SW_DEBOUNCE_SAMPLES/2))
 	   {
 		   strcpy(ssid, CFG_MAIN_WLAN_SSID);
 		   strcpy(pass, CFG_MAIN_WLAN_PSK);
@@ -132,19 +159,26 @@ void application_init(){
 	   }
    }
    wifi_init(wifiConnectionStateChanged, mode);
+#if SCHEDULER_LONG_TASKS
+   debug_printInfo("APP: WiFi started %lums after boot", scheduler_get_time());
+#endif
 
    if (mode == WIFI_DEFAULT) {
       CLOUD_init(attDeviceID);
-      scheduler_create_task(&MAIN_dataTasksTimer, MAIN_DATATASK_INTERVAL);
    }
 
    LED_test();
+   TASK_WAIT_UNTIL(!LED_isTestRunning());
+   if (mode == WIFI_DEFAULT) {
+      MAIN_startDataTask();
+   }
+   TASK_END();
 }
 
 void application_post_provisioning(void)
 {
 	CLOUD_init(attDeviceID);
-	scheduler_create_task(&MAIN_dataTasksTimer, MAIN_DATATASK_INTERVAL);
+	MAIN_startDataTask();
 }
 
 
@@ -171,29 +205,37 @@ void runScheduler(void)
 //     we avoided that. This is being called from MAIN_dataTask below
 void sendToCloud(void);
 
-// This gets called by the scheduler approximately every 100ms
-ticks MAIN_dataTask(void *payload)
+// The data is sent at the beginning of every CFG_SEND_INTERVAL seconds of the network
+//     time, so all the devices publish in step. Until the time was received from the
+//     network the task simply runs every CFG_SEND_INTERVAL seconds. The LEDs are
+//     refreshed by a task of their own, so a long interval does not delay them.
+static void MAIN_startDataTask(void)
 {
-   static time_t previousTransmissionTime = 0;
-
-   // Get the current time. This uses the C standard library time functions
-   time_t timeNow = time(NULL);
+   scheduler_start_task(&MAIN_ledTaskTimer);
+#if SCHEDULER_WALL_CLOCK
+   scheduler_create_aligned_task(&MAIN_dataTasksTimer, CFG_SEND_INTERVAL);
+#else
+   scheduler_create_long_task(&MAIN_dataTasksTimer, CFG_SEND_INTERVAL * 1000L);
+#endif
+}
 
-   // Example of how to send data when MQTT is connected every 1 second based on the system clock
+// This gets called by the scheduler every CFG_SEND_INTERVAL seconds
+ticks MAIN_dataTask(void *payload)
+{
+   // Example of how to send data when MQTT is connected
    if (CLOUD_isConnected())
    {
-      // How many seconds since the last time this loop ran?
-      int32_t delta = difftime(timeNow,previousTransmissionTime);
-
-      if (delta >= CFG_SEND_INTERVAL)
-      {
-         previousTransmissionTime = timeNow;
-
-         // Call the data task in main.c
-         sendToCloud();
-      }
+      // Call the data task in main.c
+      sendToCloud();
    }
 
+   // An aligned or long task, returning 0 will make it stop
+   return TASK_KEEP_SCHEDULE;
+}
+
+// This gets called by the scheduler every MAIN_LED_TASK_INTERVAL
+ticks MAIN_ledTask(void *payload)
+{
    LED_BLUE_set_level(!shared_networking_params.haveAPConnection);
    LED_RED_set_level(!shared_networking_params.haveERROR);
    if (LED_isBlinkingGreen() == false)
@@ -203,5 +245,5 @@ ticks MAIN_dataTask(void *payload)
 
    // This is milliseconds managed by the RTC and the scheduler, this return makes the
    //      timer run another time, returning 0 will make it stop
-   return MAIN_DATATASK_INTERVAL;
+   return MAIN_LED_TASK_INTERVAL;
 }
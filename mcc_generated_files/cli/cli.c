@@ -28,9 +28,9 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#include <avr/wdt.h>
 
 #include "../include/usart2.h"
+#include "../include/rstctrl.h"
 #include "cli.h"
 #include "../cloud/crypto_client/crypto_client.h"
 #include "../credentials_storage/credentials_storage.h"
@@ -47,6 +47,27 @@
 #define MAX_PUB_KEY_LEN         200
 #define NEWLINE "\r\n"
 
+#if SCHEDULER_PROFILING
+#define SCHED_CMD_HELP  "sched [reset]" NEWLINE
+#else
+#define SCHED_CMD_HELP
+#endif
+#if SCHEDULER_LOAD
+#define LOAD_CMD_HELP   "load" NEWLINE
+#else
+#define LOAD_CMD_HELP
+#endif
+#if SCHEDULER_CLOCK_DISCIPLINE
+#define CLOCK_CMD_HELP  "clock" NEWLINE
+#else
+#define CLOCK_CMD_HELP
+#endif
+#if SCHEDULER_TRACE
+#define TRACE_CMD_HELP  "trace" NEWLINE
+#else
+#define TRACE_CMD_HELP
+#endif
+
 #define UNKNOWN_CMD_MSG "--------------------------------------------" NEWLINE\
                         "Unknown command. List of available commands:" NEWLINE\
                         "reset"NEWLINE\
@@ -57,6 +78,10 @@
                         "cli_version" NEWLINE\
                         "wifi <ssid>[,<pass>,[authType]]" NEWLINE\
                         "debug" NEWLINE\
+                        SCHED_CMD_HELP\
+                        LOAD_CMD_HELP\
+                        CLOCK_CMD_HELP\
+                        TRACE_CMD_HELP\
                         "--------------------------------------------"NEWLINE"\4"
 
 static char command[MAX_COMMAND_SIZE];
@@ -76,14 +101,25 @@ static void get_device_id(char *pArg);
 static void get_cli_version(char *pArg);
 static void get_firmware_version(char *pArg);
 static void set_debug_level(char *pArg);
+#if SCHEDULER_PROFILING
+static void sched_cmd(char *pArg);
+#endif
+#if SCHEDULER_LOAD
+static void load_cmd(char *pArg);
+#endif
+#if SCHEDULER_CLOCK_DISCIPLINE
+static void clock_cmd(char *pArg);
+#endif
+#if SCHEDULER_TRACE
+static void trace_cmd(char *pArg);
+#endif
 
 static bool endOfLineTest(char c);
 static void enableUsartRxInterrupts(void);
-
-#define CLI_TASK_INTERVAL      50
+static void CLI_rx_isr(void);
 
 ticks CLI_task(void*);
-strTask_t CLI_task_timer             = {CLI_task};
+SCHEDULER_TASK(CLI_task_timer, .callback = CLI_task, .priority = TASK_PRIORITY_HIGH);
 
 struct cmd
 {
@@ -100,13 +136,33 @@ const struct cmd commands[] =
     { "device",      get_device_id },
     { "cli_version", get_cli_version },
     { "version",     get_firmware_version },
-    { "debug",       set_debug_level }
+    { "debug",       set_debug_level },
+#if SCHEDULER_PROFILING
+    { "sched",       sched_cmd },
+#endif
+#if SCHEDULER_LOAD
+    { "load",        load_cmd },
+#endif
+#if SCHEDULER_CLOCK_DISCIPLINE
+    { "clock",       clock_cmd },
+#endif
+#if SCHEDULER_TRACE
+    { "trace",       trace_cmd },
+#endif
 };
 
 void CLI_init(void)
 {
+    // CLI_task only runs when the RX interrupt brings in new characters
+    scheduler_create_signal_task(&CLI_task_timer);
+    USART_2_set_ISR_cb(CLI_rx_isr, USART_2_RX_CB);
     enableUsartRxInterrupts();
-    scheduler_create_task(&CLI_task_timer, CLI_TASK_INTERVAL);
+}
+
+static void CLI_rx_isr(void)
+{
+    USART_2_default_rx_isr_cb();
+    scheduler_signal(&CLI_task_timer);
 }
 
 static bool endOfLineTest(char c)
@@ -166,7 +222,7 @@ ticks CLI_task(void* param)
       }
    }
 	
-   return CLI_TASK_INTERVAL;
+   return TASK_KEEP_SCHEDULE;     // wait for the next signal
 }
 
 static void set_wifi_auth(char *ssid_pwd_auth)
@@ -248,7 +304,7 @@ static void reset_cmd(char *pArg)
 {
 	(void)pArg;
 
-	wdt_enable(WDTO_30MS);
+	RSTCTRL_reset();    // not through the WDT, it would be taken for a hang
 	while(1) {};
 }
 
@@ -267,6 +323,45 @@ static void set_debug_level(char *pArg)
    }
 }
 
+#if SCHEDULER_PROFILING
+static void sched_cmd(char *pArg)
+{
+    if (pArg != NULL && strcmp(pArg, "reset") == 0)
+    {
+        scheduler_reset_stats();
+        printf("OK\r\n");
+    }
+    else
+    {
+        scheduler_print_stats();
+    }
+}
+#endif
+
+#if SCHEDULER_LOAD
+static void load_cmd(char *pArg)
+{
+    (void)pArg;
+    scheduler_print_load();
+}
+#endif
+
+#if SCHEDULER_CLOCK_DISCIPLINE
+static void clock_cmd(char *pArg)
+{
+    (void)pArg;
+    scheduler_print_clock();
+}
+#endif
+
+#if SCHEDULER_TRACE
+static void trace_cmd(char *pArg)
+{
+    (void)pArg;
+    scheduler_print_trace();
+}
+#endif
+
 static void get_public_key(char *pArg)
 {
     char key_pem_format[MAX_PUB_KEY_LEN];
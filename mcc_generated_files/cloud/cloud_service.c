@@ -62,20 +62,22 @@ const char projectId[] = CFG_PROJECT_ID;
 const char projectRegion[] = CFG_PROJECT_REGION;
 const char registryId[] = CFG_REGISTRY_ID;
 char deviceId[CLOUD_MAX_DEVICEID_LENGTH];
-char mqttSubscribeTopic[TOPIC_SIZE];
+char mqttTopicPrefix[sizeof ("/devices//") + CLOUD_MAX_DEVICEID_LENGTH];
 
 // Scheduler Callback functions
 ticks CLOUD_task(void *param);
 ticks mqttTimeoutTask(void *payload);
 ticks cloudResetTask(void *payload);
+ticks jwtRefreshTask(void *payload);
 
 static void dnsHandler(uint8_t * domainName, uint32_t serverIP);
+static void cloudReceive(uint8_t *data, uint8_t len);
 static void updateJWT(uint32_t epoch);
 
 static int8_t connectMQTTSocket(void);
 static void connectMQTT();
 static uint8_t reInit(void);
-void receivedFromCloud(uint8_t *topic, uint8_t *payload);
+void receivedFromCloud(uint8_t *topic, uint8_t *payload, uint16_t length, uint32_t offset, uint32_t payloadLength);
 
 bool isResetting = false;
 bool cloudResetTimerFlag = false;
@@ -85,25 +87,36 @@ bool sendSubscribe = true;
 #define CLOUD_MQTT_TIMEOUT_COUNT	  10000L  // 10 seconds max allowed to establish a connection
 #define MQTT_CONN_AGE_TIMEOUT          3600L  // 3600 seconds = 60minutes
 #define CLOUD_RESET_TIMEOUT            2000L  // 2 seconds
+// How late these timers may run so they share their wake-ups with other tasks
+#define CLOUD_TASK_SLACK                100
+// The MQTT state machine must keep running, the watchdog resets the device otherwise
+#define CLOUD_TASK_DEADLINE             5000
+#define CLOUD_TIMEOUT_SLACK             500
 
 // Create the timers for scheduler_timeout which runs these tasks
-strTask_t CLOUD_taskTimer            = {CLOUD_task};
-strTask_t mqttTimeoutTaskTimer       = {mqttTimeoutTask};
+SCHEDULER_TASK(CLOUD_taskTimer, .callback = CLOUD_task, .period = CLOUD_TASK_INTERVAL, .slack = CLOUD_TASK_SLACK,
+               .deadline = CLOUD_TASK_DEADLINE);
+SCHEDULER_TASK(mqttTimeoutTaskTimer, .callback = mqttTimeoutTask, .period = CLOUD_MQTT_TIMEOUT_COUNT, .slack = CLOUD_TIMEOUT_SLACK);
 
-strTask_t cloudResetTaskTimer       = {cloudResetTask};
+SCHEDULER_TASK(cloudResetTaskTimer, .callback = cloudResetTask, .period = CLOUD_RESET_TIMEOUT, .slack = CLOUD_TIMEOUT_SLACK);
+SCHEDULER_TASK(jwtRefreshTaskTimer, .callback = jwtRefreshTask, .slack = CLOUD_TIMEOUT_SLACK);
 
 /** \brief MQTT publish handler call back table.
  *
  * This callback table lists the callback function for to be called on reception
- * of a PUBLISH message for each topic which the application has subscribed to.
- * For each new topic which is subscribed to by the application, there needs to
- * be a corresponding publish handler.
- * E.g.: For a particular topic
- *       mchp/mySubscribedTopic/myDetailedPath
- *       Sample publish handler function  = void handlePublishMessage(uint8_t *topic, uint8_t *payload)
+ * of a PUBLISH message for each topic filter which the application subscribes
+ * to, after /devices/<deviceId>/. The table and the filters are in flash.
+ * E.g.: For the topic filter
+ *       commands/+/led
+ *       Sample publish handler function  = void handlePublishMessage(uint8_t *topic, uint8_t *payload, uint16_t length, uint32_t offset, uint32_t payloadLength)
  *
  */
-publishReceptionHandler_t imqtt_publishReceiveCallBackTable[NUM_TOPICS_SUBSCRIBE];
+static const char configTopicFilter[] PROGMEM = "config";
+static const char commandsTopicFilter[] PROGMEM = "commands/#";
+static const publishReceptionHandler_t imqtt_publishReceiveCallBackTable[] PROGMEM = {
+   {configTopicFilter, receivedFromCloud},
+   {commandsTopicFilter, receivedFromCloud},
+};
 
 uint32_t mqttGoogleApisComIP;
 
@@ -132,10 +145,23 @@ ticks cloudResetTask(void *payload) {
 }
 
 
+// The Authorization (JWT) expires after MQTT_CONN_AGE_TIMEOUT, so we need to re-connect that often
+ticks jwtRefreshTask(void *payload) {
+   mqttContext* mqttConnnectionInfo = MQTT_GetClientConnectionInfo();
+
+   if (MQTT_GetConnectionState() == CONNECTED)
+   {
+      debug_printError("MQTT: Connection aged, Uptime %lus", MQTT_getConnectionAge());
+      MQTT_Disconnect(mqttConnnectionInfo);
+      BSD_close(*mqttConnnectionInfo->tcpClientSocket);
+   }
+   return 0;
+}
+
 void CLOUD_init(char*  attDeviceID)
 {
    // Create timers for the application scheduler
-   scheduler_create_task(&CLOUD_taskTimer, 500);
+   scheduler_start_task(&CLOUD_taskTimer);
 }
 
 static void connectMQTT()
@@ -146,6 +172,7 @@ static void connectMQTT()
    {
       // The JWT takes time in UNIX format (seconds since 1970), AVR-LIBC uses seconds from 2000 ...
       updateJWT(currentTime + UNIX_OFFSET);
+      scheduler_create_long_task(&jwtRefreshTaskTimer, MQTT_CONN_AGE_TIMEOUT * 1000L);
 	  MQTT_CLIENT_connect();
    debug_print("CLOUD: MQTT Connect");
    }
@@ -156,27 +183,11 @@ static void connectMQTT()
 
 void CLOUD_subscribe(void)
 {
-	mqttSubscribePacket cloudSubscribePacket;
-	uint8_t topicCount = 0;
-
-	// Variable header
-	cloudSubscribePacket.packetIdentifierLSB = 1;
-	cloudSubscribePacket.packetIdentifierMSB = 0;
+	// All the topic filters go in one SUBSCRIBE packet
+	sprintf(mqttTopicPrefix, "/devices/%s/", deviceId);
+	MQTT_SetPublishReceptionHandlerTable(imqtt_publishReceiveCallBackTable, sizeof (imqtt_publishReceiveCallBackTable) / sizeof (imqtt_publishReceiveCallBackTable[0]), mqttTopicPrefix);
 
-	// Payload
-	for(topicCount = 0; topicCount < NUM_TOPICS_SUBSCRIBE; topicCount++)
-	{
-		sprintf(mqttSubscribeTopic, "/devices/%s/config", deviceId);
-		cloudSubscribePacket.subscribePayload[topicCount].topic = (uint8_t *)mqttSubscribeTopic;
-		cloudSubscribePacket.subscribePayload[topicCount].topicLength = strlen(mqttSubscribeTopic);
-		cloudSubscribePacket.subscribePayload[topicCount].requestedQoS = 0;
-
-		imqtt_publishReceiveCallBackTable[0].topic = mqttSubscribeTopic;
-		imqtt_publishReceiveCallBackTable[0].mqttHandlePublishDataCallBack = receivedFromCloud;
-		MQTT_SetPublishReceptionHandlerTable(imqtt_publishReceiveCallBackTable);
-	}
-
-	if(MQTT_CreateSubscribePacket(&cloudSubscribePacket) == true)
+	if(MQTT_CreateTopicFilterSubscribePacket() == true)
 	{
 		debug_printInfo("CLOUD: SUBSCRIBE packet created");
 		sendSubscribe = false;
@@ -251,7 +262,7 @@ ticks CLOUD_task(void *param)
         isResetting = true;
         debug_printError("CLOUD: Cloud reset timer is set");
         scheduler_kill_task(&mqttTimeoutTaskTimer);
-        scheduler_create_task(&cloudResetTaskTimer, CLOUD_RESET_TIMEOUT);
+        scheduler_start_task(&cloudResetTaskTimer);
         cloudResetTimerFlag = true;
       }
 	} else {
@@ -261,7 +272,7 @@ ticks CLOUD_task(void *param)
          {
             // Start the MQTT connection timeout
 			debug_printError("MQTT: MQTT reset timer is created");
-            scheduler_create_task(&mqttTimeoutTaskTimer, CLOUD_MQTT_TIMEOUT_COUNT);
+            scheduler_start_task(&mqttTimeoutTaskTimer);
             waitingForMQTT = true;
          }
       }
@@ -334,13 +345,6 @@ ticks CLOUD_task(void *param)
 				  {
 				      CLOUD_subscribe();
 				  }
-
-                  // The Authorization timeout is set to 3600, so we need to re-connect that often
-                  if (MQTT_getConnectionAge() > MQTT_CONN_AGE_TIMEOUT) {
-					  debug_printError("MQTT: Connection aged, Uptime %lus SocketState (%d) MQTT (%d)", thisAge , socketState, MQTT_GetConnectionState());
-                     MQTT_Disconnect(mqttConnnectionInfo);
-                     BSD_close(*mqttConnnectionInfo->tcpClientSocket);
-                  }
                }
             }
 		   break;
@@ -363,9 +367,9 @@ bool CLOUD_isConnected(void)
    }
 }
 
-void CLOUD_publishData(uint8_t* data, unsigned int len)
+bool CLOUD_publishData(uint8_t* data, unsigned int len)
 {
-   MQTT_CLIENT_publish(data, len);
+   return MQTT_CLIENT_publish(data, len);
 }
 
 static void dnsHandler(uint8_t* domainName, uint32_t serverIP)
@@ -394,6 +398,13 @@ static void updateJWT(uint32_t epoch)
    debug_printInfo("JWT: Result(%d) at %s", res==0? 1 : -1, ctime(&t));
 }
 
+// Data from the broker is processed by CLOUD_task right away instead of on its next period
+static void cloudReceive(uint8_t *data, uint8_t len)
+{
+   MQTT_CLIENT_receive(data, len);
+   scheduler_signal(&CLOUD_taskTimer);
+}
+
 static uint8_t reInit(void)
 {
     debug_printInfo("CLOUD: reinit");
@@ -414,7 +425,7 @@ static uint8_t reInit(void)
     BSD_SetRecvHandlerTable(cloud_packetReceiveCallBackTable);
 
     cloud_packetReceiveCallBackTable[0].socket = MQTT_GetClientConnectionInfo()->tcpClientSocket;
-    cloud_packetReceiveCallBackTable[0].recvCallBack = MQTT_CLIENT_receive;
+    cloud_packetReceiveCallBackTable[0].recvCallBack = cloudReceive;
 
     //When the input comes through cli/.cfg
     if((strcmp(ssid,"") != 0) &&  (strcmp(authType,"") != 0))
@@ -436,7 +447,7 @@ static uint8_t reInit(void)
 
     scheduler_kill_task(&cloudResetTaskTimer);
     debug_printInfo("CLOUD: Cloud reset timer is deleted");
-    scheduler_create_task(&mqttTimeoutTaskTimer, CLOUD_MQTT_TIMEOUT_COUNT);
+    scheduler_start_task(&mqttTimeoutTaskTimer);
     cloudResetTimerFlag = false;
     waitingForMQTT = true;
 
@@ -20,6 +20,6 @@ void CLOUD_init(char* deviceId);
 void CLOUD_subscribe(void);
 void CLOUD_disconnect(void);
 bool CLOUD_isConnected(void);
-void CLOUD_publishData(uint8_t *data, unsigned int len);
+bool CLOUD_publishData(uint8_t *data, unsigned int len);
 
 #endif /* CLOUD_SERVICE_H_ */
\ No newline at end of file
@@ -39,31 +39,43 @@
 
 char mqttPassword[456];
 char cid[MQTT_CID_LENGTH];
+// Passed by address: with MQTT 5.0 the core gives it a topic alias for the
+// connection, it is only rewritten before connecting (updateJWT())
 char mqttTopic[MQTT_TOPIC_LENGTH];
 char mqttHostName[] = CFG_MQTT_HOST;
 
 
-void MQTT_CLIENT_publish(uint8_t *data, uint16_t len)
+bool MQTT_CLIENT_publish(uint8_t *data, uint16_t len)
 {
 	 mqttPublishPacket cloudPublishPacket;
     
     // Fixed header
     cloudPublishPacket.publishHeaderFlags.duplicate = 0;
-    cloudPublishPacket.publishHeaderFlags.qos = 0;
+    cloudPublishPacket.publishHeaderFlags.qos = MQTT_PUBLISH_QOS;
     cloudPublishPacket.publishHeaderFlags.retain = 0;
     
-    // Variable header
+    // Variable header, with MQTT 5.0 the topic goes once per connection and
+    // a 2-byte alias stands for it in the next packets
     cloudPublishPacket.topic = (uint8_t*)mqttTopic;
     
-    // Payload
+    // Payload, copied in the publish queue: data can be reused on return
     cloudPublishPacket.payload = data;
     // ToDo Check whether sizeof can be used for integers and strings
     cloudPublishPacket.payloadLength = len;
     
     if(MQTT_CreatePublishPacket(&cloudPublishPacket) != true)
     {
-        debug_printError("MQTT: Connection lost PUBLISH failed");
+        if(MQTT_GetConnectionState() == CONNECTED)
+        {
+            debug_printError("MQTT: PUBLISH queue full, %u bytes dropped", len);
+        }
+        else
+        {
+            debug_printError("MQTT: Connection lost PUBLISH failed");
+        }
+        return false;
     }
+    return true;
 }
 
 void MQTT_CLIENT_receive(uint8_t *data, uint8_t len)
@@ -38,7 +38,7 @@ extern char cid[];
 extern char mqttTopic[];
 extern char mqttHostName[];
 
-void MQTT_CLIENT_publish(uint8_t *data, uint16_t len);
+bool MQTT_CLIENT_publish(uint8_t *data, uint16_t len);
 void MQTT_CLIENT_receive(uint8_t *data, uint8_t len);
 void MQTT_CLIENT_connect(void);
 
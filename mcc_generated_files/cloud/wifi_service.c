@@ -41,21 +41,28 @@ SOFTWARE.
 #include "../credentials_storage/credentials_storage.h"
 #include "../led.h"
 
-#define CLOUD_WIFI_TASK_INTERVAL        50
-#define CLOUD_NTP_TASK_INTERVAL         1000
+#define CLOUD_WIFI_TASK_INTERVAL        1000    // backup poll, the WINC interrupt signals the task
+#define CLOUD_CHECK_BACK_INTERVAL       50
+// Not a whole second: the time gets read at every phase of the second, which tells the
+//     scheduler precisely when the seconds begin for the wall-clock aligned tasks
+#define CLOUD_NTP_TASK_INTERVAL         1064
 #define SOFT_AP_CONNECT_RETRY_INTERVAL  1000
+#define CLOUD_WIFI_TASK_SLACK           500     // the backup poll can wait for another task to wake up
+#define CLOUD_WIFI_TASK_DEADLINE        5000    // the WINC events must keep flowing, the watchdog resets the device otherwise
 
 // Scheduler
 ticks ntpTimeFetchTask(void *payload);
 ticks wifiHandlerTask(void * param);
+static void wifiEventIsr(void);
 ticks softApConnectTask(void* param);
 
-strTask_t softApConnectTimer = {softApConnectTask};
-strTask_t ntpTimeFetchTimer  = {ntpTimeFetchTask};
-strTask_t wifiHandlerTimer  = {wifiHandlerTask};
+SCHEDULER_TASK(softApConnectTimer, .callback = softApConnectTask, .period = SOFT_AP_CONNECT_RETRY_INTERVAL);
+SCHEDULER_TASK(ntpTimeFetchTimer, .callback = ntpTimeFetchTask, .period = CLOUD_NTP_TASK_INTERVAL);
+SCHEDULER_TASK(wifiHandlerTimer, .callback = wifiHandlerTask, .period = CLOUD_WIFI_TASK_INTERVAL, .slack = CLOUD_WIFI_TASK_SLACK,
+               .deadline = CLOUD_WIFI_TASK_DEADLINE);
 
 ticks checkBackTask(void * param);
-strTask_t checkBackTimer  = {checkBackTask};
+SCHEDULER_TASK(checkBackTimer, .callback = checkBackTask, .period = CLOUD_CHECK_BACK_INTERVAL);
 
 static bool responseFromProvisionConnect = false;
 
@@ -108,11 +115,18 @@ void wifi_init(void (*funcPtr)(uint8_t), uint8_t mode) {
       debug_printInfo("ACCESS POINT MODE for provisioning");
    }
    else {
-      scheduler_create_task(&ntpTimeFetchTimer,CLOUD_NTP_TASK_INTERVAL);
+      scheduler_start_task(&ntpTimeFetchTimer);
    }
 
 
-   scheduler_create_task(&wifiHandlerTimer, CLOUD_WIFI_TASK_INTERVAL);
+   scheduler_start_task(&wifiHandlerTimer);
+   nm_bsp_register_event_cb(wifiEventIsr);
+}
+
+// The WINC has events for us, handle them on the next main loop iteration
+static void wifiEventIsr(void)
+{
+   scheduler_signal(&wifiHandlerTimer);
 }
 
 bool wifi_connectToAp(uint8_t passed_wifi_creds)
@@ -165,9 +179,18 @@ bool wifi_disconnectFromAp(void)
 	return true;
 }
 
-// Update the system time every CLOUD_NTP_TASK_INTERVAL milliseconds
+// Update the system time every CLOUD_NTP_TASK_INTERVAL milliseconds. Once the
+//     scheduler has calibrated its clock it keeps the time itself and only
+//     needs a few reads every few minutes
 ticks ntpTimeFetchTask(void *payload)
 {
+#if SCHEDULER_CLOCK_DISCIPLINE
+    ticks wait = scheduler_clock_next_query();
+
+    if (wait != 0) {
+        return wait;
+    }
+#endif
     m2m_wifi_get_sytem_time();
     return CLOUD_NTP_TASK_INTERVAL;
 }
@@ -201,7 +224,7 @@ static void wifiCallback(uint8_t msgType, void *pMsg)
 					scheduler_kill_task(&softApConnectTimer);
 					responseFromProvisionConnect = false;
                     LED_blinkingBlue(false);
-					scheduler_create_task(&ntpTimeFetchTimer,CLOUD_NTP_TASK_INTERVAL);
+					scheduler_start_task(&ntpTimeFetchTimer);
 					application_post_provisioning();
 				}
 				shared_networking_params.haveAPConnection = 1;
@@ -211,7 +234,7 @@ static void wifiCallback(uint8_t msgType, void *pMsg)
                 // We need more than AP to have an APConnection, we also need a DHCP IP address!
             } else if (pstrWifiState->u8CurrState == M2M_WIFI_DISCONNECTED)
 			{
-                scheduler_create_task(&checkBackTimer,CLOUD_WIFI_TASK_INTERVAL);
+                scheduler_start_task(&checkBackTimer);
 				shared_networking_params.amDisconnecting = 1;
             }
 
@@ -246,6 +269,8 @@ static void wifiCallback(uint8_t msgType, void *pMsg)
             //    are doing a couple of adjustments here.
             if (WINCTime->u16Year > 0)
             {
+                time_t now;
+
                 theTime.tm_hour = WINCTime->u8Hour;
                 theTime.tm_min = WINCTime->u8Minute;
                 theTime.tm_sec = WINCTime->u8Second;
@@ -254,7 +279,11 @@ static void wifiCallback(uint8_t msgType, void *pMsg)
                 theTime.tm_mday = WINCTime->u8Day;
                 theTime.tm_isdst = 0;
 
-                set_system_time(mktime(&theTime));
+                now = mktime(&theTime);
+                set_system_time(now);
+#if SCHEDULER_WALL_CLOCK
+                scheduler_set_wall_time(now);
+#endif
 //                printf("seting theTime=%lx ;", theTime);
             }
             break;
@@ -272,7 +301,7 @@ static void wifiCallback(uint8_t msgType, void *pMsg)
 			   strcpy(pass, (char *)pstrProvInfo->au8Password);
 			   debug_printInfo("SOFT AP: Connect Credentials sent to WINC");
 			   responseFromProvisionConnect = true;
-			   scheduler_create_task(&softApConnectTimer, SOFT_AP_CONNECT_RETRY_INTERVAL);
+			   scheduler_start_task(&softApConnectTimer);
              }
             break;
          }
@@ -3,6 +3,8 @@
 
 #define CFG_SEND_INTERVAL 1
 
+#define CFG_PUBLISH_LOAD 0  // add the 10s CPU load average to the telemetry (needs SCHEDULER_LOAD)
+
 #define CFG_TIMEOUT 10000
 
 #define CFG_DEBUG_MSG  1
@@ -31,9 +31,27 @@
 #define CFG_MQTT_HOST "mqtt.googleapis.com"
 #define CFG_MQTT_PORT 443
 #define CFG_MQTT_CONN_TIMEOUT 10
+#define MQTT_VERSION_3_1_1      4   //Protocol level of MQTT 3.1.1
+#define MQTT_VERSION_5_0        5   //Protocol level of MQTT 5.0
+#ifndef MQTT_VERSION                    // the host build (tests/host) sets it on the command line
+#define MQTT_VERSION            MQTT_VERSION_3_1_1  //Protocol spoken to the broker, MQTT_VERSION_5_0 for topic aliases, reason codes and the broker's flow control (mqtt.googleapis.com speaks 3.1.1 only)
+#endif
 #define TOPIC_SIZE				100	//Defines the topic length that is supported when we process a published packet 
-#define PAYLOAD_SIZE            200	//Defines the payload size that is supported when we process a published packet
-#define NUM_TOPICS_SUBSCRIBE	1   //Defines number of topics which can be subscribed
+#ifndef NUM_TOPICS_SUBSCRIBE            // the host build (tests/host) sets it on the command line
+#define NUM_TOPICS_SUBSCRIBE	2   //Defines number of topic filters which can be subscribed (16 at most), all in one SUBSCRIBE packet
+#endif
+#ifndef MQTT_TOPIC_TRIE_NODES
+#define MQTT_TOPIC_TRIE_NODES   8   //Levels of the topic filters indexed for the dispatch of the received PUBLISH packets (a level shared by several filters counts once), 255 at most
+#endif
+#define MQTT_SUBSCRIBE_TOPICS_SIZE  96  //Bytes for the topics of the SUBSCRIBE packet built from the topic filters, topic prefix included for each
 #define NUM_TOPICS_UNSUBSCRIBE	NUM_TOPICS_SUBSCRIBE	// The MQTT client can unsubscribe only from those topics to which it has already subscribed 
+#define MQTT_PUBLISH_QUEUE_SIZE 8   //PUBLISH packets queued until the next transmission pass, power of 2
+#define MQTT_PUBLISH_ARENA_SIZE 256 //Bytes shared by the payloads of the queued PUBLISH packets (copied when queued)
+#define MQTT_PUBLISH_BURST      4   //Queued PUBLISH packets sent together (one TCP send) by a transmission pass
+#define MQTT_PUBLISH_QOS        0   //QoS of the PUBLISH packets of CLOUD_publishData(), 0 or 1 (delivered again until acknowledged)
+#define MQTT_INFLIGHT_WINDOW    4   //QoS 1 PUBLISH packets sent and waiting for their PUBACK at a time, less than MQTT_PUBLISH_QUEUE_SIZE (MQTT 5.0: or the Receive Maximum of the broker if lower)
+#define MQTT_PUBACK_TIMEOUT     10  //Seconds without PUBACK before the QoS 1 PUBLISH packets in flight are sent again with DUP set (MQTT 5.0: before the connection is closed)
+#define MQTT_TOPIC_ALIASES      2   //MQTT 5.0: topics of the PUBLISH packets sent in full once per connection then as a 2-byte topic alias (or the Topic Alias Maximum of the broker if lower), 8 at most
+#define MQTT_RX_PROPERTIES_SIZE 32  //MQTT 5.0: bytes of properties kept from a received CONNACK or SUBACK, the rest is skipped
 
 #endif // MQTT_CONFIG_H
@@ -0,0 +1,67 @@
+/*
+    \file   scheduler_config.h
+
+    \brief  Scheduler Configuration File
+
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+   THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+   IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+#ifndef SCHEDULER_CONFIG_H
+#define	SCHEDULER_CONFIG_H
+
+#ifndef SCHEDULER_TIMING_WHEEL          // the host build (tests/host) sets it on the command line
+#define SCHEDULER_TIMING_WHEEL  0   //Set to 1 to keep the tasks in a hashed timing wheel (O(1) insert/kill) instead of a sorted list
+#endif
+#define SCHEDULER_WHEEL_SLOTS   32  //Number of wheel slots, must be a power of 2. Each slot spans one scheduler tick (8ms)
+#define SCHEDULER_PRIORITIES    4   //Number of task priority levels (max 8), due tasks of a higher level are always dispatched first
+#define SCHEDULER_LONG_TASKS    1   //Set to 1 to support task periods longer than MAX_BASE_PERIOD (up to SCHEDULER_MAX_LONG_PERIOD) and a 32-bit uptime
+#define SCHEDULER_PROFILING     0   //Set to 1 to collect run count, execution time and lateness of every task (uses TCA0), see the "sched" CLI command
+#define SCHEDULER_WALL_CLOCK    1   //Set to 1 for tasks aligned on wall-clock seconds or run at an absolute time (needs SCHEDULER_LONG_TASKS)
+#ifndef SCHEDULER_CLOCK_DISCIPLINE      // the host build (tests/host) sets it on the command line
+#define SCHEDULER_CLOCK_DISCIPLINE  1   //Set to 1 to correct the RTC oscillator from the network time and keep time() locally, see the "clock" CLI command (needs SCHEDULER_WALL_CLOCK)
+#endif
+#define SCHEDULER_TIMER_SLACK   1   //Set to 1 to delay tasks by up to their slack so they expire together with others (fewer wake-ups)
+#ifndef SCHEDULER_LOAD                  // the host build (tests/host) sets it on the command line
+#define SCHEDULER_LOAD          0   //Set to 1 to measure the CPU load (tasks, interrupts, idle) with 1s/10s/60s averages (uses TCA0), see the "load" CLI command
+#endif
+#ifndef SCHEDULER_TRACE                 // the host build (tests/host) sets it on the command line
+#define SCHEDULER_TRACE         0   //Set to 1 to record the scheduler events in a RAM ring (uses TCA0), see the "trace" CLI command and tools/sched_trace.py
+#endif
+#define SCHEDULER_TRACE_SIZE    128 //Events kept by the trace (4 bytes each), power of 2, 256 or less
+#define SCHEDULER_TRACE_TASKS   32  //Tasks the trace can tell apart, the others share id 0
+#ifndef SCHEDULER_WATCHDOG              // the host build (tests/host) sets it on the command line
+#define SCHEDULER_WATCHDOG      0   //Set to 1 to log the tasks running over their budget and feed the WDT only while the main loop and the critical tasks keep running
+#endif
+#define SCHEDULER_WATCHDOG_PERIOD   WDTO_8S //The WDT resets the device when it was not fed for this long (avr/wdt.h), 2s or more with the tickless idle
+#define SCHEDULER_TASK_BUDGET   100 //ms a callback may run when its task does not set a .budget
+#ifndef SCHEDULER_HIRES_TIMERS          // the host build (tests/host) sets it on the command line
+#define SCHEDULER_HIRES_TIMERS  0   //Set to 1 for one-shot tasks and CPU idle delays with a 6.4us resolution (starts TCA0, shared with the profiling)
+#endif
+#ifndef SCHEDULER_TICKLESS              // the host build (tests/host) sets it on the command line
+#define SCHEDULER_TICKLESS      0   //Set to 1 to stop the tick and sleep until the next task is due whenever nothing is ready to run
+#endif
+#define SCHEDULER_SLEEP_MODE    SLPCTRL_SMODE_IDLE_gc   //Sleep mode used by the tickless idle. STANDBY saves more but stops the USART and SPI clocks
+#define SCHEDULER_EXPIRED_RING  16  //Expired tasks the tick can hand over to scheduler_next() before it has to hold them back, power of 2
+#define SCHEDULER_COMMAND_RING  8   //Create/kill requests queued from the main loop to the tick, power of 2
+#define SCHEDULER_REQUEST_RING  8   //Create/kill/reschedule requests queued from interrupts to scheduler_next(), power of 2, 0 for none
+
+#endif // SCHEDULER_CONFIG_H
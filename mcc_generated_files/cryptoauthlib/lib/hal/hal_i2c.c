@@ -115,7 +115,7 @@ ATCA_STATUS hal_i2c_wake(ATCAIface iface)
 {
 	I2C_0_wake_up(0x0, 0x0, 1);
 	
-	_delay_ms (2*1);
+	atca_delay_us(atgetifacecfg(iface)->wake_delay);    // tWHI, from the device configuration
 	
 	uint8_t init_data[4];
 	uint8_t verif_data[4] = { 0x04, 0x11, 0x33, 0x43 };
@@ -41,6 +41,7 @@
 
 #define F_CPU 10000000UL
 #include <util/delay.h>
+#include "../../../include/rtc.h"
 
 /** \defgroup hal_ Hardware abstraction layer (hal_)
  *
@@ -57,11 +58,15 @@
  */
 void atca_delay_us(uint32_t delay)
 {
+#if SCHEDULER_HIRES_TIMERS
+	scheduler_delay_us(delay);      // the CPU idles meanwhile
+#else
 	/*Here you can write your own delay routine*/
 	while (delay) {
 		_delay_us(1);
 		delay--;
 	}
+#endif
 }
 
 /** \brief This function delays for a number of milliseconds.
@@ -72,11 +77,15 @@ void atca_delay_us(uint32_t delay)
  */
 void atca_delay_ms(uint32_t delay)
 {
+#if SCHEDULER_HIRES_TIMERS
+	scheduler_delay_us(delay * 1000UL);
+#else
 	/*Here you can write your own delay routine*/
 	while (delay) {
 		_delay_ms(1);
 		delay--;
 	}
+#endif
 }
 
 /** @} */
@@ -33,7 +33,7 @@ extern "C" {
 static inline void RSTCTRL_reset(void)
 {
 	/* SWRR is protected with CCP */
-//	ccp_write_io((void *)&RSTCTRL.SWRR, 0x1);
+	ccp_write_io((void *)&RSTCTRL.SWRR, RSTCTRL_SWRE_bm);
 }
 
 static inline uint8_t RSTCTRL_get_reset_cause(void)
@@ -24,30 +24,197 @@
 #ifndef SCHEDULER_H
 #define SCHEDULER_H
 
-#include "../utils/compiler.h"
+#include "../config/scheduler_config.h"
+#include "rtc_port.h"
 #include <stdint.h>
 #include <stdbool.h>
 #include <limits.h>
+#if SCHEDULER_WALL_CLOCK
+#include <time.h>
+#endif
 
 
 /** Datatype used to hold the number of ticks until a timer expires */
 typedef uint16_t ticks;
 #define MAX_BASE_PERIOD     (SHRT_MAX)
 
-/** Typedef for the function pointer for the timeout callback function */
+#if SCHEDULER_LONG_TASKS
+/** Long periods are counted down in laps of this many ms, each one a regular 16-bit period */
+#define SCHEDULER_LAP               (16384UL)
+#define SCHEDULER_MAX_LONG_PERIOD   ((UINT16_MAX + 1UL) * SCHEDULER_LAP)    // ~12 days
+#endif
+
+/** Task priorities, tasks that are due at the same time run highest priority first */
+#define TASK_PRIORITY_NORMAL    0                           ///< default for tasks that do not set one
+#define TASK_PRIORITY_HIGH      1
+#define TASK_PRIORITY_HIGHEST   (SCHEDULER_PRIORITIES - 1)
+
+#if SCHEDULER_PROFILING
+#define SCHEDULER_LATE_BUCKETS  8   ///< lateness histogram: <16ms, <32ms, <64ms, ... >=1024ms
+
+/** Execution statistics of one task */
+typedef struct {
+    uint16_t        runs;       ///< number of times the callback was called
+    uint32_t        exec_min;   ///< shortest execution time (us)
+    uint32_t        exec_max;   ///< longest execution time (us)
+    uint32_t        exec_total; ///< sum of the execution times (us), for the average
+    ticks           late_max;   ///< worst delay between due time and start of the callback (ms)
+    uint16_t        late_hist[SCHEDULER_LATE_BUCKETS];  ///< log2 histogram of the start delays
+} strTaskStats_t;
+#endif
+
+#if SCHEDULER_LOAD
+/** CPU load, in per mille. The 1s figures are those of the last full second */
+typedef struct {
+    uint16_t        tasks;      ///< share of the last second spent in the task callbacks
+    uint16_t        isr;        ///< share of the last second spent in the scheduler interrupts
+    uint16_t        load1;      ///< tasks + isr, the rest was idle
+    uint16_t        load10;     ///< load1 averaged over 10s (exponential, like the Unix load average)
+    uint16_t        load60;     ///< load1 averaged over 60s
+} strSchedulerLoad_t;
+#endif
+
+/** Life cycle of a task, as seen from the main loop */
+typedef enum {
+    TASK_IDLE,          ///< never created, or killed
+    TASK_QUEUED,        ///< waiting for its due time or its signal
+    TASK_DUE,           ///< waiting in a due queue for scheduler_next()
+    TASK_RUNNING        ///< its callback is being executed
+} taskState_t;
+
+/** Typedef for the function pointer for the timeout callback function
+ *  The value returned is the time in ms until the next run, 0 kills the task.
+ *  Returning the period the task was created with keeps it on its fixed rate,
+ *  anything else re-arms it from now with the new period. The signal-only, long
+ *  and wall-clock tasks keep their schedule whatever the value, 0 aside */
 typedef ticks (*task_callback)(void *payload);
 
-/** Data structure completely describing one timer */
-typedef struct strTask {
+/** Return value of the callbacks of the signal-only, long and wall-clock tasks,
+ *  which keep their own schedule: only 0 matters to them. Returning their period in ms
+ *  instead may not fit in ticks, and wraps to 0 at 65536 */
+#define TASK_KEEP_SCHEDULE      1
+
+/** The part of a task that never changes, it is kept in flash. Tasks are
+ *  declared with SCHEDULER_TASK(), which fills one of these */
+typedef struct {
 	task_callback   callback;   ///< function that is called when this task is due
-    char *          name;       ///< optionally assign a name (for debugging)
+    const char *    name;       ///< name in flash, given by SCHEDULER_TASK() when profiling, tracing or supervising (for debugging)
 	void *          payload;    ///< data to pass along to callback function
+    uint8_t         priority;   ///< TASK_PRIORITY_xxx
+    ticks           slack;      ///< ms the task may run late to share a wake-up with another task
+    ticks           period;     ///< ms, used by scheduler_start_task()
+    ticks           budget;     ///< ms the callback may run, longer runs are logged (SCHEDULER_WATCHDOG). 0 for SCHEDULER_TASK_BUDGET
+    ticks           deadline;   ///< ms, a critical task must complete a run at least this often or the WDT resets the device. 0 for none
+} strTaskDef_t;
+
+/** Data structure completely describing one timer, only its state is in RAM */
+typedef struct strTask {
+    const strTaskDef_t *def;    ///< fixed part, in flash
+    uint8_t         gen;        ///< generation, bumped by every create/kill so stale expiries get dropped
+    uint8_t         state;      ///< taskState_t
+    volatile bool   signaled;   ///< set by scheduler_signal() until the signal reaches the due queue
+    struct strTask  *due_next;  ///< next task in the same due queue
+    struct strTask  *due_prev;  ///< previous task in the same due queue, for an O(1) removal
+    ticks           interval;   ///< period last asked for, 0 for signal-only, long and wall-clock tasks
+    uint16_t        resume;     ///< resume point of a coroutine task, 0 to start from the top
+    // the fields below belong to the tick interrupt once the task was created
 	ticks           period;     ///< The task period
-	struct strTask  *next;      ///< linked list of all tasks that have expired and whose
-	                            ///  functions are due to be called
+	struct strTask  *next;      ///< next task in the task queue (or wheel slot)
+    struct strTask  **pprev;    ///< link pointing to this task inside the task queue (NULL when not queued)
     ticks           due;        ///< the time when this task is due
+    uint8_t         qgen;       ///< generation the task was queued with, handed back on expiry
+#if SCHEDULER_TIMER_SLACK
+    ticks           nominal;    ///< due time before the slack was used, the next period counts from it
+#endif
+#if SCHEDULER_PROFILING
+    strTaskStats_t  stats;      ///< execution statistics
+    struct strTask  *registry;  ///< list of all the tasks ever created (for reporting)
+    bool            registered; ///< set once the task is in the registry
+    ticks           released;   ///< due time of the expiry being dispatched, for the lateness
+#endif
+#if SCHEDULER_TRACE
+    uint8_t         trace_id;   ///< names the task in the trace records, 0 until created
+#endif
+#if SCHEDULER_WATCHDOG
+    ticks           checkin;    ///< time the callback of a critical task last returned (or it was created)
+    struct strTask  *wd_next;   ///< list of the critical tasks ever created
+    bool            wd_listed;  ///< set once the task is in the list of critical tasks
+#endif
+#if SCHEDULER_LONG_TASKS
+    uint16_t        laps;       ///< number of SCHEDULER_LAP periods added to the period of a long task
+    uint16_t        laps_left;  ///< SCHEDULER_LAP periods still to wait before the task is due
+#endif
+#if SCHEDULER_HIRES_TIMERS
+    bool            hires;      ///< high resolution task, its callback returns us instead of ms
+    uint16_t        hires_due;  ///< TCA0 count at which it expires
+    struct strTask  *hires_next;///< next task in the high resolution list
+#endif
+#if SCHEDULER_WALL_CLOCK
+    bool            wall;       ///< runs on wall-clock time (aligned or absolute)
+    bool            wall_listed;///< set once the task is in the list of wall-clock tasks
+    uint16_t        wall_period;///< s between two aligned runs, 0 for an absolute time task
+    time_t          wall_due;   ///< wall-clock second of the next run
+    struct strTask  *wall_next; ///< list of the wall-clock tasks, to re-align them
+#endif
 } strTask_t;
 
+#if SCHEDULER_PROFILING || SCHEDULER_TRACE || SCHEDULER_WATCHDOG
+#define SCHEDULER_TASK_NAME(var)        static const char var##_name[] PROGMEM = #var;
+#define SCHEDULER_TASK_NAME_INIT(var)   .name = var##_name,
+#else
+#define SCHEDULER_TASK_NAME(var)
+#define SCHEDULER_TASK_NAME_INIT(var)
+#endif
+
+#define SCHEDULER_TASK_DEF(var, ...) \
+    SCHEDULER_TASK_NAME(var) \
+    static const strTaskDef_t var##_def PROGMEM = { SCHEDULER_TASK_NAME_INIT(var) __VA_ARGS__ }
+
+/** Declares the task var, the other arguments initialize its strTaskDef_t:
+ *      SCHEDULER_TASK(myTimer, .callback = myTask, .period = 100);
+ *  The task is named var in the profiling statistics, the trace and the
+ *  watchdog messages */
+#define SCHEDULER_TASK(var, ...) \
+    SCHEDULER_TASK_DEF(var, __VA_ARGS__); \
+    strTask_t var = { .def = &var##_def }
+
+/** Same as SCHEDULER_TASK() for a task private to its file */
+#define SCHEDULER_STATIC_TASK(var, ...) \
+    SCHEDULER_TASK_DEF(var, __VA_ARGS__); \
+    static strTask_t var = { .def = &var##_def }
+
+/** Stackless coroutine tasks
+ *
+ * The callback of a coroutine task is written as one sequential flow that gives
+ * control back to scheduler_next() while it waits, the resume point is kept in
+ * the task. Local variables do not survive a wait, use static ones. A switch
+ * statement cannot be used across a wait. Creating the task starts it over.
+ *
+ *    static ticks blink_task(void *payload)
+ *    {
+ *        TASK_BEGIN(&blink_timer);
+ *        LED_on();
+ *        TASK_YIELD_FOR(100);
+ *        LED_off();
+ *        TASK_WAIT_UNTIL(button_pressed());
+ *        TASK_END();
+ *    }
+ */
+#define TASK_WAIT_POLL_INTERVAL 8   ///< ms between two checks of a TASK_WAIT_UNTIL() condition
+
+/** Start of the coroutine body, task is the strTask_t running it */
+#define TASK_BEGIN(task)        strTask_t *task_self_ = (task); switch (task_self_->resume) { case 0:
+
+/** Come back to this point after ms (1 to MAX_BASE_PERIOD) */
+#define TASK_YIELD_FOR(ms)      do { task_self_->resume = __LINE__; return (ms); case __LINE__:; } while (0)
+
+/** Come back to this point until cond is true, checking it every TASK_WAIT_POLL_INTERVAL */
+#define TASK_WAIT_UNTIL(cond)   do { task_self_->resume = __LINE__; case __LINE__: \
+                                     if (!(cond)) return TASK_WAIT_POLL_INTERVAL; } while (0)
+
+/** End of the coroutine body, the task is killed */
+#define TASK_END()              } task_self_->resume = 0; return 0
+
 /**
  * \brief Initialize the driver
  *
@@ -69,6 +236,206 @@ void scheduler_init(void);
  */
 bool scheduler_create_task(strTask_t *task, uint16_t ms);
 
+/**
+ * \brief Schedule the task with the period it was declared with
+ *
+ * \param[in] task      Pointer to struct describing the task to execute
+ *
+ * \return              false if it was declared without a period
+ */
+bool scheduler_start_task(strTask_t *task);
+
+/**
+ * \brief Create a task that has no period and only runs when signaled
+ *
+ * The callback returning 0 kills the task, TASK_KEEP_SCHEDULE keeps it waiting
+ * for the next scheduler_signal().
+ *
+ * \param[in] task      Pointer to struct describing the task to execute
+ *
+ * \return              true
+ */
+bool scheduler_create_signal_task(strTask_t *task);
+
+/**
+ * \brief Make a task due right away, to be called from the ISR that has work for it
+ *
+ * The task runs from scheduler_next() within one main loop iteration. Signals
+ * arriving before it runs are merged. Periodic tasks keep their period.
+ *
+ * \param[in] task      Pointer to struct describing the task to execute
+ *
+ * \return              false if the task was not created or the expired ring is full
+ */
+bool scheduler_signal(strTask_t *task);
+
+#if SCHEDULER_REQUEST_RING
+/**
+ * \brief Create, kill or reschedule a task from an interrupt
+ *
+ * The other functions must not be called from interrupts: they change the
+ * state of the task that scheduler_next() works with. These queue the request
+ * instead, in constant time, and scheduler_next() carries it out on its next
+ * call, in the order they came. The delay counts from then: a timeout may
+ * end up late by the callback that was running when the ISR asked.
+ *
+ * \param[in] task      Pointer to struct describing the task to execute
+ * \param[in] ms        Number of ms to wait before executing the task
+ *
+ * \return              false if ms is too small or too large (the task is then
+ *                      killed, like scheduler_create_task() does) or the
+ *                      request ring is full
+ */
+bool scheduler_create_task_from_isr(strTask_t *task, uint16_t ms);
+bool scheduler_kill_task_from_isr(strTask_t *task);
+bool scheduler_reschedule_from_isr(strTask_t *task, uint16_t ms);
+#endif
+
+/**
+ * \brief Move the next run of a task to ms from now, the task then runs every ms
+ *
+ * Same as scheduler_create_task() except that a coroutine task carries on from
+ * where it is instead of starting over. Meant for timeouts that are restarted
+ * over and over, like a keep-alive. A task that is not active is started.
+ *
+ * \param[in] task      Pointer to struct describing the task to execute
+ * \param[in] ms        Number of ms to wait before executing the task
+ *
+ * \return              true if succesful, false if ms too small or too large
+ */
+bool scheduler_reschedule(strTask_t *task, uint16_t ms);
+
+/**
+ * \brief Tell if a task is created, in O(1)
+ *
+ * \param[in] task      Pointer to struct describing the task
+ *
+ * \return              false if the task was never created or was killed since
+ */
+bool scheduler_is_task_active(const strTask_t *task);
+
+#if SCHEDULER_LONG_TASKS
+/**
+ * \brief Schedule the specified timer task with a period that can exceed MAX_BASE_PERIOD
+ *
+ * The period is split in a number of SCHEDULER_LAP laps plus a remainder so the
+ * tick interrupt keeps working with 16-bit time stamps. The callback returns
+ * TASK_KEEP_SCHEDULE to run again after ms, or 0 to kill the task.
+ *
+ * \param[in] task      Pointer to struct describing the task to execute
+ * \param[in] ms        Number of ms to wait before executing the task
+ *
+ * \return              true if succesful, false if ms is 0 or above SCHEDULER_MAX_LONG_PERIOD
+ */
+bool scheduler_create_long_task(strTask_t *task, uint32_t ms);
+
+/**
+ * \brief Get the time elapsed since scheduler_init()
+ *
+ * \return              32-bit time in ms, wraps around after ~49 days
+ */
+uint32_t scheduler_get_time(void);
+#endif
+
+#if SCHEDULER_HIRES_TIMERS
+/**
+ * \brief Run a task once after us microseconds, for waits shorter than the scheduler tick
+ *
+ * The timer expires within one TCA0 count (64 CPU clocks), the callback then
+ * runs from scheduler_next() like a signaled task. Its return value is the
+ * number of us until it runs again, 0 stops it.
+ *
+ * \param[in] task      Pointer to struct describing the task to execute
+ * \param[in] us        Number of us to wait before executing the task
+ *
+ * \return              false if us is 0
+ */
+bool scheduler_create_hires_task(strTask_t *task, uint16_t us);
+
+/**
+ * \brief Wait for us microseconds with the CPU idle instead of spinning
+ *
+ * For the drivers that have to wait before they return. Interrupts are still
+ * served, the CPU goes back to sleep after each one until the time is up.
+ * Called with interrupts disabled it polls the counter instead.
+ *
+ * \param[in] us        Number of us to wait
+ *
+ * \return Nothing
+ */
+void scheduler_delay_us(uint32_t us);
+#endif
+
+#if SCHEDULER_WALL_CLOCK
+/**
+ * \brief Give the scheduler the current wall-clock time, each time it is read from the network
+ *
+ * The seconds only have a 1s resolution, the scheduler narrows down when they
+ * begin from the successive calls. When the time disagrees by a second or more
+ * with what was expected the clock was set: all the wall-clock tasks are
+ * re-aligned.
+ *
+ * \param[in] now       the current time, as given to set_system_time()
+ *
+ * \return Nothing
+ */
+void scheduler_set_wall_time(time_t now);
+
+/**
+ * \brief Run a task at each wall-clock second that is a multiple of period_s
+ *
+ * period_s = 1 runs it at the beginning of every second, 60 on every minute, so
+ * devices sharing the same network time run it at the same instant. Until the
+ * wall-clock time is known the task runs every period_s without alignment. The
+ * callback returns TASK_KEEP_SCHEDULE to stay aligned, or 0 to kill the task.
+ *
+ * \param[in] task      Pointer to struct describing the task to execute
+ * \param[in] period_s  Alignment in s, 1 to 65535
+ *
+ * \return              false if period_s is 0
+ */
+bool scheduler_create_aligned_task(strTask_t *task, uint16_t period_s);
+
+/**
+ * \brief Run a task once, at the given wall-clock time
+ *
+ * \param[in] task      Pointer to struct describing the task to execute
+ * \param[in] when      wall-clock time, a time already past runs the task right away
+ *
+ * \return              false if the wall-clock time is not known yet or when is
+ *                      more than SCHEDULER_MAX_LONG_PERIOD away
+ */
+bool scheduler_create_task_at(strTask_t *task, time_t when);
+#endif
+
+#if SCHEDULER_CLOCK_DISCIPLINE
+/**
+ * \brief Tell when to read the wall-clock time from the network next
+ *
+ * The time given to scheduler_set_wall_time() measures the error of the RTC
+ * oscillator, which is then corrected, and time() is kept from the corrected
+ * tick. Until the error is measured the time is needed about every second,
+ * afterwards in a burst every few minutes.
+ *
+ * \return              ms to wait before the next query, 0 to send it now
+ */
+ticks scheduler_clock_next_query(void);
+
+/**
+ * \brief Get the error of the RTC oscillator measured against the network time
+ *
+ * \return              ppm, positive when it runs fast
+ */
+int32_t scheduler_get_clock_ppm(void);
+
+/**
+ * \brief Print the error of the RTC oscillator
+ *
+ * \return Nothing
+ */
+void scheduler_print_clock(void);
+#endif
+
 /**
  * \brief Delete the specified timer task so it won't be executed
  *
@@ -81,6 +448,12 @@ void scheduler_kill_task(strTask_t *task);
 /**
  * \brief Delete all scheduled timer tasks
  *
+ * The periodic, wall-clock and high resolution tasks end idle, whether queued,
+ * due or running: nothing signaled or expired before runs them and
+ * scheduler_is_task_active() returns false. The tasks only ever signaled
+ * (scheduler_create_signal_task()) are in no queue and stay active, unless
+ * they were due.
+ *
  * \return Nothing
  */
 void scheduler_kill_all(void);
@@ -97,6 +470,65 @@ void scheduler_next(void);
 
 void scheduler_print_list();
 
+#if SCHEDULER_WATCHDOG
+/**
+ * \brief Start the WDT, fed by scheduler_next() from then on
+ *
+ * scheduler_next() feeds it as long as every active task declared with a
+ * .deadline completes a run within that deadline: a main loop stuck in a
+ * callback or a driver, or a critical task that does not get to run, resets
+ * the device after SCHEDULER_WATCHDOG_PERIOD. The task that was running or
+ * late is reported after the reset. Callbacks running longer than their
+ * .budget are logged. Call it once the initialization is over.
+ *
+ * \return Nothing
+ */
+void scheduler_watchdog_start(void);
+#endif
+
+#if SCHEDULER_PROFILING
+/**
+ * \brief Print the execution statistics of all the tasks created so far
+ *
+ * \return Nothing
+ */
+void scheduler_print_stats(void);
+
+/**
+ * \brief Clear the execution statistics of all the tasks
+ *
+ * \return Nothing
+ */
+void scheduler_reset_stats(void);
+#endif
+
+#if SCHEDULER_LOAD
+/**
+ * \brief Get the CPU load of the last second and its 10s and 60s averages
+ *
+ * \param load     filled with the figures, all in per mille
+ * \return Nothing
+ */
+void scheduler_get_load(strSchedulerLoad_t *load);
+
+/**
+ * \brief Print the CPU load
+ *
+ * \return Nothing
+ */
+void scheduler_print_load(void);
+#endif
+
+#if SCHEDULER_TRACE
+/**
+ * \brief Print the trace of the latest scheduler events, tools/sched_trace.py
+ * turns it into a Chrome/Perfetto trace
+ *
+ * \return Nothing
+ */
+void scheduler_print_trace(void);
+#endif
+
 #endif /* SCHEDULER_H */
 
 /** @}*/
\ No newline at end of file
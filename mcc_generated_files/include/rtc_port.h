@@ -0,0 +1,229 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * Everything the scheduler (rtc.c) needs from the hardware:
+ *  - tick:   the RTC PIT interrupt, every SCHEDULER_BASE_PERIOD ms
+ *  - wake:   the RTC counter (1kHz) and its compare, for the tickless idle
+ *  - timer:  TCA0 free running at RTC_PORT_TIMER_HZ and its two compare
+ *            channels, for the profiling, the load, the trace and the high
+ *            resolution tasks
+ *  - the interrupt mask, the sleep, the WDT and the flash reads
+ * Defining SCHEDULER_PORT_HOST builds the scheduler for a PC instead, on the
+ * virtual clock of rtc_port_host.h.
+ */
+
+#ifndef RTC_PORT_H
+#define RTC_PORT_H
+
+#ifdef SCHEDULER_PORT_HOST
+#include "rtc_port_host.h"
+#else
+
+#include "../utils/compiler.h"
+#include "../utils/atomic.h"
+#include "../config/clock_config.h"
+#include "slpctrl.h"
+#include "rstctrl.h"
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
+
+#define RTC_PORT_TIMER_HZ       (F_CPU / 64)        // TCA0 counts per second
+#define RTC_PORT_SLEEP_IDLE     SLPCTRL_SMODE_IDLE_gc
+
+#define RTC_PORT_TICK_ISR()     ISR(RTC_PIT_vect)
+#define RTC_PORT_WAKE_ISR()     ISR(RTC_CNT_vect)
+#define RTC_PORT_CMP0_ISR()     ISR(TCA0_CMP0_vect)
+#define RTC_PORT_CMP1_ISR()     ISR(TCA0_CMP1_vect)
+
+static inline void rtc_port_tick_init(void)
+{
+	while (RTC.STATUS > 0)
+        ;      /* Wait for all register to be synchronized */
+
+#if SCHEDULER_TICKLESS
+    RTC.PER = 0xFFFF;                   /* Counter free running, measures the time spent sleeping */
+	RTC.CTRLA = RTC_PRESCALER_DIV1_gc   /* Prescaling Factor: RTC Clock/1 */
+              | 1 << RTC_RTCEN_bp       /* Enabled */
+              | 1 << RTC_RUNSTDBY_bp;   /* Run In Standby: enabled */
+#else
+	RTC.CTRLA = RTC_PRESCALER_DIV1_gc   /* Prescaling Factor: RTC Clock/1 */
+              | 0 << RTC_RTCEN_bp       /* Enabled */
+              | 0 << RTC_RUNSTDBY_bp;   /* Run In Standby: disabled */
+#endif
+	RTC.CLKSEL = RTC_CLKSEL_INT1K_gc;   /* Clock Select: Internal 1kHz OSC */
+    RTC.PITCTRLA = RTC_PI_bm            // enable PIT function
+                 | RTC_PERIOD_CYC8_gc;// 128 (32768/256) cycles per second
+//    while(RTC.PITSTATUS & RTC_CTRLBUSY_bm);
+}
+
+static inline void rtc_port_tick_enable(void)
+{
+    RTC_PITINTCTRL |= RTC_PI_bm;
+}
+
+static inline void rtc_port_tick_disable(void)
+{
+    RTC_PITINTCTRL &= ~RTC_PI_bm;
+}
+
+static inline void rtc_port_tick_clear(void)
+{
+    RTC_PITINTFLAGS = RTC_PI_bm;
+}
+
+// RTC counter, 1kHz like the PIT
+static inline uint16_t rtc_port_wake_count(void)
+{
+    return RTC.CNT;
+}
+
+static inline void rtc_port_wake_at(uint16_t count)
+{
+    while (RTC.STATUS & RTC_CMPBUSY_bm)
+        ;
+    RTC.CMP = count;
+    RTC.INTFLAGS = RTC_CMP_bm;
+    RTC.INTCTRL = RTC_CMP_bm;
+}
+
+static inline void rtc_port_wake_cancel(void)
+{
+    RTC.INTCTRL = 0;
+}
+
+static inline void rtc_port_wake_clear(void)
+{
+    RTC.INTFLAGS = RTC_CMP_bm | RTC_OVF_bm;
+}
+
+static inline void rtc_port_timer_init(void)
+{
+    TCA0.SINGLE.PER = 0xFFFF;           // free running, wraps every 419ms
+    TCA0.SINGLE.CTRLA = TCA_SINGLE_CLKSEL_DIV64_gc | TCA_SINGLE_ENABLE_bm;
+}
+
+// 16-bit read through the TEMP register, the caller holds the interrupts off
+//     when one of them reads TCA0 too
+static inline uint16_t rtc_port_timer_count(void)
+{
+    return TCA0.SINGLE.CNT;
+}
+
+// Programs the compare and clears a match that went by, without enabling it
+static inline void rtc_port_cmp0_set(uint16_t count)
+{
+    TCA0.SINGLE.CMP0 = count;
+    TCA0.SINGLE.INTFLAGS = TCA_SINGLE_CMP0_bm;
+}
+
+static inline void rtc_port_cmp0_enable(void)
+{
+    TCA0.SINGLE.INTCTRL |= TCA_SINGLE_CMP0_bm;
+}
+
+static inline void rtc_port_cmp0_disable(void)
+{
+    TCA0.SINGLE.INTCTRL &= ~TCA_SINGLE_CMP0_bm;
+}
+
+static inline void rtc_port_cmp0_clear(void)
+{
+    TCA0.SINGLE.INTFLAGS = TCA_SINGLE_CMP0_bm;
+}
+
+static inline void rtc_port_cmp1_set(uint16_t count)
+{
+    TCA0.SINGLE.CMP1 = count;
+    TCA0.SINGLE.INTFLAGS = TCA_SINGLE_CMP1_bm;
+}
+
+static inline void rtc_port_cmp1_enable(void)
+{
+    TCA0.SINGLE.INTCTRL |= TCA_SINGLE_CMP1_bm;
+}
+
+static inline void rtc_port_cmp1_disable(void)
+{
+    TCA0.SINGLE.INTCTRL &= ~TCA_SINGLE_CMP1_bm;
+}
+
+static inline void rtc_port_cmp1_clear(void)
+{
+    TCA0.SINGLE.INTFLAGS = TCA_SINGLE_CMP1_bm;
+}
+
+static inline bool rtc_port_irq_enabled(void)
+{
+    return (SREG & CPU_I_bm);
+}
+
+static inline void rtc_port_irq_disable(void)
+{
+    cpu_irq_disable();
+}
+
+static inline void rtc_port_irq_enable(void)
+{
+    cpu_irq_enable();
+}
+
+// One step of a busy wait on the TCA0 count
+static inline void rtc_port_spin(void)
+{
+}
+
+static inline void rtc_port_sleep_mode(uint8_t mode)
+{
+    SLPCTRL_set_sleep_mode(mode);
+}
+
+// Sleeps until the next interrupt, which is enabled first
+static inline void rtc_port_sleep(void)
+{
+    SLPCTRL_sleep();
+}
+
+static inline void rtc_port_wdt_start(uint8_t period)
+{
+    wdt_enable(period);
+}
+
+static inline void rtc_port_wdt_feed(void)
+{
+    wdt_reset();
+}
+
+// True once after the WDT reset the device
+static inline bool rtc_port_wdt_fired(void)
+{
+    bool fired = (RSTCTRL_get_reset_cause() & RSTCTRL_WDRF_bm);
+
+    RSTCTRL_clear_reset_cause();
+    return fired;
+}
+
+#endif /* SCHEDULER_PORT_HOST */
+
+#endif /* RTC_PORT_H */
@@ -0,0 +1,387 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * Scheduler port for a PC (gcc -DSCHEDULER_PORT_HOST), see rtc_port.h.
+ *
+ * Time is virtual: it only moves when the program calls rtc_port_host_run(),
+ * or when the scheduler sleeps or busy waits, so the same program always sees
+ * the same ticks and the same TCA0 counts. The interrupts are plain functions
+ * called from rtc_port_host_run() while they are enabled, or as soon as they
+ * get enabled again, like the AVR would:
+ *
+ *     scheduler_init();
+ *     scheduler_create_task(&blink, 100);
+ *     while (rtc_port_host.us < 10000000UL) {     // 10 s
+ *         scheduler_next();
+ *         rtc_port_host_run(100);                 // one pass of the main loop takes 100 us
+ *     }
+ *
+ * A callback that calls rtc_port_host_run() takes that long to run, the tick
+ * interrupts it meanwhile.
+ *
+ * A program may also run the handlers from a signal handler, at any point of
+ * the main loop like a real interrupt: while rtc_port_host.irq is set it
+ * clears it, runs them and sets it again, as the AVR does on entry and reti.
+ */
+
+#ifndef RTC_PORT_HOST_H
+#define RTC_PORT_HOST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+// avr-libc and device header bits the scheduler and its configuration use
+#define PROGMEM
+#define PGM_P                   const char *
+#define pgm_read_byte(p)        (*(const uint8_t *)(p))
+#define pgm_read_word(p)        (*(const uint16_t *)(p))
+#define pgm_read_dword(p)       (*(const uint32_t *)(p))
+#define pgm_read_ptr(p)         (*(void * const *)(p))
+#define strncpy_P               strncpy
+#define SLPCTRL_SMODE_IDLE_gc   (0x00 << 1)
+#define SLPCTRL_SMODE_STDBY_gc  (0x01 << 1)
+#define WDTO_1S                 6
+#define WDTO_2S                 7
+#define WDTO_4S                 8
+#define WDTO_8S                 9
+void set_system_time(time_t timestamp);     // provided by the program, like avr-libc's
+
+#define RTC_PORT_TIMER_HZ       156250UL    // TCA0 at F_CPU/64, F_CPU 10MHz
+#define RTC_PORT_SLEEP_IDLE     SLPCTRL_SMODE_IDLE_gc
+#define RTC_PORT_HOST_TICK_US   8000UL      // PIT period, 8 cycles of the 1kHz RTC clock
+
+typedef struct
+{
+    uint64_t    us;                 // virtual time since start
+    volatile bool irq;              // global interrupt enable (SREG I)
+    bool        tick_on;            // PIT interrupt enabled
+    bool        tick_flag;          // PIT interrupt pending
+    uint64_t    tick_next;          // us of the next PIT period
+    uint16_t    tick_phase_us;      // the PIT fires at this us modulo its period, 0 unless set first
+    bool        wake_on;            // RTC compare interrupt enabled
+    bool        wake_flag;
+    uint16_t    wake_cmp;           // RTC.CMP, in RTC counts (ms)
+    bool        cmp_on[2];          // TCA0 compare interrupts enabled
+    bool        cmp_flag[2];
+    uint16_t    cmp[2];             // TCA0.CMP0, CMP1
+    uint8_t     sleep_mode;
+    uint8_t     wdt_period;         // 0: WDT off
+    uint64_t    wdt_fed;            // us of the last wdt reset
+    bool        wdt_fired;          // set by the program to fake a WDT reset cause
+    uint32_t    wakeups;            // rtc_port_sleep() calls, for the power simulations
+    uint64_t    slept_us;           // virtual time spent in rtc_port_sleep()
+    uint32_t    other_irq_us;       // another interrupt (USART, WINC) ends the sleeps every that many us, 0: none
+} strRtcPortHost_t;
+
+extern strRtcPortHost_t rtc_port_host;      // defined in rtc.c
+
+// The interrupt handlers, the port calls those the scheduler configuration has
+void rtc_port_tick_isr(void) __attribute__((weak));
+void rtc_port_wake_isr(void) __attribute__((weak));
+void rtc_port_cmp0_isr(void) __attribute__((weak));
+void rtc_port_cmp1_isr(void) __attribute__((weak));
+
+#define RTC_PORT_TICK_ISR()     void rtc_port_tick_isr(void)
+#define RTC_PORT_WAKE_ISR()     void rtc_port_wake_isr(void)
+#define RTC_PORT_CMP0_ISR()     void rtc_port_cmp0_isr(void)
+#define RTC_PORT_CMP1_ISR()     void rtc_port_cmp1_isr(void)
+
+static inline uint16_t rtc_port_timer_count(void)
+{
+    return (uint16_t)(rtc_port_host.us * RTC_PORT_TIMER_HZ / 1000000UL);
+}
+
+static inline uint16_t rtc_port_wake_count(void)
+{
+    return (uint16_t)(rtc_port_host.us / 1000);
+}
+
+// Runs the pending interrupts that are enabled. The AVR takes them by vector
+//     number, none of the scheduler handlers depends on that order
+static inline void rtc_port_host_dispatch(void)
+{
+    while (rtc_port_host.irq) {
+        void (*isr)(void) = NULL;
+
+        if (rtc_port_host.tick_flag && rtc_port_host.tick_on) {
+            rtc_port_host.tick_flag = false;
+            isr = rtc_port_tick_isr;
+        } else if (rtc_port_host.wake_flag && rtc_port_host.wake_on) {
+            rtc_port_host.wake_flag = false;
+            isr = rtc_port_wake_isr;
+        } else if (rtc_port_host.cmp_flag[0] && rtc_port_host.cmp_on[0]) {
+            rtc_port_host.cmp_flag[0] = false;
+            isr = rtc_port_cmp0_isr;
+        } else if (rtc_port_host.cmp_flag[1] && rtc_port_host.cmp_on[1]) {
+            rtc_port_host.cmp_flag[1] = false;
+            isr = rtc_port_cmp1_isr;
+        } else {
+            break;
+        }
+        if (isr) {
+            rtc_port_host.irq = false;      // the AVR clears I on entry, reti sets it again
+            isr();
+            rtc_port_host.irq = true;
+        }
+    }
+}
+
+// us at which a counter running at hz reaches the 16-bit value target, at
+//     most one turn from now
+static inline uint64_t rtc_port_host_match(uint64_t hz, uint16_t target)
+{
+    uint64_t count = rtc_port_host.us * hz / 1000000UL;
+    uint16_t ahead = (uint16_t)(target - (uint16_t)count);
+
+    count += ahead ? ahead : 0x10000UL;
+    return (count * 1000000UL + hz - 1) / hz;
+}
+
+// us of the first PIT period after us
+static inline uint64_t rtc_port_host_tick_after(uint64_t us)
+{
+    uint64_t ahead = (rtc_port_host.tick_phase_us + RTC_PORT_HOST_TICK_US - us % RTC_PORT_HOST_TICK_US)
+                     % RTC_PORT_HOST_TICK_US;
+
+    return us + (ahead ? ahead : RTC_PORT_HOST_TICK_US);
+}
+
+// Moves the virtual time to the next event, at most until end, and raises its
+//     interrupt flags
+static inline void rtc_port_host_step(uint64_t end)
+{
+    uint64_t next = end;
+    uint64_t at[3] = { UINT64_MAX, UINT64_MAX, UINT64_MAX };
+    uint8_t  i;
+
+    if (rtc_port_host.tick_next <= rtc_port_host.us)
+        rtc_port_host.tick_next = rtc_port_host_tick_after(rtc_port_host.us);
+    if (rtc_port_host.tick_next < next)
+        next = rtc_port_host.tick_next;
+    if (rtc_port_host.wake_on)
+        at[0] = rtc_port_host_match(1000, rtc_port_host.wake_cmp);
+    for (i = 0; i < 2; i++) {
+        if (rtc_port_host.cmp_on[i])
+            at[1 + i] = rtc_port_host_match(RTC_PORT_TIMER_HZ, rtc_port_host.cmp[i]);
+    }
+    for (i = 0; i < 3; i++) {
+        if (at[i] < next)
+            next = at[i];
+    }
+    rtc_port_host.us = next;
+    if (next == rtc_port_host.tick_next) {
+        rtc_port_host.tick_flag = true;
+        rtc_port_host.tick_next += RTC_PORT_HOST_TICK_US;
+    }
+    if (next == at[0])
+        rtc_port_host.wake_flag = true;
+    for (i = 0; i < 2; i++) {
+        if (next == at[1 + i])
+            rtc_port_host.cmp_flag[i] = true;
+    }
+}
+
+/**
+ * \brief Let us of virtual time go by, running the interrupts that come due
+ *
+ * Called with the interrupts disabled, the interrupts stay pending until they
+ * are enabled again.
+ */
+static inline void rtc_port_host_run(uint32_t us)
+{
+    uint64_t end = rtc_port_host.us + us;
+
+    while (rtc_port_host.us < end) {
+        rtc_port_host_step(end);
+        rtc_port_host_dispatch();
+    }
+}
+
+// cli() and sei() are compiler barriers as well, the scheduler relies on it
+#define RTC_PORT_HOST_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
+#define ENTER_CRITICAL(R)       bool R##_irq = rtc_port_host.irq; rtc_port_host.irq = false; RTC_PORT_HOST_BARRIER()
+#define EXIT_CRITICAL(R)        do { RTC_PORT_HOST_BARRIER(); rtc_port_host.irq = R##_irq; rtc_port_host_dispatch(); } while (0)
+
+static inline void rtc_port_tick_init(void)
+{
+    rtc_port_host.tick_next = rtc_port_host_tick_after(rtc_port_host.us);
+    rtc_port_host.irq = true;       // main() of the firmware enables them early
+}
+
+static inline void rtc_port_tick_enable(void)
+{
+    rtc_port_host.tick_on = true;
+    rtc_port_host_dispatch();
+}
+
+static inline void rtc_port_tick_disable(void)
+{
+    rtc_port_host.tick_on = false;
+}
+
+static inline void rtc_port_tick_clear(void)
+{
+    rtc_port_host.tick_flag = false;
+}
+
+static inline void rtc_port_wake_at(uint16_t count)
+{
+    rtc_port_host.wake_cmp = count;
+    rtc_port_host.wake_flag = false;
+    rtc_port_host.wake_on = true;
+}
+
+static inline void rtc_port_wake_cancel(void)
+{
+    rtc_port_host.wake_on = false;
+}
+
+static inline void rtc_port_wake_clear(void)
+{
+    rtc_port_host.wake_flag = false;
+}
+
+static inline void rtc_port_timer_init(void)
+{
+}
+
+static inline void rtc_port_cmp0_set(uint16_t count)
+{
+    rtc_port_host.cmp[0] = count;
+    rtc_port_host.cmp_flag[0] = false;
+}
+
+static inline void rtc_port_cmp0_enable(void)
+{
+    rtc_port_host.cmp_on[0] = true;
+}
+
+static inline void rtc_port_cmp0_disable(void)
+{
+    rtc_port_host.cmp_on[0] = false;
+}
+
+static inline void rtc_port_cmp0_clear(void)
+{
+    rtc_port_host.cmp_flag[0] = false;
+}
+
+static inline void rtc_port_cmp1_set(uint16_t count)
+{
+    rtc_port_host.cmp[1] = count;
+    rtc_port_host.cmp_flag[1] = false;
+}
+
+static inline void rtc_port_cmp1_enable(void)
+{
+    rtc_port_host.cmp_on[1] = true;
+}
+
+static inline void rtc_port_cmp1_disable(void)
+{
+    rtc_port_host.cmp_on[1] = false;
+}
+
+static inline void rtc_port_cmp1_clear(void)
+{
+    rtc_port_host.cmp_flag[1] = false;
+}
+
+static inline bool rtc_port_irq_enabled(void)
+{
+    return rtc_port_host.irq;
+}
+
+static inline void rtc_port_irq_disable(void)
+{
+    rtc_port_host.irq = false;
+    RTC_PORT_HOST_BARRIER();
+}
+
+static inline void rtc_port_irq_enable(void)
+{
+    RTC_PORT_HOST_BARRIER();
+    rtc_port_host.irq = true;
+    rtc_port_host_dispatch();
+}
+
+// A busy wait on the TCA0 count lets one count go by
+static inline void rtc_port_spin(void)
+{
+    rtc_port_host_run(1000000UL / RTC_PORT_TIMER_HZ + 1);
+}
+
+static inline void rtc_port_sleep_mode(uint8_t mode)
+{
+    rtc_port_host.sleep_mode = mode;
+}
+
+// Enables the interrupts and skips the time to the first one that runs
+static inline void rtc_port_sleep(void)
+{
+    bool     woken = false;
+    uint64_t start = rtc_port_host.us;
+    uint64_t other = UINT64_MAX;
+
+    if (rtc_port_host.other_irq_us)
+        other = (start / rtc_port_host.other_irq_us + 1) * rtc_port_host.other_irq_us;
+    rtc_port_host.irq = true;
+    while (!woken) {
+        rtc_port_host_step(other);
+        woken = ((rtc_port_host.us == other)
+                 || (rtc_port_host.tick_flag && rtc_port_host.tick_on)
+                 || (rtc_port_host.wake_flag && rtc_port_host.wake_on)
+                 || (rtc_port_host.cmp_flag[0] && rtc_port_host.cmp_on[0])
+                 || (rtc_port_host.cmp_flag[1] && rtc_port_host.cmp_on[1]));
+        if (woken) {
+            rtc_port_host.wakeups++;
+            rtc_port_host.slept_us += rtc_port_host.us - start;
+        }
+        rtc_port_host_dispatch();
+    }
+}
+
+static inline void rtc_port_wdt_start(uint8_t period)
+{
+    rtc_port_host.wdt_period = period;
+    rtc_port_host.wdt_fed = rtc_port_host.us;
+}
+
+static inline void rtc_port_wdt_feed(void)
+{
+    rtc_port_host.wdt_fed = rtc_port_host.us;
+}
+
+static inline bool rtc_port_wdt_fired(void)
+{
+    bool fired = rtc_port_host.wdt_fired;
+
+    rtc_port_host.wdt_fired = false;
+    return fired;
+}
+
+#endif /* RTC_PORT_HOST_H */
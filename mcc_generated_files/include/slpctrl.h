@@ -35,6 +35,25 @@ extern "C" {
   */
 int8_t SLPCTRL_init();
 
+/**
+ * \brief Select the sleep mode entered by SLPCTRL_sleep()
+ *
+ * \param[in] mode SLPCTRL_SMODE_IDLE_gc, SLPCTRL_SMODE_STDBY_gc or SLPCTRL_SMODE_PDOWN_gc
+ *
+ * \return Nothing
+ */
+void SLPCTRL_set_sleep_mode(uint8_t mode);
+
+/**
+ * \brief Enter the selected sleep mode until the next interrupt
+ *
+ * Global interrupts are enabled right before the sleep instruction, so calling this
+ * with interrupts disabled cannot miss a wake-up interrupt that fires in between.
+ *
+ * \return Nothing
+ */
+void SLPCTRL_sleep(void);
+
 #ifdef __cplusplus
 }
 #endif
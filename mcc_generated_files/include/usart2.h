@@ -159,6 +159,16 @@ void USART_2_write(const uint8_t data);
  */
 void USART_2_set_ISR_cb(usart_callback cb, usart_2_cb_t type);
 
+/**
+ * \brief Default RX complete handler, stores the received byte in the RX buffer
+ *
+ * To be called by a replacement RX call back that needs to be told about
+ * incoming data.
+ *
+ * \return Nothing
+ */
+void USART_2_default_rx_isr_cb(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -27,9 +27,6 @@
 
 #include <stdbool.h>
 #include "mcc.h"
-#include "config/clock_config.h"
-
-#include <util/delay.h>
 #include "led.h"
 
 #define LEDS_TEST_INTERVAL	50L
@@ -38,35 +35,55 @@
 
 static bool ledForDefaultCredentials = false;
 static bool ledHeld = false;
+static bool ledTestRunning = false;
+
+static ticks ledTest_task(void *payload);
+SCHEDULER_STATIC_TASK(ledTest_timer, .callback = ledTest_task);
 
 static ticks yellow_task(void *payload);
-static strTask_t yellow_timer = {yellow_task};
+SCHEDULER_STATIC_TASK(yellow_timer, .callback = yellow_task);
 
 static ticks red_task(void *payload);
-static strTask_t red_timer = {red_task};
+SCHEDULER_STATIC_TASK(red_timer, .callback = red_task, .period = LED_ON_INTERVAL);
 
 static ticks defaultCredentials_task(void *payload);
-static strTask_t defaultCredentials_timer = {defaultCredentials_task};
+SCHEDULER_STATIC_TASK(defaultCredentials_timer, .callback = defaultCredentials_task, .period = LED_ON_INTERVAL);
 
 static ticks softAp_task(void *payload);
-static strTask_t softAP_timer = {softAp_task};
+SCHEDULER_STATIC_TASK(softAP_timer, .callback = softAp_task, .period = LED_ON_INTERVAL);
 
-static void testSequence (uint8_t ledState)
+// Turns the LEDs on one by one, then off the same way
+static ticks ledTest_task(void *payload)
 {
-	LED_BLUE_set_level(ledState);
-	_delay_ms(LEDS_TEST_INTERVAL);
-	LED_GREEN_set_level(ledState);
-	_delay_ms(LEDS_TEST_INTERVAL);
-	LED_YELLOW_set_level(ledState);
-	_delay_ms(LEDS_TEST_INTERVAL);
-	LED_RED_set_level(ledState);
-	_delay_ms(LEDS_TEST_INTERVAL);
+	static bool ledState;
+
+	TASK_BEGIN(&ledTest_timer);
+	ledState = LED_ON;
+	do {
+		LED_BLUE_set_level(ledState);
+		TASK_YIELD_FOR(LEDS_TEST_INTERVAL);
+		LED_GREEN_set_level(ledState);
+		TASK_YIELD_FOR(LEDS_TEST_INTERVAL);
+		LED_YELLOW_set_level(ledState);
+		TASK_YIELD_FOR(LEDS_TEST_INTERVAL);
+		LED_RED_set_level(ledState);
+		TASK_YIELD_FOR(LEDS_TEST_INTERVAL);
+		ledState = !ledState;
+	} while (ledState == LED_OFF);
+	ledTestRunning = false;
+	TASK_END();
 }
 
+// Starts the LED test, it runs from the scheduler
 void LED_test(void)
 {
-	testSequence(LED_ON);
-	testSequence(LED_OFF);
+	ledTestRunning = true;
+	scheduler_create_task(&ledTest_timer, 1);
+}
+
+bool LED_isTestRunning(void)
+{
+	return ledTestRunning;
 }
 
 static ticks yellow_task(void *payload)
@@ -122,14 +139,14 @@ void LED_holdYellowOn(bool holdHigh)
 void LED_flashRed(void)
 {
    LED_RED_set_level(LED_ON);
-   scheduler_create_task(&red_timer,LED_ON_INTERVAL);	
+   scheduler_start_task(&red_timer);	
 }
 
 void LED_blinkingBlue(bool amBlinking)
 {
     if (amBlinking == true)
     {
-        scheduler_create_task(&softAP_timer,LED_ON_INTERVAL);
+        scheduler_start_task(&softAP_timer);
     }
     else
     {
@@ -139,7 +156,7 @@ void LED_blinkingBlue(bool amBlinking)
 
 void LED_startBlinkingGreen(void)
 {
-    scheduler_create_task(&defaultCredentials_timer,LED_ON_INTERVAL);
+    scheduler_start_task(&defaultCredentials_timer);
     ledForDefaultCredentials = true;
 }
 
@@ -35,6 +35,7 @@
 #define LED_OFF				true
 
 void LED_test(void);
+bool LED_isTestRunning(void);
 void LED_flashYellow(void);
 void LED_holdYellowOn(bool holdHigh);
 void LED_flashRed(void);
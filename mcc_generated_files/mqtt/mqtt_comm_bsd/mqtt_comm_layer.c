@@ -89,8 +89,18 @@ bool MQTT_Close(mqttContext *connectionPtr)
 	return ret;
 }
 
+// The MQTT core parses everything received before the next receive, a packet
+// split over several receives is put back together by its parser
 void MQTT_GetReceivedData(uint8_t *pData, uint8_t len)
 {
-	MQTT_ExchangeBufferInit(&mqttConn.mqttDataExchangeBuffers.rxbuff);
-	MQTT_ExchangeBufferWrite(&mqttConn.mqttDataExchangeBuffers.rxbuff, pData, len);
+	if (pData == mqttConn.mqttDataExchangeBuffers.rxbuff.start)
+	{
+		// Received in place
+		MQTT_ExchangeBufferInit(&mqttConn.mqttDataExchangeBuffers.rxbuff);
+		mqttConn.mqttDataExchangeBuffers.rxbuff.dataLength = len;
+	}
+	else
+	{
+		MQTT_ExchangeBufferWrite(&mqttConn.mqttDataExchangeBuffers.rxbuff, pData, len);
+	}
 }
@@ -26,7 +26,8 @@ IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
  * About:
  *  MQTT client implementation. This is the core of the MQTT client protocol
  *  implementation. The aim of this file is to implement a hardware-independent
- *  subsystem that complies with [mqtt-v3.1.1-plus-errata01].
+ *  subsystem that complies with [mqtt-v3.1.1-plus-errata01], or with [mqtt-v5.0]
+ *  when MQTT_VERSION is MQTT_VERSION_5_0.
  *
  *
  ******************************************************************************/
@@ -48,6 +49,15 @@ IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
 #define MQTT_TX_PACKET_DECISION_CONSTANT    0x01
 #define KEEP_ALIVE_CALCULATION_CONSTANT     0x01
 #define CONNECT_CLEAN_SESSION_MASK          0x02
+#define MQTT_PUBLISH_QUEUE_MASK             (MQTT_PUBLISH_QUEUE_SIZE - 1)
+#define MQTT_PUBLISH_ARENA_FULL             0xFFFF
+#if MQTT_VERSION == MQTT_VERSION_5_0
+#define MQTT_RX_PACKET_SIZE                 (5 + NUM_TOPICS_SUBSCRIBE + MQTT_RX_PROPERTIES_SIZE) // Largest packet but PUBLISH, a SUBACK or a CONNACK with its properties
+#define MQTT_REASON_CODE_FAILURE            0x80 // The reason codes from 0x80 on report a failure
+#else
+#define MQTT_RX_PACKET_SIZE                 (4 + NUM_TOPICS_SUBSCRIBE) // Largest packet but PUBLISH, a SUBACK
+#endif
+#define MQTT_RX_CHUNK_MAX                   0xFFFF
 
 
 // MQTT packet transmission flags. The creation and transmission processes of
@@ -99,19 +109,103 @@ typedef enum {
    SENDPINGREQ = 32,
 } mqttConnectCurrentTxSubstate;
 
-// Function pointer for handling QoS levels.
-typedef void (*qosLevelHandler)(uint8_t);
+// States of a PUBLISH packet in the publish queue. A QoS 0 packet goes from
+// QUEUED to DONE when it is sent, a QoS 1 packet stays INFLIGHT until its
+// PUBACK comes. The packets leave the queue in order, once DONE.
 
-// The QoS levels in PUBLISH message are 0, 1 and 2 with quality of service
-// increasing from QoS level 0 to 2. QoS level processing needs information
-// about the QoS level and the appropriate callback function. The call back
-// table type for determining whether the correct callback function for the QoS
-// level under consideration is defined here.
+typedef enum {
+   PUBLISH_QUEUED,      // Never sent
+   PUBLISH_INFLIGHT,    // QoS 1, sent and waiting for its PUBACK
+   PUBLISH_RESEND,      // QoS 1, to be sent again with DUP set
+   PUBLISH_DONE,        // Sent (QoS 0) or acknowledged (QoS 1)
+} mqttPublishQueueState;
+
+// PUBLISH packet waiting in the publish queue. Its payload is copied in the
+// publish arena, the topic is not: it must stay valid until the packet is sent
+// (the topics of the application are static strings).
+
+typedef struct {
+   uint8_t *topic;
+   uint16_t payloadOffset; // In publishArena
+   uint16_t payloadLength; // Up to MQTT_PUBLISH_ARENA_SIZE
+   uint8_t state; // mqttPublishQueueState
+   mqttHeaderFlags publishHeaderFlags;
+   uint16_t packetIdentifier; // QoS 1, given when first sent
+} mqttPublishQueueEntry;
+
+// States of the receive parser. The TCP stream comes in pieces of any size, a
+// packet may start in one and end several pieces later: the parser keeps where
+// it is in the packet from one piece to the next.
+
+typedef enum {
+   RX_FIXED_HEADER,        // First byte of a packet
+   RX_REMAINING_LENGTH,    // 1 to 4 bytes, 7 bits each
+   RX_TOPIC_LENGTH,        // PUBLISH
+   RX_TOPIC,               // PUBLISH, copied in rxTopic
+   RX_PACKET_IDENTIFIER,   // PUBLISH with QoS 1 or 2
+   RX_PROPERTY_LENGTH,     // PUBLISH, MQTT 5.0, 1 to 4 bytes, 7 bits each
+   RX_PROPERTIES,          // PUBLISH, MQTT 5.0, dropped
+   RX_PAYLOAD,             // PUBLISH, handed to the application as it comes
+   RX_BODY,                // Any other packet, copied in rxControlPacket
+   RX_SKIP,                // PUBLISH of no interest or with a topic too large, dropped
+} mqttRxState;
+
+// What the receive parser stopped on.
+
+typedef enum {
+   RX_INCOMPLETE,          // All the bytes were used, the packet goes on in the next ones
+   RX_COMPLETE,            // A packet other than PUBLISH is in rxControlPacket
+   RX_MALFORMED,           // Protocol violation, the connection must be closed
+} mqttRxResult;
 
 typedef struct {
-   uint8_t qosLevel;
-   qosLevelHandler qosLevelHandlerFunction;
-} qosLevelHandler_t;
+   uint8_t state; // mqttRxState
+   mqttHeaderFlags header;
+   uint8_t lengthBytes; // Bytes of the remaining length read so far
+   uint32_t remaining; // Bytes of the packet not parsed yet
+   uint16_t fieldLength; // Topic length
+   uint16_t fieldCount; // Bytes of the current field read so far
+   uint32_t payloadLength;
+   uint32_t payloadOffset;
+   uint16_t filters; // Topic filters the PUBLISH packet matches, 0 when nobody subscribed to its topic
+#if MQTT_VERSION == MQTT_VERSION_5_0
+   uint32_t propertyLength; // Bytes of the properties not parsed yet
+#endif
+} mqttRxParser;
+
+#if MQTT_VERSION == MQTT_VERSION_5_0
+// Identifiers of the MQTT 5.0 properties (MQTT 5.0, section 2.2.2.2).
+
+typedef enum {
+   PROPERTY_PAYLOAD_FORMAT_INDICATOR = 0x01,
+   PROPERTY_MESSAGE_EXPIRY_INTERVAL = 0x02,
+   PROPERTY_CONTENT_TYPE = 0x03,
+   PROPERTY_RESPONSE_TOPIC = 0x08,
+   PROPERTY_CORRELATION_DATA = 0x09,
+   PROPERTY_SUBSCRIPTION_IDENTIFIER = 0x0B,
+   PROPERTY_SESSION_EXPIRY_INTERVAL = 0x11,
+   PROPERTY_ASSIGNED_CLIENT_IDENTIFIER = 0x12,
+   PROPERTY_SERVER_KEEP_ALIVE = 0x13,
+   PROPERTY_AUTHENTICATION_METHOD = 0x15,
+   PROPERTY_AUTHENTICATION_DATA = 0x16,
+   PROPERTY_REQUEST_PROBLEM_INFORMATION = 0x17,
+   PROPERTY_WILL_DELAY_INTERVAL = 0x18,
+   PROPERTY_REQUEST_RESPONSE_INFORMATION = 0x19,
+   PROPERTY_RESPONSE_INFORMATION = 0x1A,
+   PROPERTY_SERVER_REFERENCE = 0x1C,
+   PROPERTY_REASON_STRING = 0x1F,
+   PROPERTY_RECEIVE_MAXIMUM = 0x21,
+   PROPERTY_TOPIC_ALIAS_MAXIMUM = 0x22,
+   PROPERTY_TOPIC_ALIAS = 0x23,
+   PROPERTY_MAXIMUM_QOS = 0x24,
+   PROPERTY_RETAIN_AVAILABLE = 0x25,
+   PROPERTY_USER_PROPERTY = 0x26,
+   PROPERTY_MAXIMUM_PACKET_SIZE = 0x27,
+   PROPERTY_WILDCARD_SUBSCRIPTION_AVAILABLE = 0x28,
+   PROPERTY_SUBSCRIPTION_IDENTIFIER_AVAILABLE = 0x29,
+   PROPERTY_SHARED_SUBSCRIPTION_AVAILABLE = 0x2A,
+} mqttPropertyIdentifier;
+#endif
 
 /***********************MQTT Client definitions*(END)**************************/
 
@@ -121,15 +215,89 @@ typedef struct {
 /** \brief MQTT packet transmission flags. */
 static newTxDataFlags mqttTxFlags;
 
+/** \brief Receive parser, kept from one piece of the TCP stream to the next. */
+static mqttRxParser rxParser;
+
+/** \brief Topic of the PUBLISH packet being received. */
+static uint8_t rxTopic[TOPIC_SIZE];
+
+/** \brief Last packet received other than PUBLISH, with a one byte remaining length. */
+static uint8_t rxPacketData[MQTT_RX_PACKET_SIZE];
+static exchangeBuffer rxControlPacket = {rxPacketData, rxPacketData, sizeof (rxPacketData), 0};
+
 /** \brief MQTT packet reception flags. */
 static newRxDataFlags mqttRxFlags;
 
 /** \brief CONNECT packet to be transmitted. */
 static mqttConnectPacket txConnectPacket;
 
-/** \brief PUBLISH packet to be transmitted. */
+/** \brief Last PUBLISH packet transmitted. */
 static mqttPublishPacket txPublishPacket;
 
+/** \brief PUBLISH packets waiting for transmission or for their PUBACK.
+ *
+ * Ring of MQTT_PUBLISH_QUEUE_SIZE entries, the indexes run freely: the oldest
+ * entry is at publishQueueTail, the oldest never sent at publishQueueSent and
+ * the next free one at publishQueueHead. The QoS 1 packets in flight are the
+ * INFLIGHT and RESEND entries between publishQueueTail and publishQueueSent.
+ */
+static mqttPublishQueueEntry publishQueue[MQTT_PUBLISH_QUEUE_SIZE];
+static uint8_t publishQueueHead;
+static uint8_t publishQueueSent;
+static uint8_t publishQueueTail;
+
+/** \brief Number of QoS 1 PUBLISH packets in flight, publishInflightLimit at most. */
+static uint8_t publishInflight;
+
+/** \brief QoS 1 PUBLISH packets the broker takes in flight, MQTT_INFLIGHT_WINDOW at most. */
+static uint8_t publishInflightLimit = MQTT_INFLIGHT_WINDOW;
+
+#if MQTT_VERSION == MQTT_VERSION_5_0
+/** \brief Highest QoS the broker takes in the PUBLISH packets. */
+static uint8_t publishMaximumQoS;
+
+/** \brief Topic aliases the broker takes, MQTT_TOPIC_ALIASES at most. */
+static uint8_t publishTopicAliasMaximum;
+
+/** \brief Topics known to the broker by their alias, the alias being the index + 1.
+ *
+ * The topics are told apart by their address, as in the publish queue. The
+ * aliases only last for the connection.
+ */
+static uint8_t *publishTopicAliases[MQTT_TOPIC_ALIASES];
+
+/** \brief Properties of the CONNECT packet.
+ *
+ * The subscriptions are QoS 0, the broker has no QoS 1 PUBLISH packet to send
+ * and one at a time is plenty. Without problem information the broker sends
+ * no reason string or user property in the PUBACK and SUBACK packets, which
+ * then fit in rxControlPacket. No Topic Alias Maximum: the broker does not
+ * replace the topics of the PUBLISH packets it sends, the topic filters need
+ * them.
+ */
+static const uint8_t mqttConnectProperties[] = {
+   5, // Property length
+   PROPERTY_RECEIVE_MAXIMUM, 0x00, 0x01,
+   PROPERTY_REQUEST_PROBLEM_INFORMATION, 0x00,
+};
+
+/** \brief Property length of the SUBSCRIBE and UNSUBSCRIBE packets, which
+ *  carry no property (MQTT 5.0, sections 3.8.2.1 and 3.10.2.1). */
+static const uint8_t mqttNoProperties = 0;
+#endif
+
+/** \brief Last packet identifier given to a QoS 1 PUBLISH packet. */
+static uint16_t publishPacketIdentifier;
+
+/** \brief Payloads of the queued PUBLISH packets.
+ *
+ * They are stored in queue order from publishArenaHead, each one in a single
+ * piece: a payload that does not fit before the end of the arena starts again
+ * at 0, above the payload of the oldest entry.
+ */
+static uint8_t publishArena[MQTT_PUBLISH_ARENA_SIZE];
+static uint16_t publishArenaHead;
+
 /** \brief SUBSCRIBE packet to be transmitted. */
 static mqttSubscribePacket txSubscribePacket;
 
@@ -151,21 +319,12 @@ static volatile bool subackTimeoutOccured = false;
 /** \brief SUBACK packet timeout indicator. */
 static volatile bool unsubackTimeoutOccured = false;
 
+/** \brief PUBACK packet timeout indicator. */
+static volatile bool pubackTimeoutOccured = false;
+
 /** \brief Store the timestamp at the last CONNACK. */
 time_t connectTime = 0;
 
-/** \brief QoS level call back table.
- *
- * This callback table lists the callback functions for 3 different QoS levels
- * of the MQTT PUBLISH message. For each QoS level there needs to be a
- * corresponding callback function.
- * Currently only QoS level 0 is supported.
- *
- */
-static const qosLevelHandler_t mqtt_qosLevelCallBackTable[] = {
-   //    {0x00, handleQoSLevel0}
-};
-
 /** \brief Current state of MQTT Client state machine. */
 static mqttCurrentState mqttState = DISCONNECTED;
 
@@ -189,17 +348,139 @@ static mqttConnectCurrentTxSubstate mqttConnectTxSubstate;
  */
 static uint8_t mqttEncodeLength(uint16_t length, uint8_t *output);
 
-/** \brief Decode the MQTT packet length.
+/** \brief Parse the received bytes.
  *
- * This function decodes the MQTT packet length available in the remainingLength
- * field of the received packet.
+ * This function parses the bytes in rxbuff until a packet other than PUBLISH
+is complete or all the bytes are used. The payload of a PUBLISH packet is
+handed to the application piece by piece, as it is parsed.
  *
- * @param *data
+ * @param rxbuff
  *
  * @return
- *  - The number of bytes decoded
+ *  - RX_COMPLETE when a packet is ready in rxControlPacket
+ *  - RX_MALFORMED when the bytes break the protocol
+ *  - RX_INCOMPLETE otherwise
+ */
+static mqttRxResult mqttParse(exchangeBuffer *rxbuff);
+
+/** \brief Start the payload of the PUBLISH packet being received.
+ *
+ * This function looks up the topic filters matching the topic and hands an
+empty payload to their handlers right away.
  */
-static uint32_t mqttDecodeLength(uint8_t *encodedData);
+static void mqttParsePayloadStart(void);
+
+/** \brief End the variable header of the PUBLISH packet being received.
+ *
+ * This function starts its properties with MQTT 5.0, its payload otherwise.
+ */
+static void mqttParseVariableHeaderEnd(void);
+
+/** \brief Process the packet in rxControlPacket.
+ *
+ * @param mqttConnectionPtr
+ */
+static void mqttProcessPacket(mqttContext *mqttConnectionPtr);
+
+/** \brief Find room for a payload in the publish arena.
+ *
+ * @param length
+ *
+ * @return
+ *  - The offset of the room, MQTT_PUBLISH_ARENA_FULL when there is none
+ */
+static uint16_t mqttPublishArenaFit(uint16_t length);
+
+/** \brief Queue a PUBLISH packet.
+ *
+ * This function copies the payload of the packet in the publish arena and
+ * queues the packet for the next transmission passes.
+ *
+ * @param newPublishPacket
+ *
+ * @return
+ *  - false when the queue or the arena is full, nothing is queued then
+ */
+static bool mqttPublishQueuePut(mqttPublishPacket *newPublishPacket);
+
+/** \brief Remove the oldest queued PUBLISH packets that are DONE.
+ *
+ * This function frees their payloads in the publish arena.
+ */
+static void mqttPublishQueueRelease(void);
+
+/** \brief Tell if mqttSendPublish() has something to send.
+ *
+ * @return
+ *  - true when a packet must be sent again or when the in-flight window has
+ room for the oldest packet never sent
+ */
+static bool mqttPublishQueueReady(void);
+
+/** \brief Send the QoS 1 PUBLISH packets in flight again.
+ *
+ * This function marks the packets waiting for their PUBACK for a new
+ * transmission with DUP set, after a reconnection or, with MQTT 3.1.1 only,
+ * a PUBACK timeout.
+ */
+static void mqttPublishQueueResend(void);
+
+/** \brief Give a packet identifier to a QoS 1 PUBLISH packet.
+ *
+ * This function returns the next identifier that is not 0 and not used by a
+ * packet in flight or by a SUBSCRIBE/UNSUBSCRIBE packet waiting for its
+ * acknowledgement.
+ *
+ * @return
+ *  - The packet identifier
+ */
+static uint16_t mqttAllocatePacketIdentifier(void);
+
+/** \brief Build txPublishPacket from a queued PUBLISH packet.
+ *
+ * @param entry
+ *
+ * @return
+ *  - The number of bytes of the packet on the wire
+ */
+static uint16_t mqttPublishLoad(mqttPublishQueueEntry *entry);
+
+#if MQTT_VERSION == MQTT_VERSION_5_0
+/** \brief Read a Variable Byte Integer (MQTT 5.0, section 1.5.5).
+ *
+ * @param rxPacket
+ * @param value
+ *
+ * @return
+ *  - The number of bytes read, 0 when the packet ends before the integer or
+ the integer is longer than 4 bytes
+ */
+static uint8_t mqttReadVariableInteger(exchangeBuffer *rxPacket, uint32_t *value);
+
+/** \brief Read a property of a received packet.
+ *
+ * This function reads the identifier of the property and its value when it is
+ an integer. The other values (strings, binary data) are skipped.
+ *
+ * @param rxPacket
+ * @param identifier
+ * @param value
+ *
+ * @return
+ *  - The number of bytes of the property, 0 when the packet ends before the
+ property or the identifier is unknown
+ */
+static uint32_t mqttReadProperty(exchangeBuffer *rxPacket, uint8_t *identifier, uint32_t *value);
+
+/** \brief Skip the properties of a received packet.
+ *
+ * @param rxPacket
+ *
+ * @return
+ *  - false when the packet ends before the properties do
+ */
+static bool mqttSkipProperties(exchangeBuffer *rxPacket);
+#endif
 
 /** \brief Send the MQTT CONNECT packet.
  *
@@ -214,10 +495,11 @@ transmission.
  */
 static bool mqttSendConnect(mqttContext *mqttConnectionPtr);
 
-/** \brief Send the MQTT PUBLISH packet.
+/** \brief Send the queued MQTT PUBLISH packets.
  *
- * This function sends the MQTT PUBLISH packet using the underlying
-TCP layer.
+ * This function sends the oldest queued MQTT PUBLISH packets, up to
+MQTT_PUBLISH_BURST of them and as many as fit in the TCP Tx buffer, with a
+single send of the underlying TCP layer. They leave the queue once sent.
  *
  * @param mqttConnectionPtr
  *
@@ -286,36 +568,36 @@ static bool mqttSendDisconnect(mqttContext *mqttConnectionPtr);
  * This function processes the CONNACK packet received from the
 broker.
  *
- * @param mqttConnectionPtr
+ * @param rxPacket
  *
  * @return
  *  - The state of MQTT Tx and Rx handlers depending on whether the CONNACK
 packet was received and processed correctly.
  */
-static mqttCurrentState mqttProcessConnack(mqttContext *mqttConnectionPtr);
+static mqttCurrentState mqttProcessConnack(exchangeBuffer *rxPacket);
 
 /** \brief Process the MQTT PINGRESP packet.
  *
  * This function processes the PINGRESP packet received from the
 broker.
  *
- * @param mqttConnectionPtr
+ * @param rxPacket
  *
  */
-static void mqttProcessPingresp(mqttContext *mqttConnectionPtr);
+static void mqttProcessPingresp(exchangeBuffer *rxPacket);
 
 /** \brief Process the MQTT SUBACK packet.
  *
  * This function processes the SUBACK packet received from the
 broker.
  *
- * @param mqttConnectionPtr
+ * @param rxPacket
  *
  * @return
  *  - The state of MQTT Tx and Rx handlers depending on whether the mqttProcessSuback
 packet was received and processed correctly.
  */
-static mqttCurrentState mqttProcessSuback(mqttContext *mqttConnectionPtr);
+static mqttCurrentState mqttProcessSuback(exchangeBuffer *rxPacket);
 
 
 /** \brief Process the MQTT UNSUBACK packet.
@@ -323,24 +605,24 @@ static mqttCurrentState mqttProcessSuback(mqttContext *mqttConnectionPtr);
  * This function processes the UNSUBACK packet received from the
 broker.
  *
- * @param mqttConnectionPtr
+ * @param rxPacket
  *
  * @return
  *  - The state of MQTT Tx and Rx handlers depending on whether the mqttProcessUnsuback
 packet was received and processed correctly.
  */
-static mqttCurrentState mqttProcessUnsuback(mqttContext *mqttConnectionPtr);
-
+static mqttCurrentState mqttProcessUnsuback(exchangeBuffer *rxPacket);
 
-/** \brief Process the MQTT PUBLISH packet.
+/** \brief Process the MQTT PUBACK packet.
  *
- * This function processes the PUBLISH packet received from the
-broker.
+ * This function processes a PUBACK packet received from the
+broker, ending the transmission of the QoS 1 PUBLISH packet it
+acknowledges.
  *
- * @param mqttConnectionPtr
+ * @param rxPacket
  *
  */
-static mqttCurrentState mqttProcessPublish(mqttContext *mqttConnectionPtr);
+static void mqttProcessPuback(exchangeBuffer *rxPacket);
 
 /** \brief Check whether timeout has occurred after sending CONNECT
 packet.
@@ -355,7 +637,7 @@ within 30s.
  *  - The number of ticks till the connackTimer expires.
  */
 static ticks checkConnackTimeoutState();
-timerstruct_t connackTimer = {checkConnackTimeoutState, NULL};
+timeout_declare(connackTimer, .callback = checkConnackTimeoutState);
 
 /** \brief Check whether timeout has occurred after receiving CONNACK
 or PINGRESP packet.
@@ -370,7 +652,7 @@ packet to the broker within (keepAliveTime)s time period.
  *  - The number of ticks till the connackTimer or pingrespTimer expires.
  */
 static ticks checkPingreqTimeoutState();
-timerstruct_t pingreqTimer = {checkPingreqTimeoutState, NULL};
+timeout_declare(pingreqTimer, .callback = checkPingreqTimeoutState, .priority = TASK_PRIORITY_HIGH);
 
 /** \brief Check whether timeout has occurred after sending PINGREQ
 packet.
@@ -386,7 +668,7 @@ packet.
  *  - The number of ticks till the pingreq expires.
  */
 static ticks checkPingrespTimeoutState();
-timerstruct_t pingrespTimer = {checkPingrespTimeoutState, NULL};
+timeout_declare(pingrespTimer, .callback = checkPingrespTimeoutState);
 	
 
 /** \brief Check whether timeout has occurred after sending SUBSCRIBE
@@ -407,7 +689,7 @@ Connection by checking subackTimeoutOccured flag (MQTT RFC, section 4.8).
  *  - The number of ticks till the suback expires.
  */
 static ticks checkSubackTimeoutState();
-timerstruct_t subackTimer = {checkSubackTimeoutState, NULL};
+timeout_declare(subackTimer, .callback = checkSubackTimeoutState);
 	
 
 /** \brief Check whether timeout has occurred after sending UNSUBSCRIBE
@@ -428,7 +710,24 @@ Connection by checking unsubackTimeoutOccured flag (MQTT RFC, section 4.8).
  *  - The number of ticks till the unsuback expires.
  */
 static ticks checkUnsubackTimeoutState();
-timerstruct_t unsubackTimer = {checkUnsubackTimeoutState, NULL};
+timeout_declare(unsubackTimer, .callback = checkUnsubackTimeoutState);
+
+/** \brief Check whether timeout has occurred after sending QoS 1 PUBLISH
+packets.
+ *
+ * This function checks whether a timeout (MQTT_PUBACK_TIMEOUT) has occurred
+without PUBACK after sending QoS 1 PUBLISH packets. The packets still in
+flight are then sent again with DUP set, or with MQTT 5.0 the connection is
+closed and they go again after the next CONNACK. The timeout restarts on
+every PUBACK while packets remain in flight.
+ *
+ * @param none
+ *
+ * @return
+ *  - The number of ticks till the puback expires.
+ */
+static ticks checkPubackTimeoutState();
+timeout_declare(pubackTimer, .callback = checkPubackTimeoutState);
 	
 /**********************Local function definitions*(END)************************/
 
@@ -470,6 +769,11 @@ static ticks checkUnsubackTimeoutState()
 	return 0; // Stop the timer
 }
 
+static ticks checkPubackTimeoutState() {
+   pubackTimeoutOccured = true; // Mark that timer has executed
+   return 0; // Stop the timer, the next transmission restarts it
+}
+
 
 void MQTT_initialiseState(void){
 	mqttState = DISCONNECTED;
@@ -479,6 +783,227 @@ mqttCurrentState MQTT_GetConnectionState(void) {
    return mqttState;
 }
 
+uint16_t MQTT_GetPublishQueueSpace(void) {
+   uint16_t tail;
+   uint16_t space;
+
+   if (MQTT_GetPublishQueueLength() == MQTT_PUBLISH_QUEUE_SIZE) {
+      return 0;
+   }
+   if (MQTT_GetPublishQueueLength() == 0) {
+      return MQTT_PUBLISH_ARENA_SIZE;
+   }
+   // Same rules as mqttPublishArenaFit()
+   tail = publishQueue[publishQueueTail & MQTT_PUBLISH_QUEUE_MASK].payloadOffset;
+   if (publishArenaHead >= tail) {
+      space = MQTT_PUBLISH_ARENA_SIZE - publishArenaHead;
+      if (tail > space + 1) {
+         space = tail - 1;
+      }
+   } else {
+      space = tail - publishArenaHead - 1;
+   }
+   return space;
+}
+
+uint8_t MQTT_GetPublishQueueLength(void) {
+   return (uint8_t) (publishQueueHead - publishQueueTail);
+}
+
+static uint16_t mqttPublishArenaFit(uint16_t length) {
+   uint16_t tail;
+
+   if (MQTT_GetPublishQueueLength() == 0) {
+      return (length <= MQTT_PUBLISH_ARENA_SIZE) ? 0 : MQTT_PUBLISH_ARENA_FULL;
+   }
+   // The payloads in use run from tail to publishArenaHead, wrapping at most
+   // once. Keeping the head off the tail after a wrap tells the two cases
+   // apart.
+   tail = publishQueue[publishQueueTail & MQTT_PUBLISH_QUEUE_MASK].payloadOffset;
+   if (publishArenaHead >= tail) {
+      if (MQTT_PUBLISH_ARENA_SIZE - publishArenaHead >= length) {
+         return publishArenaHead;
+      }
+      if (tail > length) {
+         return 0;
+      }
+   } else if (tail - publishArenaHead > length) {
+      return publishArenaHead;
+   }
+   return MQTT_PUBLISH_ARENA_FULL;
+}
+
+static bool mqttPublishQueuePut(mqttPublishPacket *newPublishPacket) {
+   mqttPublishQueueEntry *entry;
+   uint16_t offset;
+
+   // QoS 2 is not supported
+   if ((MQTT_GetPublishQueueLength() == MQTT_PUBLISH_QUEUE_SIZE) || (newPublishPacket->publishHeaderFlags.qos > 1)) {
+      return false;
+   }
+   offset = mqttPublishArenaFit(newPublishPacket->payloadLength);
+   if (offset == MQTT_PUBLISH_ARENA_FULL) {
+      return false;
+   }
+   memcpy(&publishArena[offset], newPublishPacket->payload, newPublishPacket->payloadLength);
+   publishArenaHead = offset + newPublishPacket->payloadLength;
+
+   entry = &publishQueue[publishQueueHead & MQTT_PUBLISH_QUEUE_MASK];
+   entry->topic = newPublishPacket->topic;
+   entry->payloadOffset = offset;
+   entry->payloadLength = newPublishPacket->payloadLength;
+   entry->state = PUBLISH_QUEUED;
+
+   // Fixed header, DUP is set by mqttPublishQueueResend() and the packet
+   // identifier is given by mqttSendPublish()
+   entry->publishHeaderFlags.All = 0;
+   entry->publishHeaderFlags.controlPacketType = PUBLISH;
+   entry->publishHeaderFlags.qos = newPublishPacket->publishHeaderFlags.qos;
+   entry->publishHeaderFlags.retain = newPublishPacket->publishHeaderFlags.retain;
+#if MQTT_VERSION == MQTT_VERSION_5_0
+   // The broker may not take QoS 1 (Maximum QoS of the CONNACK)
+   if (entry->publishHeaderFlags.qos > publishMaximumQoS) {
+      entry->publishHeaderFlags.qos = publishMaximumQoS;
+   }
+#endif
+
+   publishQueueHead++;
+   return true;
+}
+
+static void mqttPublishQueueRelease(void) {
+   while ((publishQueueTail != publishQueueSent) && (publishQueue[publishQueueTail & MQTT_PUBLISH_QUEUE_MASK].state == PUBLISH_DONE)) {
+      publishQueueTail++;
+   }
+   if (MQTT_GetPublishQueueLength() == 0) {
+      // Empty, the next payload gets the whole arena
+      publishArenaHead = 0;
+   }
+}
+
+static bool mqttPublishQueueReady(void) {
+   mqttPublishQueueEntry *entry;
+   uint8_t inflightRank = 0;
+   uint8_t index;
+
+   if (publishQueueHead != publishQueueSent) {
+      entry = &publishQueue[publishQueueSent & MQTT_PUBLISH_QUEUE_MASK];
+      if ((entry->publishHeaderFlags.qos == 0) || (publishInflight < publishInflightLimit)) {
+         return true;
+      }
+   }
+   // Same rules as mqttSendPublish()
+   for (index = publishQueueTail; index != publishQueueSent; index++) {
+      entry = &publishQueue[index & MQTT_PUBLISH_QUEUE_MASK];
+      if ((entry->state == PUBLISH_RESEND) && (inflightRank < publishInflightLimit)) {
+         return true;
+      }
+      if ((entry->state == PUBLISH_INFLIGHT) || (entry->state == PUBLISH_RESEND)) {
+         inflightRank++;
+      }
+   }
+   return false;
+}
+
+static void mqttPublishQueueResend(void) {
+   mqttPublishQueueEntry *entry;
+   uint8_t index;
+
+   for (index = publishQueueTail; index != publishQueueSent; index++) {
+      entry = &publishQueue[index & MQTT_PUBLISH_QUEUE_MASK];
+      if (entry->state == PUBLISH_INFLIGHT) {
+         entry->state = PUBLISH_RESEND;
+         entry->publishHeaderFlags.duplicate = 1;
+      }
+   }
+   if (mqttPublishQueueReady() == true) {
+      mqttTxFlags.newTxPublishPacket = 1;
+   }
+}
+
+static uint16_t mqttAllocatePacketIdentifier(void) {
+   mqttPublishQueueEntry *entry;
+   bool inUse;
+   uint8_t index;
+
+   do {
+      publishPacketIdentifier++;
+      if (publishPacketIdentifier == 0) {
+         publishPacketIdentifier = 1;
+      }
+      inUse = false;
+      for (index = publishQueueTail; index != publishQueueSent; index++) {
+         entry = &publishQueue[index & MQTT_PUBLISH_QUEUE_MASK];
+         if ((entry->state != PUBLISH_DONE) && (entry->packetIdentifier == publishPacketIdentifier)) {
+            inUse = true;
+         }
+      }
+      if ((mqttTxFlags.newTxSubscribePacket == 1) || (mqttRxFlags.newRxSubackPacket == 1)) {
+         if (publishPacketIdentifier == (((uint16_t) txSubscribePacket.packetIdentifierMSB << 8) | txSubscribePacket.packetIdentifierLSB)) {
+            inUse = true;
+         }
+      }
+      if ((mqttTxFlags.newTxUnsubscribePacket == 1) || (mqttRxFlags.newRxUnsubackPacket == 1)) {
+         if (publishPacketIdentifier == (((uint16_t) txUnsubscribePacket.packetIdentifierMSB << 8) | txUnsubscribePacket.packetIdentifierLSB)) {
+            inUse = true;
+         }
+      }
+   } while (inUse == true);
+
+   return publishPacketIdentifier;
+}
+
+static uint16_t mqttPublishLoad(mqttPublishQueueEntry *entry) {
+#if MQTT_VERSION == MQTT_VERSION_5_0
+   uint8_t index;
+
+#endif
+   memset(&txPublishPacket, 0, sizeof (txPublishPacket));
+
+   // Fixed header
+   txPublishPacket.publishHeaderFlags.All = entry->publishHeaderFlags.All;
+
+   // Variable header
+   txPublishPacket.topic = entry->topic;
+   txPublishPacket.topicLength = strlen((char*) entry->topic);
+   if (txPublishPacket.publishHeaderFlags.qos > 0) {
+      txPublishPacket.packetIdentifierLSB = (uint8_t) entry->packetIdentifier;
+      txPublishPacket.packetIdentifierMSB = (uint8_t) (entry->packetIdentifier >> 8);
+      txPublishPacket.totalLength += sizeof (txPublishPacket.packetIdentifierLSB) + sizeof (txPublishPacket.packetIdentifierMSB);
+   }
+
+#if MQTT_VERSION == MQTT_VERSION_5_0
+   // The topic goes in full once per connection, with an alias standing for
+   // it in the next packets. mqttSendPublish() records the alias once the
+   // packet is in the TCP Tx buffer.
+   for (index = 0; index < publishTopicAliasMaximum; index++) {
+      if (publishTopicAliases[index] == entry->topic) {
+         txPublishPacket.topicLength = 0;
+         break;
+      }
+   }
+   if (index == publishTopicAliasMaximum) {
+      for (index = 0; (index < publishTopicAliasMaximum) && (publishTopicAliases[index] != NULL); index++) {
+      }
+   }
+   if (index < publishTopicAliasMaximum) {
+      txPublishPacket.properties[0] = PROPERTY_TOPIC_ALIAS;
+      txPublishPacket.properties[1] = 0;
+      txPublishPacket.properties[2] = index + 1;
+      txPublishPacket.propertyLength = 3;
+   }
+   txPublishPacket.totalLength += sizeof (txPublishPacket.propertyLength) + txPublishPacket.propertyLength;
+#endif
+
+   // Payload
+   txPublishPacket.payload = &publishArena[entry->payloadOffset];
+   txPublishPacket.payloadLength = entry->payloadLength;
+   txPublishPacket.totalLength += sizeof (txPublishPacket.topicLength) + txPublishPacket.topicLength + txPublishPacket.payloadLength;
+   txPublishPacket.topicLength = htons(txPublishPacket.topicLength);
+
+   return sizeof (txPublishPacket.publishHeaderFlags.All) + mqttEncodeLength(txPublishPacket.totalLength, txPublishPacket.remainingLength) + txPublishPacket.totalLength;
+}
+
 bool MQTT_CreateConnectPacket(mqttConnectPacket *newConnectPacket) {
    uint16_t payloadLength = 0;
    memset(&txConnectPacket, 0, sizeof (txConnectPacket));
@@ -496,7 +1021,7 @@ bool MQTT_CreateConnectPacket(mqttConnectPacket *newConnectPacket) {
    txConnectPacket.connectVariableHeader.protocolName[3] = 'Q';
    txConnectPacket.connectVariableHeader.protocolName[4] = 'T';
    txConnectPacket.connectVariableHeader.protocolName[5] = 'T';
-   txConnectPacket.connectVariableHeader.protocolLevel = 0x04;
+   txConnectPacket.connectVariableHeader.protocolLevel = MQTT_VERSION;
    if ((newConnectPacket->passwordLength > 0) || (newConnectPacket->usernameLength > 0)) {
       txConnectPacket.connectVariableHeader.connectFlagsByte.All = 0xC2;
    } else {
@@ -521,14 +1046,23 @@ bool MQTT_CreateConnectPacket(mqttConnectPacket *newConnectPacket) {
       payloadLength = txConnectPacket.clientIDLength + txConnectPacket.passwordLength + txConnectPacket.usernameLength + 4;
    }
    txConnectPacket.totalLength = sizeof (txConnectPacket.connectVariableHeader) + sizeof (payloadLength) + payloadLength;
+#if MQTT_VERSION == MQTT_VERSION_5_0
+   txConnectPacket.totalLength += sizeof (mqttConnectProperties);
+#endif
    if (txConnectPacket.connectVariableHeader.connectFlagsByte.usernameFlag == 1 || txConnectPacket.connectVariableHeader.connectFlagsByte.passwordFlag == 1) {
       txConnectPacket.passwordLength = htons(txConnectPacket.passwordLength);
       txConnectPacket.usernameLength = htons(txConnectPacket.usernameLength);
    }
    txConnectPacket.clientIDLength = htons(txConnectPacket.clientIDLength);
 
-   // Clear all pending transmissions first
+   // Clear all pending transmissions first. The queued PUBLISH packets stay,
+   // they are sent once connected.
    mqttTxFlags.All = 0;
+   timeout_delete(&pubackTimer);
+   pubackTimeoutOccured = false;
+   // The new connection starts a new stream
+   memset(&rxParser, 0, sizeof (rxParser));
+   MQTT_ExchangeBufferInit(&rxControlPacket);
    
    // Now mark the Connect for sending
    mqttTxFlags.newTxConnectPacket = 1;
@@ -542,36 +1076,15 @@ bool MQTT_CreatePublishPacket(mqttPublishPacket *newPublishPacket) {
 
    ret = false;
 
-   memset(&txPublishPacket, 0, sizeof (txPublishPacket));
-
+   // The packet is queued, MQTT_TransmissionHandler() sends it later. It fails
+   // when the publish queue is full, see MQTT_GetPublishQueueSpace(). The
+   // packet identifier of a QoS 1 packet is given by the library.
    if (mqttState == CONNECTED) {
       debug_printInfo("MQTT: PublishBuild");
-      // Fixed header
-      txPublishPacket.publishHeaderFlags.controlPacketType = PUBLISH;
-      txPublishPacket.publishHeaderFlags.duplicate = newPublishPacket->publishHeaderFlags.duplicate;
-      txPublishPacket.publishHeaderFlags.qos = newPublishPacket->publishHeaderFlags.qos;
-      if ((txPublishPacket.publishHeaderFlags.qos == 0) && (txPublishPacket.publishHeaderFlags.duplicate != 0)) {
-         txPublishPacket.publishHeaderFlags.duplicate = 0;
+      ret = mqttPublishQueuePut(newPublishPacket);
+      if ((ret == true) && (mqttPublishQueueReady() == true)) {
+         mqttTxFlags.newTxPublishPacket = 1;
       }
-      txPublishPacket.publishHeaderFlags.retain = newPublishPacket->publishHeaderFlags.retain;
-
-      // Variable header
-      txPublishPacket.topic = newPublishPacket->topic;
-      txPublishPacket.topicLength = strlen((char*) newPublishPacket->topic);
-      if (newPublishPacket->publishHeaderFlags.qos > 0) {
-         txPublishPacket.packetIdentifierLSB = newPublishPacket->packetIdentifierLSB;
-         txPublishPacket.packetIdentifierMSB = newPublishPacket->packetIdentifierMSB;
-         txPublishPacket.totalLength += sizeof (txPublishPacket.packetIdentifierLSB) + sizeof (txPublishPacket.packetIdentifierMSB);
-      }
-
-      // Payload
-      txPublishPacket.payload = newPublishPacket->payload;
-      txPublishPacket.payloadLength = newPublishPacket->payloadLength;
-      txPublishPacket.totalLength += sizeof (txPublishPacket.topicLength) + txPublishPacket.topicLength + txPublishPacket.payloadLength;
-      txPublishPacket.topicLength = htons(txPublishPacket.topicLength);
-
-      mqttTxFlags.newTxPublishPacket = 1;
-      ret = true;
    }
    return ret;
 }
@@ -600,8 +1113,8 @@ bool MQTT_CreateSubscribePacket(mqttSubscribePacket *newSubscribePacket) {
       txSubscribePacket.packetIdentifierLSB = newSubscribePacket->packetIdentifierLSB;
       txSubscribePacket.packetIdentifierMSB = newSubscribePacket->packetIdentifierMSB;
 
-      // Payload
-      for (topicCount = 0; topicCount < NUM_TOPICS_SUBSCRIBE; topicCount++) {
+      // Payload, the topics in use come first
+      for (topicCount = 0; (topicCount < NUM_TOPICS_SUBSCRIBE) && (newSubscribePacket->subscribePayload[topicCount].topicLength > 0); topicCount++) {
          txSubscribePacket.subscribePayload[topicCount].topicLength = htons(newSubscribePacket->subscribePayload[topicCount].topicLength);
          txSubscribePacket.subscribePayload[topicCount].topic = newSubscribePacket->subscribePayload[topicCount].topic;
          txSubscribePacket.subscribePayload[topicCount].requestedQoS = newSubscribePacket->subscribePayload[topicCount].requestedQoS;
@@ -612,6 +1125,9 @@ bool MQTT_CreateSubscribePacket(mqttSubscribePacket *newSubscribePacket) {
       // The totalLength field is not essentially a part of the SUBSCRIBE
       // packet. It is used for calculation of the remaining length field.
       txSubscribePacket.totalLength += sizeof (txSubscribePacket.packetIdentifierLSB) + sizeof (txSubscribePacket.packetIdentifierMSB);
+#if MQTT_VERSION == MQTT_VERSION_5_0
+      txSubscribePacket.totalLength += sizeof (mqttNoProperties);
+#endif
 
       mqttTxFlags.newTxSubscribePacket = 1;
       ret = true;
@@ -657,6 +1173,9 @@ bool MQTT_CreateUnsubscribePacket(mqttUnsubscribePacket *newUnsubscribePacket)
 		// The totalLength field is not essentially a part of the UNSUBSCRIBE
 		// packet. It is used for calculation of the remaining length field.
 		txUnsubscribePacket.totalLength += sizeof (txUnsubscribePacket.packetIdentifierLSB) + sizeof (txUnsubscribePacket.packetIdentifierMSB);
+#if MQTT_VERSION == MQTT_VERSION_5_0
+		txUnsubscribePacket.totalLength += sizeof (mqttNoProperties);
+#endif
 
 		mqttTxFlags.newTxUnsubscribePacket = 1;
 		ret = true;
@@ -674,6 +1193,9 @@ static bool mqttSendConnect(mqttContext *mqttConnectionPtr) {
    MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, (uint8_t*) & txConnectPacket.connectFixedHeaderFlags.All, sizeof (txConnectPacket.connectFixedHeaderFlags.All));
    MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, (uint8_t*) txConnectPacket.remainingLength, mqttEncodeLength(txConnectPacket.totalLength, txConnectPacket.remainingLength));
    MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, (uint8_t*) & txConnectPacket.connectVariableHeader, sizeof (txConnectPacket.connectVariableHeader));
+#if MQTT_VERSION == MQTT_VERSION_5_0
+   MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, (uint8_t*) mqttConnectProperties, sizeof (mqttConnectProperties));
+#endif
    MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, (uint8_t*) & txConnectPacket.clientIDLength, sizeof (txConnectPacket.clientIDLength));
    MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, (uint8_t*) txConnectPacket.clientID, strlen((char*) txConnectPacket.clientID));
 
@@ -696,32 +1218,122 @@ static bool mqttSendConnect(mqttContext *mqttConnectionPtr) {
 
 static bool mqttSendPublish(mqttContext *mqttConnectionPtr) {
    bool ret = false;
+   mqttPublishQueueEntry *entry;
+   uint8_t sentIndex[MQTT_PUBLISH_BURST];
+   uint8_t packetCount = 0;
+   uint8_t newInflight = 0;
+   uint8_t inflightRank = 0;
+   uint8_t index;
+   uint8_t i;
+   uint16_t packetLength;
+#if MQTT_VERSION == MQTT_VERSION_5_0
+   uint8_t newTopicAliases = 0;
+   uint8_t alias;
+#endif
 
    MQTT_ExchangeBufferInit(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff);
    MQTT_ExchangeBufferInit(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff);
 
-   // Copy the txPublishPacket data in TCP Tx buffer
-   MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, &txPublishPacket.publishHeaderFlags.All, sizeof (txPublishPacket.publishHeaderFlags.All));
-   MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, txPublishPacket.remainingLength, mqttEncodeLength(txPublishPacket.totalLength, txPublishPacket.remainingLength));
-   MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, (uint8_t*) & txPublishPacket.topicLength, sizeof (txPublishPacket.topicLength));
-   MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, txPublishPacket.topic, ntohs(txPublishPacket.topicLength));
+   // Copy the packets in TCP Tx buffer in queue order, as many as fit: the
+   // QoS 1 packets to send again, then the ones never sent while the in-flight
+   // window has room
+   for (index = publishQueueTail; (index != publishQueueHead) && (packetCount < MQTT_PUBLISH_BURST); index++) {
+      entry = &publishQueue[index & MQTT_PUBLISH_QUEUE_MASK];
+      if (entry->state == PUBLISH_QUEUED) {
+         if (entry->publishHeaderFlags.qos == 1) {
+            if (publishInflight + newInflight >= publishInflightLimit) {
+               break;
+            }
+            entry->packetIdentifier = mqttAllocatePacketIdentifier();
+         }
+      } else if (entry->state == PUBLISH_RESEND) {
+         // After a reconnection the broker may take fewer packets in flight
+         // than before, the last ones wait for PUBACKs
+         if (inflightRank++ >= publishInflightLimit) {
+            break;
+         }
+      } else {
+         if (entry->state == PUBLISH_INFLIGHT) {
+            inflightRank++;
+         }
+         continue;
+      }
 
-   if (txPublishPacket.publishHeaderFlags.qos == 1) {
-      MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, &txPublishPacket.packetIdentifierMSB, sizeof (txPublishPacket.packetIdentifierMSB));
-      MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, &txPublishPacket.packetIdentifierLSB, sizeof (txPublishPacket.packetIdentifierLSB));
+      packetLength = mqttPublishLoad(entry);
+      if (packetLength > mqttConnectionPtr->mqttDataExchangeBuffers.txbuff.bufferLength - mqttConnectionPtr->mqttDataExchangeBuffers.txbuff.dataLength) {
+         if (packetCount > 0) {
+            break;
+         }
+         // It would never fit, drop it instead of blocking the queue
+         debug_printError("MQTT: PUBLISH of %u bytes dropped", packetLength);
+         if (entry->state == PUBLISH_QUEUED) {
+            publishQueueSent++;
+         } else {
+            publishInflight--;
+         }
+         entry->state = PUBLISH_DONE;
+         continue;
+      }
+
+      MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, &txPublishPacket.publishHeaderFlags.All, sizeof (txPublishPacket.publishHeaderFlags.All));
+      MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, txPublishPacket.remainingLength, mqttEncodeLength(txPublishPacket.totalLength, txPublishPacket.remainingLength));
+      MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, (uint8_t*) & txPublishPacket.topicLength, sizeof (txPublishPacket.topicLength));
+      MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, txPublishPacket.topic, ntohs(txPublishPacket.topicLength));
+
+      if (txPublishPacket.publishHeaderFlags.qos == 1) {
+         MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, &txPublishPacket.packetIdentifierMSB, sizeof (txPublishPacket.packetIdentifierMSB));
+         MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, &txPublishPacket.packetIdentifierLSB, sizeof (txPublishPacket.packetIdentifierLSB));
+         if (entry->state == PUBLISH_QUEUED) {
+            newInflight++;
+         }
+      }
+#if MQTT_VERSION == MQTT_VERSION_5_0
+      MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, &txPublishPacket.propertyLength, sizeof (txPublishPacket.propertyLength));
+      MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, txPublishPacket.properties, txPublishPacket.propertyLength);
+      if ((txPublishPacket.propertyLength > 0) && (txPublishPacket.topicLength > 0)) {
+         // The next packets of the burst already use the alias
+         alias = txPublishPacket.properties[2] - 1;
+         publishTopicAliases[alias] = entry->topic;
+         newTopicAliases |= 1 << alias;
+      }
+#endif
+      MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, txPublishPacket.payload, txPublishPacket.payloadLength);
+      sentIndex[packetCount++] = index;
    }
-   MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, txPublishPacket.payload, txPublishPacket.payloadLength);
 
    // Function call to TCP_Send() is abstracted
-   if (mqttTxFlags.newTxPublishPacket == 1 || txPublishPacket.publishHeaderFlags.duplicate == 1) {
+   if (packetCount > 0) {
       ret = MQTT_Send(mqttConnectionPtr);
       if (ret == true) {
-         mqttTxFlags.newTxPublishPacket = 0;
-         if (txPublishPacket.publishHeaderFlags.qos == 1) {
+         for (i = 0; i < packetCount; i++) {
+            entry = &publishQueue[sentIndex[i] & MQTT_PUBLISH_QUEUE_MASK];
+            if (entry->state == PUBLISH_QUEUED) {
+               publishQueueSent++;
+            }
+            entry->state = (entry->publishHeaderFlags.qos == 1) ? PUBLISH_INFLIGHT : PUBLISH_DONE;
+         }
+         publishInflight += newInflight;
+         if (publishInflight > 0) {
             mqttRxFlags.newRxPubackPacket = 1;
+            if (timeout_active(&pubackTimer) == false) {
+               timeout_create(&pubackTimer, WAITFORPUBACK_TIMEOUT);
+            }
          }
       }
+#if MQTT_VERSION == MQTT_VERSION_5_0
+      if (ret == false) {
+         // The broker never saw the topics, they go in full again
+         for (alias = 0; alias < MQTT_TOPIC_ALIASES; alias++) {
+            if (newTopicAliases & (1 << alias)) {
+               publishTopicAliases[alias] = NULL;
+            }
+         }
+      }
+#endif
    }
+   mqttPublishQueueRelease();
+   // What is left goes with the next transmission passes
+   mqttTxFlags.newTxPublishPacket = mqttPublishQueueReady();
    return ret;
 }
 
@@ -743,26 +1355,128 @@ static uint8_t mqttEncodeLength(uint16_t length, uint8_t *output) {
    return i; /* Return the amount of bytes used */
 }
 
-static uint32_t mqttDecodeLength(uint8_t *encodedData) {
-   uint32_t multiplier;
-   uint32_t value;
-   uint32_t i;
+#if MQTT_VERSION == MQTT_VERSION_5_0
+static uint8_t mqttReadVariableInteger(exchangeBuffer *rxPacket, uint32_t *value) {
+   uint8_t byte;
+   uint8_t count = 0;
 
-   multiplier = 1;
-   value = 0;
+   *value = 0;
+   do {
+      if ((count == 4) || (MQTT_ExchangeBufferRead(rxPacket, &byte, sizeof (byte)) == 0)) {
+         return 0;
+      }
+      *value |= (uint32_t) (byte & 0x7F) << (7 * count);
+      count++;
+   } while (byte & 0x80);
 
-   for (i = 0; i == 0 || (encodedData[i - 1] & 0x80); i++) {
-      value += (encodedData[i] & 0x7f) * multiplier;
-      multiplier *= 0x80;
+   return count;
+}
+
+static uint32_t mqttReadProperty(exchangeBuffer *rxPacket, uint8_t *identifier, uint32_t *value) {
+   uint8_t bytes[4];
+   uint32_t length = 1;
+   uint16_t stringLength;
+   uint8_t size = 0;
+   uint8_t strings = 0;
+   uint8_t i;
+
+   *value = 0;
+   if (MQTT_ExchangeBufferRead(rxPacket, identifier, sizeof (*identifier)) == 0) {
+      return 0;
    }
+   switch (*identifier) {
+      case PROPERTY_PAYLOAD_FORMAT_INDICATOR:
+      case PROPERTY_REQUEST_PROBLEM_INFORMATION:
+      case PROPERTY_REQUEST_RESPONSE_INFORMATION:
+      case PROPERTY_MAXIMUM_QOS:
+      case PROPERTY_RETAIN_AVAILABLE:
+      case PROPERTY_WILDCARD_SUBSCRIPTION_AVAILABLE:
+      case PROPERTY_SUBSCRIPTION_IDENTIFIER_AVAILABLE:
+      case PROPERTY_SHARED_SUBSCRIPTION_AVAILABLE:
+         size = 1;
+         break;
+      case PROPERTY_SERVER_KEEP_ALIVE:
+      case PROPERTY_RECEIVE_MAXIMUM:
+      case PROPERTY_TOPIC_ALIAS_MAXIMUM:
+      case PROPERTY_TOPIC_ALIAS:
+         size = 2;
+         break;
+      case PROPERTY_MESSAGE_EXPIRY_INTERVAL:
+      case PROPERTY_SESSION_EXPIRY_INTERVAL:
+      case PROPERTY_WILL_DELAY_INTERVAL:
+      case PROPERTY_MAXIMUM_PACKET_SIZE:
+         size = 4;
+         break;
+      case PROPERTY_SUBSCRIPTION_IDENTIFIER:
+         size = mqttReadVariableInteger(rxPacket, value);
+         return (size == 0) ? 0 : length + size;
+      case PROPERTY_CONTENT_TYPE:
+      case PROPERTY_RESPONSE_TOPIC:
+      case PROPERTY_CORRELATION_DATA:
+      case PROPERTY_ASSIGNED_CLIENT_IDENTIFIER:
+      case PROPERTY_AUTHENTICATION_METHOD:
+      case PROPERTY_AUTHENTICATION_DATA:
+      case PROPERTY_RESPONSE_INFORMATION:
+      case PROPERTY_SERVER_REFERENCE:
+      case PROPERTY_REASON_STRING:
+         strings = 1;
+         break;
+      case PROPERTY_USER_PROPERTY:
+         strings = 2;
+         break;
+      default:
+         return 0;
+   }
+
+   if (MQTT_ExchangeBufferRead(rxPacket, bytes, size) != size) {
+      return 0;
+   }
+   for (i = 0; i < size; i++) {
+      *value = (*value << 8) | bytes[i];
+   }
+   length += size;
 
-   return value;
+   // Strings and binary data, each with a two byte length
+   while (strings-- > 0) {
+      if (MQTT_ExchangeBufferRead(rxPacket, bytes, 2) != 2) {
+         return 0;
+      }
+      stringLength = ((uint16_t) bytes[0] << 8) | bytes[1];
+      length += 2 + stringLength;
+      while (stringLength > 0) {
+         size = (stringLength > sizeof (bytes)) ? sizeof (bytes) : stringLength;
+         if (MQTT_ExchangeBufferRead(rxPacket, bytes, size) != size) {
+            return 0;
+         }
+         stringLength -= size;
+      }
+   }
+   return length;
 }
 
+static bool mqttSkipProperties(exchangeBuffer *rxPacket) {
+   uint32_t propertyLength;
+   uint16_t length;
+
+   if (mqttReadVariableInteger(rxPacket, &propertyLength) == 0) {
+      return false;
+   }
+   while (propertyLength > 0) {
+      length = (propertyLength > MQTT_RX_CHUNK_MAX) ? MQTT_RX_CHUNK_MAX : propertyLength;
+      MQTT_ExchangeBufferGet(rxPacket, &length);
+      if (length == 0) {
+         return false;
+      }
+      propertyLength -= length;
+   }
+   return true;
+}
+#endif
 
 mqttCurrentState MQTT_Disconnect(mqttContext* connectionInfo) {
    if ((mqttState == CONNECTED) || (mqttState == WAITFORCONNACK)) {
       timeout_delete(&pingreqTimer);
+      timeout_delete(&pubackTimer);
 
       mqttSendDisconnect(connectionInfo);
       mqttState = DISCONNECTED;
@@ -772,37 +1486,35 @@ mqttCurrentState MQTT_Disconnect(mqttContext* connectionInfo) {
 
 }
 
-static void mqttProcessPingresp(mqttContext *mqttConnectionPtr) {
+static void mqttProcessPingresp(exchangeBuffer *rxPacket) {
    mqttPingPacket txPingrespPacket;
 
    memset(&txPingrespPacket, 0, sizeof (txPingrespPacket));
 
-   MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &txPingrespPacket.pingFixedHeader.All, sizeof (txPingrespPacket.pingFixedHeader.All));
+   MQTT_ExchangeBufferRead(rxPacket, &txPingrespPacket.pingFixedHeader.All, sizeof (txPingrespPacket.pingFixedHeader.All));
    // Reload timeout for keepAliveTimer
    // The timeout should be reloaded only if the keepAliveTimer is set
    // to a non-zero value.
    if (ntohs(txConnectPacket.connectVariableHeader.keepAliveTimer) != 0) {
       mqttTxFlags.newTxPingreqPacket = 1;
    }
-   // Re-initialise the RX exchange buffer to be able to process the
-   // next incoming MQTT packet
-   MQTT_ExchangeBufferInit(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff);
 }
 
-static mqttCurrentState mqttProcessSuback(mqttContext *mqttConnectionPtr) {
+static mqttCurrentState mqttProcessSuback(exchangeBuffer *rxPacket) {
    mqttCurrentState ret;
    mqttSubackPacket rxSubackPacket;
    uint8_t topicNumbers = 0;
+   uint8_t returnCode;
    uint8_t topicCount = 0;
 
    memset(&rxSubackPacket, 0, sizeof (rxSubackPacket));
 
    ret = CONNECTED;
 
-   MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &rxSubackPacket.subscribeAckHeaderFlags.All, sizeof (rxSubackPacket.subscribeAckHeaderFlags.All));
-   MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &rxSubackPacket.remainingLength[0], sizeof (rxSubackPacket.remainingLength[0]));
-   MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &rxSubackPacket.packetIdentifierMSB, sizeof (rxSubackPacket.packetIdentifierMSB));
-   MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &rxSubackPacket.packetIdentifierLSB, sizeof (rxSubackPacket.packetIdentifierLSB));
+   MQTT_ExchangeBufferRead(rxPacket, &rxSubackPacket.subscribeAckHeaderFlags.All, sizeof (rxSubackPacket.subscribeAckHeaderFlags.All));
+   MQTT_ExchangeBufferRead(rxPacket, &rxSubackPacket.remainingLength[0], sizeof (rxSubackPacket.remainingLength[0]));
+   MQTT_ExchangeBufferRead(rxPacket, &rxSubackPacket.packetIdentifierMSB, sizeof (rxSubackPacket.packetIdentifierMSB));
+   MQTT_ExchangeBufferRead(rxPacket, &rxSubackPacket.packetIdentifierLSB, sizeof (rxSubackPacket.packetIdentifierLSB));
    // The packetIdentifier of the SUBACK packet must match the
    // packetIdentifier of the SUBSCRIBE packet. Since the library allows
    // the application to create only one SUBSCRIBE packet at a time,
@@ -811,13 +1523,21 @@ static mqttCurrentState mqttProcessSuback(mqttContext *mqttConnectionPtr) {
       // Change state appropriately
       ret = DISCONNECTED;
    } else {
-      // ToDo remove hardcoding
-      MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, rxSubackPacket.returnCode, 1);
-      // ToDo This calculation needs to be modified after removing
-      // hardcoding
-      topicNumbers = (sizeof (rxSubackPacket.returnCode) / sizeof (rxSubackPacket.returnCode[0]));
+#if MQTT_VERSION == MQTT_VERSION_5_0
+      // The properties come first, none is of use
+      mqttSkipProperties(rxPacket);
+#endif
+      // One return code per topic of the SUBSCRIBE packet, in the same order
+      while ((topicNumbers < NUM_TOPICS_SUBSCRIBE) && (MQTT_ExchangeBufferRead(rxPacket, &returnCode, sizeof (returnCode)) == sizeof (returnCode))) {
+         rxSubackPacket.returnCode[topicNumbers++] = returnCode;
+      }
+      if (topicNumbers == 0) {
+         ret = DISCONNECTED;
+      }
       for (topicCount = 0; topicCount < topicNumbers; topicCount++) {
-         if (rxSubackPacket.returnCode[topicCount] == SUBSCRIBE_FAILURE) {
+         if (rxSubackPacket.returnCode[topicCount] >= SUBSCRIBE_FAILURE) {
+            // MQTT 5.0 tells why with the failure code
+            debug_printError("MQTT: SUBSCRIBE topic %d refused (0x%02x)", topicCount, rxSubackPacket.returnCode[topicCount]);
             // Change state appropriately
             ret = DISCONNECTED;
             break;
@@ -835,13 +1555,10 @@ static mqttCurrentState mqttProcessSuback(mqttContext *mqttConnectionPtr) {
    }
 
    mqttRxFlags.newRxSubackPacket = 0;
-   // Re-initialize the RX exchange buffer to be able to process the
-   // next incoming MQTT packet
-   MQTT_ExchangeBufferInit(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff);
    return ret;
 }
 
-static mqttCurrentState mqttProcessUnsuback(mqttContext *mqttConnectionPtr) 
+static mqttCurrentState mqttProcessUnsuback(exchangeBuffer *rxPacket) 
 {
 	mqttCurrentState ret;
 	mqttUnsubackPacket rxUnsubackPacket;
@@ -850,18 +1567,27 @@ static mqttCurrentState mqttProcessUnsuback(mqttContext *mqttConnectionPtr)
 	
 	ret = CONNECTED;
 
-	MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &rxUnsubackPacket.unsubAckHeaderFlags.All, sizeof (rxUnsubackPacket.unsubAckHeaderFlags.All));
-	MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &rxUnsubackPacket.remainingLength, sizeof (rxUnsubackPacket.remainingLength));
+	MQTT_ExchangeBufferRead(rxPacket, &rxUnsubackPacket.unsubAckHeaderFlags.All, sizeof (rxUnsubackPacket.unsubAckHeaderFlags.All));
+	MQTT_ExchangeBufferRead(rxPacket, &rxUnsubackPacket.remainingLength, sizeof (rxUnsubackPacket.remainingLength));
+#if MQTT_VERSION == MQTT_VERSION_5_0
+	if(rxUnsubackPacket.remainingLength < 4)
+	{
+		// The packet identifier, the properties and a reason code per topic
+		// at least (MQTT 5.0, section 3.11)
+		ret = DISCONNECTED;
+	}
+#else
 	if(rxUnsubackPacket.remainingLength != 2)
 	{
 		// The length of the variable header for UNSUBACK Packet has to be 2 
         // according to MQTT RFC, section 3.11.1.
 		ret = DISCONNECTED;
 	}
+#endif
     else
     {	
-        MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &rxUnsubackPacket.packetIdentifierMSB, sizeof (rxUnsubackPacket.packetIdentifierMSB));
-        MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &rxUnsubackPacket.packetIdentifierLSB, sizeof (rxUnsubackPacket.packetIdentifierLSB));
+        MQTT_ExchangeBufferRead(rxPacket, &rxUnsubackPacket.packetIdentifierMSB, sizeof (rxUnsubackPacket.packetIdentifierMSB));
+        MQTT_ExchangeBufferRead(rxPacket, &rxUnsubackPacket.packetIdentifierLSB, sizeof (rxUnsubackPacket.packetIdentifierLSB));
         // The packetIdentifier of the UNSUBACK packet must match the
         // packetIdentifier of the UNSUBSCRIBE packet. Since the library allows
         // the application to create only one UNSUBSCRIBE packet at a time,
@@ -874,75 +1600,259 @@ static mqttCurrentState mqttProcessUnsuback(mqttContext *mqttConnectionPtr)
     }
     
 	mqttRxFlags.newRxUnsubackPacket = 0;
-	// Re-initialize the RX exchange buffer to be able to process the
-	// next incoming MQTT packet
-	MQTT_ExchangeBufferInit(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff);
 	return ret;
 }
 
-static mqttCurrentState mqttProcessPublish(mqttContext *mqttConnectionPtr) {
-   mqttCurrentState ret;
-   uint32_t decodedLength;
-   mqttPublishPacket rxPublishPacket;
-   const publishReceptionHandler_t *publishRecvHandlerInfo;
-   uint8_t i;
+static void mqttParsePayloadStart(void) {
+   rxParser.payloadLength = rxParser.remaining;
+   rxParser.payloadOffset = 0;
+   // Only the topics subscribed to are delivered
+   rxParser.filters = (mqttState == CONNECTED) ? MQTT_MatchTopicFilters((char*) rxTopic) : 0;
 
-   uint8_t mqttTopic[TOPIC_SIZE];
-   uint8_t mqttPayload[PAYLOAD_SIZE];
+   if (rxParser.remaining == 0) {
+      // An empty payload is still a message for the application
+      if (rxParser.filters) {
+         MQTT_HandlePublishData(rxParser.filters, rxTopic, NULL, 0, 0, 0);
+      }
+      rxParser.state = RX_FIXED_HEADER;
+   } else if (rxParser.filters) {
+      rxParser.state = RX_PAYLOAD;
+   } else {
+      rxParser.state = RX_SKIP;
+   }
+}
 
-   decodedLength = 0;
+static void mqttParseVariableHeaderEnd(void) {
+#if MQTT_VERSION == MQTT_VERSION_5_0
+   // The properties come before the payload (MQTT 5.0, section 3.3.2.3)
+   rxParser.propertyLength = 0;
+   rxParser.fieldCount = 0;
+   rxParser.state = RX_PROPERTY_LENGTH;
+#else
+   mqttParsePayloadStart();
+#endif
+}
 
-   memset(&rxPublishPacket, 0, sizeof (rxPublishPacket));
-   memset(mqttTopic, 0, sizeof (mqttTopic));
-   memset(mqttPayload, 0, sizeof (mqttPayload));
+static mqttRxResult mqttParse(exchangeBuffer *rxbuff) {
+   uint8_t byte;
+   uint8_t *data;
+   uint16_t length;
+
+   while (rxbuff->dataLength > 0) {
+      switch (rxParser.state) {
+         case RX_FIXED_HEADER:
+            MQTT_ExchangeBufferRead(rxbuff, &rxParser.header.All, 1);
+            rxParser.lengthBytes = 0;
+            rxParser.remaining = 0;
+            rxParser.state = RX_REMAINING_LENGTH;
+            break;
 
-   // Fixed header
-   MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &rxPublishPacket.publishHeaderFlags.All, sizeof (rxPublishPacket.publishHeaderFlags.All));
-   MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &rxPublishPacket.remainingLength[0], sizeof (rxPublishPacket.remainingLength[0]));
-   for (i = 2; rxPublishPacket.remainingLength[i - 1] & 0x80 && i < sizeof (rxPublishPacket.remainingLength); i++) {
-      MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &rxPublishPacket.remainingLength[i], 1);
-   }
-   decodedLength = mqttDecodeLength(&rxPublishPacket.remainingLength[0]);
+         case RX_REMAINING_LENGTH:
+            MQTT_ExchangeBufferRead(rxbuff, &byte, 1);
+            rxParser.remaining |= (uint32_t) (byte & 0x7F) << (7 * rxParser.lengthBytes);
+            rxParser.lengthBytes++;
+            if (byte & 0x80) {
+               // The remaining length takes 4 bytes at most (MQTT RFC, section 2.2.3)
+               if (rxParser.lengthBytes == 4) {
+                  return RX_MALFORMED;
+               }
+               break;
+            }
+            if (rxParser.header.controlPacketType == PUBLISH) {
+               rxParser.fieldLength = 0;
+               rxParser.fieldCount = 0;
+               rxParser.state = RX_TOPIC_LENGTH;
+            } else {
+               // The other packets are small, they are rebuilt for the
+               // mqttProcess functions. What they need comes first, the end
+               // of a larger packet (MQTT 5.0 properties) is dropped.
+               MQTT_ExchangeBufferInit(&rxControlPacket);
+               MQTT_ExchangeBufferWrite(&rxControlPacket, &rxParser.header.All, 1);
+               byte = (rxParser.remaining > 0xFF) ? 0xFF : rxParser.remaining;
+               MQTT_ExchangeBufferWrite(&rxControlPacket, &byte, 1);
+               if (rxParser.remaining > (MQTT_RX_PACKET_SIZE - 2)) {
+                  debug_printInfo("MQTT: packet type %d of %lu bytes cut", rxParser.header.controlPacketType, (unsigned long) rxParser.remaining);
+               }
+               if (rxParser.remaining == 0) {
+                  rxParser.state = RX_FIXED_HEADER;
+                  return RX_COMPLETE;
+               }
+               rxParser.state = RX_BODY;
+            }
+            break;
 
-   // Variable header
-   MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, (uint8_t*) & rxPublishPacket.topicLength, sizeof (rxPublishPacket.topicLength));
-   decodedLength -= sizeof (rxPublishPacket.topicLength);
-   rxPublishPacket.topic = (uint8_t*) mqttTopic;
-   MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, rxPublishPacket.topic, ntohs(rxPublishPacket.topicLength));
-   decodedLength -= ntohs(rxPublishPacket.topicLength);
+         case RX_TOPIC_LENGTH:
+            if (rxParser.remaining == 0) {
+               return RX_MALFORMED;
+            }
+            MQTT_ExchangeBufferRead(rxbuff, &byte, 1);
+            rxParser.fieldLength = (rxParser.fieldLength << 8) | byte;
+            rxParser.remaining--;
+            rxParser.fieldCount++;
+            if (rxParser.fieldCount == sizeof (rxParser.fieldLength)) {
+               // A topic name is at least one character long (MQTT RFC, section 4.7.3)
+               if ((rxParser.fieldLength == 0) || (rxParser.fieldLength > rxParser.remaining)) {
+                  return RX_MALFORMED;
+               }
+               rxParser.fieldCount = 0;
+               if (rxParser.fieldLength < sizeof (rxTopic)) {
+                  rxParser.state = RX_TOPIC;
+               } else {
+                  debug_printError("MQTT: topic of %u bytes dropped", rxParser.fieldLength);
+                  rxParser.state = RX_SKIP;
+               }
+            }
+            break;
 
-   // Payload
-   rxPublishPacket.payload = (uint8_t*) mqttPayload;
-   MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, rxPublishPacket.payload, decodedLength);
-
-   // Send payload information to the application
-   publishRecvHandlerInfo = MQTT_GetPublishReceptionHandlerTable();
-   for (i = 0; i < NUM_TOPICS_SUBSCRIBE; i++) {
-      if (publishRecvHandlerInfo) {
-         if (memcmp((void*) publishRecvHandlerInfo->topic, (void*) rxPublishPacket.topic, ntohs(rxPublishPacket.topicLength)) == 0) {
-            publishRecvHandlerInfo->mqttHandlePublishDataCallBack(rxPublishPacket.topic, rxPublishPacket.payload);
+         case RX_TOPIC:
+            length = MQTT_ExchangeBufferRead(rxbuff, &rxTopic[rxParser.fieldCount], rxParser.fieldLength - rxParser.fieldCount);
+            rxParser.fieldCount += length;
+            rxParser.remaining -= length;
+            if (rxParser.fieldCount == rxParser.fieldLength) {
+               rxTopic[rxParser.fieldLength] = '\0';
+               rxParser.fieldCount = 0;
+               if (rxParser.header.qos > 0) {
+                  rxParser.state = RX_PACKET_IDENTIFIER;
+               } else {
+                  mqttParseVariableHeaderEnd();
+               }
+            }
+            break;
+
+         case RX_PACKET_IDENTIFIER:
+            // Only QoS 0 is subscribed to, the identifier is not kept
+            if (rxParser.remaining == 0) {
+               return RX_MALFORMED;
+            }
+            MQTT_ExchangeBufferRead(rxbuff, &byte, 1);
+            rxParser.remaining--;
+            rxParser.fieldCount++;
+            if (rxParser.fieldCount == 2) {
+               mqttParseVariableHeaderEnd();
+            }
+            break;
+
+#if MQTT_VERSION == MQTT_VERSION_5_0
+         case RX_PROPERTY_LENGTH:
+            if (rxParser.remaining == 0) {
+               return RX_MALFORMED;
+            }
+            MQTT_ExchangeBufferRead(rxbuff, &byte, 1);
+            rxParser.remaining--;
+            rxParser.propertyLength |= (uint32_t) (byte & 0x7F) << (7 * rxParser.fieldCount);
+            rxParser.fieldCount++;
+            if (byte & 0x80) {
+               if (rxParser.fieldCount == 4) {
+                  return RX_MALFORMED;
+               }
+               break;
+            }
+            if (rxParser.propertyLength > rxParser.remaining) {
+               return RX_MALFORMED;
+            }
+            if (rxParser.propertyLength == 0) {
+               mqttParsePayloadStart();
+            } else {
+               rxParser.state = RX_PROPERTIES;
+            }
+            break;
+
+         case RX_PROPERTIES:
+            // None is of use: the broker gives no topic alias and the
+            // subscriptions have no identifier
+            length = (rxParser.propertyLength > MQTT_RX_CHUNK_MAX) ? MQTT_RX_CHUNK_MAX : rxParser.propertyLength;
+            MQTT_ExchangeBufferGet(rxbuff, &length);
+            rxParser.propertyLength -= length;
+            rxParser.remaining -= length;
+            if (rxParser.propertyLength == 0) {
+               mqttParsePayloadStart();
+            }
+            break;
+#endif
+
+         case RX_PAYLOAD:
+            // The payload is handed over where it lies in rxbuff, in as many
+            // pieces as it takes
+            length = (rxParser.remaining > MQTT_RX_CHUNK_MAX) ? MQTT_RX_CHUNK_MAX : rxParser.remaining;
+            data = MQTT_ExchangeBufferGet(rxbuff, &length);
+            MQTT_HandlePublishData(rxParser.filters, rxTopic, data, length, rxParser.payloadOffset, rxParser.payloadLength);
+            rxParser.payloadOffset += length;
+            rxParser.remaining -= length;
+            if (rxParser.remaining == 0) {
+               rxParser.state = RX_FIXED_HEADER;
+            }
+            break;
+
+         case RX_BODY:
+            // Less than MQTT_RX_PACKET_SIZE is left, clamped like the other states all the same
+            length = (rxParser.remaining > MQTT_RX_CHUNK_MAX) ? MQTT_RX_CHUNK_MAX : rxParser.remaining;
+            data = MQTT_ExchangeBufferGet(rxbuff, &length);
+            MQTT_ExchangeBufferWrite(&rxControlPacket, data, length);
+            rxParser.remaining -= length;
+            if (rxParser.remaining == 0) {
+               rxParser.state = RX_FIXED_HEADER;
+               return RX_COMPLETE;
+            }
+            break;
+
+         case RX_SKIP:
+         default:
+            length = (rxParser.remaining > MQTT_RX_CHUNK_MAX) ? MQTT_RX_CHUNK_MAX : rxParser.remaining;
+            MQTT_ExchangeBufferGet(rxbuff, &length);
+            rxParser.remaining -= length;
+            if (rxParser.remaining == 0) {
+               rxParser.state = RX_FIXED_HEADER;
+            }
             break;
-         }
       }
-      publishRecvHandlerInfo++;
    }
 
-   // Re-initialize the RX exchange buffer to be able to process the
-   // next incoming MQTT packet
-   MQTT_ExchangeBufferInit(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff);
-   ret = CONNECTED;
-   return ret;
+   return RX_INCOMPLETE;
 }
 
-static void mqttProcessPuback(mqttContext *mqttConnectionPtr) {
+static void mqttProcessPuback(exchangeBuffer *rxPacket) {
    mqttPubackPacket rxPubackPacket;
+   mqttPublishQueueEntry *entry;
+   uint16_t packetIdentifier;
+   uint8_t index;
+#if MQTT_VERSION == MQTT_VERSION_5_0
+   uint8_t reasonCode;
+#endif
+
    memset(&rxPubackPacket, 0, sizeof (rxPubackPacket));
-   MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, (uint8_t*) & rxPubackPacket.pubackFixedHeader, sizeof (rxPubackPacket.pubackFixedHeader));
-   MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &rxPubackPacket.remainingLength, sizeof (rxPubackPacket.remainingLength));
-   MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &rxPubackPacket.packetIdentifierMSB, sizeof (rxPubackPacket.packetIdentifierMSB));
-   MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &rxPubackPacket.packetIdentifierLSB, sizeof (rxPubackPacket.packetIdentifierLSB));
-   if (rxPubackPacket.packetIdentifierLSB == txPublishPacket.packetIdentifierLSB && rxPubackPacket.packetIdentifierMSB == txPublishPacket.packetIdentifierMSB) {
+   MQTT_ExchangeBufferRead(rxPacket, &rxPubackPacket.pubackFixedHeader.All, sizeof (rxPubackPacket.pubackFixedHeader.All));
+   MQTT_ExchangeBufferRead(rxPacket, &rxPubackPacket.remainingLength, sizeof (rxPubackPacket.remainingLength));
+   MQTT_ExchangeBufferRead(rxPacket, &rxPubackPacket.packetIdentifierMSB, sizeof (rxPubackPacket.packetIdentifierMSB));
+   MQTT_ExchangeBufferRead(rxPacket, &rxPubackPacket.packetIdentifierLSB, sizeof (rxPubackPacket.packetIdentifierLSB));
+   packetIdentifier = ((uint16_t) rxPubackPacket.packetIdentifierMSB << 8) | rxPubackPacket.packetIdentifierLSB;
+#if MQTT_VERSION == MQTT_VERSION_5_0
+   // The reason code is left out on success (MQTT 5.0, section 3.4.2.1). A
+   // refused packet is not sent again, the PUBACK still ends its transmission.
+   if ((MQTT_ExchangeBufferRead(rxPacket, &reasonCode, sizeof (reasonCode)) == sizeof (reasonCode)) && (reasonCode >= MQTT_REASON_CODE_FAILURE)) {
+      debug_printError("MQTT: PUBLISH %u refused (0x%02x)", packetIdentifier, reasonCode);
+   }
+#endif
+
+   // A PUBACK matching no packet in flight is a late duplicate, ignore it
+   for (index = publishQueueTail; index != publishQueueSent; index++) {
+      entry = &publishQueue[index & MQTT_PUBLISH_QUEUE_MASK];
+      if (((entry->state == PUBLISH_INFLIGHT) || (entry->state == PUBLISH_RESEND)) && (entry->packetIdentifier == packetIdentifier)) {
+         entry->state = PUBLISH_DONE;
+         publishInflight--;
+         break;
+      }
+   }
+
+   mqttPublishQueueRelease();
+   if (publishInflight == 0) {
       mqttRxFlags.newRxPubackPacket = 0;
+      timeout_delete(&pubackTimer);
+   } else {
+      // The broker is making progress, give the rest of the window more time
+      timeout_reschedule(&pubackTimer, WAITFORPUBACK_TIMEOUT);
+   }
+   if (mqttPublishQueueReady() == true) {
+      mqttTxFlags.newTxPublishPacket = 1;
    }
 }
 
@@ -967,6 +1877,19 @@ mqttCurrentState MQTT_TransmissionHandler(mqttContext *mqttConnectionPtr) {
          break;
 
       case CONNECTED:
+         if (pubackTimeoutOccured == true) {
+            pubackTimeoutOccured = false;
+#if MQTT_VERSION == MQTT_VERSION_5_0
+            // No PUBACK for too long. A 5.0 client sends a PUBLISH again only
+            // on a new connection (MQTT 5.0, section 4.4), so close this one
+            mqttState = DISCONNECTED;
+            MQTT_Close(mqttConnectionPtr);
+            break;
+#else
+            // No PUBACK for too long, send the packets in flight again
+            mqttPublishQueueResend();
+#endif
+         }
          // ToDo Find out ways to improve this logic
          if (mqttTxFlags.All > 0) {
             while ((mqttTxFlags.All & (MQTT_TX_PACKET_DECISION_CONSTANT << getSetFlag)) == 0) {
@@ -983,30 +1906,29 @@ mqttCurrentState MQTT_TransmissionHandler(mqttContext *mqttConnectionPtr) {
                   }
                   break;
                case SENDPUBLISH:
-                  timeout_delete(&pingreqTimer);
                   packetSent = mqttSendPublish(mqttConnectionPtr);
-
+                  if (packetSent == true) {
+                     // any packet sent restarts the keep alive countdown
                      keepAliveTimeout = ntohs(txConnectPacket.connectVariableHeader.keepAliveTimer);
                      if (txConnectPacket.connectVariableHeader.keepAliveTimer > 0) {
-                        timeout_create(&pingreqTimer, ((keepAliveTimeout - KEEP_ALIVE_CALCULATION_CONSTANT) * SECONDS));
+                        timeout_reschedule(&pingreqTimer, ((keepAliveTimeout - KEEP_ALIVE_CALCULATION_CONSTANT) * SECONDS));
                      }
+                  }
                   break;
                case SENDSUBSCRIBE:
-				  timeout_delete(&pingreqTimer);
                   mqttSendSubscribe(mqttConnectionPtr);
                   keepAliveTimeout = ntohs(txConnectPacket.connectVariableHeader.keepAliveTimer);
 				  if (txConnectPacket.connectVariableHeader.keepAliveTimer > 0)
 				  {
-                    timeout_create(&pingreqTimer, ((keepAliveTimeout - KEEP_ALIVE_CALCULATION_CONSTANT) * SECONDS));
+                    timeout_reschedule(&pingreqTimer, ((keepAliveTimeout - KEEP_ALIVE_CALCULATION_CONSTANT) * SECONDS));
 				  }
                   break;
                case SENDUNSUBSCRIBE:
-			      timeout_delete(&pingreqTimer);
                   mqttSendUnsubscribe(mqttConnectionPtr);
                   keepAliveTimeout = ntohs(txConnectPacket.connectVariableHeader.keepAliveTimer);
                   if (txConnectPacket.connectVariableHeader.keepAliveTimer > 0)
 				  {
-                    timeout_create(&pingreqTimer, ((keepAliveTimeout - KEEP_ALIVE_CALCULATION_CONSTANT) * SECONDS));
+                    timeout_reschedule(&pingreqTimer, ((keepAliveTimeout - KEEP_ALIVE_CALCULATION_CONSTANT) * SECONDS));
 				  }
                   break;
                default:
@@ -1022,11 +1944,7 @@ mqttCurrentState MQTT_TransmissionHandler(mqttContext *mqttConnectionPtr) {
 }
 
 mqttCurrentState MQTT_ReceptionHandler(mqttContext *mqttConnectionPtr) {
-   uint16_t keepAliveTimeout;
-   mqttHeaderFlags receivedPacketHeader;
-
-   keepAliveTimeout = 0;
-   receivedPacketHeader.All = 0;
+   mqttRxResult result;
 
    if(pingrespTimeoutOccured == true || subackTimeoutOccured == true || unsubackTimeoutOccured == true)
    {
@@ -1037,24 +1955,45 @@ mqttCurrentState MQTT_ReceptionHandler(mqttContext *mqttConnectionPtr) {
 	  mqttState = DISCONNECTED;
       MQTT_Close(mqttConnectionPtr);
    }
-   // If nothing to process
-   if (mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff.dataLength == 0)
-      return mqttState;
+
+   // A piece of the stream may hold several packets, or only part of one
+   while ((mqttState != DISCONNECTED) && (mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff.dataLength > 0)) {
+      result = mqttParse(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff);
+      if (result == RX_COMPLETE) {
+         mqttProcessPacket(mqttConnectionPtr);
+      } else if (result == RX_MALFORMED) {
+         debug_printError("MQTT: malformed packet");
+         mqttState = DISCONNECTED;
+         MQTT_Close(mqttConnectionPtr);
+      }
+   }
+   // Once disconnected, what is left belongs to no packet
+   MQTT_ExchangeBufferInit(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff);
+
+   return mqttState;
+}
+
+static void mqttProcessPacket(mqttContext *mqttConnectionPtr) {
+   uint16_t keepAliveTimeout;
+#if MQTT_VERSION == MQTT_VERSION_5_0
+   uint8_t rxDisconnectPacket[3];
+#endif
+
+   keepAliveTimeout = 0;
 
    switch (mqttState) {
       case WAITFORCONNACK:
-         keepAliveTimeout = ntohs(txConnectPacket.connectVariableHeader.keepAliveTimer);
          if (connackTimeoutOccured == false) {
             // The timeout API names are different in MCC foundation
             // services timeout driver and START timeout driver
             timeout_delete(&connackTimer);
             // Check the type of packet
-            uint16_t len = MQTT_ExchangeBufferPeek(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &receivedPacketHeader.All, sizeof (receivedPacketHeader.All));
-
-            if (receivedPacketHeader.controlPacketType == CONNACK) 
+            if (rxParser.header.controlPacketType == CONNACK) 
             {
-               mqttState = mqttProcessConnack(mqttConnectionPtr);
+               mqttState = mqttProcessConnack(&rxControlPacket);
                if (mqttState == CONNECTED) {
+                  // With MQTT 5.0 the broker may have changed it
+                  keepAliveTimeout = ntohs(txConnectPacket.connectVariableHeader.keepAliveTimer);
                   if (keepAliveTimeout != 0) {
                      // Send a PINGREQ packet after (keepAliveTimer - KEEP_ALIVE_CALCULATION_CONSTANT)s
                      // if keepAliveTime is non-zero
@@ -1064,13 +2003,17 @@ mqttCurrentState MQTT_ReceptionHandler(mqttContext *mqttConnectionPtr) {
                      timeout_create(&pingreqTimer, ((keepAliveTimeout - KEEP_ALIVE_CALCULATION_CONSTANT) * SECONDS));
                   }
 
+                  // The QoS 1 packets in flight on the previous connection may
+                  // have been lost, send them again with the queued ones
+                  mqttPublishQueueResend();
+
                   connectTime = time(NULL);
                   debug_printGOOD("MQTT: CONNACK CONNECTED at %s", ctime(&connectTime));
                } else {
                   debug_printError("MQTT: CONNACK DISCONNECTED :(");
                }
             } else {
-               debug_printError("MQTT: DISCONNECT (%d) from (%d)", receivedPacketHeader.controlPacketType, len);
+               debug_printError("MQTT: DISCONNECT (%d)", rxParser.header.controlPacketType);
                //If the Client does not receive a CONNACK Packet from the Server within a reasonable amount of time,
                //the Client SHOULD close the Network Connection.
                mqttState = DISCONNECTED;
@@ -1084,22 +2027,20 @@ mqttCurrentState MQTT_ReceptionHandler(mqttContext *mqttConnectionPtr) {
          break;
 
       case CONNECTED:
-         // Check the type of packet
-         MQTT_ExchangeBufferPeek(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &receivedPacketHeader.All, sizeof (receivedPacketHeader.All));
-
-         switch (receivedPacketHeader.controlPacketType) {
+         // Check the type of packet, PUBLISH packets were delivered by the parser
+         switch (rxParser.header.controlPacketType) {
             case PINGRESP:
                // PINGRESP received
                if ((mqttRxFlags.newRxPingrespPacket == 1) && (pingrespTimeoutOccured == false)) {
                   timeout_delete(&pingrespTimer);
-                  mqttProcessPingresp(mqttConnectionPtr);
+                  mqttProcessPingresp(&rxControlPacket);
                }
                break;
             case SUBACK:
                // SUBACK received
                if ((mqttRxFlags.newRxSubackPacket == 1) && (subackTimeoutOccured == false)) {
 	              timeout_delete(&subackTimer);
-                  mqttState = mqttProcessSuback(mqttConnectionPtr);
+                  mqttState = mqttProcessSuback(&rxControlPacket);
                }
                break;
                case UNSUBACK:
@@ -1107,16 +2048,23 @@ mqttCurrentState MQTT_ReceptionHandler(mqttContext *mqttConnectionPtr) {
                if ((mqttRxFlags.newRxUnsubackPacket == 1) && (unsubackTimeoutOccured == false)) 
 			   {
 				   timeout_delete(&unsubackTimer);
-	               mqttState = mqttProcessUnsuback(mqttConnectionPtr);
+	               mqttState = mqttProcessUnsuback(&rxControlPacket);
 	           } 
                break;
-            case PUBLISH:
-               // PUBLISH received
-               mqttProcessPublish(mqttConnectionPtr);
-               break;
             case PUBACK:
-               mqttProcessPuback(mqttConnectionPtr);
+               mqttProcessPuback(&rxControlPacket);
+               break;
+#if MQTT_VERSION == MQTT_VERSION_5_0
+            case DISCONNECT:
+               // The broker closes the connection and tells why, no reason
+               // code is a normal disconnection (MQTT 5.0, section 3.14)
+               memset(rxDisconnectPacket, 0, sizeof (rxDisconnectPacket));
+               MQTT_ExchangeBufferRead(&rxControlPacket, rxDisconnectPacket, sizeof (rxDisconnectPacket));
+               debug_printError("MQTT: DISCONNECT from the broker (0x%02x)", rxDisconnectPacket[2]);
+               mqttState = DISCONNECTED;
+               MQTT_Close(mqttConnectionPtr);
                break;
+#endif
             default:
                break;
          }
@@ -1129,8 +2077,6 @@ mqttCurrentState MQTT_ReceptionHandler(mqttContext *mqttConnectionPtr) {
          debug_printError("MQTT: mqttState=%d", mqttState);
          break;
    }
-
-   return mqttState;
 }
 
 
@@ -1146,8 +2092,11 @@ static bool mqttSendSubscribe(mqttContext *mqttConnectionPtr) {
    MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, txSubscribePacket.remainingLength, mqttEncodeLength(txSubscribePacket.totalLength, txSubscribePacket.remainingLength));
    MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, &txSubscribePacket.packetIdentifierMSB, sizeof (txSubscribePacket.packetIdentifierMSB));
    MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, &txSubscribePacket.packetIdentifierLSB, sizeof (txSubscribePacket.packetIdentifierLSB));
+#if MQTT_VERSION == MQTT_VERSION_5_0
+   MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, (uint8_t*) &mqttNoProperties, sizeof (mqttNoProperties));
+#endif
 
-   for (topicCount = 0; topicCount < NUM_TOPICS_SUBSCRIBE; topicCount++) {
+   for (topicCount = 0; (topicCount < NUM_TOPICS_SUBSCRIBE) && (txSubscribePacket.subscribePayload[topicCount].topicLength > 0); topicCount++) {
       MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, (uint8_t*) & txSubscribePacket.subscribePayload[topicCount].topicLength, sizeof (txSubscribePacket.subscribePayload[topicCount].topicLength));
       MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, txSubscribePacket.subscribePayload[topicCount].topic, ntohs(txSubscribePacket.subscribePayload[topicCount].topicLength));
       MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, &txSubscribePacket.subscribePayload[topicCount].requestedQoS, sizeof (txSubscribePacket.subscribePayload[topicCount].requestedQoS));
@@ -1181,6 +2130,9 @@ static bool mqttSendUnsubscribe(mqttContext *mqttConnectionPtr)
     MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, txUnsubscribePacket.remainingLength, mqttEncodeLength(txUnsubscribePacket.totalLength, txUnsubscribePacket.remainingLength));
     MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, &txUnsubscribePacket.packetIdentifierMSB, sizeof(txUnsubscribePacket.packetIdentifierMSB));
     MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, &txUnsubscribePacket.packetIdentifierLSB, sizeof(txUnsubscribePacket.packetIdentifierLSB));
+#if MQTT_VERSION == MQTT_VERSION_5_0
+    MQTT_ExchangeBufferWrite(&mqttConnectionPtr->mqttDataExchangeBuffers.txbuff, (uint8_t*) &mqttNoProperties, sizeof(mqttNoProperties));
+#endif
     
     for (topicCount = 0; topicCount < NUM_TOPICS_UNSUBSCRIBE; topicCount++) 
     {
@@ -1263,20 +2215,68 @@ static bool mqttSendDisconnect(mqttContext *mqttConnectionPtr) {
    return ret;
 }
 
-static mqttCurrentState mqttProcessConnack(mqttContext *mqttConnectionPtr) {
+static mqttCurrentState mqttProcessConnack(exchangeBuffer *rxPacket) {
    mqttConnackPacket_t mqttConnackPacket;
+   uint8_t returnCode = 0;
+#if MQTT_VERSION == MQTT_VERSION_5_0
+   uint32_t propertyLength;
+   uint32_t length;
+   uint32_t value;
+   uint8_t identifier;
+#endif
 
    memset(&mqttConnackPacket, 0, sizeof (mqttConnackPacket));
 
    // Check 1st (4) bytes in Rx MQTT Packet
-   MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &mqttConnackPacket.connackFixedHeader.All, sizeof (mqttConnackPacket.connackFixedHeader.All));
-   MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &mqttConnackPacket.remainingLength, sizeof (mqttConnackPacket.remainingLength));
-   MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &mqttConnackPacket.connackVariableHeader.connackAcknowledgeFlags.All, sizeof (mqttConnackPacket.connackVariableHeader.connackAcknowledgeFlags.All));
-   MQTT_ExchangeBufferRead(&mqttConnectionPtr->mqttDataExchangeBuffers.rxbuff, &mqttConnackPacket.connackVariableHeader.connackReturnCode, sizeof (mqttConnackPacket.connackVariableHeader.connackReturnCode));
-
-   if (mqttConnackPacket.connackVariableHeader.connackReturnCode == CONN_ACCEPTED) {
-      return CONNECTED;
-      } else {
+   MQTT_ExchangeBufferRead(rxPacket, &mqttConnackPacket.connackFixedHeader.All, sizeof (mqttConnackPacket.connackFixedHeader.All));
+   MQTT_ExchangeBufferRead(rxPacket, &mqttConnackPacket.remainingLength, sizeof (mqttConnackPacket.remainingLength));
+   MQTT_ExchangeBufferRead(rxPacket, &mqttConnackPacket.connackVariableHeader.connackAcknowledgeFlags.All, sizeof (mqttConnackPacket.connackVariableHeader.connackAcknowledgeFlags.All));
+   // One byte on the wire, whatever the size of the enum
+   MQTT_ExchangeBufferRead(rxPacket, &returnCode, sizeof (returnCode));
+   mqttConnackPacket.connackVariableHeader.connackReturnCode = returnCode;
+
+   if (mqttConnackPacket.connackVariableHeader.connackReturnCode != CONN_ACCEPTED) {
+      debug_printError("MQTT: CONNACK return code 0x%02x", returnCode);
       return DISCONNECTED;
    }
+
+#if MQTT_VERSION == MQTT_VERSION_5_0
+   // What the broker leaves out keeps its default (MQTT 5.0, section 3.2.2.3),
+   // as do the properties cut by the parser. QoS 2 is not supported.
+   publishInflightLimit = MQTT_INFLIGHT_WINDOW;
+   publishMaximumQoS = 1;
+   publishTopicAliasMaximum = 0;
+   memset(publishTopicAliases, 0, sizeof (publishTopicAliases));
+   if (mqttReadVariableInteger(rxPacket, &propertyLength) > 0) {
+      while (propertyLength > 0) {
+         length = mqttReadProperty(rxPacket, &identifier, &value);
+         if ((length == 0) || (length > propertyLength)) {
+            break;
+         }
+         propertyLength -= length;
+         switch (identifier) {
+            case PROPERTY_RECEIVE_MAXIMUM:
+               if ((value > 0) && (value < publishInflightLimit)) {
+                  publishInflightLimit = value;
+               }
+               break;
+            case PROPERTY_MAXIMUM_QOS:
+               if (value < publishMaximumQoS) {
+                  publishMaximumQoS = value;
+               }
+               break;
+            case PROPERTY_TOPIC_ALIAS_MAXIMUM:
+               publishTopicAliasMaximum = (value < MQTT_TOPIC_ALIASES) ? value : MQTT_TOPIC_ALIASES;
+               break;
+            case PROPERTY_SERVER_KEEP_ALIVE:
+               // The keep alive of the broker replaces the one of the CONNECT
+               txConnectPacket.connectVariableHeader.keepAliveTimer = htons((uint16_t) value);
+               break;
+            default:
+               break;
+         }
+      }
+   }
+#endif
+   return CONNECTED;
 }
@@ -34,13 +34,22 @@
 #include "../../winc/socket/include/socket.h"
 #include "../../config/mqtt_config.h"
 
+#if (MQTT_VERSION != MQTT_VERSION_3_1_1) && (MQTT_VERSION != MQTT_VERSION_5_0)
+#error "MQTT_VERSION must be MQTT_VERSION_3_1_1 or MQTT_VERSION_5_0"
+#endif
+#if MQTT_TOPIC_ALIASES > 8
+#error "MQTT_TOPIC_ALIASES must be 8 at most"
+#endif
 
 /********************Timeout Driver for MQTT definitions***********************/
 #define timerstruct_t                   strTask_t
+#define timeout_declare(task, ...)      SCHEDULER_TASK(task, __VA_ARGS__)
 #define htons(a)                        _htons(a)
 #define ntohs(a)                        _ntohs(a)
 #define timeout_create(task, timeout)  scheduler_create_task(task, timeout)
 #define timeout_delete(task)           scheduler_kill_task(task)
+#define timeout_reschedule(task, timeout)   scheduler_reschedule(task, timeout)
+#define timeout_active(task)           scheduler_is_task_active(task)
 
 // Timeout is calculated on the basis of clock frequency.
 // This macros need to be changed in accordance with the clock frequency.
@@ -50,6 +59,7 @@
 #define WAITFORPINGRESP_TIMEOUT             (30 * SECONDS)
 #define WAITFORSUBACK_TIMEOUT				(30 * SECONDS)
 #define WAITFORUNSUBACK_TIMEOUT				(30 * SECONDS)
+#define WAITFORPUBACK_TIMEOUT               (MQTT_PUBACK_TIMEOUT * SECONDS)
 
 
 /*******************Timeout Driver for MQTT definitions*(END)******************/
@@ -223,9 +233,15 @@ typedef struct
     // Packet identifier present only when QoS level = 1 or QoS level = 2
     uint8_t packetIdentifierLSB;
     uint8_t packetIdentifierMSB;
-
-    // Payload
-    uint8_t payloadLength;
+#if MQTT_VERSION == MQTT_VERSION_5_0
+    // Properties, set by the library: the topic alias only. The topic length
+    // is 0 once the broker knows the alias.
+    uint8_t propertyLength;
+    uint8_t properties[3];
+#endif
+
+    // Payload, MQTT_PUBLISH_ARENA_SIZE bytes at most
+    uint16_t payloadLength;
     uint8_t *payload;
 
     uint16_t totalLength;
@@ -390,6 +406,11 @@ mqttCurrentState MQTT_ReceptionHandler(mqttContext *mqttContextPtr);
 
 mqttCurrentState MQTT_GetConnectionState(void);
 
+// Largest payload MQTT_CreatePublishPacket() can queue now, 0 when the publish queue is full
+uint16_t MQTT_GetPublishQueueSpace(void);
+// PUBLISH packets queued and not sent yet, or sent with QoS 1 and not acknowledged yet
+uint8_t MQTT_GetPublishQueueLength(void);
+
 
 #endif	/* MQTT_CORE_H */
 
@@ -93,3 +93,27 @@ uint16_t MQTT_ExchangeBufferRead(exchangeBuffer *buffer, uint8_t *data, uint16_t
 	}
 	return i; 
 }
+
+// Consumes up to *length bytes in place, as many as are contiguous in the buffer,
+// and returns where they are. *length is set to the number of bytes consumed.
+uint8_t *MQTT_ExchangeBufferGet(exchangeBuffer *buffer, uint16_t *length)
+{
+	uint8_t *data = buffer->currentLocation;
+	uint16_t contiguous = buffer->start + buffer->bufferLength - buffer->currentLocation;
+
+	if (*length > buffer->dataLength)
+	{
+		*length = buffer->dataLength;
+	}
+	if (*length > contiguous)
+	{
+		*length = contiguous;
+	}
+	buffer->currentLocation += *length;
+	buffer->dataLength -= *length;
+	if (buffer->currentLocation == buffer->start + buffer->bufferLength)
+	{
+		buffer->currentLocation = buffer->start;
+	}
+	return data;
+}
@@ -35,9 +35,26 @@
 #include <stdint.h>
 #include <string.h>
 #include "mqtt_packetTransfer_interface.h"
+#include "mqtt_core/mqtt_core.h"
+#include "../include/rtc_port.h"
 #include "../debug_print.h"
 
 
+/**********************MQTT Interface layer definitions************************/
+
+// Node of the topic filter trie, one per level of the filters. The levels are
+// not copied, a node points at its level inside the filter, in flash. Node 0 is
+// the root, above the first level.
+typedef struct
+{
+    const char *level;      // In flash, up to the next '/' or the end of the filter
+    uint8_t length;
+    uint8_t child;          // First node of the next level, 0 for none
+    uint8_t sibling;        // Next node of the same level, 0 for none
+    uint16_t filters;       // Filters ending with this level, one bit each
+} topicFilterNode;
+
+/*******************MQTT Interface layer definitions*(END)*********************/
 
 /**********************MQTT Interface layer variables**************************/
 
@@ -47,20 +64,297 @@
  * PUBLISH packet payload received for a particular topic needs to be sent to 
  * the application for further processing.
  */
-publishReceptionHandler_t *publishRecvInfo;
+const publishReceptionHandler_t *publishRecvInfo;
+static uint8_t publishRecvCount;
+
+/** \brief Start of all the topics, the filters follow it. */
+static const char *topicPrefix = "";
+static uint8_t topicPrefixLength;
+
+/** \brief Topic filter trie, built from the publish handler table. */
+static topicFilterNode topicFilterTrie[MQTT_TOPIC_TRIE_NODES];
+static uint8_t topicFilterNodes;
+
+/** \brief Topics of the SUBSCRIBE packet, they must stay until it is sent. */
+static char subscribeTopics[MQTT_SUBSCRIBE_TOPICS_SIZE];
 /*******************MQTT Interface layer variables*(END)***********************/
 
+/**********************Local function definitions******************************/
+
+// Length of the level of a filter starting at level, in flash
+static uint8_t topicFilterLevelLength(const char *level)
+{
+    uint8_t length = 0;
+    char c;
+
+    while (((c = pgm_read_byte(level + length)) != '\0') && (c != '/'))
+    {
+        length++;
+    }
+    return length;
+}
+
+// Compares the level of a node with a level of a filter (in flash) or of a
+// received topic (in RAM)
+static bool topicFilterLevelEquals(const topicFilterNode *node, const char *level, uint8_t length, bool levelInFlash)
+{
+    uint8_t i;
+    char c;
+
+    if (node->length != length)
+    {
+        return false;
+    }
+    for (i = 0; i < length; i++)
+    {
+        c = levelInFlash ? pgm_read_byte(level + i) : level[i];
+        if (c != (char) pgm_read_byte(node->level + i))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Wildcard level of a node, '\0' for the others
+static char topicFilterWildcard(const topicFilterNode *node)
+{
+    char c = (node->length == 1) ? pgm_read_byte(node->level) : '\0';
+
+    return ((c == '+') || (c == '#')) ? c : '\0';
+}
+
+// Adds the levels of a filter to the trie, the filters sharing their first
+// levels share their nodes
+static bool topicFilterInsert(const char *filter, uint8_t index)
+{
+    uint8_t node = 0;
+    uint8_t child;
+    uint8_t length;
+    uint8_t i;
+    char c;
+
+    // A topic filter is at least one character long (MQTT RFC, section 4.7.3)
+    if (filter == NULL || pgm_read_byte(filter) == '\0')
+    {
+        return false;
+    }
+
+    while (true)
+    {
+        length = topicFilterLevelLength(filter);
+        // A wildcard takes a whole level and '#' is the last one (MQTT RFC,
+        // section 4.7.1)
+        for (i = 0; i < length; i++)
+        {
+            c = pgm_read_byte(filter + i);
+            if (((c == '+') || (c == '#')) && (length > 1))
+            {
+                return false;
+            }
+        }
+        if ((pgm_read_byte(filter) == '#') && (pgm_read_byte(filter + length) != '\0'))
+        {
+            return false;
+        }
+
+        for (child = topicFilterTrie[node].child; child != 0; child = topicFilterTrie[child].sibling)
+        {
+            if (topicFilterLevelEquals(&topicFilterTrie[child], filter, length, true))
+            {
+                break;
+            }
+        }
+        if (child == 0)
+        {
+            if (topicFilterNodes == MQTT_TOPIC_TRIE_NODES)
+            {
+                return false;
+            }
+            child = topicFilterNodes++;
+            topicFilterTrie[child].level = filter;
+            topicFilterTrie[child].length = length;
+            topicFilterTrie[child].sibling = topicFilterTrie[node].child;
+            topicFilterTrie[node].child = child;
+        }
+        node = child;
+
+        if (pgm_read_byte(filter + length) == '\0')
+        {
+            break;
+        }
+        filter += length + 1;
+    }
+
+    topicFilterTrie[node].filters |= (uint16_t) 1 << index;
+    return true;
+}
+
+// Filters below node matching a topic from its level starting at level on. A
+// level is compared with the few nodes under the previous one only, whatever
+// the number of filters
+static uint16_t topicFilterMatch(uint8_t node, const char *level, bool wildcards)
+{
+    const char *end;
+    uint16_t filters = 0;
+    uint8_t child;
+    uint8_t last;
+    char wildcard;
+
+    end = strchr(level, '/');
+    if (end == NULL)
+    {
+        end = level + strlen(level);
+    }
+
+    for (child = topicFilterTrie[node].child; child != 0; child = topicFilterTrie[child].sibling)
+    {
+        wildcard = topicFilterWildcard(&topicFilterTrie[child]);
+        if (wildcard == '#')
+        {
+            if (wildcards)
+            {
+                filters |= topicFilterTrie[child].filters;
+            }
+        }
+        else if (((wildcard == '+') && wildcards) || topicFilterLevelEquals(&topicFilterTrie[child], level, end - level, false))
+        {
+            if (*end != '\0')
+            {
+                filters |= topicFilterMatch(child, end + 1, true);
+            }
+            else
+            {
+                filters |= topicFilterTrie[child].filters;
+                // "a/#" matches "a" too
+                for (last = topicFilterTrie[child].child; last != 0; last = topicFilterTrie[last].sibling)
+                {
+                    if (topicFilterWildcard(&topicFilterTrie[last]) == '#')
+                    {
+                        filters |= topicFilterTrie[last].filters;
+                    }
+                }
+            }
+        }
+    }
+    return filters;
+}
+
+// Writes the topic prefix and a filter (in flash) in topic, returns their
+// length or 0 when they do not fit in size
+static uint16_t topicFilterWrite(char *topic, uint16_t size, const char *filter)
+{
+    uint16_t length;
+    char c;
+
+    if (topicPrefixLength > size)
+    {
+        return 0;
+    }
+    memcpy(topic, topicPrefix, topicPrefixLength);
+    length = topicPrefixLength;
+    while ((c = pgm_read_byte(filter++)) != '\0')
+    {
+        if (length == size)
+        {
+            return 0;
+        }
+        topic[length++] = c;
+    }
+    return length;
+}
+
 /**********************Function implementations********************************/
 
-void MQTT_SetPublishReceptionHandlerTable(publishReceptionHandler_t *appPublishReceptionInfo) 
+bool MQTT_SetPublishReceptionHandlerTable(const publishReceptionHandler_t *appPublishReceptionInfo, uint8_t count, const char *prefix) 
 {
+    uint8_t index;
+
     publishRecvInfo = appPublishReceptionInfo;
+    publishRecvCount = 0;
+    topicPrefix = (prefix != NULL) ? prefix : "";
+    topicPrefixLength = strlen(topicPrefix);
+
+    memset(topicFilterTrie, 0, sizeof (topicFilterTrie));
+    topicFilterNodes = 1;
+    for (index = 0; index < count; index++)
+    {
+        if ((index == NUM_TOPICS_SUBSCRIBE) || !topicFilterInsert(pgm_read_ptr(&appPublishReceptionInfo[index].topicFilter), index))
+        {
+            debug_printError("MQTT: topic filter %d not registered", index);
+            return false;
+        }
+        publishRecvCount++;
+    }
+    return true;
 }
 
-publishReceptionHandler_t *MQTT_GetPublishReceptionHandlerTable()
+const publishReceptionHandler_t *MQTT_GetPublishReceptionHandlerTable()
 {
     return publishRecvInfo;
 }
 
+uint16_t MQTT_MatchTopicFilters(const char *topic)
+{
+    if (strncmp(topic, topicPrefix, topicPrefixLength) != 0)
+    {
+        return 0;
+    }
+    // The wildcards do not match the topics starting with '$' (MQTT RFC,
+    // section 4.7.2)
+    return topicFilterMatch(0, topic + topicPrefixLength, (topicPrefixLength > 0) || (topic[0] != '$'));
+}
+
+void MQTT_HandlePublishData(uint16_t filters, uint8_t *topic, uint8_t *payload, uint16_t length, uint32_t offset, uint32_t payloadLength)
+{
+    imqttHandlePublishDataFuncPtr handler;
+    uint8_t index;
+
+    for (index = 0; filters != 0; index++, filters >>= 1)
+    {
+        if (filters & 1)
+        {
+            handler = (imqttHandlePublishDataFuncPtr) pgm_read_ptr(&publishRecvInfo[index].mqttHandlePublishDataCallBack);
+            handler(topic, payload, length, offset, payloadLength);
+        }
+    }
+}
+
+bool MQTT_CreateTopicFilterSubscribePacket(void)
+{
+    mqttSubscribePacket subscribePacket;
+    char *topic = subscribeTopics;
+    uint16_t length;
+    uint8_t index;
+
+    if (publishRecvCount == 0)
+    {
+        return false;
+    }
+
+    memset(&subscribePacket, 0, sizeof (subscribePacket));
+
+    // Variable header
+    subscribePacket.packetIdentifierLSB = 1;
+    subscribePacket.packetIdentifierMSB = 0;
+
+    // Payload, one topic per filter
+    for (index = 0; index < publishRecvCount; index++)
+    {
+        length = topicFilterWrite(topic, subscribeTopics + sizeof (subscribeTopics) - topic, pgm_read_ptr(&publishRecvInfo[index].topicFilter));
+        if (length == 0)
+        {
+            debug_printError("MQTT: SUBSCRIBE topics over MQTT_SUBSCRIBE_TOPICS_SIZE");
+            return false;
+        }
+        subscribePacket.subscribePayload[index].topic = (uint8_t *) topic;
+        subscribePacket.subscribePayload[index].topicLength = length;
+        subscribePacket.subscribePayload[index].requestedQoS = 0;
+        topic += length;
+    }
+
+    return MQTT_CreateSubscribePacket(&subscribePacket);
+}
+
 
 /**********************Function implementations*(END)**************************/
@@ -29,39 +29,65 @@
 #define	MQTT_PACKET_TRANSFER_INTERFACE_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include "../config/mqtt_config.h"
 
 
 /*********************MQTT Interface layer definitions*************************/
 /** \brief Function pointer for interaction between the MQTT core and user
  * application to transfer the information received as part of the published
  * packet to the application.
+ *
+ * The payload is handed over as it is received, in one or more pieces: the
+ * function is called for each piece with its length and its offset in the
+ * payload, the last one ends at payloadLength. An empty payload is one call
+ * with a length of 0. The payload is not NUL terminated, the topic is.
  **/
-typedef void (*imqttHandlePublishDataFuncPtr)(uint8_t *topic, uint8_t *payload);
+typedef void (*imqttHandlePublishDataFuncPtr)(uint8_t *topic, uint8_t *payload, uint16_t length, uint32_t offset, uint32_t payloadLength);
 
 // The call back table prototype for sending the payload received as part of
 // PUBLISH packet to the correct publish reception handler function defined in
 // the user application. An instance of this table needs to be initialised by
-// the user application to specify the total number of topics to subscribe to,
-// the path of each topic and the call back function for handling the payload
-// received as part of the PUBLISH packet.
+// the user application to specify the topic filters to subscribe to and the
+// call back function for handling the payload of the PUBLISH packets matching
+// each of them. The table and its filters are kept in flash (PROGMEM).
+//
+// A filter is relative to the topic prefix given with the table: "config" with
+// the prefix "/devices/d0123/" subscribes to "/devices/d0123/config". Its
+// levels are separated by '/', a '+' level matches any one level and a '#'
+// level, the last one, matches any number of levels (MQTT RFC, section 4.7.1).
+// A PUBLISH packet matching several filters goes to each of their handlers.
 typedef struct
 {
-    char  *topic;
+    const char *topicFilter;
     imqttHandlePublishDataFuncPtr mqttHandlePublishDataCallBack;
 } publishReceptionHandler_t;
 
+#if NUM_TOPICS_SUBSCRIBE > 16
+#error "NUM_TOPICS_SUBSCRIBE: the topic filters matched are a 16-bit set"
+#endif
+
 /*******************MQTT Interface layer definitions*(END)*********************/
 
 /** \brief Set the publish reception handler table information.
  *
  * This function is called by the user application to inform the MQTT core of
- * the call back table defined to handler the received PUBLISH messages.
+ * the call back table defined to handler the received PUBLISH messages. The
+ * topic filters of the table are indexed in a trie, the received topics are
+ * matched level by level against it instead of filter by filter.
  *
  * @param appPublishReceptionInfo Instance of publishReceptionHandler_t with
  *                                callback functions to handle PUBLISH messages
- *                                received for each topic
+ *                                received for each topic filter, in flash
+ * @param count                   Number of filters in the table, up to
+ *                                NUM_TOPICS_SUBSCRIBE
+ * @param topicPrefix             Start of all the topics, not copied: it must
+ *                                stay valid
+ *
+ * @return false when a filter is malformed or the trie is full
+ *         (MQTT_TOPIC_TRIE_NODES), the filters from that one on are ignored
  */
-void MQTT_SetPublishReceptionHandlerTable(publishReceptionHandler_t *appPublishReceptionInfo);
+bool MQTT_SetPublishReceptionHandlerTable(const publishReceptionHandler_t *appPublishReceptionInfo, uint8_t count, const char *topicPrefix);
 
 /** \brief Obtain the publishReceptionHandler_t table information defined in the
  * user application that the application.
@@ -72,7 +98,30 @@ void MQTT_SetPublishReceptionHandlerTable(publishReceptionHandler_t *appPublishR
  *
  * @return publish reception handler details defined in the user application
  */
-publishReceptionHandler_t *MQTT_GetPublishReceptionHandlerTable();
+const publishReceptionHandler_t *MQTT_GetPublishReceptionHandlerTable();
+
+/** \brief Find the topic filters matching a topic.
+ *
+ * @param topic Topic of a received PUBLISH packet, NUL terminated
+ *
+ * @return the filters matching the topic, bit n set for the filter n of the
+ *         publish reception handler table. 0 for none
+ */
+uint16_t MQTT_MatchTopicFilters(const char *topic);
+
+/** \brief Hand a piece of a PUBLISH payload to the handlers of the filters it
+ * matched (see imqttHandlePublishDataFuncPtr for the arguments).
+ *
+ * @param filters Filters matched, as returned by MQTT_MatchTopicFilters()
+ */
+void MQTT_HandlePublishData(uint16_t filters, uint8_t *topic, uint8_t *payload, uint16_t length, uint32_t offset, uint32_t payloadLength);
+
+/** \brief Create a SUBSCRIBE packet for all the topic filters of the publish
+ * reception handler table, each with the topic prefix in front and QoS 0.
+ *
+ * @return true when the packet was created (see MQTT_CreateSubscribePacket())
+ */
+bool MQTT_CreateTopicFilterSubscribePacket(void);
 
 #endif	/* MQTT_PACKET_TRANSFER_INTERFACE_H */
 
@@ -22,20 +22,183 @@
 */
 
 #include <stdio.h>
-#include "../mcc.h"
-#include "../utils/atomic.h"
+#include <string.h>
+#include "../include/rtc.h"
+#if SCHEDULER_WATCHDOG
+#include "../debug_print.h"
+#endif
 
 #define SCHEDULER_BASE_PERIOD 8    // ms
 
-#define RTC_INT_DISABLE()   do{RTC_PITINTCTRL &= ~RTC_PI_bm;}while(0);
-#define RTC_INT_ENABLE()    do{RTC_PITINTCTRL |= RTC_PI_bm;}while(0);
-#define RTC_INT_GET()       ((RTC_PITINTCTRL  &  RTC_PI_bm) >> RTC_PI_bp)
-#define RTC_INT_CLEAR()     do{RTC_PITINTFLAGS = 1;}while(0);
+#ifdef SCHEDULER_PORT_HOST
+strRtcPortHost_t rtc_port_host;
+#endif
 
+#define RTC_INT_DISABLE()   rtc_port_tick_disable()
+#define RTC_INT_ENABLE()    rtc_port_tick_enable()
+#define RTC_INT_CLEAR()     rtc_port_tick_clear()
+
+// keeps the compiler from moving ring accesses across the index updates
+#define RING_BARRIER()      __asm__ __volatile__ ("" ::: "memory")
+#define RING_NEXT(i, size)  ((uint8_t)((i) + 1) & ((size) - 1))
+
+// The fixed part of a task is in flash
+#define TASK_CALLBACK(task) ((task_callback)pgm_read_ptr(&(task)->def->callback))
+#define TASK_PAYLOAD(task)  (pgm_read_ptr(&(task)->def->payload))
+#define TASK_SLACK(task)    ((ticks)pgm_read_word(&(task)->def->slack))
+#define TASK_NAME_SIZE      16
+
+#if SCHEDULER_TIMER_SLACK
+// time of the tick that expires a task due at time t
+#define TICK_OF(t)      ((ticks)((t) + SCHEDULER_BASE_PERIOD - 1) & (ticks)~(SCHEDULER_BASE_PERIOD - 1))
+#define TASK_NOMINAL(task)  ((task)->nominal)
+#else
+#define TASK_NOMINAL(task)  ((task)->due)
+#endif
+
+#if SCHEDULER_TIMING_WHEEL
+#if (SCHEDULER_WHEEL_SLOTS & (SCHEDULER_WHEEL_SLOTS - 1)) != 0
+#error "SCHEDULER_WHEEL_SLOTS must be a power of 2"
+#endif
+// slot holding the tasks that become due at time t (rounded up to the next tick)
+#define WHEEL_SLOT(t)   ((ticks)((ticks)((t) + SCHEDULER_BASE_PERIOD - 1) / SCHEDULER_BASE_PERIOD) & (SCHEDULER_WHEEL_SLOTS - 1))
+
+static strTask_t *wheel[SCHEDULER_WHEEL_SLOTS];
+#else
 static strTask_t *tasks_head        = NULL;
-static strTask_t *volatile due_head = NULL;
+#endif
+#if SCHEDULER_WALL_CLOCK && !SCHEDULER_LONG_TASKS
+#error "SCHEDULER_WALL_CLOCK needs SCHEDULER_LONG_TASKS"
+#endif
+#if SCHEDULER_CLOCK_DISCIPLINE && !SCHEDULER_WALL_CLOCK
+#error "SCHEDULER_CLOCK_DISCIPLINE needs SCHEDULER_WALL_CLOCK"
+#endif
+#if SCHEDULER_PRIORITIES > 8
+#error "SCHEDULER_PRIORITIES must be 8 or less"
+#endif
+#if (SCHEDULER_EXPIRED_RING & (SCHEDULER_EXPIRED_RING - 1)) || (SCHEDULER_EXPIRED_RING > 128)
+#error "SCHEDULER_EXPIRED_RING must be a power of 2, 128 or less"
+#endif
+#if (SCHEDULER_COMMAND_RING & (SCHEDULER_COMMAND_RING - 1)) || (SCHEDULER_COMMAND_RING > 128)
+#error "SCHEDULER_COMMAND_RING must be a power of 2, 128 or less"
+#endif
+#if (SCHEDULER_REQUEST_RING & (SCHEDULER_REQUEST_RING - 1)) || (SCHEDULER_REQUEST_RING > 128)
+#error "SCHEDULER_REQUEST_RING must be 0 or a power of 2, 128 or less"
+#endif
+
+// The task queue (list or wheel) belongs to the tick interrupt, the due
+// queues to scheduler_next(). They only talk through two single producer,
+// single consumer rings so neither side ever has to mask the other:
+//  - commands: create/kill requests from the main loop, applied by the tick
+//  - expired:  tasks that reached their due time or were signaled, dispatched
+//              by the main loop. Interrupts do not nest so the tick and the
+//              ISRs calling scheduler_signal() count as one producer
+// A task carries a generation that the main loop bumps on every create/kill,
+// an expiry handed over with an older generation is stale and dropped. For
+// the tasks a kill-all drops the tick bumps it and idles them itself, the
+// main loop waits in scheduler_kill_all() meanwhile.
+// The ISRs cannot create or kill a task themselves since the main loop owns
+// its state, they go through a third ring:
+//  - requests: create/kill/reschedule from the ISRs, replayed by
+//              scheduler_next() before it looks at the expired tasks
+typedef enum {
+    CMD_CREATE,
+    CMD_KILL,
+    CMD_KILL_ALL
+} cmdOp_t;
+
+typedef struct {
+    strTask_t   *task;
+    uint8_t     op;         // cmdOp_t
+    uint8_t     gen;        // generation the task is created with
+    ticks       due;
+    ticks       period;
+#if SCHEDULER_LONG_TASKS
+    uint16_t    laps;
+#endif
+} strCommand_t;
+
+typedef struct {
+    strTask_t   *task;
+    uint8_t     gen;        // generation the task was queued or signaled with
+    ticks       due;        // time it was due (or signaled)
+} strExpired_t;
+
+static strCommand_t     cmd_ring[SCHEDULER_COMMAND_RING];
+static volatile uint8_t cmd_head = 0;       // written by the main loop only
+static volatile uint8_t cmd_tail = 0;       // written by the tick only
+static strExpired_t     expired_ring[SCHEDULER_EXPIRED_RING];
+static volatile uint8_t expired_head = 0;   // written by interrupts only
+static volatile uint8_t expired_tail = 0;   // written by the main loop only
+
+#if SCHEDULER_REQUEST_RING
+typedef enum {
+    REQ_CREATE,
+    REQ_KILL,
+    REQ_RESCHEDULE
+} reqOp_t;
+
+typedef struct {
+    strTask_t   *task;
+    uint8_t     op;         // reqOp_t
+    uint16_t    ms;
+} strRequest_t;
+
+static strRequest_t     request_ring[SCHEDULER_REQUEST_RING];
+static volatile uint8_t request_head = 0;   // written by interrupts only
+static volatile uint8_t request_tail = 0;   // written by the main loop only
+
+static void requests_drain(void);
+#endif
+
+// one FIFO of due tasks per priority, due_ready has a bit set for each non empty one
+static strTask_t *due_head[SCHEDULER_PRIORITIES];
+static strTask_t *due_tail[SCHEDULER_PRIORITIES];
+static uint8_t   due_ready = 0;
 
 volatile ticks  curr_time = 0;
+#if SCHEDULER_PROFILING
+static strTask_t *registry_head = NULL;
+#endif
+#if SCHEDULER_LONG_TASKS
+static volatile uint16_t curr_epoch = 0;   // number of times curr_time wrapped around
+#endif
+#if SCHEDULER_WALL_CLOCK
+#define WALL_DRIFT_PPM      1000L                   // how fast the clocks may drift apart
+#define WALL_STEP           1000L                   // ms, more disagreement than this means the clock was set
+
+static bool      wall_known = false;
+static time_t    wall_sec;              // last wall-clock second received
+static uint32_t  wall_lo;               // window of scheduler time in which wall_sec began
+static uint32_t  wall_hi;
+static strTask_t *wall_head = NULL;     // all the tasks that were given a wall-clock schedule
+
+static void wall_arm(strTask_t *task);
+#endif
+#if SCHEDULER_CLOCK_DISCIPLINE
+#define CLOCK_FRAC_TICK     ((int32_t)SCHEDULER_BASE_PERIOD << 16)  // one tick, in 1/65536 ms
+#define CLOCK_SPAN_S        64      // s between two measurements of the RTC oscillator, at least
+#define CLOCK_BURST         16      // time queries in a row, enough to narrow the window of the second again
+#define CLOCK_POLL_S        300     // s between two bursts, once the oscillator is calibrated
+#define CLOCK_MAX_PPM       100000L // more than that (10%) is a wrong measurement
+#define CLOCK_START_PPM     50000L  // how far off the RTC oscillator may be before it is measured
+#define CLOCK_DRIFT_PPM     200L    // how much it may change with the temperature once measured
+
+static volatile int32_t clock_adjust = 0;   // correction per tick in 1/65536 ms, set by the main loop
+static int32_t  clock_frac = 0;             // correction the tick accumulated, belongs to the tick
+static int32_t  clock_ppm = 0;              // error of the RTC oscillator, > 0 when it runs fast
+static int32_t  clock_margin = CLOCK_START_PPM;    // how much the corrected clock may still be off
+static bool     clock_calibrated = false;
+static bool     clock_ref_known = false;
+static time_t   clock_ref_sec;              // wall second, its start in scheduler time and
+static uint32_t clock_ref_ms;               //     how precisely it is known, at the
+static uint16_t clock_ref_width;            //     previous measurement
+static uint8_t  clock_samples = 0;          // time received in the current burst
+static uint32_t clock_burst_end;            // scheduler time the last burst ended
+static bool     clock_query_sent = false;
+static uint32_t clock_query_time;           // scheduler time of the last query
+static ticks    clock_latency = 0;          // ms from a query to its answer
+#endif
 
 // compare two timestamps and return true if a >= thenb
 // timestamps are unsigned, using Z math (Z = 16-bit or 32-bit)
@@ -46,187 +209,1916 @@ inline bool greaterOrEqual(ticks a, ticks thenb)
     return ((int16_t)(a - thenb) >= 0);
 }
 
-void scheduler_init(void)
+// Priority the task was declared with, out of range ones are the highest
+static uint8_t task_priority(const strTask_t *task)
+{
+    uint8_t prio = pgm_read_byte(&task->def->priority);
+
+    return (prio < SCHEDULER_PRIORITIES) ? prio : TASK_PRIORITY_HIGHEST;
+}
+
+// Copies the name of the task out of flash into buf (TASK_NAME_SIZE), a task
+//     declared without one is named after the address of its callback
+static char *task_name(const strTask_t *task, char *buf)
+{
+    PGM_P name = pgm_read_ptr(&task->def->name);
+
+    if (name != NULL) {
+        strncpy_P(buf, name, TASK_NAME_SIZE - 1);
+        buf[TASK_NAME_SIZE - 1] = '\0';
+    }
+    else {
+        snprintf(buf, TASK_NAME_SIZE, "@%04x", (uint16_t)(uintptr_t)TASK_CALLBACK(task));
+    }
+    return buf;
+}
+
+// Reads curr_time from the main loop without masking the tick: the two bytes
+//     are read again until no tick slipped in between
+static ticks scheduler_now(void)
 {
+    ticks now;
 
-	while (RTC.STATUS > 0)
-        ;      /* Wait for all register to be synchronized */
+    do {
+        now = curr_time;
+    } while (now != curr_time);
+    return now;
+}
 
-	RTC.CTRLA = RTC_PRESCALER_DIV1_gc   /* Prescaling Factor: RTC Clock/1 */
-              | 0 << RTC_RTCEN_bp       /* Enabled */
-              | 0 << RTC_RUNSTDBY_bp;   /* Run In Standby: disabled */
-	RTC.CLKSEL = RTC_CLKSEL_INT1K_gc;   /* Clock Select: Internal 1kHz OSC */
-    RTC.PITCTRLA = RTC_PI_bm            // enable PIT function
-                 | RTC_PERIOD_CYC8_gc;// 128 (32768/256) cycles per second
-//    while(RTC.PITSTATUS & RTC_CTRLBUSY_bm);
+void scheduler_init(void)
+{
+    rtc_port_tick_init();
+#if SCHEDULER_TICKLESS
+    rtc_port_sleep_mode(SCHEDULER_SLEEP_MODE);
+#endif
+#if SCHEDULER_PROFILING || SCHEDULER_HIRES_TIMERS || SCHEDULER_TRACE || SCHEDULER_LOAD
+    rtc_port_timer_init();
+#endif
     RTC_INT_ENABLE();
 }
 
-void scheduler_print_list(void)
+#if SCHEDULER_PROFILING || SCHEDULER_LOAD
+// Reads the TCA0 count. Its 16-bit registers go through a TEMP register shared
+//     with the high resolution timer interrupt, which must be held off
+static uint16_t tca_count(void)
 {
-	strTask_t *pTask = tasks_head;
+    uint16_t count;
 
-    printf("@%d tasks_head -> ", curr_time);
-	while (pTask != NULL) {
-		printf("%s:%ld -> ", pTask->name, (uint32_t)pTask->due);
-		pTask = pTask->next;
-	}
-	printf("NULL\n");
+    ENTER_CRITICAL(C);
+    count = rtc_port_timer_count();
+    EXIT_CRITICAL(C);
+    return count;
 }
+#endif
 
-// Returns true if the insert was at the head, false if not
-void tasks_queue_insert(strTask_t *task)
+#if SCHEDULER_PROFILING
+// Converts TCA0 counts to us
+#define PROFILE_COUNT_TO_US(c)      ((uint32_t)(c) * 64 / (RTC_PORT_TIMER_HZ * 64 / 1000000UL))
+// beyond this the 16-bit TCA0 count may have wrapped, use the scheduler time instead
+#define PROFILE_MAX_COUNTED_MS      256
+
+static void profile_reset(strTask_t *task)
 {
-	uint8_t   at_head       = true;
-	strTask_t *insert_point = tasks_head;
-	strTask_t *prev_point   = NULL;
-
-    task->next = NULL;
-	while (insert_point != NULL) {
-		if (greaterOrEqual(insert_point->due, task->due)) {
-			break; // found the spot
-		}
-		prev_point   = insert_point;
-		insert_point = insert_point->next;
-		at_head      = false;
-	}
+    memset(&task->stats, 0, sizeof(task->stats));
+    task->stats.exec_min = UINT32_MAX;
+}
 
-	if (at_head) { // the front of the list.
-		task->next = tasks_head;
-		tasks_head = task;
-		return;
-	}
-    else { // middle of the list
-		task->next = prev_point->next;
-	}
-	prev_point->next = task;
-	return;
+static void profile_register(strTask_t *task)
+{
+    if (!task->registered) {
+        task->registered = true;
+        task->registry = registry_head;
+        registry_head = task;
+        profile_reset(task);
+    }
 }
 
-// Cancel and remove all active tasks
-void scheduler_kill_all(void)
+// Records the start delay of a task about to run
+static void profile_start(strTask_t *task)
 {
-//	scheduler_stop();
-	while (tasks_head != NULL) {
-		scheduler_kill_task(tasks_head);
-	}
+    ticks   late = scheduler_now() - task->released;
+    ticks   bucket_limit = 2 * SCHEDULER_BASE_PERIOD;
+    uint8_t bucket = 0;
 
-	while (due_head != NULL) {
-		scheduler_kill_task(due_head);
-	}
+    while ((late >= bucket_limit) && (bucket < SCHEDULER_LATE_BUCKETS - 1)) {
+        bucket_limit <<= 1;
+        bucket++;
+    }
+    if (task->stats.late_hist[bucket] < UINT16_MAX) {
+        task->stats.late_hist[bucket]++;
+    }
+    if (late > task->stats.late_max) {
+        task->stats.late_max = late;
+    }
 }
 
-// Deletes a task from a list and returns true if the task was found and
-//     removed from the list specified
-bool scheduler_delete(strTask_t *volatile *queue, strTask_t *task)
+static void profile_end(strTask_t *task, ticks start_time, uint16_t start_count)
 {
-	bool ret_val = false;
-	if (*queue == NULL)  {       // the list is empty
-		return ret_val;
+    strTaskStats_t *stats = &task->stats;
+    ticks    ms = scheduler_now() - start_time;
+    uint32_t us;
+
+    if (ms < PROFILE_MAX_COUNTED_MS) {
+        us = PROFILE_COUNT_TO_US((uint16_t)(tca_count() - start_count));
+    }
+    else {
+        us = ms * 1000UL;
+    }
+    if (stats->runs == UINT16_MAX) {    // keep the average meaningful
+        stats->runs /= 2;
+        stats->exec_total /= 2;
     }
+    stats->runs++;
+    stats->exec_total += us;
+    if (us < stats->exec_min) {
+        stats->exec_min = us;
+    }
+    if (us > stats->exec_max) {
+        stats->exec_max = us;
+    }
+}
 
-	RTC_INT_DISABLE();          // disable rtc interrupts
+void scheduler_reset_stats(void)
+{
+    strTask_t *pTask;
 
-	if (task == *queue) {        // the head is the one we are deleting
-		*queue = (*queue)->next;  // Delete the head
-		ret_val = true;
-//		check_scheduler_queue();   // check if the queue is now empty
-	}
-    else {                      // compare from the second task (if present) down
-		strTask_t *delete_point = (*queue)->next;
-		strTask_t *prev_task = *queue;   // start from the second element
-		while (delete_point != NULL) {
-			if (delete_point == task) {
-				prev_task->next = delete_point->next; // delete it from list
-				ret_val = true;
-				break;
-			}
-			prev_task = delete_point; // advance down the list
-			delete_point = delete_point->next;
-		}
-	}
-    RTC_INT_ENABLE();
+    for (pTask = registry_head; pTask != NULL; pTask = pTask->registry) {
+        profile_reset(pTask);
+    }
+}
+
+void scheduler_print_stats(void)
+{
+    strTask_t *pTask;
+    uint8_t   i;
+    char      name[TASK_NAME_SIZE];
+
+    printf("task      runs  exec us min/   avg/    max  late  <16 <32 <64 <128 <256 <512 <1024 >=1024 ms\r\n");
+    for (pTask = registry_head; pTask != NULL; pTask = pTask->registry) {
+        strTaskStats_t *stats = &pTask->stats;
 
-	return ret_val;
+        printf("%-8.8s", task_name(pTask, name));
+        if (stats->runs == 0) {
+            printf(" %5u\r\n", 0);
+            continue;
+        }
+        printf(" %5u %6lu/%6lu/%7lu %5u ", stats->runs, stats->exec_min,
+               stats->exec_total / stats->runs, stats->exec_max, stats->late_max);
+        for (i = 0; i < SCHEDULER_LATE_BUCKETS; i++) {
+            printf(" %u", stats->late_hist[i]);
+        }
+        printf("\r\n");
+    }
 }
+#endif
 
-// This will cancel/remove a running task. If the task is already due it will
-//     also remove it from the callback queue
-void scheduler_kill_task(strTask_t *task)
+static bool tasks_queue_remove(strTask_t *task);
+
+// Takes the task out of the task queue for a kill-all, what it handed over
+//     before becomes stale. A due task is left to scheduler_kill_all(), which
+//     empties the due queues
+static void task_drop(strTask_t *task)
 {
-    if (!scheduler_delete(&tasks_head, task))
-    {
-	    scheduler_delete(&due_head, task);
+    tasks_queue_remove(task);
+    task->gen++;
+    if (task->state != TASK_DUE) {
+        task->state = TASK_IDLE;    // running, its callback finds it killed
     }
+}
+#if SCHEDULER_TRACE
+#if (SCHEDULER_TRACE_SIZE & (SCHEDULER_TRACE_SIZE - 1)) || (SCHEDULER_TRACE_SIZE > 256)
+#error "SCHEDULER_TRACE_SIZE must be a power of 2, 256 or less"
+#endif
+#define TRACE_TIME_EVERY    256     // ms between two time records, well within a TCA0 turn (419ms)
+#define TRACE_VERSION       1       // dump format, tools/sched_trace.py must follow
+
+// Event codes of the trace records, tools/sched_trace.py decodes them
+typedef enum {
+    TRACE_NONE,                     // record never written
+    TRACE_TIME,                     // stamp is curr_time instead, to count the TCA0 turns
+    TRACE_CREATE,                   // created or re-armed
+    TRACE_KILL,
+    TRACE_DUE,                      // handed over by the tick or the TCA0 compare
+    TRACE_SIGNAL,                   // handed over by scheduler_signal(), mostly an ISR entry
+    TRACE_START,                    // callback called
+    TRACE_END                       // callback returned
+} traceEvent_t;
+
+typedef struct {
+    uint8_t     event;              // traceEvent_t
+    uint8_t     id;                 // trace_id of the task, 0 if it got none
+    uint16_t    stamp;              // TCA0 count (RTC_PORT_TIMER_HZ) when it happened
+} strTrace_t;
+
+// Flight recorder: the oldest records are overwritten
+static strTrace_t trace_ring[SCHEDULER_TRACE_SIZE];
+static uint8_t    trace_head = 0;
+static bool       trace_paused = false;
+static ticks      trace_time;       // curr_time of the last time record
+static strTask_t  *trace_tasks[SCHEDULER_TRACE_TASKS];  // task of each trace_id - 1, for the names
+static uint8_t    trace_ids = 0;
+
+// Records an event, from the main loop or an interrupt. The interrupts are
+//     masked anyway to read TCA0, that makes the ring safe for both
+static inline void trace_put(uint8_t event, const strTask_t *task)
+{
+    strTrace_t *rec;
 
-    task->next = NULL;
+    ENTER_CRITICAL(T);
+    if (!trace_paused) {
+        if ((ticks)(curr_time - trace_time) >= TRACE_TIME_EVERY) {
+            trace_time = curr_time;
+            rec = &trace_ring[trace_head];
+            rec->event = TRACE_TIME;
+            rec->id    = 0;
+            rec->stamp = (uint16_t)curr_time;
+            trace_head = RING_NEXT(trace_head, SCHEDULER_TRACE_SIZE);
+        }
+        rec = &trace_ring[trace_head];
+        rec->event = event;
+        rec->id    = task->trace_id;
+        rec->stamp = rtc_port_timer_count();
+        trace_head = RING_NEXT(trace_head, SCHEDULER_TRACE_SIZE);
+    }
+    EXIT_CRITICAL(T);
 }
 
+// Gives the task an id for its records the first time it is created
+static void trace_register(strTask_t *task)
+{
+    if ((task->trace_id == 0) && (trace_ids < SCHEDULER_TRACE_TASKS)) {
+        trace_tasks[trace_ids++] = task;
+        task->trace_id = trace_ids;
+    }
+}
 
-// This function checks the list of due tasks and calls the first one in the
-//    list if the list is not empty. It also reschedules the task if on repeat
-// It is recommended this is called from the main superloop (while(1)) in your code
-//    but by design this can also be called from the task ISR. If you wish callbacks
-//    to happen from the ISR context you can call this as the last action in timeout_isr
-//    instead.
-void scheduler_next(void)
+// The dump is text so it can be captured from any terminal: a header, one line
+//     per task id, then the records oldest first as 8 hex digits each
+void scheduler_print_trace(void)
 {
-	if (due_head == NULL)
-		return;
+    uint8_t  idx;
+    uint16_t n;
+    uint8_t  col = 0;
+    char     name[TASK_NAME_SIZE];
+
+    trace_paused = true;
+    printf("trace begin %u %lu %u\r\n", TRACE_VERSION, (unsigned long)RTC_PORT_TIMER_HZ, SCHEDULER_TRACE_SIZE);
+    for (idx = 0; idx < trace_ids; idx++) {
+        printf("task %u %s\r\n", idx + 1, task_name(trace_tasks[idx], name));
+    }
+    idx = trace_head;
+    for (n = 0; n < SCHEDULER_TRACE_SIZE; n++) {
+        strTrace_t *rec = &trace_ring[idx];
+
+        if (rec->event != TRACE_NONE) {
+            printf("%02x%02x%04x", rec->event, rec->id, rec->stamp);
+            if (++col == 8) {
+                printf("\r\n");
+                col = 0;
+            }
+            else {
+                printf(" ");
+            }
+        }
+        idx = RING_NEXT(idx, SCHEDULER_TRACE_SIZE);
+    }
+    if (col != 0) {
+        printf("\r\n");
+    }
+    printf("trace end\r\n");
+    trace_paused = false;
+}
+
+#define TRACE(event, task)  trace_put(event, task)
+#else
+#define TRACE(event, task)  do {} while (0)
+#endif
+
+#if SCHEDULER_LOAD
+#define LOAD_COUNTS_PER_MS      (RTC_PORT_TIMER_HZ / 1000UL)    // TCA0 counts
+#define LOAD_MAX_COUNTED_MS     256     // beyond this the TCA0 count may have wrapped, use the scheduler time
+#define LOAD_WINDOW             1000    // ms per load sample
+#define LOAD_EXP_10S            927     // 1024 * exp(-1/10), weight of the old 10s average at every sample
+#define LOAD_EXP_60S            1007    // 1024 * exp(-1/60)
+
+// The time not spent in the callbacks or the scheduler interrupts is idle: the
+//     empty passes of the main loop, sleeping, and the other interrupts
+//     unless they hit a callback
+static volatile uint32_t  load_isr = 0;     // TCA0 counts spent in the scheduler interrupts
+static uint32_t           load_tasks = 0;   // TCA0 counts spent in the callbacks, interrupts excluded
+static ticks              load_time = 0;    // start of the current window
+static uint32_t           load_avg10 = 0;   // per mille << 10
+static uint32_t           load_avg60 = 0;
+static strSchedulerLoad_t load_last;
+
+#define LOAD_ISR_ENTER()    uint16_t load_start = rtc_port_timer_count()
+#define LOAD_ISR_EXIT()     load_isr += (uint16_t)(rtc_port_timer_count() - load_start)
+
+static uint32_t load_isr_read(void)
+{
+    uint32_t counts;
+
+    ENTER_CRITICAL(L);
+    counts = load_isr;
+    EXIT_CRITICAL(L);
+    return counts;
+}
+
+// Adds the time a callback took, less the interrupts that came in meanwhile
+static void load_account(ticks start_time, uint16_t start_count, uint32_t start_isr)
+{
+    ticks    ms = scheduler_now() - start_time;
+    uint32_t counts;
+    uint32_t isr = load_isr_read() - start_isr;
+
+    if (ms < LOAD_MAX_COUNTED_MS) {
+        counts = (uint16_t)(tca_count() - start_count);
+    }
+    else {
+        counts = ms * LOAD_COUNTS_PER_MS;
+    }
+    if (counts > isr) {
+        load_tasks += counts - isr;
+    }
+}
+
+// Per mille of total, saturated
+static uint16_t load_permille(uint32_t counts, uint32_t total)
+{
+    counts /= total / 1000;
+    return (counts > 1000) ? 1000 : (uint16_t)counts;
+}
+
+// Closes the window once a second has gone by and folds it into the averages,
+//     once per second it lasted (the main loop may have been held up)
+static void load_update(void)
+{
+    ticks    ms = scheduler_now() - load_time;
+    uint32_t total;
+    uint32_t busy;
+    uint16_t seconds;
+
+    if (ms < LOAD_WINDOW) {
+        return;
+    }
+    load_time += ms;
+    total = ms * LOAD_COUNTS_PER_MS;
+    ENTER_CRITICAL(L);
+    load_last.isr = load_permille(load_isr, total);
+    load_isr = 0;
+    EXIT_CRITICAL(L);
+    load_last.tasks = load_permille(load_tasks, total);
+    load_tasks = 0;
+    load_last.load1 = load_last.tasks + load_last.isr;
+    if (load_last.load1 > 1000) {
+        load_last.load1 = 1000;
+    }
+    busy = (uint32_t)load_last.load1 << 10;
+    for (seconds = ms / LOAD_WINDOW; seconds != 0; seconds--) {
+        load_avg10 = (load_avg10 * LOAD_EXP_10S + busy * (1024 - LOAD_EXP_10S)) >> 10;
+        load_avg60 = (load_avg60 * LOAD_EXP_60S + busy * (1024 - LOAD_EXP_60S)) >> 10;
+    }
+    load_last.load10 = (load_avg10 + 512) >> 10;
+    load_last.load60 = (load_avg60 + 512) >> 10;
+}
+
+void scheduler_get_load(strSchedulerLoad_t *load)
+{
+    *load = load_last;
+}
+
+void scheduler_print_load(void)
+{
+    printf("load %u.%u%% (tasks %u.%u%%, isr %u.%u%%) 10s %u.%u%% 60s %u.%u%%\r\n",
+           load_last.load1 / 10, load_last.load1 % 10,
+           load_last.tasks / 10, load_last.tasks % 10,
+           load_last.isr / 10, load_last.isr % 10,
+           load_last.load10 / 10, load_last.load10 % 10,
+           load_last.load60 / 10, load_last.load60 % 10);
+}
+#else
+#define LOAD_ISR_ENTER()
+#define LOAD_ISR_EXIT()
+#endif
+
+#if SCHEDULER_WATCHDOG
+#define TASK_BUDGET(task)   ((ticks)pgm_read_word(&(task)->def->budget))
+#define TASK_DEADLINE(task) ((ticks)pgm_read_word(&(task)->def->deadline))
+#define WATCHDOG_SLEEP_MAX  1000    // ms, the tickless idle wakes up to feed the WDT at least this often
 
-	RTC_INT_DISABLE();              // disable rtc interrupts
+static strTask_t *wd_head = NULL;   // all the critical tasks ever created
+static bool      wd_started = false;
+static ticks     wd_checked;        // time the critical tasks were last checked
+static strTask_t *wd_late = NULL;   // critical task that missed its deadline, the WDT is not fed anymore
+// Task running (or late) when the WDT fired, it survives the reset
+static strTask_t *wd_culprit __attribute__((section(".noinit")));
 
-	strTask_t *pTask = due_head;    // pick the first task due
-//    printf("@%d task:%s!\n", curr_time, pTask->name);
-	due_head = due_head->next;      // and remove it from the list
-    tasks_queue_insert(pTask);       // re-enter it immediately in the task queue
-//    scheduler_print_list();
+void scheduler_watchdog_start(void)
+{
+    char name[TASK_NAME_SIZE];
+
+    if (rtc_port_wdt_fired()) {
+        if (wd_culprit != NULL) {
+            debug_printError("SCHED: watchdog reset, %s was stuck or late", task_name(wd_culprit, name));
+        }
+        else {
+            debug_printError("SCHED: watchdog reset outside of the tasks");
+        }
+    }
+    wd_culprit = NULL;
+    wd_checked = scheduler_now();
+    wd_started = true;
+    rtc_port_wdt_start(SCHEDULER_WATCHDOG_PERIOD);
+}
+
+// A created critical task gets a whole deadline for its first run
+static void watchdog_register(strTask_t *task)
+{
+    if (TASK_DEADLINE(task) == 0) {
+        return;
+    }
+    task->checkin = scheduler_now();
+    if (!task->wd_listed) {
+        task->wd_listed = true;
+        task->wd_next = wd_head;
+        wd_head = task;
+    }
+}
+
+// Around a callback: the task is the culprit if the WDT fires meanwhile
+static void watchdog_enter(strTask_t *task)
+{
+    if (wd_late == NULL) {
+        wd_culprit = task;
+    }
+}
+
+static void watchdog_exit(strTask_t *task, ticks start_time)
+{
+    ticks now = scheduler_now();
+    ticks budget = TASK_BUDGET(task);
+    char  name[TASK_NAME_SIZE];
+
+    if (wd_late == NULL) {
+        wd_culprit = NULL;
+    }
+    task->checkin = now;
+    if (budget == 0) {
+        budget = SCHEDULER_TASK_BUDGET;
+    }
+    if ((ticks)(now - start_time) > budget) {
+        debug_printError("SCHED: %s ran %ums, over its %ums budget", task_name(task, name),
+                         (ticks)(now - start_time), budget);
+    }
+}
+
+// Feeds the WDT, unless a critical task missed its deadline. Called by every
+//     scheduler_next(): a main loop stuck in a callback or a driver does not
+//     feed it either. Once late the device is reset, even if the task runs again
+static void watchdog_service(void)
+{
+    ticks     now = scheduler_now();
+    strTask_t *task;
+    char      name[TASK_NAME_SIZE];
+
+    if (!wd_started || (wd_late != NULL) || (now == wd_checked)) {
+        return;                     // checked already on this tick
+    }
+    wd_checked = now;
+    for (task = wd_head; task != NULL; task = task->wd_next) {
+        if ((task->state != TASK_IDLE) && ((ticks)(now - task->checkin) > TASK_DEADLINE(task))) {
+            wd_late = task;
+            wd_culprit = task;
+            debug_printError("SCHED: %s missed its %ums deadline, resetting", task_name(task, name),
+                             TASK_DEADLINE(task));
+            return;
+        }
+    }
+    rtc_port_wdt_feed();
+}
+#endif
+
+#if SCHEDULER_TIMER_SLACK
+// Keeps in *best the earliest tick from wake on that expires the queued task
+//     other. Its later periods count too: a periodic task is only queued for
+//     its next run but will be back every period
+static void coalesce_check(const strTask_t *other, ticks wake, ticks *best)
+{
+    ticks due = other->due;
+
+    if (!greaterOrEqual(due, wake)
+#if SCHEDULER_LONG_TASKS
+        && (other->laps == 0)
+#endif
+       ) {
+        ticks periods = ((ticks)(wake - other->nominal) + other->period - 1) / other->period;
+        due = other->nominal + periods * other->period;
+    }
+    due = TICK_OF(due);
+    if (greaterOrEqual(due, wake) && !greaterOrEqual(due, *best)) {
+        *best = due;
+    }
+}
+
+// Delays the task to the best tick found if it is within its slack, unless its
+//     own tick already expires another task
+static void coalesce_apply(strTask_t *task, ticks wake, ticks best)
+{
+    if ((best != wake) && greaterOrEqual(task->due + TASK_SLACK(task), best)) {
+        task->due = best;
+    }
+}
+#endif
+
+// Unlinks the task from the task queue (or its wheel slot), O(1). Returns false
+//     if it was not there
+static bool tasks_queue_remove(strTask_t *task)
+{
+    if (task->pprev == NULL) {
+        return false;
+    }
+    *task->pprev = task->next;
+    if (task->next != NULL) {
+        task->next->pprev = task->pprev;
+    }
+    task->pprev = NULL;
+    return true;
+}
+
+// The task queue is walked by the tick, which is held off meanwhile (debug only)
+#if SCHEDULER_TIMING_WHEEL
+void scheduler_print_list(void)
+{
+    uint8_t slot;
+    char    name[TASK_NAME_SIZE];
 
+    RTC_INT_DISABLE();
+    printf("@%d wheel\n", curr_time);
+    for (slot = 0; slot < SCHEDULER_WHEEL_SLOTS; slot++) {
+        strTask_t *pTask = wheel[slot];
+        if (pTask == NULL)
+            continue;
+        printf("[%d] -> ", slot);
+        while (pTask != NULL) {
+            printf("%s:%ld -> ", task_name(pTask, name), (long)pTask->due);
+            pTask = pTask->next;
+        }
+        printf("NULL\n");
+    }
     RTC_INT_ENABLE();
+}
 
-	bool reschedule = pTask->callback(pTask->payload); // execute the task
+// Hashes the task in the slot of its due time, O(1)
+// A task that is already late goes in the slot of the next tick
+void tasks_queue_insert(strTask_t *task)
+{
+    ticks when = task->due;
 
-	// did the task decide to terminate (return 0 / false)
-	if (!reschedule) {
-        scheduler_kill_task(pTask);
+    if (greaterOrEqual(curr_time, when)) {
+        when = curr_time + SCHEDULER_BASE_PERIOD;
+    }
+    strTask_t **slot = &wheel[WHEEL_SLOT(when)];
+
+    task->next = *slot;
+    if (task->next != NULL) {
+        task->next->pprev = &task->next;
+    }
+    *slot = task;
+    task->pprev = slot;
+}
+
+static void tasks_queue_clear(void)
+{
+    uint8_t slot;
+
+    for (slot = 0; slot < SCHEDULER_WHEEL_SLOTS; slot++) {
+        while (wheel[slot] != NULL) {
+            task_drop(wheel[slot]);
+        }
+    }
+}
+
+#if SCHEDULER_TIMER_SLACK
+static void tasks_queue_coalesce(strTask_t *task)
+{
+    ticks   wake = TICK_OF(task->due);
+    ticks   best = task->due + TASK_SLACK(task) + 1;
+    uint8_t slot;
+
+    for (slot = 0; slot < SCHEDULER_WHEEL_SLOTS; slot++) {
+        strTask_t *pTask;
+        for (pTask = wheel[slot]; pTask != NULL; pTask = pTask->next) {
+            coalesce_check(pTask, wake, &best);
+        }
+    }
+    coalesce_apply(task, wake, best);
+}
+#endif
+
+#if SCHEDULER_TICKLESS
+// Returns the due time of the first task expiring within one wheel turn,
+//     or the end of the turn when all the tasks are further away
+static bool tasks_queue_earliest(ticks *due)
+{
+    ticks   when = curr_time;
+    uint8_t i;
+
+    for (i = 0; i < SCHEDULER_WHEEL_SLOTS; i++) {
+        when += SCHEDULER_BASE_PERIOD;
+        strTask_t *pTask = wheel[WHEEL_SLOT(when)];
+        while (pTask != NULL) {
+            if (greaterOrEqual(when, pTask->due)) {
+                *due = pTask->due;
+                return true;
+            }
+            pTask = pTask->next;
+        }
+    }
+    *due = when;
+    return true;
+}
+#endif
+#else
+void scheduler_print_list(void)
+{
+	strTask_t *pTask;
+    char      name[TASK_NAME_SIZE];
+
+    RTC_INT_DISABLE();
+    pTask = tasks_head;
+    printf("@%d tasks_head -> ", curr_time);
+	while (pTask != NULL) {
+		printf("%s:%ld -> ", task_name(pTask, name), (long)pTask->due);
+		pTask = pTask->next;
 	}
+	printf("NULL\n");
+    RTC_INT_ENABLE();
 }
 
-// This function queues a task with a given period/duration
-// If the task was already active/running it will be replaced by this and the
-//    old (active) task will be removed/cancelled first
-// inputs:
-//   ms         time expressed in ms
-//   return     true if successful, false if period < SCHEDULER_BASE_PERIOD
-bool scheduler_create_task(strTask_t *task, uint16_t ms)
+// Inserts the task in the list, sorted by due time
+void tasks_queue_insert(strTask_t *task)
 {
-    // If this task is already active, replace it
-	scheduler_kill_task(task);
+	strTask_t **link = &tasks_head;
 
-    if ((ms == 0) || (ms > MAX_BASE_PERIOD)){
+	while ((*link != NULL) && !greaterOrEqual((*link)->due, task->due)) {
+		link = &(*link)->next;      // not the spot yet
+	}
+	task->next = *link;
+    if (task->next != NULL) {
+        task->next->pprev = &task->next;
+    }
+	*link = task;
+    task->pprev = link;
+}
+
+static void tasks_queue_clear(void)
+{
+    while (tasks_head != NULL) {
+        task_drop(tasks_head);
+    }
+}
+
+#if SCHEDULER_TIMER_SLACK
+static void tasks_queue_coalesce(strTask_t *task)
+{
+    ticks     wake = TICK_OF(task->due);
+    ticks     best = task->due + TASK_SLACK(task) + 1;
+    strTask_t *pTask;
+
+    // sorted: the tasks due after the best tick found cannot do better
+    for (pTask = tasks_head; (pTask != NULL) && !greaterOrEqual(pTask->due, best); pTask = pTask->next) {
+        coalesce_check(pTask, wake, &best);
+    }
+    coalesce_apply(task, wake, best);
+}
+#endif
+
+#if SCHEDULER_TICKLESS
+// Returns the due time of the first task in the (sorted) queue, false if empty
+static bool tasks_queue_earliest(ticks *due)
+{
+    if (tasks_head == NULL) {
         return false;
     }
-	RTC_INT_DISABLE();         // disable rtc interrupts
+    *due = tasks_head->due;
+    return true;
+}
+#endif
+#endif
 
-    task->period = (ticks)ms;               // store period scaled
-    task->due = curr_time + task->period;   // compute due time
+// Queues the task for its nominal due time, or a little later when its slack
+//     lets it expire on the same tick as another task
+static void task_queue(strTask_t *task, ticks nominal)
+{
+    task->due = nominal;
+#if SCHEDULER_TIMER_SLACK
+    task->nominal = nominal;
+    if ((TASK_SLACK(task) >= SCHEDULER_BASE_PERIOD) && !greaterOrEqual(curr_time, nominal)) {
+        tasks_queue_coalesce(task);
+    }
+#endif
     tasks_queue_insert(task);
-    RTC_INT_ENABLE();
-    return true;    // successful creation
 }
 
-ISR(RTC_PIT_vect)
+// Applies the requests queued by the main loop. Runs in the tick, or in the
+//     main loop when interrupts are disabled and the tick cannot run
+static void commands_apply(void)
 {
-    curr_time += SCHEDULER_BASE_PERIOD;    // forever advancing and wrapping around
-    // activate tasks that are due (move to due list))
-    while( (tasks_head)  &&
-            greaterOrEqual(curr_time, tasks_head->due) ) {
-        tasks_head->due += tasks_head->period;    // update immediately the due time
-        strTask_t * pNext = tasks_head->next;     // save next temporarily
-        tasks_head->next = due_head;         // insert at head of due
-        due_head = tasks_head;
-        tasks_head = pNext;             // remove task from scheduler queue
+    uint8_t tail = cmd_tail;
+
+    while (tail != cmd_head) {
+        RING_BARRIER();
+        strCommand_t *cmd  = &cmd_ring[tail];
+        strTask_t    *task = cmd->task;
+
+        switch (cmd->op) {
+            case CMD_CREATE:
+                tasks_queue_remove(task);   // replaces the task if it was active
+                task->qgen   = cmd->gen;
+                task->period = cmd->period;
+#if SCHEDULER_LONG_TASKS
+                task->laps = task->laps_left = cmd->laps;
+#endif
+                task_queue(task, cmd->due);
+                break;
+            case CMD_KILL:
+                tasks_queue_remove(task);
+                break;
+            case CMD_KILL_ALL:
+                tasks_queue_clear();
+                break;
+            default:
+                break;
         }
+        RING_BARRIER();
+        tail = RING_NEXT(tail, SCHEDULER_COMMAND_RING);
+        cmd_tail = tail;
+    }
+}
+
+// Busy wait step of the main loop while it needs the tick to consume commands
+static void commands_wait(void)
+{
+    if (!rtc_port_irq_enabled()) {
+        commands_apply();           // the tick cannot run, do its job
+    }
+    else {
+        rtc_port_spin();
+    }
+}
+
+// Queues a request for the tick, waits for room if the ring is full
+static void command_post(const strCommand_t *cmd)
+{
+    uint8_t head = cmd_head;
+    uint8_t next = RING_NEXT(head, SCHEDULER_COMMAND_RING);
+
+    while (next == cmd_tail) {
+        commands_wait();
+    }
+    cmd_ring[head] = *cmd;
+    RING_BARRIER();
+    cmd_head = next;
+}
+
+// Hands an expired task over to scheduler_next(), false if the ring is full
+static bool expired_push(strTask_t *task, uint8_t gen, ticks due)
+{
+    uint8_t head = expired_head;
+    uint8_t next = RING_NEXT(head, SCHEDULER_EXPIRED_RING);
+
+    if (next == expired_tail) {
+        return false;
+    }
+    expired_ring[head].task = task;
+    expired_ring[head].gen  = gen;
+    expired_ring[head].due  = due;
+    RING_BARRIER();
+    expired_head = next;
+    return true;
+}
+
+#if SCHEDULER_HIRES_TIMERS
+// Converts us to TCA0 counts rounded up: us * HZ / 1e6 with 1e6 = 15625 * 4096 / 64
+#define HIRES_COUNTS_PER_15625  (RTC_PORT_TIMER_HZ * 64 / 15625UL)
+#define HIRES_US_TO_COUNT(us)   ((uint16_t)(((uint32_t)(us) * HIRES_COUNTS_PER_15625 + 4095) / 4096))
+#define HIRES_RETRY_US          1000    // the expired ring was full, try again after that
+#define HIRES_DELAY_MAX_US      50000U  // longest wait per compare, well within half the TCA0 turn
+
+#if (HIRES_COUNTS_PER_15625 * UINT16_MAX / 4096) > INT16_MAX
+#error "SCHEDULER_HIRES_TIMERS: UINT16_MAX us do not fit in half a TCA0 turn at this RTC_PORT_TIMER_HZ"
+#endif
+
+// Tasks waiting for TCA0 to reach their hires_due, soonest first. Shared with
+//     the TCA0 compare interrupt, the main loop masks interrupts to use it
+static strTask_t *hires_head = NULL;
+
+// Hands the high resolution tasks that are due over to scheduler_next() and
+//     programs the compare for the next one. Interrupts must be masked
+static void hires_service(void)
+{
+    while (hires_head != NULL) {
+        strTask_t *task = hires_head;
+
+        if (!greaterOrEqual(rtc_port_timer_count(), task->hires_due)) {
+            rtc_port_cmp0_set(task->hires_due);
+            if (!greaterOrEqual(rtc_port_timer_count(), task->hires_due)) {
+                rtc_port_cmp0_enable();
+                return;                 // the compare will fire
+            }
+            continue;                   // it went by while being programmed
+        }
+        if (!expired_push(task, task->gen, curr_time)) {
+            rtc_port_cmp0_set(rtc_port_timer_count() + HIRES_US_TO_COUNT(HIRES_RETRY_US));
+            rtc_port_cmp0_enable();
+            return;
+        }
+        TRACE(TRACE_DUE, task);
+        hires_head = task->hires_next;
+    }
+    rtc_port_cmp0_disable();
+}
+
+// Takes the task out of the high resolution list, the compare may then fire
+//     for nothing which does no harm
+static void hires_cancel(strTask_t *task)
+{
+    strTask_t **link = &hires_head;
+
+    ENTER_CRITICAL(H);
+    while ((*link != NULL) && (*link != task)) {
+        link = &(*link)->hires_next;
+    }
+    if (*link != NULL) {
+        *link = task->hires_next;
+    }
+    EXIT_CRITICAL(H);
+    task->hires = false;
+}
+
+// Queues the task to expire in us
+static void hires_arm(strTask_t *task, uint16_t us)
+{
+    strTask_t **link = &hires_head;
+
+    hires_cancel(task);
+    task->hires = true;
+    ENTER_CRITICAL(H);
+    task->hires_due = rtc_port_timer_count() + HIRES_US_TO_COUNT(us) + 1;  // +1: the current count already began
+    while ((*link != NULL) && greaterOrEqual(task->hires_due, (*link)->hires_due)) {
+        link = &(*link)->hires_next;
+    }
+    task->hires_next = *link;
+    *link = task;
+    hires_service();
+    EXIT_CRITICAL(H);
+}
+#endif
+
+// Deletes a task from the due queue of its priority, O(1)
+static void due_queue_delete(strTask_t *task)
+{
+    uint8_t prio = task_priority(task);
+
+    if (task->due_prev == NULL) {
+        due_head[prio] = task->due_next;
+    }
+    else {
+        task->due_prev->due_next = task->due_next;
+    }
+    if (task->due_next == NULL) {
+        due_tail[prio] = task->due_prev;
+    }
+    else {
+        task->due_next->due_prev = task->due_prev;
+    }
+    if (due_head[prio] == NULL) {
+        due_ready &= ~(1 << prio);
+    }
+}
+
+// Appends a task at the end of the due queue of its priority
+static void due_queue_append(strTask_t *task)
+{
+    uint8_t prio = task_priority(task);
+
+    task->due_next = NULL;
+    task->due_prev = due_tail[prio];
+    if (due_head[prio] == NULL) {
+        due_head[prio] = task;
+    }
+    else {
+        due_tail[prio]->due_next = task;
+    }
+    due_tail[prio] = task;
+    due_ready |= (1 << prio);
+    task->state = TASK_DUE;
+}
+
+// Moves the tasks handed over by the tick and the ISRs to the due queues, in
+//     order of expiry. Stale expiries are dropped and a task still waiting
+//     from its previous expiry is not queued twice
+static void expired_drain(void)
+{
+    uint8_t tail = expired_tail;
+
+    while (tail != expired_head) {
+        RING_BARRIER();
+        strExpired_t *entry = &expired_ring[tail];
+        strTask_t    *task  = entry->task;
+
+        task->signaled = false;     // further signals need another run
+        if ((entry->gen == task->gen) && (task->state == TASK_QUEUED)) {
+#if SCHEDULER_PROFILING
+            task->released = entry->due;
+#endif
+            due_queue_append(task);
+        }
+        RING_BARRIER();
+        tail = RING_NEXT(tail, SCHEDULER_EXPIRED_RING);
+        expired_tail = tail;
+    }
+}
+
+// True if the tick may hold the task in its queue, it never gets the high
+//     resolution tasks
+static bool task_ticked(const strTask_t *task)
+{
+#if SCHEDULER_HIRES_TIMERS
+    return !task->hires;
+#else
+    return true;
+#endif
+}
+
+// Makes whatever the tick already handed over for this task stale and
+//     removes it from the due queues
+static void task_release(strTask_t *task)
+{
+    task->gen++;
+#if SCHEDULER_HIRES_TIMERS
+    if (task->hires) {
+        hires_cancel(task);
+    }
+#endif
+    if (task->state == TASK_DUE) {
+        due_queue_delete(task);
+        task->state = TASK_QUEUED;
+    }
+}
+
+// Cancel and remove all active tasks
+void scheduler_kill_all(void)
+{
+    strCommand_t cmd = { .op = CMD_KILL_ALL };
+    uint8_t      prio;
+
+    command_post(&cmd);
+    while (cmd_tail != cmd_head) {  // once applied nothing can expire anymore
+        commands_wait();
+    }
+#if SCHEDULER_HIRES_TIMERS
+    for (;;) {                      // the high resolution tasks are in no task queue
+        ENTER_CRITICAL(H);
+        strTask_t *task = hires_head;
+        EXIT_CRITICAL(H);
+        if (task == NULL) {
+            break;
+        }
+        scheduler_kill_task(task);
+    }
+#endif
+    while (expired_tail != expired_head) {  // and what expired in the meantime
+        scheduler_kill_task(expired_ring[expired_tail].task);
+        expired_tail = RING_NEXT(expired_tail, SCHEDULER_EXPIRED_RING);
+    }
+#if SCHEDULER_REQUEST_RING
+    request_tail = request_head;    // drop what the ISRs asked for before
+#endif
+
+    for (prio = 0; prio < SCHEDULER_PRIORITIES; prio++) {
+        while (due_head[prio] != NULL) {
+            scheduler_kill_task(due_head[prio]);
+        }
+    }
+}
+
+// This will cancel/remove a running task. If the task is already due it will
+//     also remove it from the callback queue
+void scheduler_kill_task(strTask_t *task)
+{
+    bool ticked = task_ticked(task);
+
+    task_release(task);
+    if (task->state != TASK_IDLE) {
+        strCommand_t cmd = { .task = task, .op = CMD_KILL };
+
+        task->state = TASK_IDLE;
+        TRACE(TRACE_KILL, task);
+        if (ticked) {
+            command_post(&cmd);
+        }
+    }
+}
+
+// Called by the tick for a task that just left the task queue because its due
+//     time was reached. The task goes back in the queue for its next period
+//     right away and the expiry is handed over to scheduler_next(). Returns
+//     false if the expired ring is full: the task then stays late and expires
+//     again on the next tick
+static bool task_expired(strTask_t *pTask)
+{
+    ticks nominal;
+
+#if SCHEDULER_LONG_TASKS
+    if (pTask->laps_left) {             // a long task, still some laps to go
+        pTask->laps_left--;
+        task_queue(pTask, TASK_NOMINAL(pTask) + SCHEDULER_LAP);
+        return true;
+    }
+#endif
+    if (!expired_push(pTask, pTask->qgen, pTask->due)) {
+        tasks_queue_insert(pTask);
+        return false;
+    }
+    TRACE(TRACE_DUE, pTask);
+#if SCHEDULER_LONG_TASKS
+    pTask->laps_left = pTask->laps;
+#endif
+    nominal = TASK_NOMINAL(pTask) + pTask->period;
+#if !SCHEDULER_TIMING_WHEEL
+    // Late by whole periods (the main loop was stuck): queued at the head again
+    //     it would be handed over once per missed period on this very tick,
+    //     filling the ring for scheduler_next() to drop all but one. Skip
+    //     them, the phase is kept. The wheel puts it on the next tick instead
+    if (greaterOrEqual(curr_time, nominal)
+#if SCHEDULER_LONG_TASKS
+        && (pTask->laps == 0)
+#endif
+       ) {
+        nominal += ((ticks)(curr_time - nominal) / pTask->period + 1) * pTask->period;
+    }
+#endif
+    task_queue(pTask, nominal);         // update immediately the due time
+    return true;
+}
+
+// Advances the time by one tick, applies the pending requests and hands the
+//     tasks that expire over to scheduler_next()
+static void scheduler_tick(void)
+{
+    commands_apply();               // first, they were posted before this tick
+    curr_time += SCHEDULER_BASE_PERIOD;    // forever advancing and wrapping around
+#if SCHEDULER_LONG_TASKS
+    if (curr_time < SCHEDULER_BASE_PERIOD) {
+        curr_epoch++;
+    }
+#endif
+#if SCHEDULER_TIMING_WHEEL
+    // only the current slot can hold tasks that are due now, the others
+    // found here are one or more wheel turns away
+    strTask_t *pTask = wheel[WHEEL_SLOT(curr_time)];
+    while (pTask != NULL) {
+        strTask_t *pNext = pTask->next;
+        if (greaterOrEqual(curr_time, pTask->due)) {
+            tasks_queue_remove(pTask);
+            task_expired(pTask);        // when held back it moves to the next slot
+        }
+        pTask = pNext;
+    }
+#else
+    // hand over the tasks that are due, stop if the ring is full
+    while( (tasks_head)  &&
+            greaterOrEqual(curr_time, tasks_head->due) ) {
+        strTask_t * pTask = tasks_head;
+        tasks_queue_remove(pTask);      // remove task from scheduler queue
+        if (!task_expired(pTask)) {
+            break;
+        }
+    }
+#endif
+}
+
+#if SCHEDULER_CLOCK_DISCIPLINE
+// Advances the time by one tick, or by none or two when the correction for
+//     the error of the RTC oscillator adds up to a whole tick
+static void clock_tick(void)
+{
+    clock_frac += clock_adjust;
+    if (clock_frac <= -CLOCK_FRAC_TICK) {   // the oscillator is fast, drop this one
+        clock_frac += CLOCK_FRAC_TICK;
+        return;
+    }
+    scheduler_tick();
+    if (clock_frac >= CLOCK_FRAC_TICK) {    // it is slow, catch up
+        clock_frac -= CLOCK_FRAC_TICK;
+        scheduler_tick();
+    }
+}
+#define SCHEDULER_TICK()    clock_tick()
+
+#if SCHEDULER_TICKLESS
+// RTC counts the oscillator takes for ms of corrected scheduler time, within a
+//     count and rather less: ms * (1 + ppm) instead of ms / (1 - ppm)
+static ticks clock_counts(ticks ms)
+{
+    return ms + (int32_t)(ms / 1000) * clock_ppm / 1000 + (int32_t)(ms % 1000) * clock_ppm / 1000000L;
+}
+#define SCHEDULER_COUNTS(ms)    clock_counts(ms)
+#endif
+#else
+#define SCHEDULER_TICK()    scheduler_tick()
+#define SCHEDULER_COUNTS(ms)    (ms)
+#endif
+
+#if SCHEDULER_TICKLESS
+#define SCHEDULER_MIN_SLEEP     (2 * SCHEDULER_BASE_PERIOD)     // not worth stopping the tick for less
+
+// RTC count, modulo 8, on which the PIT fires. The PIT and the counter share
+//     the RTC clock but nothing ties the PIT periods to the multiples of 8 of
+//     the count, so the tick reads it: its interrupt runs well within the 1ms
+//     of the count it fired on
+static volatile uint8_t pit_phase = 0;
+
+// Stops the periodic tick and sleeps until the next task is due (or any other
+//     interrupt wakes us up), then accounts for the ticks that were skipped.
+// The RTC counter runs from the same 1kHz clock as the PIT, so one count is
+//     taken as 1ms exactly like the PIT period is taken as 8ms.
+static void scheduler_idle(void)
+{
+    ticks    due;
+    ticks    sleep_time = MAX_BASE_PERIOD;
+    uint16_t start;
+    uint16_t end;
+    uint16_t elapsed;
+
+    rtc_port_irq_disable();
+    commands_apply();                   // the queue must be up to date to find the next task
+    if (expired_tail != expired_head) { // a task expired in the meantime
+        rtc_port_irq_enable();
+        return;
+    }
+#if SCHEDULER_REQUEST_RING
+    if (request_tail != request_head) { // or an ISR has a request
+        rtc_port_irq_enable();
+        return;
+    }
+#endif
+    if (tasks_queue_earliest(&due)) {
+        if (greaterOrEqual(curr_time + SCHEDULER_MIN_SLEEP, due)) {
+            rtc_port_irq_enable();           // next task is too close, keep ticking
+            return;
+        }
+        sleep_time = due - curr_time;
+    }
+#if SCHEDULER_WATCHDOG
+    if (wd_started && (sleep_time > WATCHDOG_SLEEP_MAX)) {
+        sleep_time = WATCHDOG_SLEEP_MAX;    // the WDT keeps running
+    }
+#endif
+
+    start = rtc_port_wake_count();
+    rtc_port_wake_at(start + SCHEDULER_COUNTS(sleep_time));
+    RTC_INT_DISABLE();                  // stop the periodic tick
+
+    rtc_port_sleep();                   // wakes up with interrupts enabled
+
+    rtc_port_irq_disable();
+    rtc_port_wake_cancel();
+    RTC_INT_CLEAR();
+    // the PIT fires on every 8th RTC clock, on the counts equal to pit_phase
+    //     modulo 8: count the periods we slept through
+    end = rtc_port_wake_count();
+    elapsed = (((uint16_t)(end - pit_phase) >> 3) - ((uint16_t)(start - pit_phase) >> 3)) & (0xFFFF >> 3);
+    while (elapsed--) {
+        SCHEDULER_TICK();
+    }
+    RTC_INT_ENABLE();
+    rtc_port_irq_enable();
+}
+
+RTC_PORT_WAKE_ISR()
+{
+    rtc_port_wake_clear();              // only used to wake up from sleep
+}
+#endif
+
+// Common part of the create functions, returns true if the task was active
+static bool task_activate(strTask_t *task)
+{
+    bool was_active = (task->state != TASK_IDLE);
+
+    task_release(task);
+#if SCHEDULER_PROFILING
+    profile_register(task);
+#endif
+#if SCHEDULER_TRACE
+    trace_register(task);
+#endif
+#if SCHEDULER_WATCHDOG
+    watchdog_register(task);
+#endif
+    TRACE(TRACE_CREATE, task);
+    if (task->state != TASK_RUNNING) {
+        task->state = TASK_QUEUED;  // a running task gets there when its callback returns
+    }
+    task->interval = 0;
+    return was_active;
+}
+
+// Forgets the coroutine position and the wall-clock schedule of a task that
+//     is being created
+static void task_reset(strTask_t *task)
+{
+    task->resume = 0;
+#if SCHEDULER_WALL_CLOCK
+    task->wall = false;
+#endif
+}
+
+// Asks the tick to (re)start the task, the due time is taken from now
+static void task_start(strTask_t *task, ticks period, uint16_t laps)
+{
+    strCommand_t cmd;
+
+    task_activate(task);            // the tick replaces the old instance
+    if (laps == 0) {
+        task->interval = period;
+    }
+    cmd.task   = task;
+    cmd.op     = CMD_CREATE;
+    cmd.gen    = task->gen;
+    cmd.due    = scheduler_now() + period;
+    cmd.period = period;
+#if SCHEDULER_LONG_TASKS
+    cmd.laps   = laps;
+#endif
+    command_post(&cmd);
+}
+
+// This function checks the list of due tasks and calls the first one in the
+//    list if the list is not empty. The tick already put the task back in the
+//    task queue for its next period.
+// It must be called from the main superloop (while(1)) in your code, it is the
+//    only consumer of the tasks handed over by the tick interrupt.
+void scheduler_next(void)
+{
+#if SCHEDULER_LOAD
+    load_update();
+#endif
+#if SCHEDULER_WATCHDOG
+    watchdog_service();
+#endif
+#if SCHEDULER_REQUEST_RING
+    requests_drain();               // first, a kill makes the expiries of the task stale
+#endif
+    expired_drain();
+	if (due_ready == 0) {
+#if SCHEDULER_TICKLESS
+        scheduler_idle();
+#endif
+		return;
+    }
+
+    uint8_t prio = SCHEDULER_PRIORITIES - 1;
+    while (!(due_ready & (1 << prio))) {
+        prio--;                     // find the highest priority with a task due
+    }
+	strTask_t *pTask = due_head[prio];  // pick the first task due
+	due_queue_delete(pTask);            // and remove it from the list
+    pTask->state = TASK_RUNNING;
+
+#if SCHEDULER_PROFILING || SCHEDULER_LOAD || SCHEDULER_WATCHDOG
+    ticks    start_time = scheduler_now();
+#endif
+#if SCHEDULER_PROFILING || SCHEDULER_LOAD
+    uint16_t start_count = tca_count();
+#endif
+#if SCHEDULER_LOAD
+    uint32_t start_isr = load_isr_read();
+#endif
+#if SCHEDULER_PROFILING
+    profile_start(pTask);
+#endif
+#if SCHEDULER_WATCHDOG
+    watchdog_enter(pTask);
+#endif
+    uint8_t gen = pTask->gen;
+    TRACE(TRACE_START, pTask);
+	ticks next_run = TASK_CALLBACK(pTask)(TASK_PAYLOAD(pTask)); // execute the task
+    TRACE(TRACE_END, pTask);
+#if SCHEDULER_WATCHDOG
+    watchdog_exit(pTask, start_time);
+#endif
+    if (pTask->state == TASK_RUNNING) {
+        pTask->state = TASK_QUEUED;
+    }
+#if SCHEDULER_PROFILING
+    profile_end(pTask, start_time, start_count);
+#endif
+#if SCHEDULER_LOAD
+    load_account(start_time, start_count, start_isr);
+#endif
+
+	// did the task decide to terminate (return 0 / false)
+	if (!next_run) {
+        scheduler_kill_task(pTask);
+        return;
+	}
+    if (gen != pTask->gen) {
+        return;                     // it was re-created meanwhile
+    }
+#if SCHEDULER_HIRES_TIMERS
+    if (pTask->hires) {
+        hires_arm(pTask, next_run);     // us until the next run
+        return;
+    }
+#endif
+#if SCHEDULER_WALL_CLOCK
+    if (pTask->wall) {
+        if (pTask->wall_period != 0) {
+            wall_arm(pTask);        // aligned again on the wall-clock for every run
+        }
+        else {
+            scheduler_kill_task(pTask);     // absolute time tasks run once
+        }
+        return;
+    }
+#endif
+    // or to run at another time
+    if ((pTask->interval != 0) && (next_run != pTask->interval)) {
+        if (next_run > MAX_BASE_PERIOD) {
+            next_run = MAX_BASE_PERIOD;
+        }
+        task_start(pTask, next_run, 0);
+    }
+}
+
+// This function queues a task with a given period/duration
+// If the task was already active/running it will be replaced by this and the
+//    old (active) task will be removed/cancelled first
+// inputs:
+//   ms         time expressed in ms
+//   return     true if successful, false if period < SCHEDULER_BASE_PERIOD
+bool scheduler_create_task(strTask_t *task, uint16_t ms)
+{
+    if ((ms == 0) || (ms > MAX_BASE_PERIOD)){
+        scheduler_kill_task(task);
+        return false;
+    }
+    task_reset(task);
+    task_start(task, (ticks)ms, 0);
+    return true;    // successful creation
+}
+
+// Creates the task with the period it was declared with
+bool scheduler_start_task(strTask_t *task)
+{
+    return scheduler_create_task(task, pgm_read_word(&task->def->period));
+}
+
+// Restarts the task without starting a coroutine over. The tick moves it in the
+//     task queue with a single command, O(1) with the timing wheel
+bool scheduler_reschedule(strTask_t *task, uint16_t ms)
+{
+    if ((ms == 0) || (ms > MAX_BASE_PERIOD)){
+        scheduler_kill_task(task);
+        return false;
+    }
+#if SCHEDULER_WALL_CLOCK
+    task->wall = false;
+#endif
+    task_start(task, (ticks)ms, 0);
+    return true;
+}
+
+bool scheduler_is_task_active(const strTask_t *task)
+{
+    return (task->state != TASK_IDLE);
+}
+
+// Activates a task that does not go in the task queue of the tick
+static void task_activate_unqueued(strTask_t *task)
+{
+    bool ticked = task_ticked(task);
+
+    if (task_activate(task) && ticked) {
+        strCommand_t cmd = { .task = task, .op = CMD_KILL };
+
+        command_post(&cmd);         // drop its period if it had one
+    }
+}
+
+// Creates a task without a period, it only runs when signaled
+bool scheduler_create_signal_task(strTask_t *task)
+{
+    task_reset(task);
+    task_activate_unqueued(task);
+    return true;
+}
+
+// Moves the task to the due queue right away, without waiting for a tick.
+//     Safe to call from interrupts, that is what it is meant for
+bool scheduler_signal(strTask_t *task)
+{
+    bool ret_val = true;
+
+    ENTER_CRITICAL(S);              // from the main loop the ISRs must be held off
+    if (task->state == TASK_IDLE) {
+        ret_val = false;
+    }
+    else if (!task->signaled) {
+        task->signaled = true;
+        if (!expired_push(task, task->gen, curr_time)) {
+            task->signaled = false;
+            ret_val = false;
+        }
+        else {
+            TRACE(TRACE_SIGNAL, task);
+        }
+    }
+    EXIT_CRITICAL(S);
+    return ret_val;
+}
+
+#if SCHEDULER_REQUEST_RING
+// Queues a request of an ISR for scheduler_next(), false if the ring is full
+static bool request_post(strTask_t *task, uint8_t op, uint16_t ms)
+{
+    bool ret_val = false;
+
+    ENTER_CRITICAL(R);              // in case it is called from the main loop too
+    uint8_t head = request_head;
+    uint8_t next = RING_NEXT(head, SCHEDULER_REQUEST_RING);
+
+    if (next != request_tail) {
+        request_ring[head].task = task;
+        request_ring[head].op   = op;
+        request_ring[head].ms   = ms;
+        RING_BARRIER();
+        request_head = next;
+        ret_val = true;
+    }
+    EXIT_CRITICAL(R);
+    return ret_val;
+}
+
+// Replays the requests of the ISRs in the order they came, the delays count
+//     from now
+static void requests_drain(void)
+{
+    uint8_t tail = request_tail;
+
+    while (tail != request_head) {
+        RING_BARRIER();
+        strRequest_t *req = &request_ring[tail];
+
+        switch (req->op) {
+            case REQ_CREATE:
+                scheduler_create_task(req->task, req->ms);
+                break;
+            case REQ_KILL:
+                scheduler_kill_task(req->task);
+                break;
+            case REQ_RESCHEDULE:
+                scheduler_reschedule(req->task, req->ms);
+                break;
+            default:
+                break;
+        }
+        RING_BARRIER();
+        tail = RING_NEXT(tail, SCHEDULER_REQUEST_RING);
+        request_tail = tail;
+    }
+}
+
+bool scheduler_create_task_from_isr(strTask_t *task, uint16_t ms)
+{
+    if ((ms == 0) || (ms > MAX_BASE_PERIOD)) {
+        scheduler_kill_task_from_isr(task);
+        return false;
+    }
+    return request_post(task, REQ_CREATE, ms);
+}
+
+bool scheduler_kill_task_from_isr(strTask_t *task)
+{
+    return request_post(task, REQ_KILL, 0);
+}
+
+bool scheduler_reschedule_from_isr(strTask_t *task, uint16_t ms)
+{
+    if ((ms == 0) || (ms > MAX_BASE_PERIOD)) {
+        scheduler_kill_task_from_isr(task);
+        return false;
+    }
+    return request_post(task, REQ_RESCHEDULE, ms);
+}
+#endif
+
+#if SCHEDULER_HIRES_TIMERS
+bool scheduler_create_hires_task(strTask_t *task, uint16_t us)
+{
+    if (us == 0) {
+        scheduler_kill_task(task);
+        return false;
+    }
+    task_reset(task);
+    task_activate_unqueued(task);
+    hires_arm(task, us);
+    return true;
+}
+
+// Waits up to HIRES_DELAY_MAX_US on the TCA0 compare channel 1, the other
+//     one belongs to the high resolution tasks
+static void hires_delay(uint16_t us)
+{
+    bool     can_sleep = rtc_port_irq_enabled();
+    uint16_t end;
+
+    ENTER_CRITICAL(D);
+    end = rtc_port_timer_count() + HIRES_US_TO_COUNT(us) + 1;
+    if (can_sleep) {
+        rtc_port_cmp1_set(end);             // wakes the CPU up when the time is up
+        rtc_port_cmp1_enable();
+    }
+    EXIT_CRITICAL(D);
+    if (!can_sleep) {
+        while (!greaterOrEqual(rtc_port_timer_count(), end)) {
+            rtc_port_spin();
+        }
+        return;
+    }
+#if SCHEDULER_TICKLESS
+    rtc_port_sleep_mode(RTC_PORT_SLEEP_IDLE);   // TCA0 stops in standby
+#endif
+    while (1) {
+        rtc_port_irq_disable();
+        if (greaterOrEqual(rtc_port_timer_count(), end)) {
+            break;
+        }
+        rtc_port_sleep();                   // enables the interrupts before sleeping
+    }
+    rtc_port_cmp1_disable();
+    rtc_port_irq_enable();
+#if SCHEDULER_TICKLESS
+    rtc_port_sleep_mode(SCHEDULER_SLEEP_MODE);
+#endif
+}
+
+void scheduler_delay_us(uint32_t us)
+{
+    while (us > HIRES_DELAY_MAX_US) {
+        hires_delay(HIRES_DELAY_MAX_US);
+        us -= HIRES_DELAY_MAX_US;
+    }
+    if (us != 0) {
+        hires_delay((uint16_t)us);
+    }
+}
+
+RTC_PORT_CMP0_ISR()
+{
+    LOAD_ISR_ENTER();
+    rtc_port_cmp0_clear();
+    hires_service();
+    LOAD_ISR_EXIT();
+}
+
+RTC_PORT_CMP1_ISR()
+{
+    rtc_port_cmp1_clear();              // only used to wake up from hires_delay()
+}
+#endif
+
+#if SCHEDULER_LONG_TASKS
+// Starts the task for any period up to SCHEDULER_MAX_LONG_PERIOD
+// The remainder is waited for first, then the laps are counted down by the tick
+static void task_arm(strTask_t *task, uint32_t ms)
+{
+    uint16_t laps = 0;
+
+    if (ms > MAX_BASE_PERIOD) {
+        laps = (ms - 1) / SCHEDULER_LAP;    // leaves 1..SCHEDULER_LAP ms
+    }
+    task_start(task, (ticks)(ms - laps * SCHEDULER_LAP), laps);
+    task->interval = 0;             // keeps its schedule whatever the callback returns
+}
+
+// Same as scheduler_create_task() for periods up to SCHEDULER_MAX_LONG_PERIOD
+bool scheduler_create_long_task(strTask_t *task, uint32_t ms)
+{
+    if ((ms == 0) || (ms > SCHEDULER_MAX_LONG_PERIOD)) {
+        scheduler_kill_task(task);
+        return false;
+    }
+    task_reset(task);
+    task_arm(task, ms);
+    return true;
+}
+
+uint32_t scheduler_get_time(void)
+{
+    uint16_t epoch;
+    ticks    now;
+
+    do {                            // read again if a tick slipped in between
+        epoch = curr_epoch;
+        now = curr_time;
+    } while ((epoch != curr_epoch) || (now != curr_time));
+    return ((uint32_t)epoch << 16) | now;
+}
+#endif
+
+#if SCHEDULER_WALL_CLOCK
+// Arms a wall-clock task for its next run, counted from the latest scheduler
+//     time at which wall_sec may have begun so it never runs a bit too early
+static void wall_arm(strTask_t *task)
+{
+    uint32_t now = scheduler_get_time();
+    uint32_t boundary = wall_hi;
+    uint32_t delay = 1;
+    int32_t  into;
+    time_t   sec_now;
+    time_t   sec;
+
+    if (!wall_known) {
+        if (task->wall_period != 0) {       // free running until the clock is set
+            task_arm(task, task->wall_period * 1000UL);
+        }
+        return;
+    }
+    into = (int32_t)(now - boundary);      // the boundary can be up to a tick ahead
+    sec_now = wall_sec + ((into < 0) ? -1 : into / 1000);
+    if (task->wall_period != 0) {
+        sec = (sec_now / task->wall_period + 1) * task->wall_period;
+        if ((int32_t)(sec - task->wall_due) <= 0) {
+            sec = task->wall_due + task->wall_period;   // never twice for the same second
+        }
+        task->wall_due = sec;
+    }
+    else {
+        sec = task->wall_due;
+    }
+    if ((int32_t)(sec - sec_now) > 0) {
+        delay = boundary + (uint32_t)(sec - wall_sec) * 1000UL - now;
+        if (delay > SCHEDULER_MAX_LONG_PERIOD) {
+            delay = SCHEDULER_MAX_LONG_PERIOD;
+        }
+    }
+    task_arm(task, delay);
+}
+
+// Arms all the wall-clock tasks again, after the clock was set
+static void wall_realign(void)
+{
+    strTask_t *pTask;
+
+    for (pTask = wall_head; pTask != NULL; pTask = pTask->wall_next) {
+        if (pTask->wall && (pTask->state != TASK_IDLE)) {
+            if (pTask->wall_period != 0) {
+                pTask->wall_due = 0;
+            }
+            wall_arm(pTask);
+        }
+    }
+}
+
+static void wall_register(strTask_t *task, uint16_t period_s, time_t when)
+{
+    if (!task->wall_listed) {
+        task->wall_listed = true;
+        task->wall_next = wall_head;
+        wall_head = task;
+    }
+    task_reset(task);
+    task->wall = true;
+    task->wall_period = period_s;
+    task->wall_due = when;
+    wall_arm(task);
+}
+
+#if SCHEDULER_CLOCK_DISCIPLINE
+// Keeps time() on the wall-clock seconds between two network time queries
+static ticks clock_task(void *payload);
+SCHEDULER_STATIC_TASK(clock_timer, .callback = clock_task);
+
+static ticks clock_task(void *payload)
+{
+    set_system_time(clock_timer.wall_due);  // the second it was aligned on
+    return TASK_KEEP_SCHEDULE;
+}
+
+static void clock_set_adjust(void)
+{
+    int32_t adjust = -clock_ppm * 2048 / 3906;  // 8ms * 65536 / 1e6 = 2048 / 3906.25
+
+    ENTER_CRITICAL(K);
+    clock_adjust = adjust;
+    EXIT_CRITICAL(K);
+}
+
+// Compares the scheduler time elapsed since the previous measurement with the
+//     wall-clock time, both taken at the beginning of a second. The windows of
+//     the second bound the error of the measurement, it is only taken when
+//     that bound is at most half what is already known: 100ms over 64s is
+//     1600ppm, 20ms over a poll interval 70ppm. What is left of the error
+//     after the correction is then within the bound, plus what the
+//     temperature may change.
+static void clock_measure(void)
+{
+    uint32_t start = wall_lo + (wall_hi - wall_lo) / 2;
+    uint16_t width = wall_hi - wall_lo;
+    int32_t  span_s = (int32_t)(wall_sec - clock_ref_sec);
+    int32_t  bound;
+    int32_t  ppm;
+
+    if (clock_ref_known && (span_s < CLOCK_SPAN_S)) {
+        if (width * 2 <= clock_ref_width) {
+            clock_ref_known = false;    // start over from a narrower window
+        }
+        else {
+            return;
+        }
+    }
+    if (clock_ref_known) {
+        bound = ((int32_t)width + clock_ref_width) * 500L / span_s;
+        if (bound * 2 > clock_margin) {
+            return;
+        }
+        // ms counted in excess, per 1000s
+        ppm = clock_ppm + ((int32_t)(start - clock_ref_ms) - span_s * 1000L) * 1000L / span_s;
+        if ((ppm <= -CLOCK_MAX_PPM) || (ppm >= CLOCK_MAX_PPM)) {
+            return;
+        }
+        clock_ppm = ppm;
+        clock_margin = bound + CLOCK_DRIFT_PPM;
+        clock_calibrated = true;
+        clock_set_adjust();
+    }
+    clock_ref_known = true;
+    clock_ref_sec = wall_sec;
+    clock_ref_ms = start;
+    clock_ref_width = width;
+}
+
+// Called with each time received from the network
+static void clock_sample(bool stepped)
+{
+    if (clock_query_sent) {
+        uint32_t latency = scheduler_get_time() - clock_query_time;
+
+        clock_query_sent = false;
+        if (latency < 1000) {
+            clock_latency = latency;
+        }
+    }
+    if (stepped) {
+        clock_ref_known = false;        // the seconds are not the same anymore
+        clock_samples = 0;
+    }
+    else {
+        clock_measure();
+    }
+    if ((clock_samples < CLOCK_BURST) && (++clock_samples == CLOCK_BURST)) {
+        clock_burst_end = scheduler_get_time();
+    }
+    if (!scheduler_is_task_active(&clock_timer)) {
+        scheduler_create_aligned_task(&clock_timer, 1);
+    }
+}
+
+// The query is timed for its answer to come in the middle of the window of
+//     the second, whichever way it falls the answer halves the window
+ticks scheduler_clock_next_query(void)
+{
+    uint32_t now = scheduler_get_time();
+    uint32_t wait;
+    int32_t  phase;
+
+    if (clock_calibrated && (clock_samples >= CLOCK_BURST)) {
+        wait = now - clock_burst_end;
+        if (wait < CLOCK_POLL_S * 1000UL) {
+            wait = CLOCK_POLL_S * 1000UL - wait;
+            return (wait > MAX_BASE_PERIOD) ? MAX_BASE_PERIOD : (ticks)wait;
+        }
+        clock_samples = 0;              // time for another burst
+    }
+    if (wall_known) {
+        phase = (int32_t)(wall_lo + (wall_hi - wall_lo) / 2 - clock_latency - now) % 1000;
+        if (phase < 0) {
+            phase += 1000;
+        }
+        if ((phase > SCHEDULER_BASE_PERIOD / 2) && (phase < 1000 - SCHEDULER_BASE_PERIOD / 2)) {
+            return phase;
+        }
+    }
+    clock_query_sent = true;
+    clock_query_time = now;
+    return 0;
+}
+
+int32_t scheduler_get_clock_ppm(void)
+{
+    return clock_ppm;
+}
+
+void scheduler_print_clock(void)
+{
+    printf("clock %ld ppm%s, within %ld ppm, second known within %lums\r\n", (long)clock_ppm,
+           clock_calibrated ? "" : " (not calibrated yet)", (long)clock_margin,
+           wall_known ? (wall_hi - wall_lo) : 1000UL);
+}
+#endif
+
+// Each second given here began within the last 1000ms. Intersecting these
+//     windows over the successive calls tells more and more precisely when the
+//     seconds begin in scheduler time. A window that misses the estimate by a
+//     little is the two clocks drifting apart: the estimate follows. By a
+//     second or more, the clock was set: start over and re-align the tasks.
+void scheduler_set_wall_time(time_t now)
+{
+    uint32_t hi = scheduler_get_time() + SCHEDULER_BASE_PERIOD - 1;   // the next tick did not come yet
+    uint32_t lo = hi - 999;
+    int32_t  elapsed = (int32_t)(now - wall_sec);
+    bool     stepped = true;
+
+    if (wall_known && (elapsed > -86400L) && (elapsed < 86400L)) {
+#if SCHEDULER_CLOCK_DISCIPLINE
+        int32_t  drift = clock_margin;
+#else
+        int32_t  drift = WALL_DRIFT_PPM;
+#endif
+        int32_t  span = (elapsed < 0) ? -elapsed : elapsed;
+        int32_t  margin = span / 1000 * drift + ((span % 1000) * drift + 999) / 1000;     // no overflow
+        uint32_t expected_lo = wall_lo + elapsed * 1000L - margin;
+        uint32_t expected_hi = wall_hi + elapsed * 1000L + margin;
+
+        stepped = false;
+        if ((int32_t)(lo - expected_hi) > 0) {          // began later than expected
+            stepped = ((int32_t)(lo - expected_hi) >= WALL_STEP);
+            hi = lo;
+        }
+        else if ((int32_t)(expected_lo - hi) > 0) {     // began earlier than expected
+            stepped = ((int32_t)(expected_lo - hi) >= WALL_STEP);
+            lo = hi;
+        }
+        else {
+            if ((int32_t)(expected_lo - lo) > 0) {
+                lo = expected_lo;
+            }
+            if ((int32_t)(hi - expected_hi) > 0) {
+                hi = expected_hi;
+            }
+        }
+        if (stepped) {
+            hi = scheduler_get_time() + SCHEDULER_BASE_PERIOD - 1;
+            lo = hi - 999;
+        }
+    }
+    wall_sec = now;
+    wall_lo = lo;
+    wall_hi = hi;
+    wall_known = true;
+    if (stepped) {
+        wall_realign();
+    }
+#if SCHEDULER_CLOCK_DISCIPLINE
+    clock_sample(stepped);
+#endif
+}
+
+bool scheduler_create_aligned_task(strTask_t *task, uint16_t period_s)
+{
+    if (period_s == 0) {
+        scheduler_kill_task(task);
+        return false;
+    }
+    wall_register(task, period_s, 0);
+    return true;
+}
+
+bool scheduler_create_task_at(strTask_t *task, time_t when)
+{
+    int32_t ahead = (int32_t)(when - wall_sec);
+
+    if (!wall_known || (ahead > (int32_t)(SCHEDULER_MAX_LONG_PERIOD / 1000))) {
+        scheduler_kill_task(task);
+        return false;
+    }
+    wall_register(task, 0, when);
+    return true;
+}
+#endif
+
+RTC_PORT_TICK_ISR()
+{
+    LOAD_ISR_ENTER();
+#if SCHEDULER_TICKLESS
+    pit_phase = rtc_port_wake_count() & 7;
+#endif
+    SCHEDULER_TICK();
 
 	RTC_INT_CLEAR();
+    LOAD_ISR_EXIT();
 }
@@ -21,6 +21,7 @@
     SOFTWARE.
 */
 
+#include <avr/sleep.h>
 #include "../include/slpctrl.h"
 
 /**
@@ -29,8 +30,21 @@
 int8_t SLPCTRL_init()
 {
 
-    // 	SLPCTRL.CTRLA = 0 << SLPCTRL_SEN_bp /* Sleep enable: disabled */
-    // 				| SLPCTRL_SMODE_IDLE_gc; /* Sleep mode: Idle mode */
+    SLPCTRL.CTRLA = 0 << SLPCTRL_SEN_bp /* Sleep enable: disabled */
+                  | SLPCTRL_SMODE_IDLE_gc; /* Sleep mode: Idle mode */
 
     return 0;
+}
+
+void SLPCTRL_set_sleep_mode(uint8_t mode)
+{
+    SLPCTRL.CTRLA = (SLPCTRL.CTRLA & ~SLPCTRL_SMODE_gm) | (mode & SLPCTRL_SMODE_gm);
+}
+
+void SLPCTRL_sleep(void)
+{
+    SLPCTRL.CTRLA |= SLPCTRL_SEN_bm;
+    sei();          // the instruction after sei is always executed before a pending interrupt
+    sleep_cpu();
+    SLPCTRL.CTRLA &= ~SLPCTRL_SEN_bm;
 }
\ No newline at end of file
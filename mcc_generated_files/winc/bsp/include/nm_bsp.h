@@ -288,6 +288,24 @@ void nm_bsp_register_isr(tpfNmBspIsr pfIsr);
 void nm_bsp_interrupt_ctrl(uint8 u8Enable);
   /**@}*/
 
+/** @defgroup NmBspRegisterEventFn nm_bsp_register_event_cb
+*     @ingroup BSPAPI
+*    Register an application function told about WINC interrupts
+*/
+/**@{*/
+/*!
+ * @fn           void nm_bsp_register_event_cb(tpfNmBspIsr);
+ * @param [in]   tpfNmBspIsr  pfCb
+ *               Pointer to the function, NULL to unregister
+ * @brief        Register a function called from the WINC interrupt after the HIF one,
+ *               so the application can schedule m2m_wifi_handle_events() only when needed.
+ *               It is kept across nm_bsp_init()/nm_bsp_deinit().
+ * @note         The function runs in interrupt context.
+ * @return       None
+ */
+void nm_bsp_register_event_cb(tpfNmBspIsr pfCb);
+  /**@}*/
+
 #ifdef __cplusplus
 }
 #endif
@@ -46,13 +46,18 @@
 #include <util/delay.h>
 #include "../../../config/conf_winc.h"
 #include "../../../include/port.h"
+#include "../../../include/rtc.h"
 
 static tpfNmBspIsr gpfIsr;
+static tpfNmBspIsr gpfEventCb;
 
 ISR(CONF_WIFI_M2M_INT_vect)
 {
 	if (!(CONF_WIFI_M2M_INT_PIN_get_level()) && gpfIsr) {
 		gpfIsr();
+		if (gpfEventCb) {
+			gpfEventCb();
+		}
 	}
 	
 	/* Insert your PORTF interrupt handling code here */
@@ -129,9 +134,13 @@ void nm_bsp_reset(void)
  */
 void nm_bsp_sleep(uint32 u32TimeMsec)
 {
+#if SCHEDULER_HIRES_TIMERS
+	scheduler_delay_us(u32TimeMsec * 1000UL);   // the CPU idles meanwhile
+#else
 	while (u32TimeMsec--) {
 		_delay_ms(1);
 	}
+#endif
 }
 
 /*
@@ -152,6 +161,17 @@ void nm_bsp_register_isr(tpfNmBspIsr pfIsr)
 	CONF_WIFI_M2M_INT_PIN_set_isc(PORT_ISC_FALLING_gc);
 }
 
+/*
+ *	@fn		nm_bsp_register_event_cb
+ *	@brief	Register the application function called after the HIF ISR
+ *	@param[IN]	pfCb
+ *				Pointer to the function, NULL to unregister
+ */
+void nm_bsp_register_event_cb(tpfNmBspIsr pfCb)
+{
+	gpfEventCb = pfCb;
+}
+
 /*
  *	@fn		nm_bsp_interrupt_ctrl
  *	@brief	Enable/Disable interrupts
@@ -0,0 +1,92 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+#include "host.h"
+
+uint32_t host_errors;
+time_t   host_system_time;
+
+static uint32_t host_failures;
+
+void set_system_time(time_t timestamp)
+{
+    host_system_time = timestamp;
+}
+
+void debug_printer(debug_severity_t debug_severity, debug_errorLevel_t error_level, char* format, ...)
+{
+    va_list argptr;
+
+    if (error_level == LEVEL_ERROR) {
+        host_errors++;
+    }
+    if (getenv("HOST_VERBOSE") != NULL) {
+        printf("%10.3f ", rtc_port_host.us / 1000.0);
+        va_start(argptr, format);
+        vprintf(format, argptr);
+        va_end(argptr);
+        printf("\n");
+    }
+}
+
+void host_run(uint64_t us, uint32_t loop_us)
+{
+    uint64_t end = rtc_port_host.us + us;
+
+    while (rtc_port_host.us < end) {
+        scheduler_next();
+        rtc_port_host_run(loop_us);
+    }
+}
+
+void host_check(bool ok, const char *file, int line, const char *fmt, ...)
+{
+    va_list argptr;
+
+    if (ok) {
+        return;
+    }
+    host_failures++;
+    printf("%s:%d: ", file, line);
+    va_start(argptr, fmt);
+    vprintf(fmt, argptr);
+    va_end(argptr);
+    printf("\n");
+}
+
+double host_seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+int host_result(const char *name)
+{
+    printf("%s: %s\n", name, (host_failures == 0) ? "PASS" : "FAIL");
+    return (host_failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * Driver of the host programs: the main loop on the virtual clock of
+ * include/rtc_port_host.h, set_system_time() of avr-libc, the printer of
+ * debug_print.c, and the checks.
+ *
+ * A program builds its scenario, runs it with host_run() and checks the
+ * outcome with HOST_CHECK(). main() returns host_result(), 1 if a check
+ * failed. HOST_VERBOSE=1 in the environment prints the debug messages.
+ */
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+#include "../../mcc_generated_files/include/rtc.h"
+#include "../../mcc_generated_files/debug_print.h"
+
+extern uint32_t host_errors;        // debug_printError() calls so far
+extern time_t   host_system_time;   // last value given to set_system_time()
+
+#define HOST_CHECK(cond, ...)   host_check((cond), __FILE__, __LINE__, __VA_ARGS__)
+
+/**
+ * \brief Runs the main loop for us of virtual time
+ *
+ * Every pass calls scheduler_next() then lets loop_us go by, the interrupts
+ * that come due meanwhile run.
+ */
+void host_run(uint64_t us, uint32_t loop_us);
+
+/** Records a failed check, fmt tells what was expected */
+void host_check(bool ok, const char *file, int line, const char *fmt, ...);
+
+/** Seconds of real time, for the benchmarks */
+double host_seconds(void);
+
+/** Prints the outcome of the program, returns its exit status */
+int host_result(const char *name);
+
+#endif /* HOST_H */
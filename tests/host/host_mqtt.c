@@ -0,0 +1,121 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+#include <string.h>
+#include "host_mqtt.h"
+
+#define TX_BUFF_SIZE 400        // as mqtt_comm_layer.c
+#define RX_BUFF_SIZE 100
+
+uint8_t  host_mqtt_wire[HOST_MQTT_WIRE_SIZE];
+uint16_t host_mqtt_wire_length;
+bool     host_mqtt_send_fails;
+uint32_t host_mqtt_sends;
+uint32_t host_mqtt_closes;
+
+static mqttContext mqttConn;
+static uint8_t mqttTxBuff[TX_BUFF_SIZE];
+static uint8_t mqttRxBuff[RX_BUFF_SIZE];
+
+void MQTT_ClientInitialise(void)
+{
+    MQTT_initialiseState();
+    mqttConn.mqttDataExchangeBuffers.txbuff.start = mqttTxBuff;
+    mqttConn.mqttDataExchangeBuffers.txbuff.bufferLength = TX_BUFF_SIZE;
+    MQTT_ExchangeBufferInit(&mqttConn.mqttDataExchangeBuffers.txbuff);
+    mqttConn.mqttDataExchangeBuffers.rxbuff.start = mqttRxBuff;
+    mqttConn.mqttDataExchangeBuffers.rxbuff.bufferLength = RX_BUFF_SIZE;
+    MQTT_ExchangeBufferInit(&mqttConn.mqttDataExchangeBuffers.rxbuff);
+}
+
+mqttContext* MQTT_GetClientConnectionInfo()
+{
+    return &mqttConn;
+}
+
+bool MQTT_Send(mqttContext *connectionPtr)
+{
+    uint16_t length = connectionPtr->mqttDataExchangeBuffers.txbuff.dataLength;
+
+    if (host_mqtt_send_fails || (host_mqtt_wire_length + length > sizeof (host_mqtt_wire))) {
+        return false;
+    }
+    memcpy(&host_mqtt_wire[host_mqtt_wire_length], connectionPtr->mqttDataExchangeBuffers.txbuff.start, length);
+    host_mqtt_wire_length += length;
+    host_mqtt_sends++;
+    return true;
+}
+
+bool MQTT_Close(mqttContext *connectionPtr)
+{
+    host_mqtt_closes++;
+    return true;
+}
+
+// Same as mqtt_comm_layer.c
+void MQTT_GetReceivedData(uint8_t *pData, uint8_t len)
+{
+    if (pData == mqttConn.mqttDataExchangeBuffers.rxbuff.start) {
+        MQTT_ExchangeBufferInit(&mqttConn.mqttDataExchangeBuffers.rxbuff);
+        mqttConn.mqttDataExchangeBuffers.rxbuff.dataLength = len;
+    } else {
+        MQTT_ExchangeBufferWrite(&mqttConn.mqttDataExchangeBuffers.rxbuff, pData, len);
+    }
+}
+
+void host_mqtt_receive(const uint8_t *data, uint8_t length)
+{
+    mqttContext *connection = MQTT_GetClientConnectionInfo();
+
+    MQTT_GetReceivedData((uint8_t *)data, length);
+    MQTT_ReceptionHandler(connection);
+}
+
+bool host_mqtt_connect(uint16_t keep_alive, const uint8_t *connack, uint8_t length)
+{
+    mqttConnectPacket connect;
+    mqttContext       *connection = MQTT_GetClientConnectionInfo();
+
+    memset(&connect, 0, sizeof (connect));
+    connect.connectVariableHeader.keepAliveTimer = keep_alive;
+    connect.clientID = (uint8_t *)"cid";
+    MQTT_CreateConnectPacket(&connect);
+    MQTT_TransmissionHandler(connection);
+    host_mqtt_wire_length = 0;
+    host_mqtt_receive(connack, length);
+    return (MQTT_GetConnectionState() == CONNECTED);
+}
+
+uint32_t host_mqtt_packet_length(const uint8_t *packet, uint8_t *header)
+{
+    uint32_t length = 0;
+    uint32_t multiplier = 1;
+    uint8_t  i = 1;
+
+    do {
+        length += (packet[i] & 0x7F) * multiplier;
+        multiplier *= 128;
+    } while ((packet[i++] & 0x80) && (i < 5));
+    *header = i;
+    return i + length;
+}
@@ -0,0 +1,72 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * The broker end of the MQTT connection for the host programs, in place of
+ * mqtt/mqtt_comm_bsd/mqtt_comm_layer.c and the WINC sockets. Whatever the MQTT
+ * core sends piles up in host_mqtt_wire until the program takes it, what the
+ * broker answers goes in with host_mqtt_receive() like a TCP receive. The
+ * program calls MQTT_ClientInitialise() after scheduler_init(), as
+ * cloud_service.c does.
+ */
+
+#ifndef HOST_MQTT_H
+#define HOST_MQTT_H
+
+#include "host.h"
+#include "../../mcc_generated_files/mqtt/mqtt_core/mqtt_core.h"   // the socket layer and exchange buffers too
+#include "../../mcc_generated_files/mqtt/mqtt_packetTransfer_interface.h"
+
+#define HOST_MQTT_WIRE_SIZE     8192
+
+extern uint8_t  host_mqtt_wire[HOST_MQTT_WIRE_SIZE];   // sent, not taken yet
+extern uint16_t host_mqtt_wire_length;
+extern bool     host_mqtt_send_fails;   // MQTT_Send() fails while set
+extern uint32_t host_mqtt_sends;        // MQTT_Send() calls that succeeded
+extern uint32_t host_mqtt_closes;       // MQTT_Close() calls
+
+/**
+ * \brief Hands data from the broker to the MQTT core, as one TCP receive
+ *
+ * data may be the receive buffer of the connection itself, as the socket
+ * callback of the firmware does.
+ */
+void host_mqtt_receive(const uint8_t *data, uint8_t length);
+
+/**
+ * \brief Connects with a CONNECT from client "cid", answered by connack
+ *
+ * The CONNECT is taken off the wire. keep_alive is in s, 0 for none.
+ *
+ * \return              true once CONNECTED
+ */
+bool host_mqtt_connect(uint16_t keep_alive, const uint8_t *connack, uint8_t length);
+
+/**
+ * \brief Length of the packet that starts at packet, its fixed header included
+ *
+ * *header gets the length of the fixed header.
+ */
+uint32_t host_mqtt_packet_length(const uint8_t *packet, uint8_t *header);
+
+#endif /* HOST_MQTT_H */
@@ -0,0 +1,222 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * Receive parser of the MQTT core: a stream of PUBLISH packets for the
+ * subscribed topic, mixed with packets for other topics, topics longer than
+ * TOPIC_SIZE and PUBACKs, cut in pieces of random size like TCP delivers
+ * them. Each payload reaches the handler whole, in order and at the right
+ * offsets, however it was cut, even when it is far larger than the receive
+ * buffer. A control packet too large to be rebuilt, over 64kB, is skipped
+ * and the next packet parses. A malformed remaining length closes the
+ * connection.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "host_mqtt.h"
+
+#define ROUNDS          200000
+#define PAYLOAD_MAX     1900
+#define TOPIC           "/devices/d1/config"
+#define OVERSIZED       70000UL         // remaining length of a control packet, past 16 bits
+
+static uint8_t  stream[4000];           // what the broker sends next
+static uint16_t stream_length;
+
+static uint8_t  expected[PAYLOAD_MAX];  // payload of the PUBLISH for TOPIC
+static uint32_t expected_length;
+static bool     expecting;
+static uint32_t got;                    // bytes of it handed over so far
+static uint32_t delivered;
+static uint32_t calls;
+static uint32_t errors;
+
+static void config_received(uint8_t *topic, uint8_t *payload, uint16_t length, uint32_t offset, uint32_t payloadLength)
+{
+    calls++;
+    if (strcmp((char *)topic, TOPIC) != 0) {
+        errors++;
+    }
+    if (!expecting) {
+        errors++;
+        return;
+    }
+    if ((offset != got) || (payloadLength != expected_length) ||
+        ((length != 0) && (memcmp(payload, &expected[offset], length) != 0))) {
+        errors++;
+    }
+    got += length;
+    if (got == expected_length) {
+        delivered++;
+        expecting = false;
+    }
+}
+
+static const publishReceptionHandler_t handlers[] = {
+    { "config", config_received },
+};
+
+static void stream_length_put(uint32_t length)
+{
+    do {
+        uint8_t digit = length % 128;
+
+        length /= 128;
+        stream[stream_length++] = digit | ((length != 0) ? 0x80 : 0);
+    } while (length != 0);
+}
+
+static void stream_publish(const char *topic, uint32_t length, uint8_t qos, bool handled)
+{
+    uint16_t topic_length = strlen(topic);
+    uint32_t i;
+
+    stream[stream_length++] = (PUBLISH << 4) | (qos << 1);
+    stream_length_put(2 + topic_length + (qos ? 2 : 0) + length);
+    stream[stream_length++] = topic_length >> 8;
+    stream[stream_length++] = topic_length & 0xFF;
+    memcpy(&stream[stream_length], topic, topic_length);
+    stream_length += topic_length;
+    if (qos) {
+        stream[stream_length++] = 0x12;
+        stream[stream_length++] = 0x34;
+    }
+    for (i = 0; i < length; i++) {
+        uint8_t c = 'a' + rand() % 26;
+
+        stream[stream_length++] = c;
+        if (handled) {
+            expected[i] = c;
+        }
+    }
+    if (handled) {
+        expected_length = length;
+        expecting = true;
+        got = 0;
+    }
+}
+
+// Sends the stream in pieces of 1 to 100 bytes, some received in place in
+//     the receive buffer, some copied there
+static void stream_send(void)
+{
+    uint8_t  *rx = MQTT_GetClientConnectionInfo()->mqttDataExchangeBuffers.rxbuff.start;
+    uint16_t i = 0;
+
+    while (i < stream_length) {
+        uint8_t piece = 1 + rand() % 100;
+
+        if (piece > stream_length - i) {
+            piece = stream_length - i;
+        }
+        if (rand() % 2) {
+            memcpy(rx, &stream[i], piece);
+            host_mqtt_receive(rx, piece);
+        }
+        else {
+            host_mqtt_receive(&stream[i], piece);
+        }
+        i += piece;
+    }
+    stream_length = 0;
+}
+
+int main(void)
+{
+    static const uint8_t connack[] = { 0x20, 2, 0, 0 };
+    static const uint8_t malformed[] = { PUBLISH << 4, 0xFF, 0xFF, 0xFF, 0xFF, 0x01 };
+    uint32_t round;
+    uint32_t longest = 0;
+    uint32_t lost = 0;
+    uint32_t before;
+    uint32_t skipped;
+    uint16_t piece;
+
+    scheduler_init();
+    MQTT_ClientInitialise();
+    MQTT_SetPublishReceptionHandlerTable(handlers, 1, "/devices/d1/");
+    HOST_CHECK(host_mqtt_connect(0, connack, sizeof (connack)), "not connected");
+    srand(7);
+    for (round = 0; (round < ROUNDS) && (MQTT_GetConnectionState() == CONNECTED); round++) {
+        uint32_t length = (rand() % 4 == 0) ? rand() % PAYLOAD_MAX : rand() % 60;
+        uint32_t before = delivered;
+        char     topic[TOPIC_SIZE + 21];
+
+        switch (rand() % 5) {
+            case 0:
+                stream_publish("/devices/d1/other", length, 0, false);
+                break;
+            case 1:
+                stream[stream_length++] = PUBACK << 4;
+                stream[stream_length++] = 2;
+                stream[stream_length++] = 0x7F;
+                stream[stream_length++] = 0x01;
+                break;
+            case 2:
+                memset(topic, 'z', sizeof (topic) - 1);
+                topic[sizeof (topic) - 1] = '\0';
+                stream_publish(topic, length, 0, false);
+                break;
+            default:
+                break;
+        }
+        stream_publish(TOPIC, length, rand() % 2, true);
+        stream_send();
+        if ((delivered != before + 1) || expecting) {
+            lost++;
+        }
+        longest = (length > longest) ? length : longest;
+    }
+    printf("parser: %u payloads delivered (%u bytes at most, %u handler calls), %u lost, %u errors\n",
+           delivered, longest, calls, lost, errors);
+    HOST_CHECK(MQTT_GetConnectionState() == CONNECTED, "disconnected after %u rounds", round);
+    HOST_CHECK((delivered == ROUNDS) && (lost == 0), "%u payloads delivered, %u lost", delivered, lost);
+    HOST_CHECK(errors == 0, "%u wrong handler calls", errors);
+
+    // a SUBACK far too large for the control packet buffer is skipped
+    stream[stream_length++] = SUBACK << 4;
+    stream_length_put(OVERSIZED);
+    stream_send();
+    for (skipped = 0; skipped < OVERSIZED; skipped += piece) {
+        piece = (OVERSIZED - skipped < sizeof (stream)) ? OVERSIZED - skipped : sizeof (stream);
+        memset(stream, SUBACK << 4, piece);
+        stream_length = piece;
+        stream_send();
+    }
+    before = delivered;
+    stream_publish(TOPIC, 100, 0, true);
+    stream_send();
+    printf("oversized: %lu byte SUBACK skipped, %u payload delivered after it\n", OVERSIZED, delivered - before);
+    HOST_CHECK(MQTT_GetConnectionState() == CONNECTED, "an oversized SUBACK closed the connection");
+    HOST_CHECK((delivered == before + 1) && !expecting, "the PUBLISH after an oversized SUBACK was lost");
+    HOST_CHECK(errors == 0, "%u wrong handler calls after an oversized SUBACK", errors);
+
+    // a remaining length of 5 bytes is malformed
+    memcpy(stream, malformed, sizeof (malformed));
+    stream_length = sizeof (malformed);
+    stream_send();
+    HOST_CHECK((MQTT_GetConnectionState() == DISCONNECTED) && (host_mqtt_closes == 1),
+               "a malformed packet left the connection up");
+    return host_result("mqtt_parser");
+}
@@ -0,0 +1,261 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * QoS 1 PUBLISH packets against a broker that acknowledges them late, first
+ * over a clean connection then over a lossy one: PUBLISH and PUBACK packets
+ * lost on the way, sends that fail and reconnections. Every packet queued
+ * reaches the broker at least once, never more than MQTT_INFLIGHT_WINDOW
+ * are waiting for their PUBACK, and a packet sent again carries DUP and the
+ * packet identifier it had.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "host_mqtt.h"
+
+#define ROUNDS          20000
+#define MESSAGES        (4 * ROUNDS)    // at most 3 queued per round
+#define TOPIC           "/devices/d0123456789ABCDEF01/events"
+#define ACKS            64
+
+typedef struct {
+    bool     lossy;
+    uint32_t queued;
+    uint32_t rejected;
+    uint32_t duplicates;        // received more than once
+    uint32_t dup_flagged;       // sent again with DUP
+    uint32_t errors;            // protocol errors
+    uint32_t in_flight;
+    uint32_t in_flight_max;
+    uint32_t reconnects;
+    uint32_t pings;
+} strPhase_t;
+
+static strPhase_t phase;
+static uint8_t    delivered[MESSAGES];
+static bool       in_flight[0x10000];   // by packet identifier
+static uint16_t   acks[ACKS];           // PUBACKs the broker owes
+static uint8_t    ack_count;
+static bool       pingreq;
+
+static bool lost(void)
+{
+    return phase.lossy && (rand() % 8 == 0);
+}
+
+static void publish(void)
+{
+    char              payload[80];
+    mqttPublishPacket packet;
+    uint16_t          length = sprintf(payload, "n=%u ", phase.queued);
+    uint16_t          pad = rand() % 60;
+
+    memset(&payload[length], 'x', pad);
+    memset(&packet, 0, sizeof (packet));
+    packet.topic = (uint8_t *)TOPIC;
+    packet.payload = (uint8_t *)payload;
+    packet.payloadLength = length + pad;
+    packet.publishHeaderFlags.qos = 1;
+    if (MQTT_CreatePublishPacket(&packet)) {
+        phase.queued++;
+    }
+    else {
+        phase.rejected++;
+    }
+}
+
+// The broker takes what was sent, and owes a PUBACK for each PUBLISH that
+//     made it
+static void broker_take(void)
+{
+    uint16_t i = 0;
+
+    while ((i < host_mqtt_wire_length) && (phase.errors == 0)) {
+        uint8_t  *packet = &host_mqtt_wire[i];
+        uint8_t  header;
+        uint32_t length = host_mqtt_packet_length(packet, &header);
+        uint16_t topic = (packet[header] << 8) | packet[header + 1];
+        uint8_t  *id_at = &packet[header + 2 + topic];
+        uint16_t id = (id_at[0] << 8) | id_at[1];
+        bool     dup = (packet[0] >> 3) & 1;
+        char     payload[80];
+        uint32_t n;
+
+        i += length;
+        if ((packet[0] >> 4) == PINGREQ) {
+            pingreq = true;
+            continue;
+        }
+        if (((packet[0] >> 4) != PUBLISH) || (((packet[0] >> 1) & 3) != 1) || (id == 0)) {
+            phase.errors++;
+            break;
+        }
+        if (dup) {
+            phase.dup_flagged++;
+            if (!in_flight[id]) {
+                phase.errors++;     // sent again with another identifier
+            }
+        }
+        else if (in_flight[id]) {
+            phase.errors++;         // identifier still in use
+        }
+        else {
+            in_flight[id] = true;
+            phase.in_flight++;
+            if (phase.in_flight > phase.in_flight_max) {
+                phase.in_flight_max = phase.in_flight;
+            }
+        }
+        memcpy(payload, id_at + 2, packet + length - (id_at + 2));
+        payload[packet + length - (id_at + 2)] = '\0';
+        if ((sscanf(payload, "n=%u", &n) != 1) || (n >= MESSAGES)) {
+            phase.errors++;
+            break;
+        }
+        if (lost()) {
+            continue;
+        }
+        if (delivered[n]++ != 0) {
+            phase.duplicates++;
+        }
+        if (ack_count < ACKS) {
+            acks[ack_count++] = id;
+        }
+    }
+    host_mqtt_wire_length = 0;
+}
+
+// The PUBACKs owed, in one receive, and the PINGRESP
+static void broker_answer(void)
+{
+    uint8_t data[100];
+    uint8_t length = 0;
+    uint8_t i = 0;
+
+    while ((i < ack_count) && (length + 4 <= sizeof (data))) {
+        uint16_t id = acks[i++];
+
+        if (lost()) {
+            continue;
+        }
+        data[length++] = PUBACK << 4;
+        data[length++] = 2;
+        data[length++] = id >> 8;
+        data[length++] = id & 0xFF;
+        if (in_flight[id]) {
+            in_flight[id] = false;
+            phase.in_flight--;
+        }
+    }
+    memmove(acks, &acks[i], (ack_count - i) * sizeof (acks[0]));
+    ack_count -= i;
+    if (length != 0) {
+        host_mqtt_receive(data, length);
+    }
+    if (pingreq) {
+        static const uint8_t pingresp[] = { PINGRESP << 4, 0 };
+
+        pingreq = false;
+        phase.pings++;
+        host_mqtt_receive(pingresp, sizeof (pingresp));
+    }
+}
+
+static void broker_connect(void)
+{
+    static const uint8_t connack[] = { 0x20, 2, 0, 0 };
+
+    host_mqtt_send_fails = false;
+    if (!host_mqtt_connect(10, connack, sizeof (connack))) {
+        phase.errors++;
+    }
+    ack_count = 0;                  // the PUBACKs of the old connection are lost
+}
+
+static void simulate(bool lossy)
+{
+    mqttContext *connection = MQTT_GetClientConnectionInfo();
+    uint32_t    round;
+    uint32_t    missing = 0;
+    uint32_t    n;
+    const char  *name = lossy ? "lossy" : "clean";
+
+    memset(&phase, 0, sizeof (phase));
+    memset(delivered, 0, sizeof (delivered));
+    memset(in_flight, 0, sizeof (in_flight));
+    phase.lossy = lossy;
+    broker_connect();
+    for (round = 0; (round < ROUNDS) && (phase.errors == 0); round++) {
+        uint8_t burst = rand() % 4;
+
+        while (burst-- > 0) {
+            publish();
+        }
+        host_mqtt_send_fails = lossy && (rand() % 10 == 0);
+        MQTT_TransmissionHandler(connection);
+        broker_take();
+        if (rand() % 2) {
+            broker_answer();
+        }
+        if (MQTT_GetConnectionState() != CONNECTED) {
+            phase.errors++;
+        }
+        if (lossy && (rand() % 500 == 0)) {
+            phase.reconnects++;
+            broker_connect();
+        }
+        host_run(500000, 1000);
+    }
+    phase.lossy = false;            // what is left goes through
+    host_mqtt_send_fails = false;
+    for (round = 0; (round < 200) && (MQTT_GetPublishQueueLength() != 0) && (phase.errors == 0); round++) {
+        MQTT_TransmissionHandler(connection);
+        broker_take();
+        broker_answer();
+        host_run(500000, 1000);
+    }
+    for (n = 0; n < phase.queued; n++) {
+        missing += (delivered[n] == 0);
+    }
+
+    printf("%s: %u queued, %u rejected, %u missing, %u received twice, %u sent again with DUP, "
+           "%u in flight at most, %u reconnections, %u PINGREQ\n", name, phase.queued, phase.rejected, missing,
+           phase.duplicates, phase.dup_flagged, phase.in_flight_max, phase.reconnects, phase.pings);
+    HOST_CHECK(phase.errors == 0, "%s: protocol error", name);
+    HOST_CHECK(missing == 0, "%s: %u PUBLISH packets never received", name, missing);
+    HOST_CHECK(phase.in_flight_max <= MQTT_INFLIGHT_WINDOW, "%s: %u in flight", name, phase.in_flight_max);
+    HOST_CHECK(MQTT_GetPublishQueueLength() == 0, "%s: %u left in the queue", name, MQTT_GetPublishQueueLength());
+    HOST_CHECK(lossy ? (phase.dup_flagged != 0) : (phase.duplicates + phase.dup_flagged == 0),
+               "%s: %u sent again", name, phase.dup_flagged);
+}
+
+int main(void)
+{
+    scheduler_init();
+    MQTT_ClientInitialise();
+    srand(1);
+    simulate(false);
+    simulate(true);
+    return host_result("mqtt_qos1");
+}
@@ -0,0 +1,144 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * Publish queue of the MQTT core: PUBLISH packets queued in random bursts,
+ * payloads of random length copied in the arena, sends that fail now and
+ * then. Every packet queued reaches the wire whole and in order, and
+ * MQTT_GetPublishQueueSpace() tells exactly which ones fit.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "host_mqtt.h"
+
+#define ROUNDS      20000
+#define TOPIC       "/devices/d0123456789ABCDEF01/events"
+
+static uint32_t queued;
+static uint32_t received;
+static uint32_t bad_packets;
+
+static bool publish(uint32_t n, uint16_t pad)
+{
+    static char        payload[MQTT_PUBLISH_ARENA_SIZE + 16];
+    mqttPublishPacket  packet;
+    uint16_t           length = sprintf(payload, "n=%u ", n);
+
+    memset(&payload[length], 'x', pad);
+    memset(&packet, 0, sizeof (packet));
+    packet.topic = (uint8_t *)TOPIC;
+    packet.payload = (uint8_t *)payload;
+    packet.payloadLength = length + pad;
+    return MQTT_CreatePublishPacket(&packet);
+}
+
+// Takes the PUBLISH packets off the wire, their payloads must count up
+static void wire_check(void)
+{
+    uint16_t i = 0;
+
+    while (i < host_mqtt_wire_length) {
+        uint8_t  *packet = &host_mqtt_wire[i];
+        uint8_t  header;
+        uint32_t length = host_mqtt_packet_length(packet, &header);
+        uint16_t topic = (packet[header] << 8) | packet[header + 1];
+        char     payload[MQTT_PUBLISH_ARENA_SIZE + 1];
+        uint32_t n;
+
+        if (((packet[0] >> 4) != PUBLISH) || (topic != strlen(TOPIC)) ||
+            (length - header - 2 - topic > MQTT_PUBLISH_ARENA_SIZE)) {
+            bad_packets++;
+            break;
+        }
+        memcpy(payload, &packet[header + 2 + topic], length - header - 2 - topic);
+        payload[length - header - 2 - topic] = '\0';
+        if ((sscanf(payload, "n=%u", &n) != 1) || (n != received)) {
+            bad_packets++;
+            break;
+        }
+        received++;
+        i += length;
+    }
+    host_mqtt_wire_length = 0;
+}
+
+int main(void)
+{
+    static const uint8_t connack[] = { 0x20, 2, 0, 0 };
+    mqttContext *connection;
+    uint32_t    rejected = 0;
+    uint32_t    wrong_space = 0;
+    uint32_t    round;
+
+    scheduler_init();
+    MQTT_ClientInitialise();
+    connection = MQTT_GetClientConnectionInfo();
+    HOST_CHECK(host_mqtt_connect(10, connack, sizeof (connack)), "not connected");
+
+    // the arena holds one payload of its whole size, not more
+    HOST_CHECK(!publish(0, MQTT_PUBLISH_ARENA_SIZE + 1 - 4), "a payload over the arena size was queued");
+    HOST_CHECK(publish(0, MQTT_PUBLISH_ARENA_SIZE - 4), "a payload of the arena size was not queued");
+    queued++;
+    MQTT_TransmissionHandler(connection);
+    wire_check();
+
+    srand(1);
+    host_mqtt_sends = 0;
+    for (round = 0; round < ROUNDS; round++) {
+        uint8_t burst = rand() % 7;
+
+        while (burst-- > 0) {
+            uint16_t pad = (rand() % 16 == 0) ? rand() % (MQTT_PUBLISH_ARENA_SIZE - 8) : rand() % 120;
+            uint16_t space = MQTT_GetPublishQueueSpace();
+            uint16_t length = snprintf(NULL, 0, "n=%u ", queued) + pad;
+            bool     ok = publish(queued, pad);
+
+            if (ok != (space >= length)) {
+                wrong_space++;
+            }
+            if (ok) {
+                queued++;
+            }
+            else {
+                rejected++;
+            }
+        }
+        host_mqtt_send_fails = (rand() % 10 == 0);
+        MQTT_TransmissionHandler(connection);
+        wire_check();
+    }
+    host_mqtt_send_fails = false;
+    for (round = 0; (round < 100) && (MQTT_GetPublishQueueLength() != 0); round++) {
+        MQTT_TransmissionHandler(connection);
+        wire_check();
+    }
+
+    printf("publish queue: %u queued, %u rejected, %u received in order in %u sends\n",
+           queued, rejected, received, host_mqtt_sends);
+    HOST_CHECK(bad_packets == 0, "%u PUBLISH packets out of order or malformed", bad_packets);
+    HOST_CHECK(wrong_space == 0, "MQTT_GetPublishQueueSpace() was wrong %u times", wrong_space);
+    HOST_CHECK(received == queued, "%u received of %u queued", received, queued);
+    HOST_CHECK(rejected != 0, "the queue was never full");
+    return host_result("mqtt_queue");
+}
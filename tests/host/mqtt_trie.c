@@ -0,0 +1,158 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * Topic filters of the subscriptions, indexed in a trie: which filters a
+ * topic matches, with the + and # wildcards and a topic prefix, the filters
+ * refused, and the SUBSCRIBE packet built from them. Built with 4 filters
+ * and 9 trie nodes, see the Makefile.
+ */
+
+#include <string.h>
+#include "host_mqtt.h"
+
+#if (NUM_TOPICS_SUBSCRIBE != 4) || (MQTT_TOPIC_TRIE_NODES != 9)
+#error "mqtt_trie expects NUM_TOPICS_SUBSCRIBE 4 and MQTT_TOPIC_TRIE_NODES 9"
+#endif
+
+static uint32_t hits[4];
+
+static void handler0(uint8_t *topic, uint8_t *payload, uint16_t length, uint32_t offset, uint32_t payloadLength)
+{
+    hits[0]++;
+}
+
+static void handler1(uint8_t *topic, uint8_t *payload, uint16_t length, uint32_t offset, uint32_t payloadLength)
+{
+    hits[1]++;
+}
+
+static void handler2(uint8_t *topic, uint8_t *payload, uint16_t length, uint32_t offset, uint32_t payloadLength)
+{
+    hits[2]++;
+}
+
+static void handler3(uint8_t *topic, uint8_t *payload, uint16_t length, uint32_t offset, uint32_t payloadLength)
+{
+    hits[3]++;
+}
+
+#define MATCH(topic, filters)   HOST_CHECK(MQTT_MatchTopicFilters(topic) == (filters), "%s matches %#x, %#x expected", \
+                                           topic, MQTT_MatchTopicFilters(topic), filters)
+
+// The filters of the device: its config and its commands
+static void filters_device(void)
+{
+    static const publishReceptionHandler_t device[] = { { "config", handler0 }, { "commands/#", handler1 } };
+
+    HOST_CHECK(MQTT_SetPublishReceptionHandlerTable(device, 2, "/devices/d1/"), "device filters refused");
+    MATCH("/devices/d1/config", 0x1);
+    MATCH("/devices/d1/configx", 0);
+    MATCH("/devices/d1/config/x", 0);
+    MATCH("/devices/d1/commands", 0x2);         // # matches its parent level too
+    MATCH("/devices/d1/commands/", 0x2);
+    MATCH("/devices/d1/commands/led/on", 0x2);
+    MATCH("/devices/d2/config", 0);
+    MATCH("/devices/d1", 0);
+}
+
+// Overlapping wildcards: a topic matches all of them at once
+static void filters_wildcards(void)
+{
+    static const publishReceptionHandler_t wildcards[] = {
+        { "a/+/c", handler0 }, { "a/#", handler1 }, { "+/b/c", handler2 }, { "#", handler3 },
+    };
+
+    HOST_CHECK(MQTT_SetPublishReceptionHandlerTable(wildcards, 4, NULL), "wildcard filters refused");
+    MATCH("a/b/c", 0xF);
+    MATCH("a/x/c", 0xB);
+    MATCH("x/b/c", 0xC);
+    MATCH("a", 0xA);
+    MATCH("/b/c", 0xC);                         // an empty level matches +
+    MATCH("$SYS/b/c", 0);                       // not matched by wildcards at the first level
+    memset(hits, 0, sizeof (hits));
+    MQTT_HandlePublishData(MQTT_MatchTopicFilters("a/b/c"), (uint8_t *)"a/b/c", NULL, 0, 0, 0);
+    HOST_CHECK((hits[0] == 1) && (hits[1] == 1) && (hits[2] == 1) && (hits[3] == 1),
+               "handlers called %u, %u, %u, %u times", hits[0], hits[1], hits[2], hits[3]);
+}
+
+// Malformed filters, and one with more levels than the trie has nodes
+static void filters_refused(void)
+{
+    static const publishReceptionHandler_t hash_in_level[] = { { "a/b#", handler0 } };
+    static const publishReceptionHandler_t hash_not_last[] = { { "#/a", handler0 } };
+    static const publishReceptionHandler_t empty[] = { { "", handler0 } };
+    static const publishReceptionHandler_t plus_in_level[] = { { "a+", handler0 } };
+    static const publishReceptionHandler_t too_deep[] = { { "a/b/c/d/e/f/g/h/i", handler0 } };
+
+    HOST_CHECK(!MQTT_SetPublishReceptionHandlerTable(hash_in_level, 1, NULL), "a/b# taken");
+    HOST_CHECK(!MQTT_SetPublishReceptionHandlerTable(hash_not_last, 1, NULL), "#/a taken");
+    HOST_CHECK(!MQTT_SetPublishReceptionHandlerTable(empty, 1, NULL), "an empty filter taken");
+    HOST_CHECK(!MQTT_SetPublishReceptionHandlerTable(plus_in_level, 1, NULL), "a+ taken");
+    HOST_CHECK(!MQTT_SetPublishReceptionHandlerTable(too_deep, 1, NULL), "9 levels taken in %u nodes",
+               MQTT_TOPIC_TRIE_NODES);
+}
+
+// The SUBSCRIBE packet holds the device filters with their prefix, and a
+//     PUBLISH received goes to the handler of the filter it matches
+static void filters_subscribe(void)
+{
+    static const publishReceptionHandler_t device[] = { { "config", handler0 }, { "commands/#", handler1 } };
+    static const uint8_t connack[] = { 0x20, 2, 0, 0 };
+    static const uint8_t subscribe[] = {
+        0x82, 48, 0, 1,
+        0, 18, '/', 'd', 'e', 'v', 'i', 'c', 'e', 's', '/', 'd', '1', '/', 'c', 'o', 'n', 'f', 'i', 'g', 0,
+        0, 22, '/', 'd', 'e', 'v', 'i', 'c', 'e', 's', '/', 'd', '1', '/', 'c', 'o', 'm', 'm', 'a', 'n', 'd', 's',
+        '/', '#', 0,
+    };
+    static const uint8_t suback[] = { 0x90, 4, 0, 1, 0, 0 };
+    static const uint8_t publish[] = {
+        0x30, 28, 0, 24, '/', 'd', 'e', 'v', 'i', 'c', 'e', 's', '/', 'd', '1', '/', 'c', 'o', 'm', 'm', 'a', 'n',
+        'd', 's', '/', 'l', 'e', 'd', 'h', 'i',
+    };
+
+    HOST_CHECK(MQTT_SetPublishReceptionHandlerTable(device, 2, "/devices/d1/"), "device filters refused");
+    HOST_CHECK(!MQTT_CreateTopicFilterSubscribePacket(), "SUBSCRIBE created while not connected");
+    HOST_CHECK(host_mqtt_connect(10, connack, sizeof (connack)), "not connected");
+    HOST_CHECK(MQTT_CreateTopicFilterSubscribePacket(), "SUBSCRIBE not created");
+    host_mqtt_wire_length = 0;
+    MQTT_TransmissionHandler(MQTT_GetClientConnectionInfo());
+    HOST_CHECK((host_mqtt_wire_length == sizeof (subscribe)) && (memcmp(host_mqtt_wire, subscribe, sizeof (subscribe)) == 0),
+               "SUBSCRIBE of %u bytes differs", host_mqtt_wire_length);
+    host_mqtt_receive(suback, sizeof (suback));
+    HOST_CHECK(MQTT_GetConnectionState() == CONNECTED, "SUBACK refused");
+    memset(hits, 0, sizeof (hits));
+    host_mqtt_receive(publish, sizeof (publish));
+    HOST_CHECK((hits[0] == 0) && (hits[1] == 1), "commands handled %u times, config %u", hits[1], hits[0]);
+}
+
+int main(void)
+{
+    scheduler_init();
+    MQTT_ClientInitialise();
+    filters_device();
+    filters_wildcards();
+    filters_refused();
+    filters_subscribe();
+    return host_result("mqtt_trie");
+}
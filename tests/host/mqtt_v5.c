@@ -0,0 +1,244 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * The MQTT 5.0 mode against a broker that speaks it: the properties of the
+ * CONNECT packet and the ones of the CONNACK taken, CONNACK, PUBACK and
+ * SUBACK reason codes, the topic aliases and the Receive Maximum of the
+ * broker, the property length of SUBSCRIBE and UNSUBSCRIBE, a PUBLISH
+ * received with properties in pieces, a PUBACK timeout, and a DISCONNECT from
+ * the broker.
+ */
+
+#include <string.h>
+#include "host_mqtt.h"
+
+#if MQTT_VERSION != MQTT_VERSION_5_0
+#error "mqtt_v5 expects MQTT_VERSION_5_0"
+#endif
+
+#define TOPIC           "/devices/d0123456789ABCDEF01/events"
+#define PAYLOAD         "{\"Light\":123,\"Temp\":\"23.45\"}"
+#define TOPIC_LENGTH      (sizeof (TOPIC) - 1)
+#define PAYLOAD_LENGTH    (sizeof (PAYLOAD) - 1)
+#define PROPERTIES      (2 + 2 + TOPIC_LENGTH + 2)        // properties of a PUBLISH, after its packet identifier
+
+// CONNACK: Topic Alias Maximum 5, Receive Maximum 1, Server Keep Alive 30,
+//     a user property and Retain Available
+static const uint8_t connack_limits[] = {
+    0x20, 22, 0, 0, 19, 0x22, 0, 5, 0x21, 0, 1, 0x13, 0, 30, 0x26, 0, 1, 'k', 0, 2, 'v', 'v', 0x24, 1,
+};
+
+static char     received[16];
+static uint32_t received_length;
+
+static void handler(uint8_t *topic, uint8_t *payload, uint16_t length, uint32_t offset, uint32_t payloadLength)
+{
+    if (offset + length <= sizeof (received)) {
+        memcpy(&received[offset], payload, length);
+    }
+    received_length += length;
+}
+
+static bool publish(void)
+{
+    mqttPublishPacket packet;
+
+    memset(&packet, 0, sizeof (packet));
+    packet.topic = (uint8_t *)TOPIC;
+    packet.payload = (uint8_t *)PAYLOAD;
+    packet.payloadLength = PAYLOAD_LENGTH;
+    packet.publishHeaderFlags.qos = 1;
+    return MQTT_CreatePublishPacket(&packet);
+}
+
+static void transmit(void)
+{
+    host_mqtt_wire_length = 0;
+    MQTT_TransmissionHandler(MQTT_GetClientConnectionInfo());
+}
+
+// The CONNECT packet asks for 5.0 with its properties, a CONNACK with a
+//     reason string longer than the client keeps is still taken
+static void v5_connect(void)
+{
+    static const uint8_t properties[] = { 5, 0x21, 0, 1, 0x17, 0, 0, 3, 'c', 'i', 'd' };
+    uint8_t           connack[60] = { 0x20, 58, 0, 0, 55, 0x1F, 0, 52 };
+    mqttConnectPacket connect;
+
+    memset(&connect, 0, sizeof (connect));
+    connect.connectVariableHeader.keepAliveTimer = 10;
+    connect.clientID = (uint8_t *)"cid";
+    MQTT_CreateConnectPacket(&connect);
+    transmit();
+    // The host pads the variable header struct: the level, then from the properties on
+    HOST_CHECK(host_mqtt_wire[8] == MQTT_VERSION_5_0, "protocol level %u", host_mqtt_wire[8]);
+    HOST_CHECK(memcmp(&host_mqtt_wire[host_mqtt_wire_length - sizeof (properties)], properties, sizeof (properties)) == 0,
+               "CONNECT properties differ");
+    memset(&connack[8], 'r', 52);
+    host_mqtt_receive(connack, sizeof (connack));
+    HOST_CHECK(MQTT_GetConnectionState() == CONNECTED, "long CONNACK refused");
+
+    // Without a Topic Alias Maximum, the topic goes out in full and no property
+    HOST_CHECK(publish(), "PUBLISH not queued");
+    transmit();
+    HOST_CHECK((host_mqtt_wire[0] == 0x32) && (host_mqtt_wire[3] == TOPIC_LENGTH) && (host_mqtt_wire[PROPERTIES] == 0),
+               "PUBLISH without alias differs");
+    HOST_CHECK(host_mqtt_wire_length == PROPERTIES + 1 + PAYLOAD_LENGTH, "PUBLISH of %u bytes", host_mqtt_wire_length);
+    uint8_t puback[] = { 0x40, 2, host_mqtt_wire[PROPERTIES - 2], host_mqtt_wire[PROPERTIES - 1] };
+    host_mqtt_receive(puback, sizeof (puback));
+    HOST_CHECK(MQTT_GetPublishQueueLength() == 0, "PUBLISH not acknowledged");
+
+    static const uint8_t refused[] = { 0x20, 3, 0, 0x87, 0 };
+    HOST_CHECK(!host_mqtt_connect(10, refused, sizeof (refused)), "CONNACK 0x87 taken");
+}
+
+// The topic goes out once then by its alias, one PUBLISH in flight at a
+//     time, and a PUBACK with a failure code ends the wait all the same
+static void v5_aliases(void)
+{
+    HOST_CHECK(host_mqtt_connect(10, connack_limits, sizeof (connack_limits)), "not connected");
+    HOST_CHECK(publish() && publish() && publish(), "PUBLISH not queued");
+    transmit();
+    HOST_CHECK(host_mqtt_wire_length == PROPERTIES + 4 + PAYLOAD_LENGTH, "%u bytes sent, one PUBLISH expected",
+               host_mqtt_wire_length);
+    HOST_CHECK((host_mqtt_wire[PROPERTIES] == 3) && (host_mqtt_wire[PROPERTIES + 1] == 0x23) && (host_mqtt_wire[PROPERTIES + 3] == 1),
+               "no Topic Alias 1 with the topic");
+
+    uint8_t failed[] = { 0x40, 3, 0, host_mqtt_wire[PROPERTIES - 1], 0x97 };
+    host_errors = 0;
+    host_mqtt_receive(failed, sizeof (failed));
+    HOST_CHECK((host_errors == 1) && (MQTT_GetPublishQueueLength() == 2), "PUBACK 0x97 not reported");
+
+    transmit();
+    HOST_CHECK(host_mqtt_wire_length == 2 + 2 + 2 + 4 + PAYLOAD_LENGTH, "aliased PUBLISH of %u bytes", host_mqtt_wire_length);
+    HOST_CHECK((host_mqtt_wire[2] == 0) && (host_mqtt_wire[3] == 0) && (host_mqtt_wire[7] == 0x23) && (host_mqtt_wire[9] == 1),
+               "topic not replaced by Topic Alias 1");
+    uint8_t properties[] = { 0x40, 8, 0, host_mqtt_wire[5], 0x10, 4, 0x1F, 0, 1, 'x' };
+    host_errors = 0;
+    host_mqtt_receive(properties, sizeof (properties));
+    HOST_CHECK((host_errors == 0) && (MQTT_GetPublishQueueLength() == 1), "PUBACK with properties refused");
+    transmit();
+    uint8_t puback[] = { 0x40, 2, 0, host_mqtt_wire[5] };
+    host_mqtt_receive(puback, sizeof (puback));
+    HOST_CHECK(MQTT_GetPublishQueueLength() == 0, "last PUBLISH not acknowledged");
+}
+
+// SUBSCRIBE and UNSUBSCRIBE carry a property length after their packet
+//     identifier, a PUBLISH received with properties reaches its handler
+static void v5_subscribe(void)
+{
+    static const publishReceptionHandler_t filters[] = { { "config", handler } };
+    static const uint8_t subscribe[] = {
+        0x82, 24, 0, 1, 0,
+        0, 18, '/', 'd', 'e', 'v', 'i', 'c', 'e', 's', '/', 'd', '1', '/', 'c', 'o', 'n', 'f', 'i', 'g', 0,
+    };
+    static const uint8_t suback[] = { 0x90, 4, 0, 1, 0, 0 };
+    static const uint8_t unsubscribe[] = { 0xA2, 9, 0, 2, 0, 0, 1, 'a', 0, 1, 'b' };
+    static const uint8_t refused[] = { 0x90, 4, 0, 1, 0, 0x87 };
+    uint8_t publish[] = {
+        0x30, 32, 0, 18, '/', 'd', 'e', 'v', 'i', 'c', 'e', 's', '/', 'd', '1', '/', 'c', 'o', 'n', 'f', 'i', 'g',
+        6, 0x01, 1, 0x03, 0, 1, 'j', 'h', 'e', 'l', 'l', 'o',
+    };
+    mqttUnsubscribePacket unsubscribePacket;
+    uint8_t               i;
+
+    HOST_CHECK(MQTT_SetPublishReceptionHandlerTable(filters, 1, "/devices/d1/"), "filters refused");
+    HOST_CHECK(MQTT_CreateTopicFilterSubscribePacket(), "SUBSCRIBE not created");
+    transmit();
+    HOST_CHECK((host_mqtt_wire_length == sizeof (subscribe)) && (memcmp(host_mqtt_wire, subscribe, sizeof (subscribe)) == 0),
+               "SUBSCRIBE of %u bytes differs", host_mqtt_wire_length);
+    host_mqtt_receive(suback, sizeof (suback));
+    HOST_CHECK(MQTT_GetConnectionState() == CONNECTED, "SUBACK refused");
+
+    for (i = 0; i < sizeof (publish); i += 3) {
+        host_mqtt_receive(&publish[i], (sizeof (publish) - i < 3) ? sizeof (publish) - i : 3);
+    }
+    HOST_CHECK((received_length == 5) && (memcmp(received, "hello", 5) == 0), "%u bytes received", received_length);
+
+    memset(&unsubscribePacket, 0, sizeof (unsubscribePacket));
+    unsubscribePacket.packetIdentifierLSB = 2;
+    unsubscribePacket.unsubscribePayload[0].topic = (uint8_t *)"a";
+    unsubscribePacket.unsubscribePayload[0].topicLength = 1;
+    unsubscribePacket.unsubscribePayload[1].topic = (uint8_t *)"b";
+    unsubscribePacket.unsubscribePayload[1].topicLength = 1;
+    HOST_CHECK(MQTT_CreateUnsubscribePacket(&unsubscribePacket), "UNSUBSCRIBE not created");
+    transmit();
+    HOST_CHECK((host_mqtt_wire_length == sizeof (unsubscribe)) && (memcmp(host_mqtt_wire, unsubscribe, sizeof (unsubscribe)) == 0),
+               "UNSUBSCRIBE of %u bytes differs", host_mqtt_wire_length);
+
+    HOST_CHECK(MQTT_CreateTopicFilterSubscribePacket(), "SUBSCRIBE not created again");
+    transmit();
+    host_mqtt_receive(refused, sizeof (refused));
+    HOST_CHECK(MQTT_GetConnectionState() == DISCONNECTED, "SUBACK 0x87 taken");
+}
+
+// A PUBACK timeout closes the connection instead of sending the PUBLISH
+//     again, it goes out with DUP set and its topic in full after the CONNACK
+static void v5_puback_timeout(void)
+{
+    HOST_CHECK(host_mqtt_connect(10, connack_limits, sizeof (connack_limits)), "not connected");
+    HOST_CHECK(publish(), "PUBLISH not queued");
+    transmit();
+    HOST_CHECK(host_mqtt_wire[0] == 0x32, "PUBLISH not sent");
+
+    host_mqtt_closes = 0;
+    host_run((MQTT_PUBACK_TIMEOUT + 1) * 1000000ULL, 100000);
+    transmit();
+    HOST_CHECK((MQTT_GetConnectionState() == DISCONNECTED) && (host_mqtt_closes == 1), "connection kept after the PUBACK timeout");
+    HOST_CHECK(host_mqtt_wire_length == 0, "%u bytes sent on the PUBACK timeout", host_mqtt_wire_length);
+
+    HOST_CHECK(host_mqtt_connect(10, connack_limits, sizeof (connack_limits)), "not connected again");
+    transmit();
+    HOST_CHECK((host_mqtt_wire[0] == 0x3A) && (host_mqtt_wire_length == PROPERTIES + 4 + PAYLOAD_LENGTH),
+               "PUBLISH not sent again with DUP set after the CONNACK");
+    uint8_t puback[] = { 0x40, 2, host_mqtt_wire[PROPERTIES - 2], host_mqtt_wire[PROPERTIES - 1] };
+    host_mqtt_receive(puback, sizeof (puback));
+    HOST_CHECK(MQTT_GetPublishQueueLength() == 0, "PUBLISH sent again not acknowledged");
+}
+
+// The aliases start again with the connection, the broker disconnects
+static void v5_disconnect(void)
+{
+    static const uint8_t disconnect[] = { 0xE0, 1, 0x8E };
+
+    HOST_CHECK(host_mqtt_connect(10, connack_limits, sizeof (connack_limits)), "not connected again");
+    HOST_CHECK(publish(), "PUBLISH not queued");
+    transmit();
+    HOST_CHECK(host_mqtt_wire_length == PROPERTIES + 4 + PAYLOAD_LENGTH, "topic not sent in full after reconnecting");
+    host_mqtt_closes = 0;
+    host_mqtt_receive(disconnect, sizeof (disconnect));
+    HOST_CHECK((MQTT_GetConnectionState() == DISCONNECTED) && (host_mqtt_closes == 1), "DISCONNECT not taken");
+}
+
+int main(void)
+{
+    scheduler_init();
+    MQTT_ClientInitialise();
+    v5_connect();
+    v5_aliases();
+    v5_subscribe();
+    v5_puback_timeout();
+    v5_disconnect();
+    return host_result("mqtt_v5");
+}
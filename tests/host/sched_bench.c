@@ -0,0 +1,130 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * Scheduler micro-benchmarks, in real time on the PC. Built once per task
+ * queue (sorted list, timing wheel) to compare them.
+ */
+
+#include <string.h>
+#include "host.h"
+
+#if SCHEDULER_TIMING_WHEEL
+#define QUEUE_NAME  "wheel"
+#else
+#define QUEUE_NAME  "list"
+#endif
+
+#define TASKS       256
+#define OPERATIONS  1000000UL
+
+static strTaskDef_t task_defs[TASKS];
+static strTask_t    tasks[TASKS];
+static ticks        periods[TASKS];
+static uint32_t     runs;
+
+static ticks task_run(void *payload)
+{
+    runs++;
+    return periods[(uintptr_t)payload];
+}
+
+static void tasks_reset(void)
+{
+    uint16_t i;
+
+    scheduler_kill_all();
+    host_run(100000, 50);
+    for (i = 0; i < TASKS; i++) {
+        memset(&tasks[i], 0, sizeof (tasks[i]));
+        task_defs[i].callback = task_run;
+        task_defs[i].payload = (void *)(uintptr_t)i;
+        tasks[i].def = &task_defs[i];
+        periods[i] = 0;
+    }
+    runs = 0;
+}
+
+// Real time of 200s of virtual time of the main loop, the best of 3 runs to
+//     leave out the noise of the PC. *expiries gets the runs of one of them
+static double run_200s(uint32_t *expiries)
+{
+    uint8_t  i;
+    double   start;
+    double   elapsed;
+    double   best = 0;
+
+    for (i = 0; i < 3; i++) {
+        runs = 0;
+        start = host_seconds();
+        host_run(200000000ULL, 1000);
+        elapsed = host_seconds() - start;
+        if ((i == 0) || (elapsed < best)) {
+            best = elapsed;
+        }
+    }
+    *expiries = runs;
+    return best;
+}
+
+// Cost of the task queue with n tasks of 100ms to 3s. Insert: 1M creates of
+//     a task already queued, one removal and one insertion each. Expire: the
+//     tick and the dispatch over 200s of virtual time, about one expiry per
+//     tick with 256 tasks. The same run without tasks gives the time of the
+//     virtual clock, which is taken out
+static void bench_queue(uint16_t n)
+{
+    uint32_t i;
+    uint32_t expiries;
+    double   start;
+    double   idle;
+    double   insert;
+    double   expire;
+
+    tasks_reset();
+    idle = run_200s(&expiries);
+    for (i = 0; i < n; i++) {
+        periods[i] = 100 + (i * 37) % 2900;
+        scheduler_create_task(&tasks[i], periods[i]);
+    }
+    start = host_seconds();
+    for (i = 0; i < OPERATIONS; i++) {
+        uint16_t k = (i * 13) % n;
+        periods[k] = 100 + (k * 37) % 2900 + (i & 7);       // the callback returns it, no re-arm
+        scheduler_create_task(&tasks[k], periods[k]);
+    }
+    insert = (host_seconds() - start) * 1e9 / OPERATIONS;
+
+    expire = (run_200s(&expiries) - idle) * 1e9 / expiries;
+    printf("%s: %3u tasks: insert %5.0f ns, expire and dispatch %5.0f ns (%u expiries)\n", QUEUE_NAME, n,
+           insert, expire, expiries);
+}
+
+int main(void)
+{
+    scheduler_init();
+    bench_queue(8);
+    bench_queue(32);
+    bench_queue(256);
+    return host_result("sched_bench_" QUEUE_NAME);
+}
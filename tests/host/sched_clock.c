@@ -0,0 +1,189 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * Clock discipline (SCHEDULER_CLOCK_DISCIPLINE) with an RTC oscillator that is
+ * off by up to a few %. The network time is read when
+ * scheduler_clock_next_query() asks for it and answers REPLY_MS later, as the
+ * NTP task of the firmware does. Once calibrated the measured error must be
+ * close to the true one, and time() must be set close to the wall-clock
+ * second with a few queries per hour. Every oscillator error is run from
+ * boot, in a process of its own.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "host.h"
+
+#if !SCHEDULER_CLOCK_DISCIPLINE
+#error "sched_clock needs SCHEDULER_CLOCK_DISCIPLINE set to 1"
+#endif
+
+#define SECOND_US       1000000LL
+#define LOOP_US         100
+#define WALL_EPOCH      1600000000LL    // wall-clock time at boot
+#define NTP_PERIOD      1064            // ms, CLOUD_NTP_TASK_INTERVAL of the firmware
+#define REPLY_MS        20              // the time query is answered after that
+#define RUN_S           3600
+#define CHECK_S         1800            // the last seconds of the run are checked
+#define PPM_OFF_MAX     150             // error left on the measured oscillator error
+#define EARLY_MAX_US    24000           // time() set before its second: three ticks
+#define LATE_MAX_US     120000          // and after it: the window of the second
+#define QUERIES_MAX     300             // per hour, once calibrated
+
+typedef struct {
+    int32_t     ppm;                    // measured
+    int64_t     early_us;               // most time() was set before its second
+    int64_t     late_us;                // and after
+    uint32_t    sets;                   // time() settings checked
+    uint32_t    wrong;                  // settings to another second than the one just begun
+    uint32_t    queries;                // in the last CHECK_S, scaled to an hour
+} strClockResult_t;
+
+static int64_t  wall_offset_us = 437123;    // wall-clock us at scheduler us 0
+static int32_t  rtc_ppm;                    // the RTC oscillator runs that much fast
+static uint32_t queries;
+
+static int64_t wall_us(void)
+{
+    int64_t us = (int64_t)rtc_port_host.us;
+
+    return WALL_EPOCH * SECOND_US + wall_offset_us + us - us / SECOND_US * rtc_ppm
+           - us % SECOND_US * rtc_ppm / SECOND_US;
+}
+
+static ticks ntp_task(void *payload);
+static ticks reply_task(void *payload);
+SCHEDULER_STATIC_TASK(ntp_timer, .callback = ntp_task);
+SCHEDULER_STATIC_TASK(reply_timer, .callback = reply_task);
+
+static ticks ntp_task(void *payload)
+{
+    ticks wait = scheduler_clock_next_query();
+
+    if (wait != 0) {
+        return wait;
+    }
+    queries++;
+    scheduler_create_task(&reply_timer, REPLY_MS);
+    return NTP_PERIOD;
+}
+
+static ticks reply_task(void *payload)
+{
+    scheduler_set_wall_time((time_t)(wall_us() / SECOND_US));
+    return 0;
+}
+
+// Runs from boot with the oscillator rtc_ppm off, watching the settings of time()
+static void simulate(strClockResult_t *result)
+{
+    uint64_t end_us = (uint64_t)RUN_S * SECOND_US;
+    uint64_t check_us = (uint64_t)(RUN_S - CHECK_S) * SECOND_US;
+    time_t   last = 0;
+    bool     checking = false;
+
+    memset(result, 0, sizeof (*result));
+    scheduler_init();
+    scheduler_create_task(&ntp_timer, NTP_PERIOD);
+    while (rtc_port_host.us < end_us) {
+        host_run(LOOP_US, LOOP_US);
+        if (!checking && (rtc_port_host.us >= check_us)) {
+            checking = true;
+            queries = 0;
+        }
+        if (host_system_time != last) {
+            int64_t now = wall_us();
+            int64_t off = now - (int64_t)host_system_time * SECOND_US;
+
+            last = host_system_time;
+            if (!checking) {
+                continue;
+            }
+            result->sets++;
+            if ((off < -SECOND_US / 2) || (off >= SECOND_US / 2)) {
+                result->wrong++;
+            }
+            else if (-off > result->early_us) {
+                result->early_us = -off;
+            }
+            else if (off > result->late_us) {
+                result->late_us = off;
+            }
+        }
+    }
+    result->ppm = scheduler_get_clock_ppm();
+    result->queries = queries * 3600 / CHECK_S;
+}
+
+// Each run starts from a scheduler that just booted
+static bool simulate_apart(int32_t ppm, strClockResult_t *result)
+{
+    int  fds[2];
+    bool ok;
+
+    if (pipe(fds) != 0) {
+        return false;
+    }
+    if (fork() == 0) {
+        rtc_ppm = ppm;
+        simulate(result);
+        if (write(fds[1], result, sizeof (*result)) != sizeof (*result)) {
+            _exit(1);
+        }
+        _exit(0);
+    }
+    ok = (read(fds[0], result, sizeof (*result)) == sizeof (*result));
+    wait(NULL);
+    close(fds[0]);
+    close(fds[1]);
+    return ok;
+}
+
+int main(void)
+{
+    static const int32_t ppms[] = { 0, 300, -2000, 30000, -45000 };
+    strClockResult_t     result;
+    uint8_t              i;
+
+    for (i = 0; i < sizeof (ppms) / sizeof (ppms[0]); i++) {
+        int32_t  ppm = ppms[i];
+        uint32_t seconds = CHECK_S - (int32_t)((int64_t)CHECK_S * ppm / SECOND_US);     // wall-clock ones
+
+        HOST_CHECK(simulate_apart(ppm, &result), "%ld ppm: the simulation did not report", (long)ppm);
+        printf("%6ld ppm: measured %6ld, time() set %u times, %lld us early to %lld us late, %u queries per hour\n",
+               (long)ppm, (long)result.ppm, result.sets, (long long)result.early_us, (long long)result.late_us,
+               result.queries);
+        HOST_CHECK(labs(result.ppm - ppm) <= PPM_OFF_MAX, "%ld ppm: measured %ld ppm", (long)ppm, (long)result.ppm);
+        HOST_CHECK((result.sets >= seconds - 1) && (result.sets <= seconds + 1), "%ld ppm: time() set %u times in %u s",
+                   (long)ppm, result.sets, seconds);
+        HOST_CHECK(result.wrong == 0, "%ld ppm: time() set %u times to another second", (long)ppm, result.wrong);
+        HOST_CHECK(result.early_us <= EARLY_MAX_US, "%ld ppm: time() set %lld us early", (long)ppm,
+                   (long long)result.early_us);
+        HOST_CHECK(result.late_us <= LATE_MAX_US, "%ld ppm: time() set %lld us late", (long)ppm,
+                   (long long)result.late_us);
+        HOST_CHECK(result.queries <= QUERIES_MAX, "%ld ppm: %u queries per hour", (long)ppm, result.queries);
+    }
+    return host_result("sched_clock");
+}
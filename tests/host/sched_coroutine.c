@@ -0,0 +1,99 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * Coroutine tasks (TASK_BEGIN() ... TASK_END()): the steps of one flow run at
+ * the times its waits ask for, the task ends idle, and creating it again
+ * starts it over, rescheduling it does not.
+ */
+
+#include "host.h"
+
+#define MS_US       1000ULL
+#define TICK_US     RTC_PORT_HOST_TICK_US
+
+static ticks    flow_task(void *payload);
+SCHEDULER_STATIC_TASK(flow_timer, .callback = flow_task);
+
+static bool     ready;              // what TASK_WAIT_UNTIL() waits for
+static uint8_t  step;               // the last step that ran
+static uint64_t step_us[4];         // when each one ran
+static uint16_t polls;
+
+static ticks flow_task(void *payload)
+{
+    TASK_BEGIN(&flow_timer);
+    step = 1;
+    step_us[0] = rtc_port_host.us;
+    TASK_YIELD_FOR(100);
+    step = 2;
+    step_us[1] = rtc_port_host.us;
+    TASK_WAIT_UNTIL((polls++, ready));
+    step = 3;
+    step_us[2] = rtc_port_host.us;
+    TASK_YIELD_FOR(40);
+    step = 4;
+    step_us[3] = rtc_port_host.us;
+    TASK_END();
+}
+
+int main(void)
+{
+    uint64_t ready_us;
+
+    scheduler_init();
+    scheduler_create_task(&flow_timer, 16);
+    host_run(300 * MS_US, 10);
+    HOST_CHECK(step == 2, "step %u after 300ms, waiting in 2 expected", step);
+    HOST_CHECK((step_us[1] - step_us[0] >= 100 * MS_US - TICK_US) && (step_us[1] - step_us[0] <= 100 * MS_US + TICK_US),
+               "yield of 100ms took %llu us", (unsigned long long)(step_us[1] - step_us[0]));
+    HOST_CHECK(polls >= 180 / TASK_WAIT_POLL_INTERVAL, "condition checked %u times in 200ms", polls);
+
+    // rescheduled it carries on from where it waits
+    scheduler_reschedule(&flow_timer, 16);
+    host_run(100 * MS_US, 10);
+    HOST_CHECK(step == 2, "step %u after a reschedule, still waiting in 2 expected", step);
+
+    ready = true;
+    ready_us = rtc_port_host.us;
+    host_run(200 * MS_US, 10);
+    HOST_CHECK(step == 4, "step %u once ready, 4 expected", step);
+    HOST_CHECK(step_us[2] - ready_us <= (TASK_WAIT_POLL_INTERVAL * MS_US) + TICK_US,
+               "resumed %llu us after the condition came true", (unsigned long long)(step_us[2] - ready_us));
+    HOST_CHECK((step_us[3] - step_us[2] >= 40 * MS_US - TICK_US) && (step_us[3] - step_us[2] <= 40 * MS_US + TICK_US),
+               "yield of 40ms took %llu us", (unsigned long long)(step_us[3] - step_us[2]));
+    HOST_CHECK(!scheduler_is_task_active(&flow_timer), "task still active after TASK_END()");
+
+    printf("coroutine: steps at 0, %llu, %llu, %llu ms, %u polls\n", (unsigned long long)(step_us[1] - step_us[0]) / 1000,
+           (unsigned long long)(step_us[2] - step_us[0]) / 1000, (unsigned long long)(step_us[3] - step_us[0]) / 1000,
+           polls);
+
+    // created again it starts over, from a wait of the previous run as well
+    ready = false;
+    scheduler_create_task(&flow_timer, 16);
+    host_run(200 * MS_US, 10);
+    scheduler_create_task(&flow_timer, 16);
+    host_run(50 * MS_US, 10);
+    HOST_CHECK(step == 1, "step %u after starting over, 1 expected", step);
+    return host_result("sched_coroutine");
+}
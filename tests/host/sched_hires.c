@@ -0,0 +1,168 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * High resolution tasks and delays (SCHEDULER_HIRES_TIMERS) on the simulated
+ * TCA0, 6.4us per count. Random one-shot tasks re-armed, killed and created
+ * again: none may run before its time, and only the main loop dispatch may
+ * make them late. scheduler_delay_us() waits at least its time, asleep or
+ * polling with the interrupts disabled. After scheduler_kill_all() no high
+ * resolution task is left active.
+ */
+
+#include <stdlib.h>
+#include "host.h"
+
+#if !SCHEDULER_HIRES_TIMERS
+#error "sched_hires needs SCHEDULER_HIRES_TIMERS set to 1"
+#endif
+
+#define TASKS           8
+#define EXPIRIES        100000UL
+#define LOOP_US         10
+#define COUNT_US        (1000000.0 / RTC_PORT_TIMER_HZ)
+#define LATE_MAX_US     (TASKS * LOOP_US + 2 * COUNT_US)    // a main loop pass per task due together, the rounding to counts
+
+static strTaskDef_t task_defs[TASKS];
+static strTask_t tasks[TASKS];
+static uint64_t  armed_us[TASKS];       // when the task was (re)armed
+static uint16_t  wait_us[TASKS];        // for that long
+static bool      alive[TASKS];
+
+static uint32_t  seed = 12345;
+static uint32_t  expiries;
+static uint32_t  early;
+static uint32_t  ghost_runs;
+static uint64_t  late_max_us;
+
+static uint32_t random_next(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static uint16_t random_wait(void)
+{
+    return 20 + random_next() % 20000;
+}
+
+static ticks task_run(void *payload)
+{
+    uint8_t  i = (uint8_t)(uintptr_t)payload;
+    uint64_t waited = rtc_port_host.us - armed_us[i];
+
+    expiries++;
+    if (!alive[i]) {
+        ghost_runs++;
+    }
+    if (waited < wait_us[i]) {
+        early++;
+    }
+    else if (waited - wait_us[i] > late_max_us) {
+        late_max_us = waited - wait_us[i];
+    }
+    if (random_next() % 8 == 0) {
+        alive[i] = false;
+        return 0;
+    }
+    armed_us[i] = rtc_port_host.us;
+    wait_us[i] = random_wait();
+    return wait_us[i];
+}
+
+static void create(uint8_t i)
+{
+    alive[i] = true;
+    armed_us[i] = rtc_port_host.us;
+    wait_us[i] = random_wait();
+    scheduler_create_hires_task(&tasks[i], wait_us[i]);
+}
+
+// Waits us with scheduler_delay_us(), returns how long it took
+static uint64_t delay(uint32_t us)
+{
+    uint64_t start = rtc_port_host.us;
+
+    scheduler_delay_us(us);
+    return rtc_port_host.us - start;
+}
+
+int main(void)
+{
+    uint8_t  i;
+    uint8_t  active = 0;
+    uint64_t took;
+    uint64_t slept_us;
+
+    scheduler_init();
+    for (i = 0; i < TASKS; i++) {
+        task_defs[i].callback = task_run;
+        task_defs[i].payload = (void *)(uintptr_t)i;
+        tasks[i].def = &task_defs[i];
+        create(i);
+    }
+    while (expiries < EXPIRIES) {
+        uint32_t r = random_next();
+
+        i = (r >> 8) % TASKS;
+        if (r % 64 == 0) {
+            alive[i] = false;
+            scheduler_kill_task(&tasks[i]);
+        }
+        else if ((r % 64 == 1) || !alive[i]) {
+            create(i);
+        }
+        host_run(LOOP_US, LOOP_US);
+    }
+    printf("hires: %u expiries, %u early, at most %llu us late\n", expiries, early, (unsigned long long)late_max_us);
+    HOST_CHECK(early == 0, "%u runs before their time", early);
+    HOST_CHECK(ghost_runs == 0, "%u runs of a killed task", ghost_runs);
+    HOST_CHECK(late_max_us <= LATE_MAX_US, "ran %llu us late", (unsigned long long)late_max_us);
+
+    slept_us = rtc_port_host.slept_us;
+    took = delay(1500);
+    printf("delay: 1500 us took %llu us, %llu asleep\n", (unsigned long long)took,
+           (unsigned long long)(rtc_port_host.slept_us - slept_us));
+    HOST_CHECK((took >= 1500) && (took <= 1500 + 2 * COUNT_US), "1500 us delay took %llu us", (unsigned long long)took);
+    HOST_CHECK(rtc_port_host.slept_us - slept_us >= 1000, "the CPU did not sleep through the delay");
+    took = delay(120000);
+    HOST_CHECK((took >= 120000) && (took <= 120000 + 6 * COUNT_US), "120 ms delay took %llu us", (unsigned long long)took);
+    rtc_port_irq_disable();
+    took = delay(300);
+    rtc_port_irq_enable();
+    HOST_CHECK((took >= 300) && (took <= 300 + 3 * COUNT_US), "300 us delay polled took %llu us", (unsigned long long)took);
+
+    scheduler_kill_all();
+    for (i = 0; i < TASKS; i++) {
+        alive[i] = false;
+        active += scheduler_is_task_active(&tasks[i]);
+    }
+    expiries = 0;
+    host_run(100000, LOOP_US);
+    printf("kill all: %u active, %u runs after\n", active, expiries);
+    HOST_CHECK(active == 0, "%u tasks still active after the kill-all", active);
+    HOST_CHECK(expiries == 0, "%u runs after the kill-all", expiries);
+    return host_result("sched_hires");
+}
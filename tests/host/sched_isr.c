@@ -0,0 +1,133 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * Requests from the interrupts (SCHEDULER_REQUEST_RING). The test calls the
+ * _from_isr() functions with the interrupts off, as an ISR between two
+ * passes of the main loop would. A timeout created then pushed further runs
+ * once, at the later time. A periodic task killed stops, and a signal after
+ * the kill is ignored. A create followed by a kill leaves the task killed.
+ * A full ring is reported.
+ */
+
+#include "host.h"
+
+#if !SCHEDULER_REQUEST_RING
+#error "sched_isr needs SCHEDULER_REQUEST_RING"
+#endif
+
+#define LOOP_US         100
+#define TICK_MS         (RTC_PORT_HOST_TICK_US / 1000)
+
+static strTaskDef_t task_defs[3];
+static strTask_t tasks[3];
+static uint32_t  runs[3];
+static uint64_t  ran_us[3];
+
+static ticks task_run(void *payload)
+{
+    uint8_t i = (uint8_t)(uintptr_t)payload;
+
+    runs[i]++;
+    ran_us[i] = rtc_port_host.us;
+    return (i == 1) ? 50 : 0;       // task 1 is periodic, the others are timeouts
+}
+
+// The interrupts are off in an ISR
+static void isr_begin(void)
+{
+    rtc_port_irq_disable();
+}
+
+static void isr_end(void)
+{
+    rtc_port_irq_enable();
+}
+
+int main(void)
+{
+    uint8_t  i;
+    uint64_t pushed;
+    uint32_t before;
+    uint8_t  posted = 0;
+
+    scheduler_init();
+    for (i = 0; i < 3; i++) {
+        task_defs[i].callback = task_run;
+        task_defs[i].payload = (void *)(uintptr_t)i;
+        tasks[i].def = &task_defs[i];
+    }
+
+    // a timeout created, then pushed further before it runs
+    isr_begin();
+    HOST_CHECK(scheduler_create_task_from_isr(&tasks[0], 100), "create from the ISR failed");
+    isr_end();
+    host_run(50000, LOOP_US);
+    pushed = rtc_port_host.us;     // tickless, the main loop may have slept past 50 ms
+    isr_begin();
+    HOST_CHECK(scheduler_reschedule_from_isr(&tasks[0], 300), "reschedule from the ISR failed");
+    isr_end();
+    host_run(500000, LOOP_US);
+    printf("timeout: %u runs, %llu us after the reschedule\n", runs[0], (unsigned long long)(ran_us[0] - pushed));
+    HOST_CHECK(runs[0] == 1, "the timeout ran %u times", runs[0]);
+    HOST_CHECK((ran_us[0] - pushed >= 300000) && (ran_us[0] - pushed <= (300 + 2 * TICK_MS) * 1000UL),
+               "the timeout ran %llu us after the reschedule instead of 300 ms", (unsigned long long)(ran_us[0] - pushed));
+
+    // a periodic task killed, then signaled
+    scheduler_create_task(&tasks[1], 50);
+    host_run(500000, LOOP_US);
+    HOST_CHECK(runs[1] >= 9, "the periodic task ran %u times in 500 ms", runs[1]);
+    isr_begin();
+    HOST_CHECK(scheduler_kill_task_from_isr(&tasks[1]), "kill from the ISR failed");
+    isr_end();
+    host_run(LOOP_US, LOOP_US);
+    before = runs[1];
+    isr_begin();
+    scheduler_signal(&tasks[1]);
+    isr_end();
+    host_run(500000, LOOP_US);
+    printf("kill: %u runs after\n", runs[1] - before);
+    HOST_CHECK(runs[1] == before, "the killed task ran %u times", runs[1] - before);
+    HOST_CHECK(!scheduler_is_task_active(&tasks[1]), "the killed task is active");
+
+    // created and killed before scheduler_next() sees either
+    isr_begin();
+    scheduler_create_task_from_isr(&tasks[2], 20);
+    scheduler_kill_task_from_isr(&tasks[2]);
+    isr_end();
+    host_run(200000, LOOP_US);
+    HOST_CHECK(runs[2] == 0, "the task killed after its create ran %u times", runs[2]);
+    HOST_CHECK(!scheduler_is_task_active(&tasks[2]), "the task killed after its create is active");
+
+    // the ring fills while the main loop does not run
+    isr_begin();
+    for (i = 0; i < SCHEDULER_REQUEST_RING; i++) {
+        posted += scheduler_create_task_from_isr(&tasks[2], 20);
+    }
+    isr_end();
+    printf("ring: %u of %u requests queued\n", posted, SCHEDULER_REQUEST_RING);
+    HOST_CHECK(posted == SCHEDULER_REQUEST_RING - 1, "%u requests queued in a ring of %u", posted, SCHEDULER_REQUEST_RING);
+    host_run(100000, LOOP_US);
+    HOST_CHECK(runs[2] == 1, "the task created %u times ran %u times", posted, runs[2]);
+    return host_result("sched_isr");
+}
@@ -0,0 +1,134 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * Worst-case dispatch delay per priority level under a synthetic load: the
+ * callbacks take virtual time, about 70% of the CPU. A task of the highest
+ * level waits for at most the one callback already running plus the others of
+ * its level, whatever the lower levels have due. The lower levels wait longer
+ * the lower they are. Within a level, the tasks run in the order they expire.
+ */
+
+#include <string.h>
+#include "host.h"
+
+#define SECOND_US   1000000ULL
+#define LOOP_US     10
+
+typedef struct {
+    uint8_t     priority;
+    ticks       period;         // ms, multiple of the 8ms tick
+    uint32_t    cost_us;        // time the callback takes
+} strLoad_t;
+
+static const strLoad_t load[] = {
+    { TASK_PRIORITY_NORMAL,  40, 2000 },
+    { TASK_PRIORITY_NORMAL,  40, 3000 },
+    { TASK_PRIORITY_NORMAL,  80, 5000 },
+    { TASK_PRIORITY_NORMAL,  80, 4000 },
+    { TASK_PRIORITY_NORMAL, 120, 3000 },
+    { TASK_PRIORITY_NORMAL, 200, 5000 },
+    { 1,                     24, 1000 },
+    { 1,                     48, 1000 },
+    { 1,                     96, 1000 },
+    { 2,                     16,  500 },
+    { 2,                     32,  500 },
+    { TASK_PRIORITY_HIGHEST,  8,  200 },
+    { TASK_PRIORITY_HIGHEST, 64,  200 },
+};
+
+#define LOAD_TASKS  (sizeof (load) / sizeof (load[0]))
+
+static strTaskDef_t task_defs[LOAD_TASKS];
+static strTask_t    tasks[LOAD_TASKS];
+static uint64_t     expiry_us[LOAD_TASKS];  // tick on which the task is due next
+static uint64_t     delay_max[SCHEDULER_PRIORITIES];
+static uint64_t     delay_sum[SCHEDULER_PRIORITIES];
+static uint32_t     runs[SCHEDULER_PRIORITIES];
+static uint64_t     last_expiry_us[SCHEDULER_PRIORITIES];
+static uint32_t     fifo_breaks;
+
+static ticks task_run(void *payload)
+{
+    uint8_t  i = (uint8_t)(uintptr_t)payload;
+    uint8_t  prio = load[i].priority;
+    uint64_t delay = rtc_port_host.us - expiry_us[i];
+
+    delay_max[prio] = (delay > delay_max[prio]) ? delay : delay_max[prio];
+    delay_sum[prio] += delay;
+    runs[prio]++;
+    if (expiry_us[i] < last_expiry_us[prio]) {
+        fifo_breaks++;              // one of its level that expired later ran first
+    }
+    last_expiry_us[prio] = expiry_us[i];
+    expiry_us[i] += load[i].period * 1000UL;
+    rtc_port_host_run(load[i].cost_us);
+    return load[i].period;
+}
+
+int main(void)
+{
+    uint8_t  i;
+    uint8_t  prio;
+    uint32_t cost_max = 0;
+    uint32_t cost_level[SCHEDULER_PRIORITIES] = { 0 };
+
+    scheduler_init();
+    host_run(RTC_PORT_HOST_TICK_US - rtc_port_host.us % RTC_PORT_HOST_TICK_US, 1);  // right after a tick
+    for (i = 0; i < LOAD_TASKS; i++) {
+        task_defs[i].callback = task_run;
+        task_defs[i].payload = (void *)(uintptr_t)i;
+        task_defs[i].priority = load[i].priority;
+        tasks[i].def = &task_defs[i];
+        expiry_us[i] = rtc_port_host.us + load[i].period * 1000UL;
+        cost_max = (load[i].cost_us > cost_max) ? load[i].cost_us : cost_max;
+        cost_level[load[i].priority] += load[i].cost_us;
+    }
+    rtc_port_irq_disable();         // all created on the same tick
+    for (i = 0; i < LOAD_TASKS; i++) {
+        scheduler_create_task(&tasks[i], load[i].period);
+    }
+    rtc_port_irq_enable();
+    host_run(60 * SECOND_US, LOOP_US);
+
+    for (prio = SCHEDULER_PRIORITIES; prio-- > 0;) {
+        printf("priority %u: %6u runs, dispatch delay %5llu us on average, %5llu us at worst\n",
+               prio, runs[prio], (unsigned long long)(delay_sum[prio] / runs[prio]),
+               (unsigned long long)delay_max[prio]);
+        if (prio == TASK_PRIORITY_HIGHEST) {
+            // the callback running when the task expires, then the others of
+            //     its level
+            uint32_t bound = cost_max + cost_level[prio] + LOOP_US;
+
+            HOST_CHECK(delay_max[prio] <= bound, "priority %u waited %llu us, %u us at most expected", prio,
+                       (unsigned long long)delay_max[prio], bound);
+        }
+        else {
+            HOST_CHECK(delay_max[prio] >= delay_max[prio + 1], "priority %u waits less than priority %u", prio,
+                       prio + 1);
+        }
+    }
+    printf("FIFO order broken %u times\n", fifo_breaks);
+    HOST_CHECK(fifo_breaks == 0, "tasks of a level ran out of their expiry order");
+    return host_result("sched_latency");
+}
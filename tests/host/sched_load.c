@@ -0,0 +1,100 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * CPU load (SCHEDULER_LOAD): a task burning part of every 100ms reads as that
+ * share of the second, the 10s and 60s averages follow it like exponential
+ * averages, and a main loop held up for seconds counts each of them.
+ */
+
+#include "host.h"
+
+#define MS_US       1000ULL
+#define PERIOD_MS   100
+#define EXP_10S     0.904837    // exp(-1/10), what is left of a step after 1s in the 10s average
+#define EXP_60S     0.983471    // exp(-1/60)
+
+static ticks    burn_task(void *payload);
+SCHEDULER_STATIC_TASK(burn_timer, .callback = burn_task);
+
+static uint32_t burn_ms;            // callback time per period
+static uint32_t hold_ms;            // once, on top of it
+
+// The callback takes burn_ms of virtual time, the interrupts run meanwhile
+static ticks burn_task(void *payload)
+{
+    rtc_port_host_run((burn_ms + hold_ms) * MS_US);
+    hold_ms = 0;
+    return PERIOD_MS;
+}
+
+// Per mille an exponential average reaches from start after seconds at target
+static double settle(double start, double target, uint16_t seconds, double decay)
+{
+    while (seconds--) {
+        start = target + (start - target) * decay;
+    }
+    return start;
+}
+
+// How far the figure is off
+static double off(uint16_t permille, double expected)
+{
+    return (permille > expected) ? permille - expected : expected - permille;
+}
+
+int main(void)
+{
+    strSchedulerLoad_t load;
+    uint16_t           load10;
+
+    scheduler_init();
+    burn_ms = 20;
+    scheduler_create_task(&burn_timer, PERIOD_MS);
+    host_run(60500 * MS_US, 10);
+    scheduler_get_load(&load);
+    printf("20ms per 100ms: load %u, tasks %u, isr %u, 10s %u, 60s %u\n",
+           load.load1, load.tasks, load.isr, load.load10, load.load60);
+    HOST_CHECK((load.tasks >= 195) && (load.tasks <= 205), "tasks at %u per mille, 200 expected", load.tasks);
+    HOST_CHECK(load.load1 == load.tasks + load.isr, "load %u is not tasks + isr", load.load1);
+    HOST_CHECK(off(load.load10, settle(0, 200, 60, EXP_10S)) <= 5, "10s average at %u", load.load10);
+    HOST_CHECK(off(load.load60, settle(0, 200, 60, EXP_60S)) <= 5, "60s average at %u, 63%% of 200 expected", load.load60);
+
+    // a step to 80% is followed, it lands within a window
+    burn_ms = 80;
+    host_run(10000 * MS_US, 10);
+    scheduler_get_load(&load);
+    printf("80ms per 100ms: load %u, 10s %u, 60s %u after 10s\n", load.load1, load.load10, load.load60);
+    HOST_CHECK((load.tasks >= 795) && (load.tasks <= 805), "tasks at %u per mille, 800 expected", load.tasks);
+    HOST_CHECK(off(load.load10, settle(200, 800, 10, EXP_10S)) <= 20, "10s average at %u", load.load10);
+
+    // 3s in one callback are 3 busy seconds, not one
+    load10 = load.load10;
+    hold_ms = 3000;
+    host_run(3100 * MS_US, 10);
+    scheduler_get_load(&load);
+    printf("held up 3s: load %u, 10s %u from %u\n", load.load1, load.load10, load10);
+    HOST_CHECK(load.load1 >= 950, "load %u after a 3s callback", load.load1);  // with the idle around it
+    HOST_CHECK(off(load.load10, settle(load10, load.load1, 3, EXP_10S)) <= 10, "10s average at %u after a 3s callback", load.load10);
+    return host_result("sched_load");
+}
@@ -0,0 +1,251 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * Scheduler scenarios on the virtual clock, their outcome is exact: the same
+ * build always sees the same ticks.
+ */
+
+#include <string.h>
+#include "host.h"
+
+#define TASKS       40
+#define SECOND_US   1000000ULL
+#define TICK_US     RTC_PORT_HOST_TICK_US
+
+static strTaskDef_t task_defs[TASKS];
+static strTask_t    tasks[TASKS];
+static ticks        periods[TASKS];     // what the callbacks return
+static uint32_t     runs[TASKS];
+static uint64_t     last_us[TASKS];
+static uint64_t     gap_min[TASKS];
+static uint64_t     gap_max[TASKS];
+
+static ticks task_run(void *payload)
+{
+    uint8_t i = (uint8_t)(uintptr_t)payload;
+    uint64_t now = rtc_port_host.us;
+
+    if (runs[i] != 0) {
+        if (now - last_us[i] < gap_min[i]) {
+            gap_min[i] = now - last_us[i];
+        }
+        if (now - last_us[i] > gap_max[i]) {
+            gap_max[i] = now - last_us[i];
+        }
+    }
+    last_us[i] = now;
+    runs[i]++;
+    return periods[i];
+}
+
+// Kills whatever the previous scenario left and starts over with idle tasks
+static void tasks_reset(void)
+{
+    uint8_t i;
+
+    scheduler_kill_all();
+    host_run(100000, 50);
+    for (i = 0; i < TASKS; i++) {
+        memset(&task_defs[i], 0, sizeof (task_defs[i]));
+        task_defs[i].callback = task_run;
+        task_defs[i].payload = (void *)(uintptr_t)i;
+        task_defs[i].priority = i % SCHEDULER_PRIORITIES;
+        memset(&tasks[i], 0, sizeof (tasks[i]));
+        tasks[i].def = &task_defs[i];
+        periods[i] = 0;
+        runs[i] = 0;
+        gap_min[i] = UINT64_MAX;
+        gap_max[i] = 0;
+    }
+}
+
+// curr_time wraps every 65.5s: periodic tasks keep their rate across 3 wraps
+static void scenario_wrap_around(void)
+{
+    static const ticks period_ms[] = { 8, 100, 1000, 5000, 30000 };
+    uint8_t i;
+
+    tasks_reset();
+    for (i = 0; i < sizeof (period_ms) / sizeof (period_ms[0]); i++) {
+        periods[i] = period_ms[i];
+        scheduler_create_task(&tasks[i], period_ms[i]);
+    }
+    host_run(200 * SECOND_US, 50);
+    for (i = 0; i < sizeof (period_ms) / sizeof (period_ms[0]); i++) {
+        uint32_t expected = 200000UL / period_ms[i];
+
+        printf("wrap-around: %5ums task ran %6u times, every %llu..%llu us\n", period_ms[i], runs[i],
+               (unsigned long long)gap_min[i], (unsigned long long)gap_max[i]);
+        HOST_CHECK((runs[i] + 1 >= expected) && (runs[i] <= expected + 1),
+                   "%ums task: %u runs, %u expected", period_ms[i], runs[i], expected);
+        HOST_CHECK((gap_min[i] + TICK_US >= period_ms[i] * 1000UL) && (gap_max[i] <= period_ms[i] * 1000UL + TICK_US),
+                   "%ums task: runs %llu..%llu us apart", period_ms[i],
+                   (unsigned long long)gap_min[i], (unsigned long long)gap_max[i]);
+    }
+}
+
+// 32 tasks expire on the same tick, more than the expired ring holds: all of
+//     them run, in priority order. The ones held back run up to two ticks
+//     late but keep their rate
+static uint8_t  order[TASKS];
+static uint8_t  order_count;
+
+static ticks task_order(void *payload)
+{
+    if (order_count < TASKS) {
+        order[order_count++] = (uint8_t)(uintptr_t)payload;
+    }
+    return task_run(payload);
+}
+
+static void scenario_same_tick(void)
+{
+    uint8_t  i;
+    uint32_t fewest = UINT32_MAX;
+    uint32_t most = 0;
+    uint64_t gap_low = UINT64_MAX;
+    uint64_t gap_high = 0;
+    uint8_t  inversions = 0;
+
+    tasks_reset();
+    rtc_port_irq_disable();         // all created on the same tick
+    for (i = 0; i < 32; i++) {
+        task_defs[i].callback = task_order;
+        periods[i] = 100;
+        scheduler_create_task(&tasks[i], 100);
+    }
+    rtc_port_irq_enable();
+    order_count = 0;
+    host_run(100000 - TICK_US, 10); // to the tick before the first expiry
+    order_count = 0;
+    host_run(10 * SECOND_US, 10);
+    for (i = 0; i < 32; i++) {
+        fewest = (runs[i] < fewest) ? runs[i] : fewest;
+        most = (runs[i] > most) ? runs[i] : most;
+        gap_low = (gap_min[i] < gap_low) ? gap_min[i] : gap_low;
+        gap_high = (gap_max[i] > gap_high) ? gap_max[i] : gap_high;
+    }
+    // the first expiry: the tick hands them over SCHEDULER_EXPIRED_RING - 1
+    //     at a time, each batch runs by priority
+    for (i = 1; i < SCHEDULER_EXPIRED_RING - 1; i++) {
+        if (task_defs[order[i]].priority > task_defs[order[i - 1]].priority) {
+            inversions++;
+        }
+    }
+    printf("same tick: 32 tasks ran %u..%u times, every %llu..%llu us, first batch %u priority inversions\n",
+           fewest, most, (unsigned long long)gap_low, (unsigned long long)gap_high, inversions);
+    HOST_CHECK((fewest >= 99) && (most <= 101), "runs %u..%u, 100 expected", fewest, most);
+    HOST_CHECK((gap_low + 3 * TICK_US >= 100000) && (gap_high <= 100000 + 3 * TICK_US), "runs %llu..%llu us apart",
+               (unsigned long long)gap_low, (unsigned long long)gap_high);
+    HOST_CHECK(inversions == 0, "%u priority inversions", inversions);
+}
+
+// A task killed by another one, or by itself, does not run again. One that is
+//     created again runs at its new period
+static ticks task_kill_other(void *payload)
+{
+    scheduler_kill_task(&tasks[1]);
+    return task_run(payload);
+}
+
+static void scenario_kill(void)
+{
+    uint32_t before;
+
+    tasks_reset();
+    task_defs[0].callback = task_kill_other;
+    periods[0] = 0;                 // runs once
+    periods[1] = 50;
+    periods[2] = 0;                 // kills itself by returning 0
+    periods[3] = 100;
+    scheduler_create_task(&tasks[0], 500);
+    scheduler_create_task(&tasks[1], 50);
+    scheduler_create_task(&tasks[2], 300);
+    scheduler_create_task(&tasks[3], 100);
+    host_run(SECOND_US + 50000, 50);
+    before = runs[3];
+    runs[3] = 0;
+    gap_min[3] = UINT64_MAX;
+    gap_max[3] = 0;
+    periods[3] = 400;
+    scheduler_create_task(&tasks[3], 400);
+    host_run(2 * SECOND_US, 50);
+    printf("kill: runs %u, %u, %u, %u then %u\n", runs[0], runs[1], runs[2], before, runs[3]);
+    HOST_CHECK(runs[0] == 1, "killer ran %u times", runs[0]);
+    // the killer runs after it on the tick of the kill, it has a lower priority
+    HOST_CHECK(runs[1] == 10, "killed 50ms task ran %u times, 10 expected", runs[1]);
+    HOST_CHECK((runs[2] == 1) && !scheduler_is_task_active(&tasks[2]), "task returning 0 ran %u times", runs[2]);
+    HOST_CHECK((before == 10) && (runs[3] == 5), "re-created task ran %u then %u times, 10 then 5 expected",
+               before, runs[3]);
+    HOST_CHECK((gap_min[3] + TICK_US >= 400000) && (gap_max[3] <= 400000 + TICK_US),
+               "re-created task ran %llu..%llu us apart", (unsigned long long)gap_min[3],
+               (unsigned long long)gap_max[3]);
+}
+
+// scheduler_kill_all() from a callback, with tasks waiting in the task queue
+//     and in the due queues: no expiry or signal that comes after runs them
+static ticks task_kill_all(void *payload)
+{
+    scheduler_kill_all();
+    return task_run(payload);
+}
+
+static void scenario_kill_all(void)
+{
+    uint8_t  i;
+    uint32_t before = 0;
+    uint32_t after = 0;
+
+    tasks_reset();
+    task_defs[0].callback = task_kill_all;
+    rtc_port_irq_disable();         // expire on the same tick, 0 runs first
+    for (i = 0; i < 8; i++) {
+        task_defs[i].priority = (i == 0) ? TASK_PRIORITY_HIGHEST : TASK_PRIORITY_NORMAL;
+        periods[i] = (i < 4) ? 100 : 104;
+        scheduler_create_task(&tasks[i], periods[i]);
+    }
+    rtc_port_irq_enable();
+    host_run(104000 + TICK_US, 10);
+    for (i = 0; i < 8; i++) {
+        before += runs[i];
+        scheduler_signal(&tasks[i]);    // as an ISR would
+    }
+    host_run(SECOND_US, 10);
+    for (i = 0; i < 8; i++) {
+        after += runs[i];
+    }
+    printf("kill all: %u runs before, %u after\n", before, after - before);
+    HOST_CHECK(before == 1, "%u runs before the kill-all, 1 expected", before);
+    HOST_CHECK(after == before, "%u runs after the kill-all", after - before);
+}
+
+int main(void)
+{
+    scheduler_init();
+    scenario_wrap_around();
+    scenario_same_tick();
+    scenario_kill();
+    scenario_kill_all();
+    return host_result("sched_scenarios");
+}
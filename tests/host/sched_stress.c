@@ -0,0 +1,291 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * Stress test of the hand-over between the interrupts and the main loop. A
+ * SIGALRM every few us plays an interrupt at a random point of the main loop:
+ * it runs the tick or signals a random task, whenever the main loop has the
+ * interrupts enabled. The main loop meanwhile creates (with a random slack),
+ * reschedules, kills, signals and dispatches tasks at random and now and then
+ * kills them all.
+ *
+ * The main loop knows which of its tasks it left alive: a task that was
+ * killed never runs, a running task is in the running state and
+ * scheduler_is_task_active() agrees with it. Now and then the interrupts are held off for a while to
+ * check that every alive periodic task still runs. The run is random, a
+ * failure prints the seed to repeat it with HOST_SEED.
+ */
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include "host.h"
+
+#define TASKS           24
+#define ITERATIONS      4000000UL
+#define CHECK_EVERY     65536UL     // iterations between two checks for lost tasks
+#define ISR_PERIOD_US   37          // of the SIGALRM
+
+static strTaskDef_t task_defs[TASKS];   // in RAM on the host, the slack changes
+static strTask_t    tasks[TASKS];
+static ticks        periods[TASKS];
+static bool         alive[TASKS];       // as the main loop left them
+static bool         periodic[TASKS];
+static bool         ran[TASKS];
+
+static uint32_t     runs;
+static uint32_t     ghost_runs;         // a task the main loop killed ran
+static uint32_t     bad_states;         // a running task was not in the running state
+static uint32_t     bad_active;         // scheduler_is_task_active() disagreed
+static uint32_t     lost;               // an alive periodic task did not run
+static uint32_t     kill_alls;
+static volatile uint32_t isr_runs;
+static volatile uint32_t isr_masked;    // the main loop had the interrupts off
+
+static uint32_t     main_seed;
+static uint32_t     isr_seed;
+
+// xorshift32, one state per context so the signal handler needs no lock
+static uint32_t random_next(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static ticks random_period(uint32_t r)
+{
+    return 1 + (r >> 16) % 40;
+}
+
+static ticks task_run(void *payload)
+{
+    uint8_t  i = (uint8_t)(uintptr_t)payload;
+    uint32_t r = random_next(&main_seed);
+
+    runs++;
+    ran[i] = true;
+    if (tasks[i].state != TASK_RUNNING) {
+        bad_states++;
+    }
+    if (!alive[i]) {
+        ghost_runs++;
+    }
+    if (r % 64 == 0) {
+        alive[i] = false;           // stops by returning 0
+        return 0;
+    }
+    if (r % 64 == 1) {
+        uint8_t other = (r >> 8) % TASKS;
+
+        scheduler_kill_task(&tasks[other]);
+        alive[other] = false;
+    }
+    if ((r % 64 == 2) && periodic[i]) {
+        periods[i] = random_period(r);  // re-armed from now with it
+    }
+    return periods[i];
+}
+
+// The interrupt, it may come at any point where rtc_port_host.irq is set
+static void isr_random(int sig)
+{
+    uint32_t r = random_next(&isr_seed);
+
+    (void)sig;
+    if (!rtc_port_host.irq) {
+        isr_masked++;
+        return;
+    }
+    rtc_port_host.irq = false;
+    RTC_PORT_HOST_BARRIER();
+    isr_runs++;
+    if (r % 4 != 0) {
+        scheduler_signal(&tasks[(r >> 8) % TASKS]);
+    }
+    else if (rtc_port_host.tick_on) {
+        rtc_port_tick_isr();
+    }
+    RTC_PORT_HOST_BARRIER();
+    rtc_port_host.irq = true;
+}
+
+static void isr_hold(bool hold)
+{
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGALRM);
+    sigprocmask(hold ? SIG_BLOCK : SIG_UNBLOCK, &set, NULL);
+}
+
+static void isr_start(uint32_t period_us)
+{
+    struct sigaction act;
+    struct itimerval timer;
+
+    memset(&act, 0, sizeof (act));
+    act.sa_handler = isr_random;
+    act.sa_flags = SA_RESTART;
+    sigaction(SIGALRM, &act, NULL);
+    memset(&timer, 0, sizeof (timer));
+    timer.it_value.tv_usec = period_us;
+    timer.it_interval.tv_usec = period_us;
+    setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+static void main_random(uint32_t r)
+{
+    uint8_t i = (r >> 8) % TASKS;
+
+    switch (r % 16) {
+        case 0:
+        case 1:
+            periods[i] = random_period(r);
+            periodic[i] = true;
+            alive[i] = true;
+            task_defs[i].slack = (r >> 16) % 4 * 40;
+            scheduler_create_task(&tasks[i], periods[i]);
+            break;
+        case 2:
+            periods[i] = TASK_KEEP_SCHEDULE;    // keeps waiting for the next signal
+            periodic[i] = false;
+            alive[i] = true;
+            scheduler_create_signal_task(&tasks[i]);
+            break;
+        case 3:
+            alive[i] = false;
+            scheduler_kill_task(&tasks[i]);
+            break;
+        case 4:
+            periods[i] = random_period(r);
+            periodic[i] = true;
+            alive[i] = true;
+            scheduler_reschedule(&tasks[i], periods[i]);
+            break;
+        case 5:
+            scheduler_signal(&tasks[i]);
+            break;
+        case 12:
+        case 13:
+        case 14:
+            rtc_port_host_run((r >> 16) % 200);
+            break;
+        case 15:
+            if ((r >> 16) % 4096 == 0) {
+                kill_alls++;
+                for (i = 0; i < TASKS; i++) {
+                    // the signal-only tasks are in no queue and are left, unless due
+                    alive[i] = alive[i] && !periodic[i] && (tasks[i].state != TASK_DUE);
+                }
+                scheduler_kill_all();
+            }
+            break;
+        default:
+            scheduler_next();
+            break;
+    }
+}
+
+// With the interrupts held off only the virtual tick is left: every alive
+//     periodic task runs within its period
+static void check_tasks(void)
+{
+    bool    expected[TASKS];
+    uint8_t i;
+
+    isr_hold(true);
+    for (i = 0; i < TASKS; i++) {
+        if (scheduler_is_task_active(&tasks[i]) != alive[i]) {
+            bad_active++;
+        }
+        expected[i] = alive[i] && periodic[i];
+        ran[i] = false;
+    }
+    host_run(200000, 50);
+    for (i = 0; i < TASKS; i++) {
+        if (expected[i] && alive[i] && !ran[i]) {
+            lost++;
+        }
+    }
+    isr_hold(false);
+}
+
+int main(void)
+{
+    const char *seed = getenv("HOST_SEED");
+    uint32_t   first_seed = (seed != NULL) ? (uint32_t)strtoul(seed, NULL, 0) : (uint32_t)time(NULL);
+    uint32_t   n;
+    uint8_t    i;
+    uint8_t    active = 0;
+    uint32_t   runs_before;
+    double     start = host_seconds();
+
+    main_seed = first_seed | 1;
+    isr_seed = first_seed * 2654435761UL | 1;
+    for (i = 0; i < TASKS; i++) {
+        task_defs[i].callback = task_run;
+        task_defs[i].payload = (void *)(uintptr_t)i;
+        task_defs[i].priority = i % SCHEDULER_PRIORITIES;
+        tasks[i].def = &task_defs[i];
+    }
+    scheduler_init();
+    isr_start(ISR_PERIOD_US);
+    for (n = 1; n <= ITERATIONS; n++) {
+        main_random(random_next(&main_seed));
+        if (n % CHECK_EVERY == 0) {
+            check_tasks();
+        }
+    }
+    isr_start(0);                   // stops it
+    scheduler_kill_all();
+    for (i = 0; i < TASKS; i++) {
+        scheduler_kill_task(&tasks[i]);
+    }
+    runs_before = runs;
+    host_run(1000000, 50);
+    for (i = 0; i < TASKS; i++) {
+        active += scheduler_is_task_active(&tasks[i]);
+    }
+
+    printf("stress: %lu iterations, %u interrupts (%u masked), %u runs, %u kill-alls in %.1f s\n",
+           ITERATIONS, isr_runs, isr_masked, runs, kill_alls, host_seconds() - start);
+    HOST_CHECK(isr_runs > 1000, "only %u interrupts came", isr_runs);
+    HOST_CHECK(ghost_runs == 0, "killed tasks ran %u times", ghost_runs);
+    HOST_CHECK(bad_states == 0, "%u runs of a task not in the running state", bad_states);
+    HOST_CHECK(bad_active == 0, "scheduler_is_task_active() was wrong %u times", bad_active);
+    HOST_CHECK(lost == 0, "%u periodic tasks stopped running", lost);
+    HOST_CHECK((active == 0) && (runs == runs_before), "%u tasks active, %u runs after the last kill-all",
+               active, runs - runs_before);
+    if (host_result("sched_stress") != 0) {
+        printf("HOST_SEED=%lu repeats it\n", (unsigned long)first_seed);
+        return 1;
+    }
+    return 0;
+}
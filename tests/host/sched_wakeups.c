@@ -0,0 +1,216 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * Wake-ups of the tickless idle (SCHEDULER_TICKLESS) over one hour of the
+ * stock task set once connected to the cloud. The tasks are modeled on the
+ * scheduler_create_task() calls of the firmware: same period, and the data
+ * task publishes once a second, which restarts the MQTT keep-alive. It is
+ * aligned on the wall-clock seconds the NTP task reads. The JWT refresh is the
+ * hourly long task. The CLI only runs when signaled, and no character comes
+ * in. The NTP task reads the time every 1064ms, as it does without
+ * SCHEDULER_CLOCK_DISCIPLINE: that is off here, the uptime is checked against
+ * the virtual time and the discipline would correct it.
+ *
+ * The hour runs twice, in two processes so that each starts from a fresh
+ * scheduler: with the slack the tasks declare and with none, which tells the
+ * wake-ups the timer coalescing (SCHEDULER_TIMER_SLACK) saves.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "host.h"
+
+#if !SCHEDULER_TICKLESS || !SCHEDULER_TIMER_SLACK
+#error "sched_wakeups simulates the tickless idle, build it with SCHEDULER_TICKLESS and SCHEDULER_TIMER_SLACK set to 1"
+#endif
+
+#define SECOND_US       1000000ULL
+#define HOUR_US         (3600 * SECOND_US)
+#define WALL_EPOCH      1600000000L     // wall-clock time at boot
+
+typedef struct {
+    const char  *name;
+    uint32_t    period;         // ms, 0 for a signal-only task
+    ticks       slack;          // ms
+    uint32_t    start_ms;       // created that long after boot
+} strModel_t;
+
+enum { CLI, WIFI, NTP, CLOUD, PINGREQ, JWT, DATA, LED, MODEL_TASKS };
+
+static const strModel_t model[MODEL_TASKS] = {
+    [CLI]     = { "CLI_task_timer",      0,     0,   0 },
+    [WIFI]    = { "wifiHandlerTimer",    1000,  500, 0 },
+    [NTP]     = { "ntpTimeFetchTimer",   1064,  0,   0 },
+    [CLOUD]   = { "CLOUD_taskTimer",     500,   100, 2000 },
+    [PINGREQ] = { "pingreqTimer",        9000,  0,   2000 },
+    [JWT]     = { "jwtRefreshTaskTimer", 3600000UL, 500, 2000 },
+    [DATA]    = { "MAIN_dataTasksTimer", 1000,  0,   2400 },
+    [LED]     = { "MAIN_ledTaskTimer",   1000,  500, 2400 },
+};
+
+static strTaskDef_t task_defs[MODEL_TASKS];
+static strTask_t tasks[MODEL_TASKS];
+static uint32_t  runs[MODEL_TASKS];
+
+static ticks task_run(void *payload)
+{
+    uint8_t i = (uint8_t)(uintptr_t)payload;
+
+    runs[i]++;
+    if (i == NTP) {
+        scheduler_set_wall_time(WALL_EPOCH + (time_t)(rtc_port_host.us / SECOND_US));
+    }
+    if (i == DATA) {
+        scheduler_create_task(&tasks[PINGREQ], model[PINGREQ].period);   // a PUBLISH restarts the keep-alive
+    }
+    if ((i == DATA) || (model[i].period > MAX_BASE_PERIOD)) {
+        return TASK_KEEP_SCHEDULE;
+    }
+    return (ticks)model[i].period;
+}
+
+// Boots, settles for a minute then runs one hour, the tasks with their slack or
+//     without. Returns the wake-ups of that hour, *asleep gets the permille of
+//     it spent sleeping
+static uint32_t simulate(bool slack, uint16_t *asleep)
+{
+    uint64_t boot_us = rtc_port_host.us;
+    uint32_t other_irq_us = rtc_port_host.other_irq_us;
+    uint8_t  i;
+    uint32_t wakeups;
+    uint64_t slept_us;
+    uint32_t now;
+    uint64_t now_us;
+    int32_t  off;
+
+    for (i = 0; i < MODEL_TASKS; i++) {
+        task_defs[i].callback = task_run;
+        task_defs[i].payload = (void *)(uintptr_t)i;
+        task_defs[i].name = model[i].name;
+        task_defs[i].slack = slack ? model[i].slack : 0;
+        tasks[i].def = &task_defs[i];
+    }
+    scheduler_init();
+    rtc_port_host.other_irq_us = 1000;          // the boot messages keep the USART busy
+    for (i = 0; i < MODEL_TASKS; i++) {         // in boot order
+        if (rtc_port_host.us < boot_us + model[i].start_ms * 1000ULL) {
+            host_run(boot_us + model[i].start_ms * 1000ULL - rtc_port_host.us, 100);
+        }
+        if (model[i].period == 0) {
+            scheduler_create_signal_task(&tasks[i]);
+        }
+        else if (i == DATA) {
+            scheduler_create_aligned_task(&tasks[i], model[i].period / 1000);
+        }
+        else {
+            scheduler_create_long_task(&tasks[i], model[i].period);
+        }
+    }
+    rtc_port_host.other_irq_us = other_irq_us;
+    host_run(60 * SECOND_US, 100);
+    memset(runs, 0, sizeof (runs));
+    wakeups = rtc_port_host.wakeups;
+    slept_us = rtc_port_host.slept_us;
+    now = scheduler_get_time();
+    now_us = rtc_port_host.us;
+    host_run(HOUR_US, 100);
+    // the last sleep may end past the hour, the uptime follows it to the tick
+    off = (int32_t)(scheduler_get_time() - now) - (int32_t)((rtc_port_host.us - now_us) / 1000);
+    HOST_CHECK((off > -(int32_t)(RTC_PORT_HOST_TICK_US / 1000)) && (off < (int32_t)(RTC_PORT_HOST_TICK_US / 1000)),
+               "uptime went %ld ms off the virtual time in an hour", (long)off);
+    *asleep = (uint16_t)((rtc_port_host.slept_us - slept_us) * 1000 / HOUR_US);
+    scheduler_kill_all();
+    return rtc_port_host.wakeups - wakeups;
+}
+
+static void check_runs(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < MODEL_TASKS; i++) {
+        printf("  %-20s %6u runs\n", model[i].name, runs[i]);
+    }
+    HOST_CHECK((runs[CLOUD] >= 7199) && (runs[CLOUD] <= 7201), "CLOUD_task ran %u times, 7200 expected", runs[CLOUD]);
+    HOST_CHECK((runs[DATA] >= 3599) && (runs[DATA] <= 3601), "data task ran %u times, 3600 expected", runs[DATA]);
+    HOST_CHECK(runs[PINGREQ] == 0, "PINGREQ sent %u times with a PUBLISH every second", runs[PINGREQ]);
+    HOST_CHECK(runs[JWT] == 1, "JWT refreshed %u times in an hour", runs[JWT]);
+}
+
+// The hour without slack, in a child process
+static uint32_t simulate_apart(void)
+{
+    int      fds[2];
+    uint16_t asleep;
+    uint32_t wakeups = 0;
+
+    if (pipe(fds) != 0) {
+        return 0;
+    }
+    if (fork() == 0) {
+        wakeups = simulate(false, &asleep);
+        if (write(fds[1], &wakeups, sizeof (wakeups)) != sizeof (wakeups)) {
+            _exit(1);
+        }
+        _exit(0);
+    }
+    if (read(fds[0], &wakeups, sizeof (wakeups)) != sizeof (wakeups)) {
+        wakeups = 0;
+    }
+    wait(NULL);
+    close(fds[0]);
+    close(fds[1]);
+    return wakeups;
+}
+
+int main(void)
+{
+    uint16_t asleep;
+    uint32_t wakeups;
+    uint32_t unslacked;
+
+    fflush(stdout);                 // the child would print it again
+    unslacked = simulate_apart();
+    printf("tickless without slack: %u wake-ups per hour\n", unslacked);
+    wakeups = simulate(true, &asleep);
+    printf("ticking: %lu wake-ups per hour (the PIT every %lu us)\n",
+           (unsigned long)(HOUR_US / RTC_PORT_HOST_TICK_US), RTC_PORT_HOST_TICK_US);
+    printf("tickless: %u wake-ups per hour, %u fewer with the slack (%u%%), asleep %u.%u%% of the time\n",
+           wakeups, unslacked - wakeups, (unslacked != 0) ? (unslacked - wakeups) * 100 / unslacked : 0,
+           asleep / 10, asleep % 10);
+    check_runs();
+    HOST_CHECK(wakeups < HOUR_US / RTC_PORT_HOST_TICK_US / 2, "%u wake-ups", wakeups);
+    HOST_CHECK((unslacked != 0) && (wakeups < unslacked), "%u wake-ups with the slack, %u without", wakeups, unslacked);
+
+    // the PIT periods need not start on a multiple of 8 of the RTC count: the
+    //     ticks slept through must all be accounted for, also when another
+    //     interrupt ends the sleep between two of them
+    memset(&rtc_port_host, 0, sizeof (rtc_port_host));
+    rtc_port_host.tick_phase_us = 3 * 1000;
+    rtc_port_host.other_irq_us = 37 * 1000;
+    wakeups = simulate(true, &asleep);
+    printf("tickless, PIT 3 counts out of phase, another interrupt every 37ms: %u wake-ups per hour\n", wakeups);
+    check_runs();
+    return host_result("sched_wakeups");
+}
@@ -0,0 +1,150 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * Wall-clock tasks (SCHEDULER_WALL_CLOCK) against a simulated network time
+ * that is off from the scheduler time by a fraction of a second and drifts
+ * from it. The time is read in whole seconds every 1064ms, as the NTP task of
+ * the firmware does. The aligned task must run once per true second, never
+ * before the second begins, also after the clock was set and with the two
+ * clocks drifting apart. How late it runs is how precisely the scheduler knows
+ * where the seconds begin. An absolute time task runs once, at its second.
+ */
+
+#include "host.h"
+
+#if !SCHEDULER_WALL_CLOCK
+#error "sched_wallclock needs SCHEDULER_WALL_CLOCK set to 1"
+#endif
+
+#define SECOND_US       1000000ULL
+#define LOOP_US         100
+#define WALL_EPOCH      1600000000LL    // wall-clock time at boot
+#define NTP_PERIOD      1064
+#define LATE_MAX_US     80000           // the window of the readings, widened 1ms per second
+#define LATE_DRIFT_US   125000          // drift beyond the 1000ppm the window allows for
+
+static int64_t  wall_offset_us = 437123;    // wall-clock us at scheduler us 0
+static int32_t  wall_ppm;                   // the wall clock runs that much faster
+
+static int64_t wall_us(void)
+{
+    int64_t us = (int64_t)rtc_port_host.us;
+
+    return WALL_EPOCH * (int64_t)SECOND_US + wall_offset_us + us + us / 1000000 * wall_ppm
+           + us % 1000000 * wall_ppm / 1000000;
+}
+
+static ticks ntp_task(void *payload);
+static ticks aligned_task(void *payload);
+static ticks at_task(void *payload);
+SCHEDULER_STATIC_TASK(ntp_timer, .callback = ntp_task);
+SCHEDULER_STATIC_TASK(aligned_timer, .callback = aligned_task);
+SCHEDULER_STATIC_TASK(at_timer, .callback = at_task);
+
+static uint32_t aligned_runs;
+static int64_t  late_min_us;                // how long after the wall-clock second the aligned runs came
+static int64_t  late_max_us;
+static int64_t  prev_sec;
+static uint32_t skipped;                    // seconds without a run, or with two
+static uint32_t at_runs;
+static int64_t  at_us;
+
+static ticks ntp_task(void *payload)
+{
+    scheduler_set_wall_time((time_t)(wall_us() / SECOND_US));
+    return NTP_PERIOD;
+}
+
+static ticks aligned_task(void *payload)
+{
+    int64_t now = wall_us();
+    int64_t late = now % SECOND_US;
+
+    if (late > SECOND_US / 2) {
+        late -= SECOND_US;                  // ran before the second began
+    }
+    if (aligned_runs == 0 || late < late_min_us) {
+        late_min_us = late;
+    }
+    if (aligned_runs == 0 || late > late_max_us) {
+        late_max_us = late;
+    }
+    if ((aligned_runs != 0) && ((now + SECOND_US / 2) / SECOND_US != prev_sec + 1)) {
+        skipped++;
+    }
+    prev_sec = (now + SECOND_US / 2) / SECOND_US;
+    aligned_runs++;
+    return TASK_KEEP_SCHEDULE;
+}
+
+static ticks at_task(void *payload)
+{
+    at_runs++;
+    at_us = wall_us();
+    return TASK_KEEP_SCHEDULE;
+}
+
+// Runs for s seconds, then checks the aligned runs of the last check_s of them
+static void run_aligned(const char *what, uint32_t s, uint32_t check_s, int64_t late_max)
+{
+    uint32_t expected = check_s + (uint32_t)((int64_t)check_s * wall_ppm / 1000000);
+
+    host_run((uint64_t)(s - check_s) * SECOND_US, LOOP_US);
+    aligned_runs = 0;
+    skipped = 0;
+    host_run((uint64_t)check_s * SECOND_US, LOOP_US);
+    printf("%s: %u runs, %lld to %lld us after the second\n", what, aligned_runs, (long long)late_min_us,
+           (long long)late_max_us);
+    HOST_CHECK((aligned_runs >= expected - 1) && (aligned_runs <= expected + 1), "%s: %u runs, %u expected", what,
+               aligned_runs, expected);
+    HOST_CHECK(skipped == 0, "%s: %u seconds skipped or run twice", what, skipped);
+    HOST_CHECK(late_min_us >= 0, "%s: ran %lld us before the second", what, (long long)-late_min_us);
+    HOST_CHECK(late_max_us <= late_max, "%s: ran %lld us after the second", what, (long long)late_max_us);
+}
+
+int main(void)
+{
+    int64_t when;
+
+    scheduler_init();
+    scheduler_create_task(&ntp_timer, NTP_PERIOD);
+    scheduler_create_aligned_task(&aligned_timer, 1);
+    run_aligned("aligned", 600, 540, LATE_MAX_US);
+
+    wall_offset_us += 5 * SECOND_US + 300000;   // the clock is set
+    run_aligned("after a 5.3s clock step", 60, 30, LATE_MAX_US);
+
+    wall_ppm = 2000;
+    run_aligned("2000ppm drift", 1200, 1140, LATE_DRIFT_US);
+
+    when = wall_us() / SECOND_US + 10;
+    HOST_CHECK(scheduler_create_task_at(&at_timer, (time_t)when), "absolute time task refused");
+    host_run(30 * SECOND_US, LOOP_US);
+    printf("absolute: %u runs, %lld us after its second\n", at_runs, (long long)(at_us - when * (int64_t)SECOND_US));
+    HOST_CHECK(at_runs == 1, "absolute time task ran %u times", at_runs);
+    HOST_CHECK((at_us >= when * (int64_t)SECOND_US) && (at_us <= when * (int64_t)SECOND_US + LATE_DRIFT_US),
+               "absolute time task ran %lld us after its second", (long long)(at_us - when * (int64_t)SECOND_US));
+    HOST_CHECK(!scheduler_is_task_active(&at_timer), "absolute time task still active after its run");
+    return host_result("sched_wallclock");
+}
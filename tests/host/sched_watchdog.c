@@ -0,0 +1,122 @@
+/*
+    (c) 2018 Microchip Technology Inc. and its subsidiaries.
+
+    Subject to your compliance with these terms, you may use Microchip software and any
+    derivatives exclusively with Microchip products. It is your responsibility to comply with third party
+    license terms applicable to your use of third party software (including open source software) that
+    may accompany Microchip software.
+
+    THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS". NO WARRANTIES, WHETHER
+    EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY
+    IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS
+    FOR A PARTICULAR PURPOSE.
+
+    IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE,
+    INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND
+    WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP
+    HAS BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE. TO
+    THE FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL
+    CLAIMS IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT
+    OF FEES, IF ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS
+    SOFTWARE.
+*/
+
+/*
+ * Task budgets and the WDT supervisor (SCHEDULER_WATCHDOG). A critical task
+ * runs every 100ms with a 2s deadline while a hog callback keeps the main
+ * loop for a while: 160ms is logged against the default budget, 1.6s leaves
+ * the critical task on time, 2.4s makes it late and the WDT is not fed
+ * anymore. After scheduler_kill_all() no task is active and the WDT is still
+ * fed, at least every second when tickless. A faked WDT reset names the late
+ * task.
+ */
+
+#include "host.h"
+
+#if !SCHEDULER_WATCHDOG
+#error "sched_watchdog needs SCHEDULER_WATCHDOG set to 1"
+#endif
+
+#define LOOP_US         100
+#define TICK_US         RTC_PORT_HOST_TICK_US
+#if SCHEDULER_TICKLESS
+#define FED_MAX_US      (1000000UL + 2 * TICK_US)   // the idle wakes up to feed it
+#else
+#define FED_MAX_US      (2 * TICK_US)
+#endif
+
+static uint32_t hog_us;                 // the next run of the hog keeps the main loop that long
+static uint64_t hog_start_us;
+
+static ticks critical_task(void *payload)
+{
+    return TASK_KEEP_SCHEDULE;
+}
+
+static ticks hog_task(void *payload)
+{
+    hog_start_us = rtc_port_host.us;
+    rtc_port_host_run(hog_us);
+    return 0;
+}
+
+SCHEDULER_STATIC_TASK(critical_timer, .callback = critical_task, .period = 100, .deadline = 2000);
+SCHEDULER_STATIC_TASK(hog_timer, .callback = hog_task);
+
+// Runs the hog once for us then the main loop for 3s, returns the errors logged
+static uint32_t hog(uint32_t us)
+{
+    uint32_t errors = host_errors;
+
+    hog_us = us;
+    scheduler_create_task(&hog_timer, 10);
+    host_run(3000000UL, LOOP_US);
+    return host_errors - errors;
+}
+
+static uint64_t fed_ago(void)
+{
+    return rtc_port_host.us - rtc_port_host.wdt_fed;
+}
+
+int main(void)
+{
+    uint32_t errors;
+
+    scheduler_init();
+    scheduler_start_task(&critical_timer);
+    scheduler_watchdog_start();
+    HOST_CHECK(rtc_port_host.wdt_period == SCHEDULER_WATCHDOG_PERIOD, "WDT not started");
+    host_run(1000000UL, LOOP_US);
+    HOST_CHECK(host_errors == 0, "%u errors logged without a hog", host_errors);
+
+    errors = hog(160000UL);
+    printf("160 ms callback: %u errors, fed %llu us ago\n", errors, (unsigned long long)fed_ago());
+    HOST_CHECK(errors == 1, "%u errors logged for a run over the budget", errors);
+    HOST_CHECK(fed_ago() <= FED_MAX_US, "WDT not fed for %llu us", (unsigned long long)fed_ago());
+
+    errors = hog(1600000UL);
+    printf("1.6 s callback: %u errors, fed %llu us ago\n", errors, (unsigned long long)fed_ago());
+    HOST_CHECK(errors == 1, "%u errors logged, the critical task was on time", errors);
+    HOST_CHECK(fed_ago() <= FED_MAX_US, "WDT not fed for %llu us", (unsigned long long)fed_ago());
+
+    scheduler_kill_all();
+    host_run(3000000UL, LOOP_US);
+    printf("kill all: %s active, fed %llu us ago\n", scheduler_is_task_active(&critical_timer) ? "still" : "none",
+           (unsigned long long)fed_ago());
+    HOST_CHECK(!scheduler_is_task_active(&critical_timer), "the critical task is active after the kill-all");
+    HOST_CHECK(fed_ago() <= FED_MAX_US, "WDT not fed for %llu us after the kill-all", (unsigned long long)fed_ago());
+
+    scheduler_start_task(&critical_timer);
+    host_run(1000000UL, LOOP_US);
+    errors = hog(2400000UL);
+    printf("2.4 s callback: %u errors, fed %llu us ago\n", errors, (unsigned long long)fed_ago());
+    HOST_CHECK(errors == 2, "%u errors logged instead of the budget and the deadline", errors);
+    HOST_CHECK(rtc_port_host.wdt_fed <= hog_start_us, "WDT fed %llu us ago with a critical task late", (unsigned long long)fed_ago());
+
+    errors = host_errors;
+    rtc_port_host.wdt_fired = true;     // the device was reset, the late task is still recorded
+    scheduler_watchdog_start();
+    HOST_CHECK(host_errors - errors == 1, "the watchdog reset was not reported");
+    return host_result("sched_watchdog");
+}
@@ -0,0 +1,474 @@
+#!/usr/bin/env python3
+"""Schedulability and worst-case response time of the scheduler task set.
+
+Reads the task declarations of the firmware sources and, optionally, the
+execution times measured on a board, then bounds for every task how late it
+can start and when it completes under the scheduler_next() model:
+
+    sched_analyze.py -p sched.txt            WCETs measured by the profiling
+    sched_analyze.py --budgets               the task budgets taken as WCETs, an upper bound
+    sched_analyze.py -p sched.txt --wcet jwtRefreshTaskTimer=20000 --period checkBackTimer=50 \
+                     --ignore softApConnectTimer
+
+sched.txt is a terminal capture of the "sched" CLI command of a firmware
+built with SCHEDULER_PROFILING set to 1 in scheduler_config.h, after it ran
+long enough to see the worst cases. The exit status is 1 when a task can miss
+its deadline or the MQTT keep-alive can be missed, so the tool can gate a
+build.
+
+A task needs a WCET to be analyzed: measured (-p) or given (--wcet), the
+others are left out. With --budgets they run as long as their .budget
+instead. The budgets are the runs the watchdog logs as too long, far above
+the usual run, so the result is then only an upper bound: the task set is
+schedulable when it passes, a miss or an overload may never happen and does
+not set the exit status.
+
+The tasks are found in SCHEDULER_TASK() and SCHEDULER_STATIC_TASK() (and the
+macros defined as one of them, like timeout_declare()). Their period is the
+smallest value their callback returns (TASK_YIELD_FOR() included, the polls
+of TASK_WAIT_UNTIL() only check its condition, TASK_KEEP_SCHEDULE stands for
+the period the task is created with) or, when those cannot be
+worked out, the smallest value they are created with. Long and aligned tasks
+keep the period they are created with. A task whose callback only returns 0,
+or a signal task, is sporadic: it counts once in every busy window. --period
+gives the period of the tasks the sources leave open, --ignore leaves out
+other tasks. The coroutines (TASK_BEGIN() to TASK_END()) run through once,
+at boot, and are left out unless --coroutines is given.
+
+The model (see scheduler_next() in src/rtc.c):
+  - a due task runs to completion, the highest priority level first and in
+    due order within a level, so a task can be blocked by one lower level
+    callback that just started and delayed by every task of its level or above
+  - a task is handed over by the tick, up to SCHEDULER_BASE_PERIOD after its
+    due time, and up to its .slack later with SCHEDULER_TIMER_SLACK
+  - the deadline is the .deadline of the task, its period otherwise
+
+The response time is the sufficient bound for fixed priority non-preemptive
+scheduling with release jitter (Davis, Burns, Bril and Lukkien, Real-Time
+Systems 35(3), 2007):
+
+    w = B + sum over the other tasks j of its level or above of (floor((w + Jj) / Tj) + 1) * Cj
+    R = J + w + C
+
+w + J is the worst lateness, the "late" column of the "sched" command
+measures the same thing.
+"""
+
+import argparse
+import math
+import os
+import re
+import sys
+
+BASE_PERIOD = 8                 # ms per tick, SCHEDULER_BASE_PERIOD in rtc.c
+
+DECLARERS = {"SCHEDULER_TASK", "SCHEDULER_STATIC_TASK"}
+# task creation functions: (argument holding the time, ms per unit)
+CREATORS = {
+    "scheduler_create_task": (1, 1),
+    "scheduler_create_task_from_isr": (1, 1),
+    "scheduler_reschedule": (1, 1),
+    "scheduler_reschedule_from_isr": (1, 1),
+    "scheduler_create_long_task": (1, 1),
+    "scheduler_create_aligned_task": (1, 1000),
+    "scheduler_start_task": (None, None),
+    "scheduler_create_signal_task": (None, None),
+    "scheduler_create_hires_task": (None, None),
+    "scheduler_create_task_at": (None, None),
+}
+KEEPS_PERIOD = {"scheduler_create_long_task", "scheduler_create_aligned_task"}
+
+KEEPALIVE_TASK = "pingreqTimer"         # sets the flag once the keep-alive time is almost up
+KEEPALIVE_SENDER = "CLOUD_taskTimer"    # sends the PINGREQ from MQTT_TransmissionHandler()
+KEEPALIVE_MARGIN = "KEEP_ALIVE_CALCULATION_CONSTANT * SECONDS"
+# checkPingreqTimeoutState() returns this with the keep-alive of mqtt_packetPopulate.c
+KEEPALIVE_PERIOD = "(CFG_MQTT_CONN_TIMEOUT - KEEP_ALIVE_CALCULATION_CONSTANT) * SECONDS"
+
+
+class Task:
+    def __init__(self, name, fields, where):
+        self.name = name
+        self.fields = fields            # .field = expression, from the declaration
+        self.where = where
+        self.callback = fields.get("callback")
+        self.coroutine = False
+        self.creates = []               # (function, ms or None)
+        self.period = None              # ms, None for sporadic
+        self.period_from = ""
+        self.priority = 0
+        self.slack = 0
+        self.budget = 0
+        self.deadline = 0
+        self.wcet = None                # ms
+        self.wcet_from = ""
+        self.late_seen = None           # ms, measured
+        self.response = None
+        self.lateness = None
+
+
+def strip_comments(text):
+    def blank(match):
+        s = match.group(0)
+        return s if s[0] in "\"'" else re.sub(r"[^\n]", " ", s)
+    return re.sub(r'//[^\n]*|/\*.*?\*/|"(?:\\.|[^"\\])*"|\'(?:\\.|[^\'\\])*\'', blank, text, flags=re.S)
+
+
+def balanced(text, start):
+    """Return the text between the parenthesis or brace at start and its match."""
+    pair = {"(": ")", "{": "}"}[text[start]]
+    depth = 0
+    for i in range(start, len(text)):
+        if text[i] == text[start]:
+            depth += 1
+        elif text[i] == pair:
+            depth -= 1
+            if depth == 0:
+                return text[start + 1:i]
+    return text[start + 1:]
+
+
+def split_args(args):
+    out, depth, cur = [], 0, ""
+    for c in args:
+        if c in "([{":
+            depth += 1
+        elif c in ")]}":
+            depth -= 1
+        if c == "," and depth == 0:
+            out.append(cur.strip())
+            cur = ""
+        else:
+            cur += c
+    if cur.strip():
+        out.append(cur.strip())
+    return out
+
+
+class Sources:
+    def __init__(self, root):
+        self.files = {}
+        for top, dirs, names in os.walk(root):
+            # the host programs of tests/ are not part of the firmware
+            dirs[:] = [d for d in dirs if not d.startswith((".", "_")) and (top != root or d != "tests")]
+            for name in sorted(names):
+                if name.endswith((".c", ".h")):
+                    path = os.path.join(top, name)
+                    with open(path, encoding="latin-1") as f:
+                        self.files[os.path.relpath(path, root)] = strip_comments(f.read())
+        self.defines = {}
+        self.aliases = {}               # function-like macro: function it stands for
+        for text in self.files.values():
+            for m in re.finditer(r"^[ \t]*#[ \t]*define[ \t]+(\w+)(\([^)]*\))?[ \t]*(.*?)[ \t]*$", text, re.M):
+                name, params, body = m.groups()
+                if params is None:
+                    self.defines.setdefault(name, body)
+                    continue
+                call = re.match(r"(\w+)\s*\(", body)
+                if call:
+                    self.aliases.setdefault(name, call.group(1))
+
+    def value(self, expr, depth=0):
+        """Integer value of a constant C expression, None when it depends on a variable."""
+        if expr is None or depth > 20:
+            return None
+        expr = re.sub(r"\(\s*(?:u?int\d+_t|unsigned|long|int|ticks|time_t)\s*\)", "", expr)
+        expr = re.sub(r"\b(0x[0-9a-fA-F]+|\d+)[uUlL]+\b", r"\1", expr)
+        expr = expr.replace("true", "1").replace("false", "0")
+
+        def expand(m):
+            name = m.group(0)
+            if name not in self.defines:
+                raise KeyError(name)
+            inner = self.value(self.defines[name], depth + 1)
+            if inner is None:
+                raise KeyError(name)
+            return "(%d)" % inner
+        try:
+            expr = re.sub(r"\b[A-Za-z_]\w*\b", expand, expr)
+            if not re.fullmatch(r"[\s\d()+\-*/%<>x]*", expr):
+                return None
+            return int(eval(expr.replace("/", "//"), {"__builtins__": {}}))
+        except (KeyError, SyntaxError, ZeroDivisionError, TypeError):
+            return None
+
+    def resolve(self, name, wanted):
+        """Follow the macro aliases of name, e.g. timeout_create -> scheduler_create_task."""
+        seen = set()
+        while name not in wanted and name in self.aliases and name not in seen:
+            seen.add(name)
+            name = self.aliases[name]
+        return name if name in wanted else None
+
+    def tasks(self):
+        tasks = {}
+        for path, text in self.files.items():
+            for m in re.finditer(r"\b(\w+)\s*\(", text):
+                if self.resolve(m.group(1), DECLARERS) is None:
+                    continue
+                if re.match(r"\s*#\s*define", text[text.rfind("\n", 0, m.start()) + 1:m.start()]):
+                    continue
+                args = split_args(balanced(text, m.end() - 1))
+                if not args or not re.fullmatch(r"\w+", args[0]):
+                    continue
+                fields = {}
+                for arg in args[1:]:
+                    field = re.match(r"\.(\w+)\s*=\s*(.*)", arg, re.S)
+                    if field:
+                        fields[field.group(1)] = " ".join(field.group(2).split())
+                tasks[args[0]] = Task(args[0], fields, "%s:%d" % (path, text.count("\n", 0, m.start()) + 1))
+        for text in self.files.values():
+            for m in re.finditer(r"\b(\w+)\s*\(", text):
+                func = self.resolve(m.group(1), CREATORS)
+                if func is None:
+                    continue
+                args = split_args(balanced(text, m.end() - 1))
+                target = re.fullmatch(r"&\s*(\w+)", args[0]) if args else None
+                if target is None or target.group(1) not in tasks:
+                    continue
+                arg, unit = CREATORS[func]
+                ms = None
+                if arg is not None and len(args) > arg:
+                    ms = self.value(args[arg])
+                    ms = ms * unit if ms is not None else None
+                tasks[target.group(1)].creates.append((func, ms))
+        return tasks
+
+    def returns(self, callback):
+        """Values the callback can return: ([ms], any unknown, keeps its schedule, a coroutine)."""
+        for text in self.files.values():
+            m = re.search(r"\bticks\s+%s\s*\([^)]*\)\s*\{" % re.escape(callback), text)
+            if m is None:
+                continue
+            body = balanced(text, m.end() - 1)
+            values, unknown, keeps = [], False, False
+            exprs = re.findall(r"\breturn\b([^;]*);", body)
+            exprs += re.findall(r"\bTASK_YIELD_FOR\s*\(([^;]*)\)\s*;", body)
+            for expr in exprs:
+                if expr.strip() == "TASK_KEEP_SCHEDULE":
+                    keeps = True
+                    continue
+                value = self.value(expr.strip()) if expr.strip() else 0
+                if value is None:
+                    unknown = True
+                else:
+                    values.append(value)
+            return values, unknown, keeps, re.search(r"\bTASK_BEGIN\b", body) is not None
+        return [], True, False, False
+
+
+def parse_profile(lines):
+    """Return {name: (runs, exec max us, late ms)} from a "sched" command capture."""
+    stats = {}
+    table = False
+    for line in lines:
+        words = line.split()
+        if words[:2] == ["task", "runs"]:
+            table, stats = True, {}
+            continue
+        if not table:
+            continue
+        m = re.match(r"\s*(\S+)\s+(\d+)\s+(\d+)/\s*(\d+)/\s*(\d+)\s+(\d+)", line)
+        if m:
+            stats[m.group(1)] = (int(m.group(2)), int(m.group(5)), int(m.group(6)))
+        elif len(words) == 2 and words[1] == "0":
+            stats[words[0]] = (0, 0, 0)
+        else:
+            table = False
+    return stats
+
+
+def assign(sources, tasks, profile, args):
+    task_budget = sources.value("SCHEDULER_TASK_BUDGET") or 100
+    overrides = dict(parse_pairs(args.period, "--period"))
+    wcets = dict(parse_pairs(args.wcet, "--wcet"))
+    for task in tasks.values():
+        task.priority = sources.value(task.fields.get("priority", "0")) or 0
+        task.slack = sources.value(task.fields.get("slack", "0")) or 0
+        task.budget = sources.value(task.fields.get("budget", "0")) or task_budget
+        task.deadline = sources.value(task.fields.get("deadline", "0")) or 0
+
+        declared = sources.value(task.fields.get("period"))
+        created = [ms for func, ms in task.creates if ms]
+        if declared and any(func == "scheduler_start_task" for func, _ in task.creates):
+            created.append(declared)
+        kept = [ms for func, ms in task.creates if func in KEEPS_PERIOD and ms]
+        values, unknown, keeps, task.coroutine = sources.returns(task.callback) if task.callback else ([], True, False, False)
+        periods = [v for v in values if v > 0]
+        if keeps:
+            periods += created
+        signaled = [func for func, _ in task.creates if func == "scheduler_create_signal_task"]
+        if task.name in overrides:
+            task.period, task.period_from = overrides[task.name], "given"
+        elif task.name == KEEPALIVE_TASK and sources.value(KEEPALIVE_PERIOD):
+            task.period, task.period_from = sources.value(KEEPALIVE_PERIOD), "keep-alive"
+        elif signaled and len(signaled) == len(task.creates):
+            task.period_from = "signal"     # runs when signaled, whatever the callback returns
+        elif kept:
+            task.period, task.period_from = min(kept), "created"
+        elif periods:
+            task.period, task.period_from = min(periods), "callback"
+        elif unknown and created:
+            task.period, task.period_from = min(created), "created"
+        else:
+            task.period_from = "sporadic"
+
+        short = task.name[:8]           # the "sched" command prints 8 characters
+        matches = [name for name in tasks if name[:8] == short]
+        if task.name in wcets:
+            task.wcet, task.wcet_from = wcets[task.name] / 1000.0, "given"
+        elif short in profile and len(matches) == 1 and profile[short][0]:
+            runs, exec_max, late = profile[short]
+            task.wcet, task.wcet_from = exec_max / 1000.0, "measured %d runs" % runs
+            task.late_seen = late
+        elif args.budgets:
+            task.wcet, task.wcet_from = float(task.budget), "budget"
+        elif profile:
+            task.wcet_from = "not run"      # idle while profiled, e.g. the provisioning tasks
+            continue
+        else:
+            task.wcet_from = "not measured"
+            continue
+        task.wcet *= 100.0 / (100.0 - args.isr)
+
+
+def parse_pairs(pairs, option):
+    for pair in pairs or []:
+        name, _, value = pair.partition("=")
+        if not value.isdigit():
+            sys.exit("%s expects name=value, not %r" % (option, pair))
+        yield name, int(value)
+
+
+def analyze(tasks, horizon):
+    """Fill in the response time and the lateness of every task, None when unbounded."""
+    for task in tasks:
+        jitter = BASE_PERIOD + task.slack
+        blocking = max([t.wcet for t in tasks if t.priority < task.priority] or [0])
+        others = [t for t in tasks if t is not task and t.priority >= task.priority]
+        w = blocking + sum(t.wcet for t in others)
+        while True:
+            nxt = blocking
+            for t in others:
+                jobs = 1 if t.period is None else math.floor((w + BASE_PERIOD + t.slack) / t.period) + 1
+                nxt += jobs * t.wcet
+            if nxt == w or nxt > horizon:
+                break
+            w = nxt
+        if nxt > horizon:
+            task.response = task.lateness = None
+        else:
+            task.lateness = jitter + w
+            task.response = task.lateness + task.wcet
+
+
+def ms(value):
+    return "-" if value is None else ("%.1f" % value if value < 100 else "%.0f" % value)
+
+
+def report(tasks, sources, out):
+    periodic = [t for t in tasks if t.period]
+    util = sum(t.wcet / t.period for t in periodic)
+    n = len(periodic)
+    ll_bound = n * (2 ** (1.0 / n) - 1) if n else 1.0
+    hyper = 1.0
+    for t in periodic:
+        hyper *= t.wcet / t.period + 1
+    bound = any(t.wcet_from == "budget" for t in tasks)
+    missed = "  MISS?" if bound else "  MISS"     # with the budgets, a miss is only possible
+    failed = False
+
+    out.write("%-26s %4s %8s %-10s %8s %-16s %8s %8s %8s %8s\n" % (
+        "task", "prio", "period", "from", "wcet", "from", "late", "seen", "resp", "deadline"))
+    for t in sorted(tasks, key=lambda t: (-t.priority, t.period or 1 << 30, t.name)):
+        deadline = t.deadline or t.period
+        miss = t.response is None or (deadline is not None and t.response > deadline)
+        failed |= miss
+        out.write("%-26s %4d %8s %-10s %8s %-16s %8s %8s %8s %8s%s\n" % (
+            t.name, t.priority, ms(t.period), t.period_from, ms(t.wcet), t.wcet_from,
+            ms(t.lateness), ms(t.late_seen), ms(t.response), ms(deadline), missed if miss else ""))
+    if not periodic:
+        return failed
+    out.write("\n%d periodic tasks, utilization %.1f%%\n" % (n, util * 100))
+    out.write("rate monotonic bound %.1f%% (Liu & Layland) %s, hyperbolic bound %s\n" % (
+        ll_bound * 100, "met" if util <= ll_bound else "exceeded",
+        "met" if hyper <= 2 else "exceeded"))
+    out.write("the bounds assume preemptive rate monotonic priorities, scheduler_next() is neither: "
+              "the response times above are the ones that count\n")
+    if util >= 1:
+        out.write("%s: the periodic tasks need more than the CPU\n" % ("OVERLOAD?" if bound else "OVERLOAD"))
+        failed = True
+
+    byname = {t.name: t for t in tasks}
+    margin = sources.value(KEEPALIVE_MARGIN)
+    if KEEPALIVE_TASK in byname and KEEPALIVE_SENDER in byname and margin:
+        flag, sender = byname[KEEPALIVE_TASK], byname[KEEPALIVE_SENDER]
+        if None in (flag.response, sender.response, sender.period):
+            latency = None
+        else:
+            # the sender may have run just before the flag was set: its next run
+            latency = flag.response + sender.period + sender.response
+        late = latency is None or latency > margin
+        failed |= late
+        out.write("\nMQTT keep-alive: %s is due %s ms before the broker times out, the PINGREQ leaves "
+                  "within %s ms (%s, then the next %s) %s\n" % (
+                      KEEPALIVE_TASK, ms(margin), ms(latency), KEEPALIVE_TASK, KEEPALIVE_SENDER,
+                      missed.strip() if late else "ok"))
+    guessed = [t.name for t in tasks if t.wcet_from == "budget"]
+    if guessed:
+        out.write("\nupper bound: %d tasks were taken to run as long as their budget, %s\n" % (
+            len(guessed), "the task set is schedulable" if not failed
+            else "the misses above may never happen, measure the tasks with -p"))
+        failed = False
+    return failed
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("-p", "--profile", type=argparse.FileType("r"),
+                        help="terminal capture holding the output of the sched command")
+    parser.add_argument("-s", "--source", default=os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."),
+                        help="firmware source tree (default: this repository)")
+    parser.add_argument("--wcet", action="append", metavar="TASK=US",
+                        help="execution time of a task, overrides the profiling and the budget")
+    parser.add_argument("--period", action="append", metavar="TASK=MS",
+                        help="period of a task the sources leave open")
+    parser.add_argument("--budgets", action="store_true",
+                        help="the tasks neither measured nor given run as long as their budget, for an upper bound")
+    parser.add_argument("--ignore", action="append", default=[], metavar="TASK",
+                        help="task left out of the analysis")
+    parser.add_argument("--coroutines", action="store_true",
+                        help="keep the coroutine tasks, which only run at boot, in the analysis")
+    parser.add_argument("--isr", type=float, default=0.0, metavar="PERCENT",
+                        help="CPU share of the interrupts (see the load command), stretches every callback")
+    parser.add_argument("--horizon", type=int, default=600000, metavar="MS",
+                        help="response times beyond this are taken as unbounded")
+    args = parser.parse_args()
+
+    sources = Sources(args.source)
+    tasks = sources.tasks()
+    for name in args.ignore:
+        if tasks.pop(name, None) is None:
+            sys.exit("--ignore %s: no such task" % name)
+    if not tasks:
+        sys.exit("no SCHEDULER_TASK() found under %s" % args.source)
+    profile = parse_profile(args.profile) if args.profile else {}
+    if args.profile and not profile:
+        sys.exit("no sched command output found in %s" % args.profile.name)
+    assign(sources, tasks, profile, args)
+    boot = sorted(name for name, task in tasks.items() if task.coroutine and not args.coroutines)
+    idle = sorted(name for name, task in tasks.items() if task.wcet is None and name not in boot)
+    tasks = [task for task in tasks.values() if task.wcet is not None and task.name not in boot]
+    if not tasks:
+        sys.exit("no task has a WCET: measure them with -p, give them with --wcet or bound them with --budgets")
+    analyze(tasks, args.horizon)
+    failed = report(tasks, sources, sys.stdout)
+    if boot:
+        sys.stdout.write("\nleft out, coroutines that only run at boot (--coroutines to add them): %s\n" % " ".join(boot))
+    if idle:
+        sys.stdout.write("\nleft out, %s (--wcet to add them): %s\n" % (
+            "they did not run while profiled" if profile else "not measured", " ".join(idle)))
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+"""Convert a scheduler trace dump to a Chrome/Perfetto trace.
+
+Build the firmware with SCHEDULER_TRACE set to 1 in scheduler_config.h, type
+"trace" on the CLI (USART2) and save the terminal output. Then:
+
+    sched_trace.py capture.txt -o trace.json
+
+and open trace.json in https://ui.perfetto.dev or chrome://tracing. Every task
+gets its own track showing when it was waiting (due to start) and running
+(start to end), with create, kill, due and signal markers.
+
+The dump looks like (see scheduler_print_trace() in rtc.c):
+
+    trace begin <version> <counts per s> <ring size>
+    task <id> <name>
+    eeiissss eeiissss ...      event, task id and TCA0 count, in hex
+    trace end
+"""
+
+import argparse
+import json
+import sys
+
+TRACE_VERSION = 1
+
+# traceEvent_t in rtc.c
+TRACE_NONE = 0
+TRACE_TIME = 1
+TRACE_CREATE = 2
+TRACE_KILL = 3
+TRACE_DUE = 4
+TRACE_SIGNAL = 5
+TRACE_START = 6
+TRACE_END = 7
+
+MARKERS = {
+    TRACE_CREATE: "create",
+    TRACE_KILL: "kill",
+    TRACE_DUE: "due",
+    TRACE_SIGNAL: "signal",
+}
+
+COUNT_WRAP = 1 << 16    # TCA0 is a 16-bit counter
+TIME_WRAP = 1 << 16     # so is curr_time, in ms
+
+
+def parse_dump(lines):
+    """Return (counts per s, {id: name}, [(event, id, stamp)]) of the last dump."""
+    dump = result = None
+    for line in lines:
+        words = line.split()
+        if words[:2] == ["trace", "begin"]:
+            version = int(words[2])
+            if version != TRACE_VERSION:
+                sys.exit("trace format %d, this decoder reads %d" % (version, TRACE_VERSION))
+            dump = (int(words[3]), {0: "other"}, [])
+        elif dump is None:
+            continue
+        elif words[:2] == ["trace", "end"]:
+            result, dump = dump, None
+        elif words and words[0] == "task" and len(words) >= 3:
+            dump[1][int(words[1])] = " ".join(words[2:])
+        else:
+            for word in words:
+                if len(word) != 8:
+                    continue
+                value = int(word, 16)
+                dump[2].append((value >> 24, (value >> 16) & 0xFF, value & 0xFFFF))
+    if result is None:
+        sys.exit("no complete trace found, it starts with 'trace begin' and ends with 'trace end'")
+    return result
+
+
+def unwrap(hz, records):
+    """Turn the 16-bit counts into us since the first record.
+
+    Consecutive records are taken as less than one TCA0 turn apart, the time
+    records (curr_time in ms, at least every 256ms) tell how many turns went by
+    when there was a longer gap."""
+    total = None
+    last_count = 0
+    anchor_count = anchor_ms = None     # at the last time record
+    ms = None
+    pending_ms = None
+    out = []
+    for event, task, stamp in records:
+        if event == TRACE_TIME:
+            ms = stamp if ms is None else ms + ((stamp - ms) % TIME_WRAP)
+            pending_ms = ms
+            continue
+        if total is None:
+            total = 0
+        else:
+            total += (stamp - last_count) % COUNT_WRAP
+        last_count = stamp
+        if pending_ms is not None:
+            if anchor_ms is not None:
+                expected = anchor_count + (pending_ms - anchor_ms) * hz // 1000
+                turns = round((expected - total) / COUNT_WRAP)
+                if turns > 0:
+                    total += turns * COUNT_WRAP
+            anchor_count, anchor_ms = total, pending_ms
+            pending_ms = None
+        out.append((event, task, total * 1000000.0 / hz))
+    return out
+
+
+def to_chrome(names, events):
+    trace = [{"name": "process_name", "ph": "M", "pid": 1, "args": {"name": "scheduler"}}]
+    for task, name in sorted(names.items()):
+        trace.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": task, "args": {"name": name}})
+    due = {}
+    start = {}
+    for event, task, us in events:
+        name = names.get(task, "task %d" % task)
+        if event in MARKERS:
+            trace.append({"name": MARKERS[event], "ph": "i", "s": "t", "pid": 1, "tid": task, "ts": us})
+            if event in (TRACE_DUE, TRACE_SIGNAL):
+                due.setdefault(task, us)
+            elif event == TRACE_KILL:
+                due.pop(task, None)
+        elif event == TRACE_START:
+            if task in due:
+                since = due.pop(task)
+                trace.append({"name": "wait", "cat": "wait", "ph": "X", "pid": 1, "tid": task,
+                              "ts": since, "dur": us - since})
+            start[task] = us
+        elif event == TRACE_END and task in start:
+            since = start.pop(task)
+            trace.append({"name": name, "cat": "run", "ph": "X", "pid": 1, "tid": task,
+                          "ts": since, "dur": us - since})
+    return {"traceEvents": trace, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("dump", nargs="?", type=argparse.FileType("r"), default=sys.stdin,
+                        help="terminal capture holding the output of the trace command")
+    parser.add_argument("-o", "--output", type=argparse.FileType("w"), default=sys.stdout,
+                        help="Chrome/Perfetto JSON file to write")
+    args = parser.parse_args()
+
+    hz, names, records = parse_dump(args.dump)
+    json.dump(to_chrome(names, unwrap(hz, records)), args.output, indent=1)
+    args.output.write("\n")
+
+
+if __name__ == "__main__":
+    main()